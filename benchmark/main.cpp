@@ -0,0 +1,118 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+// Runs the benchmarks of the pr_audio_fmod module (see src/fmod_benchmark.hpp) and writes the results as JSON.
+// The module is loaded at runtime, so this has to be run from the Pragma installation directory:
+//   pr_audio_fmod_benchmark [--module <path>] [--out <file.json>] [--sound <path>]... [--channels 100,1000,5000]
+//                           [--frames <n>] [--emitters <n>] [--producers 1,8,16] [--quick]
+#include "../src/fmod_benchmark.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+namespace
+{
+	using RunBenchmarks = bool(*)(const al::FMBenchmark::Settings&,std::string&);
+	RunBenchmarks load_module(const std::string &path)
+	{
+#ifdef _WIN32
+		auto lib = LoadLibraryA(path.c_str());
+		if(lib == nullptr)
+			return nullptr;
+		return reinterpret_cast<RunBenchmarks>(GetProcAddress(lib,"run_audio_benchmarks"));
+#else
+		auto *lib = dlopen(path.c_str(),RTLD_NOW);
+		if(lib == nullptr)
+		{
+			std::cerr<<dlerror()<<std::endl;
+			return nullptr;
+		}
+		return reinterpret_cast<RunBenchmarks>(dlsym(lib,"run_audio_benchmarks"));
+#endif
+	}
+	std::vector<uint32_t> parse_list(const std::string &arg)
+	{
+		std::vector<uint32_t> values;
+		std::stringstream ss {arg};
+		std::string value;
+		while(std::getline(ss,value,','))
+			values.push_back(static_cast<uint32_t>(std::stoul(value)));
+		return values;
+	}
+};
+
+int main(int argc,char *argv[])
+{
+#ifdef _WIN32
+	std::string modulePath = "modules/audio/fmod/pr_audio_fmod.dll";
+#else
+	std::string modulePath = "modules/audio/fmod/libpr_audio_fmod.so";
+#endif
+	std::string outPath;
+	al::FMBenchmark::Settings settings {};
+	for(auto i=1;i<argc;++i)
+	{
+		auto hasValue = (i +1 < argc);
+		if(strcmp(argv[i],"--module") == 0 && hasValue)
+			modulePath = argv[++i];
+		else if(strcmp(argv[i],"--out") == 0 && hasValue)
+			outPath = argv[++i];
+		else if(strcmp(argv[i],"--sound") == 0 && hasValue)
+			settings.sounds.push_back(argv[++i]);
+		else if(strcmp(argv[i],"--channels") == 0 && hasValue)
+			settings.channelCounts = parse_list(argv[++i]);
+		else if(strcmp(argv[i],"--frames") == 0 && hasValue)
+			settings.updateFrames = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if(strcmp(argv[i],"--emitters") == 0 && hasValue)
+			settings.spatialEmitters = static_cast<uint32_t>(std::stoul(argv[++i]));
+		else if(strcmp(argv[i],"--producers") == 0 && hasValue)
+			settings.producerCounts = parse_list(argv[++i]);
+		else if(strcmp(argv[i],"--quick") == 0)
+		{
+			// Smoke test, e.g. to check that the benchmarks still run
+			settings.loadIterations = 2u;
+			settings.churnIterations = 1'000u;
+			settings.updateFrames = 30u;
+			settings.listenerUpdates = 1'000u;
+			settings.spatialQueries = 100u;
+			settings.effectUpdates = 1'000u;
+			settings.dspFrames = 48'000u;
+			settings.commandsPerProducer = 10'000u;
+		}
+		else
+		{
+			std::cerr<<"Unknown argument '"<<argv[i]<<"'"<<std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	auto run = load_module(modulePath);
+	if(run == nullptr)
+	{
+		std::cerr<<"Unable to load '"<<modulePath<<"'"<<std::endl;
+		return EXIT_FAILURE;
+	}
+	std::string json;
+	if(run(settings,json) == false)
+	{
+		std::cerr<<"Benchmarks failed"<<std::endl;
+		return EXIT_FAILURE;
+	}
+	if(outPath.empty())
+	{
+		std::cout<<json<<std::endl;
+		return EXIT_SUCCESS;
+	}
+	std::ofstream f {outPath};
+	f<<json<<std::endl;
+	return f.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
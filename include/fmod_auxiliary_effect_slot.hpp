@@ -0,0 +1,52 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_AUXILIARY_EFFECT_SLOT_HPP__
+#define __FMOD_AUXILIARY_EFFECT_SLOT_HPP__
+
+#include <alsound_auxiliaryeffectslot.hpp>
+#include <memory>
+
+namespace FMOD
+{
+	class DSP;
+	class ChannelGroup;
+};
+namespace al
+{
+	class FMSoundSystem;
+	// Return bus: a channel group with a return DSP at its input and the effect DSP after it. Channels feed the slot
+	// through send DSPs, so the effect is processed once for all channels that are using the slot.
+	class FMAuxiliaryEffectSlot
+		: public IAuxiliaryEffectSlot
+	{
+	public:
+		static constexpr int32_t INVALID_RETURN_ID = -1;
+		FMAuxiliaryEffectSlot(FMSoundSystem &system);
+		virtual ~FMAuxiliaryEffectSlot() override;
+
+		virtual void SetGain(float gain) override;
+		virtual float GetGain() const override;
+		virtual void SetSendAuto(bool bAuto) override;
+		virtual bool GetSendAuto() const override;
+		// The effect's DSP is moved into this slot, an effect can only be applied to one slot at a time
+		virtual void ApplyEffect(const IEffect &effect) override;
+
+		// Id that send DSPs target (FMOD_DSP_SEND_RETURNID)
+		int32_t GetReturnId() const;
+		const FMOD::ChannelGroup *GetFMODChannelGroup() const;
+		FMOD::ChannelGroup *GetFMODChannelGroup();
+	private:
+		void RemoveEffectDsp();
+		FMSoundSystem &m_system;
+		FMOD::ChannelGroup *m_channelGroup = nullptr;
+		FMOD::DSP *m_returnDsp = nullptr;
+		std::shared_ptr<FMOD::DSP> m_effectDsp = nullptr;
+		int32_t m_returnId = INVALID_RETURN_ID;
+		float m_gain = 1.f;
+		bool m_bSendAuto = true;
+	};
+};
+
+#endif
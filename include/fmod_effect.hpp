@@ -6,6 +6,7 @@
 #define __FMOD_EFFECT_HPP__
 
 #include <alsound_effect.hpp>
+#include <array>
 
 namespace FMOD
 {
@@ -13,10 +14,18 @@ namespace FMOD
 };
 namespace al
 {
+	class FMSoundSystem;
+	class FMConvolutionReverb;
+	class FMCustomDsp;
+	// Each effect type is backed by a single FMOD DSP that is created the first time the type is used and kept
+	// for the lifetime of the effect. SetProperties only pushes parameters that have changed; continuous
+	// parameters are smoothed towards their new value over a few updates, so they can be changed every frame.
 	class FMEffect
 		: public IEffect
 	{
 	public:
+		virtual ~FMEffect() override;
+		// DSP of the effect type that was set most recently
 		const std::shared_ptr<FMOD::DSP> &GetFMODDsp() const;
 		std::shared_ptr<FMOD::DSP> &GetFMODDsp();
 
@@ -32,9 +41,71 @@ namespace al
 		virtual void SetProperties(al::EfxAutoWahProperties props) override;
 		virtual void SetProperties(al::EfxCompressor props) override;
 		virtual void SetProperties(al::EfxEqualizer props) override;
+
+		// Turns the effect into a convolution reverb with a measured impulse response (loaded once and cached by the
+		// sound system). Changing the impulse response crossfades from the previous one, e.g. when the listener changes zones.
+		bool SetImpulseResponse(const std::string &path,float crossfadeTime=0.5f);
+		void SetConvolutionMix(float wet,float dry=0.f);
+
+		// Advances the parameter smoothing; called by the sound system every update
+		void Update(float dt);
 	private:
-		FMEffect(ISoundSystem &soundSys,const std::shared_ptr<FMOD::DSP> &dsp);
+		friend FMSoundSystem;
+		enum class Type : uint8_t
+		{
+			Reverb = 0u,
+			Chorus,
+			Distortion,
+			Echo,
+			Flanger,
+			PitchShifter,
+			Compressor,
+			Equalizer,
+			Convolution,
+			FrequencyShifter,
+			VocalMorpher,
+			RingModulator,
+			AutoWah,
+
+			Count
+		};
+		static constexpr uint32_t MAX_PARAMETERS = 16u;
+		struct Parameter
+		{
+			float current = 0.f;
+			float target = 0.f;
+			bool initialized = false;
+		};
+		// Maps a property struct to a single FMOD DSP parameter
+		template<typename T>
+			struct ParameterMapping
+		{
+			int32_t index;
+			float(*get)(const T&);
+			// Continuous parameters are smoothed, parameters that reset the DSP state (e.g. delay times) are applied immediately
+			bool smooth;
+		};
+		struct DspState
+		{
+			std::shared_ptr<FMOD::DSP> dsp = nullptr;
+			// Only set for effects FMOD has no built-in DSP for, see fmod_dsp_effects.hpp
+			std::shared_ptr<FMCustomDsp> custom = nullptr;
+			std::array<Parameter,MAX_PARAMETERS> parameters = {};
+			bool smoothing = false;
+		};
+		FMEffect(ISoundSystem &soundSys);
+		// Returns the DSP state of the type and makes it the active one
+		DspState *Activate(Type type);
+		template<class TProcessor>
+			void SetCustomParameters(Type type,const typename TProcessor::Parameters &params);
+		void SetParameter(DspState &state,int32_t index,float value,bool smooth);
+		template<typename T,size_t N>
+			void ApplyParameters(Type type,const T &props,const std::array<ParameterMapping<T>,N> &mappings);
+		FMSoundSystem &GetSoundSystem();
+
+		std::array<DspState,static_cast<size_t>(Type::Count)> m_dspStates = {};
 		std::shared_ptr<FMOD::DSP> m_fmDsp = nullptr;
+		std::shared_ptr<FMConvolutionReverb> m_convolution = nullptr;
 	};
 };
 
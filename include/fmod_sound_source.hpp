@@ -6,20 +6,38 @@
 #define __FMOD_SOUND_SOURCE_HPP__
 
 #include <alsound_source.hpp>
+#include <limits>
+#include <array>
+#include <memory>
 
 namespace FMOD
 {
 	class Channel;
+	class DSP;
+	class Sound;
 };
 namespace al
 {
+	class FMTransformStore;
+	class FMDecoder;
+	class FMVoiceManager;
+	class FMSpatialGrid;
+	class FMPropagationGraph;
+	class FMCommandQueue;
+	struct FMChannelDefaults;
+	class FMAuxiliaryEffectSlot;
 	class FMSoundChannel
 		: public ISoundChannel
 	{
 	public:
+		static constexpr uint32_t MAX_AUXILIARY_SENDS = 4u;
 		FMSoundChannel(ISoundSystem &system,ISoundBuffer &buffer);
+		// The channel keeps the decoder alive; it has to have been created through FMDecoder::Create
 		FMSoundChannel(ISoundSystem &system,Decoder &decoder);
+		virtual ~FMSoundChannel() override;
 		void SetSource(FMOD::Channel *source);
+		// Same as above, but with a known FMOD_MODE, which saves querying it from the channel
+		void SetSource(FMOD::Channel *source,uint32_t mode);
 		void SetFMOD3DAttributesEffective(bool b);
 
 		virtual void Update() override;
@@ -92,15 +110,17 @@ namespace al
 		virtual bool GetSendGainAuto() const override;
 		virtual bool GetSendGainHFAuto() const override;
 
-		virtual void SetDirectFilter(const EffectParams &params) override {}
-		virtual void SetEffectParameters(uint32_t slotId,const EffectParams &params) override {}
+		// The direct filter, air absorption and outer cone gainHF are applied by the propagation graph, see FMPropagationGraph
+		virtual void SetDirectFilter(const EffectParams &params) override;
+		// Only changes the send level, the send itself stays connected
+		virtual void SetEffectParameters(uint32_t slotId,const EffectParams &params) override;
 
 		const FMOD::Channel *GetInternalSource() const;
 		FMOD::Channel *GetInternalSource();
 	protected:
-		virtual void DoAddEffect(IAuxiliaryEffectSlot &slot,uint32_t slotId,const EffectParams &params) override {}
-		virtual void DoRemoveInternalEffect(uint32_t slotId) override {}
-		virtual void DoRemoveEffect(uint32_t slotId) override {}
+		virtual void DoAddEffect(IAuxiliaryEffectSlot &slot,uint32_t slotId,const EffectParams &params) override;
+		virtual void DoRemoveInternalEffect(uint32_t slotId) override;
+		virtual void DoRemoveEffect(uint32_t slotId) override;
 		struct SoundSourceData
 		{
 			uint64_t offset = 0ull;
@@ -113,19 +133,90 @@ namespace al
 			std::pair<float,float> distanceRange = {1.f,10'000.f};
 			Vector3 position = {};
 			Vector3 velocity = {};
+			std::pair<Vector3,Vector3> orientation = {};
 			std::pair<float,float> coneAngles = {360.f,360.f};
+			std::pair<float,float> outerConeGains = {1.f,1.f}; // FMOD's default outside volume, so ApplyState doesn't have to set it
+			float airAbsorptionFactor = 0.f;
+			std::pair<float,float> directFilter = {1.f,1.f}; // Gain and gainHF
 			float dopplerFactor = 1.f;
 			bool relativeToListener = false;
 		};
 		void UpdateMode();
+		// Mode derived from the shadow state, based on the cached FMOD mode
+		uint32_t CalcFMODMode() const;
+		bool SetFMODMode(uint32_t mode);
+		std::pair<float,float> GetAudioDistanceRange() const;
+		void ApplyDistanceRange();
+		void Apply3DState();
+		void ApplyState(const FMChannelDefaults &defaults);
+		void UpdateStreamStarvation();
+		void UpdateScheduledPlay();
 		bool Is3D() const;
 		bool Is2D() const;
 		bool CheckResultAndUpdateValidity(uint32_t result) const;
 		void InvalidateSource() const;
-		bool InitializeChannel();
+		// If bAcquireVoice is false, the voice manager isn't consulted and the channel is always created
+		bool InitializeChannel(bool bAcquireVoice=true);
 		SoundSourceData m_soundSourceData = {};
 	private:
+		friend class FMTransformStore;
+		friend class FMSoundSystem;
+		friend class FMVoiceManager;
+		friend class FMBinauralRenderer;
+		friend class FMPropagationGraph;
+		friend class FMCommandQueue;
+		// Called by the transform store with attributes that have already been converted to audio space
+		void Apply3DAttributes(const Vector3 &posAudio,const Vector3 &velAudio,const Vector3 *forwardAudio);
+		FMTransformStore &GetTransformStore();
+		FMVoiceManager &GetVoiceManager();
+		FMSpatialGrid &GetSpatialGrid();
+		FMPropagationGraph &GetPropagationGraph();
+		FMCommandQueue &GetCommandQueue();
+
+		// Virtual voices are playing logically, but don't have an FMOD channel; see FMVoiceManager
+		bool IsVoiceActive() const;
+		// Channels of procedural decoders can't resume at the offset they were virtualized at
+		bool CanVirtualize() const;
+		void BeginVirtual();
+		void Virtualize();
+		bool Devirtualize();
+		// Advances the offset of a virtual voice, returns false if it has reached its end
+		bool AdvanceVirtualVoice(float dt);
+		// Connects the send DSPs to a freshly created FMOD channel
+		void ApplyAuxiliarySends();
+		// 3D channels are rendered by the binaural renderer while HRTF is enabled
+		void AttachBinaural();
+		void DetachBinaural();
+
 		mutable FMOD::Channel *m_source = nullptr;
+		std::shared_ptr<FMDecoder> m_decoder = nullptr;
+		// The channel owns its state; FMOD is only queried for the mode once per channel and for
+		// the playback state/offset once per Update(). All getters are served from memory.
+		uint32_t m_fmMode = 0u; // FMOD_MODE
+		bool m_bPlaying = false;
+		bool m_bStreamed = false;
+		bool m_bStarving = false;
+		// Streamed buffers: either this channel plays the buffer's own stream, or it has opened one of its own
+		bool m_bOwnsStream = false;
+		std::shared_ptr<FMOD::Sound> m_streamInstance = nullptr;
+		uint32_t m_transformHandle = std::numeric_limits<uint32_t>::max();
+		uint32_t m_voiceHandle = std::numeric_limits<uint32_t>::max();
+		uint32_t m_gridHandle = std::numeric_limits<uint32_t>::max();
+		uint32_t m_propagationHandle = std::numeric_limits<uint32_t>::max();
+		uint32_t m_commandIndex = std::numeric_limits<uint32_t>::max();
+		uint32_t m_binauralSlot = std::numeric_limits<uint32_t>::max();
+		bool m_bVirtual = false;
+		bool m_bPaused = false;
+		double m_virtualOffset = 0.0;
+		uint32_t m_virtualFrequency = 0u;
+		uint64_t m_virtualLength = 0ull;
+		// One send DSP per effect slot; the DSPs outlive the FMOD channel and are reconnected whenever a new one is created
+		struct AuxiliarySend
+		{
+			FMOD::DSP *dsp = nullptr;
+			float gain = 1.f;
+		};
+		std::array<AuxiliarySend,MAX_AUXILIARY_SENDS> m_auxiliarySends = {};
 	};
 };
 
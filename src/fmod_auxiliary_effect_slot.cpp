@@ -0,0 +1,75 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_auxiliary_effect_slot.hpp"
+#include "fmod_effect.hpp"
+#include "fmod_sound_system.hpp"
+#include <fmod_studio.hpp>
+
+al::FMAuxiliaryEffectSlot::FMAuxiliaryEffectSlot(FMSoundSystem &system)
+	: m_system{system}
+{
+	auto &fmSystem = system.GetFMODLowLevelSystem();
+	al::check_result(fmSystem.createChannelGroup("aux_effect_slot",&m_channelGroup));
+	if(m_channelGroup == nullptr)
+		return;
+	if(fmSystem.createDSPByType(FMOD_DSP_TYPE_RETURN,&m_returnDsp) != FMOD_OK)
+	{
+		m_returnDsp = nullptr;
+		return;
+	}
+	// The return is the input of the group, the effect is inserted after it
+	al::check_result(m_channelGroup->addDSP(FMOD_CHANNELCONTROL_DSP_TAIL,m_returnDsp));
+	al::check_result(m_returnDsp->getParameterInt(FMOD_DSP_RETURN_ID,&m_returnId,nullptr,0));
+}
+al::FMAuxiliaryEffectSlot::~FMAuxiliaryEffectSlot()
+{
+	RemoveEffectDsp();
+	if(m_returnDsp != nullptr)
+	{
+		if(m_channelGroup != nullptr)
+			m_channelGroup->removeDSP(m_returnDsp);
+		m_returnDsp->release();
+	}
+	if(m_channelGroup != nullptr)
+		m_channelGroup->release();
+}
+
+void al::FMAuxiliaryEffectSlot::SetGain(float gain)
+{
+	m_gain = gain;
+	if(m_channelGroup != nullptr)
+		al::check_result(m_channelGroup->setVolume(gain));
+}
+float al::FMAuxiliaryEffectSlot::GetGain() const {return m_gain;}
+void al::FMAuxiliaryEffectSlot::SetSendAuto(bool bAuto)
+{
+	// Sends are always taken after the channel fader, so they're attenuated with the distance either way
+	m_bSendAuto = bAuto;
+}
+bool al::FMAuxiliaryEffectSlot::GetSendAuto() const {return m_bSendAuto;}
+
+void al::FMAuxiliaryEffectSlot::RemoveEffectDsp()
+{
+	if(m_effectDsp == nullptr)
+		return;
+	if(m_channelGroup != nullptr)
+		m_channelGroup->removeDSP(m_effectDsp.get());
+	m_effectDsp = nullptr;
+}
+void al::FMAuxiliaryEffectSlot::ApplyEffect(const IEffect &effect)
+{
+	auto &dsp = static_cast<const FMEffect&>(effect).GetFMODDsp();
+	if(dsp == m_effectDsp)
+		return;
+	RemoveEffectDsp();
+	if(dsp == nullptr || m_channelGroup == nullptr)
+		return;
+	m_effectDsp = dsp;
+	al::check_result(m_channelGroup->addDSP(FMOD_CHANNELCONTROL_DSP_HEAD,m_effectDsp.get()));
+}
+
+int32_t al::FMAuxiliaryEffectSlot::GetReturnId() const {return m_returnId;}
+const FMOD::ChannelGroup *al::FMAuxiliaryEffectSlot::GetFMODChannelGroup() const {return const_cast<FMAuxiliaryEffectSlot*>(this)->GetFMODChannelGroup();}
+FMOD::ChannelGroup *al::FMAuxiliaryEffectSlot::GetFMODChannelGroup() {return m_channelGroup;}
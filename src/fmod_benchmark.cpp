@@ -0,0 +1,787 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_benchmark.hpp"
+#include "fmod_sound_system.hpp"
+#include "fmod_sound_source.hpp"
+#include "fmod_effect.hpp"
+#include "fmod_dsp_effects.hpp"
+#include "fmod_convolution.hpp"
+#include <fmod_studio.hpp>
+#include <alsound_listener.hpp>
+#include <algorithm>
+#include <sstream>
+#include <random>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#else
+		#include <x86intrin.h>
+	#endif
+	#define FMOD_BENCHMARK_TSC
+#endif
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+	double elapsed_ns(Clock::time_point t0,Clock::time_point t1) {return std::chrono::duration<double,std::nano>(t1 -t0).count();}
+	// Time stamp counter, i.e. reference cycles rather than core cycles on CPUs with frequency scaling; 0 if unavailable
+	uint64_t read_cycles()
+	{
+#ifdef FMOD_BENCHMARK_TSC
+		return __rdtsc();
+#else
+		return 0ull;
+#endif
+	}
+	constexpr uint32_t SEED = 1'337u;
+	constexpr float PI = 3.14159265358979323846f;
+};
+
+class al::FMBenchmark::JsonWriter
+{
+public:
+	void BeginObject(const char *key=nullptr)
+	{
+		Key(key);
+		m_ss<<'{';
+		m_first.push_back(true);
+	}
+	void EndObject()
+	{
+		m_first.pop_back();
+		m_ss<<'}';
+	}
+	void BeginArray(const char *key)
+	{
+		Key(key);
+		m_ss<<'[';
+		m_first.push_back(true);
+	}
+	void EndArray()
+	{
+		m_first.pop_back();
+		m_ss<<']';
+	}
+	void Write(const char *key,double value)
+	{
+		Key(key);
+		if(std::isfinite(value))
+			m_ss<<value;
+		else
+			m_ss<<"null";
+	}
+	void Write(const char *key,uint64_t value)
+	{
+		Key(key);
+		m_ss<<value;
+	}
+	void Write(const char *key,uint32_t value) {Write(key,static_cast<uint64_t>(value));}
+	void Write(const char *key,const std::string &value)
+	{
+		Key(key);
+		m_ss<<'"';
+		for(auto c : value)
+		{
+			if(c == '"' || c == '\\')
+				m_ss<<'\\';
+			m_ss<<c;
+		}
+		m_ss<<'"';
+	}
+	// Summary of a set of measurements
+	void WriteTimings(const char *key,std::vector<double> values)
+	{
+		BeginObject(key);
+		Write("count",static_cast<uint64_t>(values.size()));
+		if(values.empty() == false)
+		{
+			std::sort(values.begin(),values.end());
+			auto sum = 0.0;
+			for(auto v : values)
+				sum += v;
+			auto percentile = [&values](double p) {return values[static_cast<size_t>(p *(values.size() -1))];};
+			Write("mean",sum /values.size());
+			Write("min",values.front());
+			Write("p50",percentile(0.5));
+			Write("p99",percentile(0.99));
+			Write("max",values.back());
+		}
+		EndObject();
+	}
+	std::string GetString() const {return m_ss.str();}
+private:
+	void Key(const char *key)
+	{
+		if(m_first.empty() == false)
+		{
+			if(m_first.back() == false)
+				m_ss<<',';
+			m_first.back() = false;
+		}
+		if(key != nullptr)
+			m_ss<<'"'<<key<<"\":";
+	}
+	std::stringstream m_ss;
+	std::vector<bool> m_first;
+};
+
+std::shared_ptr<al::FMSoundSystem> al::FMBenchmark::CreateSystem()
+{
+	FMSystemCreateInfo::Offline offline {};
+	offline.capture = false;
+	return FMSoundSystem::CreateOffline(1.f,offline);
+}
+
+std::shared_ptr<al::ISoundBuffer> al::FMBenchmark::CreateTone(FMSoundSystem &system)
+{
+	// One second of a looping mono sine, created in memory so the benchmarks don't depend on any files
+	auto frequency = system.GetMixerFrequency();
+	std::vector<float> samples(frequency);
+	for(auto i=decltype(samples.size()){0u};i<samples.size();++i)
+		samples[i] = std::sin(static_cast<float>(i) /frequency *440.f *2.f *PI) *0.5f;
+	FMOD_CREATESOUNDEXINFO exInfo {};
+	memset(&exInfo,0,sizeof(exInfo));
+	exInfo.cbsize = sizeof(exInfo);
+	exInfo.length = static_cast<uint32_t>(samples.size() *sizeof(float));
+	exInfo.numchannels = 1;
+	exInfo.defaultfrequency = static_cast<int32_t>(frequency);
+	exInfo.format = FMOD_SOUND_FORMAT_PCMFLOAT;
+	FMOD::Sound *sound = nullptr;
+	al::check_result(system.m_fmLowLevelSystem.createSound(reinterpret_cast<const char*>(samples.data()),FMOD_DEFAULT | FMOD_OPENMEMORY | FMOD_OPENRAW,&exInfo,&sound));
+	if(sound == nullptr)
+		return nullptr;
+	auto ptrSound = std::shared_ptr<FMOD::Sound>(sound,[](FMOD::Sound *sound) {
+		al::check_result(sound->release());
+	});
+	return system.AddSoundBuffer("benchmark_tone",ptrSound,{},true);
+}
+
+void al::FMBenchmark::RunLoad(const Settings &settings,JsonWriter &json)
+{
+	json.BeginArray("load");
+	for(auto &path : settings.sounds)
+	{
+		auto system = CreateSystem();
+		std::vector<double> times;
+		auto failed = 0u;
+		for(auto i=0u;i<settings.loadIterations;++i)
+		{
+			auto t = Clock::now();
+			auto *buf = system->DoLoadSound(path,false,false);
+			times.push_back(elapsed_ns(t,Clock::now()) /1'000'000.0);
+			if(buf == nullptr)
+			{
+				++failed;
+				continue;
+			}
+			system->EvictSoundBuffer(path,buf->GetChannelConfig() == al::ChannelConfig::Mono);
+		}
+		json.BeginObject();
+		json.Write("path",path);
+		json.Write("failed",failed);
+		json.WriteTimings("loadMs",times);
+		json.EndObject();
+	}
+	json.EndArray();
+}
+
+void al::FMBenchmark::RunChannelChurn(const Settings &settings,JsonWriter &json)
+{
+	auto system = CreateSystem();
+	auto tone = CreateTone(*system);
+	if(tone == nullptr)
+		return;
+	std::vector<double> create;
+	std::vector<double> play;
+	std::vector<double> stop;
+	std::vector<double> release;
+	create.reserve(settings.churnIterations);
+	play.reserve(settings.churnIterations);
+	stop.reserve(settings.churnIterations);
+	release.reserve(settings.churnIterations);
+	auto t = Clock::now();
+	for(auto i=0u;i<settings.churnIterations;++i)
+	{
+		auto t0 = Clock::now();
+		auto channel = system->CreateSource(*tone);
+		auto t1 = Clock::now();
+		if(channel == nullptr)
+			continue;
+		channel->SetPosition({static_cast<float>(i %100u),0.f,0.f});
+		auto t2 = Clock::now();
+		channel->Play();
+		auto t3 = Clock::now();
+		channel->Stop();
+		auto t4 = Clock::now();
+		channel = nullptr;
+		auto t5 = Clock::now();
+		create.push_back(elapsed_ns(t0,t1));
+		play.push_back(elapsed_ns(t2,t3));
+		stop.push_back(elapsed_ns(t3,t4));
+		release.push_back(elapsed_ns(t4,t5));
+		// Released channels are cleaned up by the sound system's update
+		if((i %64u) == 63u)
+			system->Update();
+	}
+	auto total = elapsed_ns(t,Clock::now());
+	auto poolStats = system->GetChannelPoolStats();
+	json.BeginObject("channelChurn");
+	json.Write("iterations",settings.churnIterations);
+	json.Write("cyclesPerSecond",(total > 0.0) ? (settings.churnIterations /(total /1'000'000'000.0)) : 0.0);
+	json.WriteTimings("createNs",create);
+	json.WriteTimings("playNs",play);
+	json.WriteTimings("stopNs",stop);
+	json.WriteTimings("releaseNs",release);
+	json.Write("poolHeapAllocations",static_cast<uint64_t>(poolStats.heapAllocations));
+	json.EndObject();
+}
+
+void al::FMBenchmark::RunUpdate(const Settings &settings,JsonWriter &json)
+{
+	json.BeginArray("update");
+	for(auto numChannels : settings.channelCounts)
+	{
+		auto system = CreateSystem();
+		auto tone = CreateTone(*system);
+		if(tone == nullptr)
+			break;
+		// Emitters circle around random points near the listener
+		struct Emitter
+		{
+			PSoundChannel channel;
+			Vector3 center;
+			float radius;
+			float speed;
+			float phase;
+		};
+		std::mt19937 rng {SEED};
+		std::uniform_real_distribution<float> dis {-1.f,1.f};
+		std::vector<Emitter> emitters;
+		emitters.reserve(numChannels);
+		for(auto i=0u;i<numChannels;++i)
+		{
+			auto channel = system->CreateSource(*tone);
+			if(channel == nullptr)
+				continue;
+			channel->SetLooping(true);
+			Emitter emitter {channel,{dis(rng) *2'000.f,dis(rng) *200.f,dis(rng) *2'000.f},100.f +dis(rng) *50.f,dis(rng) *2.f,dis(rng) *PI};
+			channel->SetPosition(emitter.center);
+			channel->Play();
+			emitters.push_back(emitter);
+		}
+		auto blockDuration = system->GetOfflineRenderer()->GetBlockDuration();
+		auto move = [&emitters,blockDuration](uint32_t frame) {
+			auto t = static_cast<float>(frame *blockDuration);
+			for(auto &emitter : emitters)
+			{
+				auto a = emitter.phase +emitter.speed *t;
+				emitter.channel->SetPosition(emitter.center +Vector3{std::cos(a) *emitter.radius,0.f,std::sin(a) *emitter.radius});
+			}
+		};
+		// Warm-up, lets the voice manager settle
+		for(auto i=0u;i<10u;++i)
+		{
+			move(i);
+			system->Update();
+		}
+		std::vector<double> moveTimes;
+		std::vector<double> updateTimes;
+		for(auto i=0u;i<settings.updateFrames;++i)
+		{
+			auto t0 = Clock::now();
+			move(10u +i);
+			auto t1 = Clock::now();
+			system->Update();
+			auto t2 = Clock::now();
+			moveTimes.push_back(elapsed_ns(t0,t1) /1'000'000.0);
+			updateTimes.push_back(elapsed_ns(t1,t2) /1'000'000.0);
+		}
+		auto playing = 0;
+		auto real = 0;
+		al::check_result(system->GetFMODLowLevelSystem().getChannelsPlaying(&playing,&real));
+		json.BeginObject();
+		json.Write("channels",static_cast<uint32_t>(emitters.size()));
+		json.Write("fmodChannelsPlaying",static_cast<uint32_t>(playing));
+		json.Write("fmodChannelsReal",static_cast<uint32_t>(real));
+		json.WriteTimings("setPositionMs",moveTimes);
+		json.WriteTimings("updateMs",updateTimes);
+		json.EndObject();
+		emitters.clear();
+	}
+	json.EndArray();
+}
+
+void al::FMBenchmark::RunListener(const Settings &settings,JsonWriter &json)
+{
+	auto system = CreateSystem();
+	auto *listener = system->GetListenerByIndex(0u);
+	if(listener == nullptr)
+		return;
+	std::vector<double> times;
+	times.reserve(settings.listenerUpdates);
+	std::vector<double> updateTimes;
+	for(auto i=0u;i<settings.listenerUpdates;++i)
+	{
+		auto a = static_cast<float>(i) *0.01f;
+		auto t0 = Clock::now();
+		listener->SetPosition({std::cos(a) *500.f,0.f,std::sin(a) *500.f});
+		listener->SetVelocity({-std::sin(a) *50.f,0.f,std::cos(a) *50.f});
+		listener->SetOrientation({std::cos(a),0.f,std::sin(a)},{0.f,1.f,0.f});
+		auto t1 = Clock::now();
+		times.push_back(elapsed_ns(t0,t1));
+		// The changes are committed to FMOD once per update
+		if((i %16u) == 15u)
+		{
+			system->Update();
+			updateTimes.push_back(elapsed_ns(t1,Clock::now()) /1'000'000.0);
+		}
+	}
+	json.BeginObject("listener");
+	json.WriteTimings("setTransformNs",times);
+	json.WriteTimings("updateMs",updateTimes);
+	json.EndObject();
+}
+
+void al::FMBenchmark::RunSpatialQueries(const Settings &settings,JsonWriter &json)
+{
+	auto system = CreateSystem();
+	auto tone = CreateTone(*system);
+	if(tone == nullptr)
+		return;
+	// Channels don't have to be playing to be part of the grid
+	std::mt19937 rng {SEED};
+	std::uniform_real_distribution<float> dis {-1.f,1.f};
+	std::vector<PSoundChannel> channels;
+	std::vector<std::pair<FMSoundChannel*,Vector3>> emitters;
+	channels.reserve(settings.spatialEmitters);
+	emitters.reserve(settings.spatialEmitters);
+	for(auto i=0u;i<settings.spatialEmitters;++i)
+	{
+		auto channel = system->CreateSource(*tone);
+		if(channel == nullptr)
+			continue;
+		Vector3 pos {dis(rng) *10'000.f,dis(rng) *1'000.f,dis(rng) *10'000.f};
+		channel->SetPosition(pos);
+		emitters.push_back({static_cast<FMSoundChannel*>(channel.get()),pos});
+		channels.push_back(channel);
+	}
+	auto &grid = system->GetSpatialGrid();
+
+	struct Query
+	{
+		Vector3 center;
+		float radius;
+		FMSpatialGrid::Frustum frustum;
+	};
+	std::vector<Query> queries;
+	queries.reserve(settings.spatialQueries);
+	for(auto i=0u;i<settings.spatialQueries;++i)
+	{
+		Query query {};
+		query.center = {dis(rng) *10'000.f,dis(rng) *1'000.f,dis(rng) *10'000.f};
+		query.radius = 1'100.f +dis(rng) *900.f;
+		// 90 degree view frustum with a depth of 4000 units, looking in a random horizontal direction
+		auto a = dis(rng) *PI;
+		Vector3 forward {std::cos(a),0.f,std::sin(a)};
+		Vector3 up {0.f,1.f,0.f};
+		Vector3 right {-forward.z,0.f,forward.x};
+		auto plane = [](const Vector3 &n,const Vector3 &p) -> FMSpatialGrid::Plane {
+			auto normal = n /uvec::length(n);
+			return {normal,-uvec::dot(normal,p)};
+		};
+		query.frustum = {
+			plane(forward,query.center +forward *1.f),
+			plane(-forward,query.center +forward *4'000.f),
+			plane(forward +right,query.center),
+			plane(forward -right,query.center),
+			plane(forward +up,query.center),
+			plane(forward -up,query.center)
+		};
+		queries.push_back(query);
+	}
+
+	std::vector<FMSoundChannel*> results;
+	results.reserve(emitters.size());
+	auto run = [&results](const char *key,JsonWriter &json,const std::vector<Query> &queries,const std::function<void(const Query&)> &query) -> std::vector<size_t> {
+		std::vector<double> times;
+		std::vector<size_t> counts;
+		times.reserve(queries.size());
+		counts.reserve(queries.size());
+		auto numResults = 0ull;
+		for(auto &q : queries)
+		{
+			results.clear();
+			auto t = Clock::now();
+			query(q);
+			times.push_back(elapsed_ns(t,Clock::now()) /1'000.0);
+			counts.push_back(results.size());
+			numResults += results.size();
+		}
+		json.BeginObject(key);
+		json.WriteTimings("queryUs",times);
+		json.Write("meanResults",queries.empty() ? 0.0 : (static_cast<double>(numResults) /queries.size()));
+		json.EndObject();
+		return counts;
+	};
+	auto inside = [](const FMSpatialGrid::Frustum &frustum,const Vector3 &pos) {
+		for(auto &plane : frustum)
+		{
+			if(uvec::dot(plane.normal,pos) +plane.distance < 0.f)
+				return false;
+		}
+		return true;
+	};
+	auto countMismatches = [](const std::vector<size_t> &a,const std::vector<size_t> &b) {
+		auto mismatches = 0u;
+		for(auto i=decltype(a.size()){0u};i<a.size();++i)
+		{
+			if(a[i] != b[i])
+				++mismatches;
+		}
+		return mismatches;
+	};
+
+	json.BeginObject("spatialQueries");
+	json.Write("emitters",static_cast<uint32_t>(emitters.size()));
+	json.Write("cells",grid.GetCellCount());
+	json.Write("cellSize",static_cast<double>(grid.GetCellSize()));
+	json.BeginObject("radius");
+	auto gridCounts = run("grid",json,queries,[&grid,&results](const Query &q) {grid.QueryRadius(q.center,q.radius,results);});
+	auto linearCounts = run("linear",json,queries,[&emitters,&results](const Query &q) {
+		auto radiusSqr = q.radius *q.radius;
+		for(auto &emitter : emitters)
+		{
+			if(uvec::length_sqr(emitter.second -q.center) <= radiusSqr)
+				results.push_back(emitter.first);
+		}
+	});
+	json.Write("mismatches",countMismatches(gridCounts,linearCounts));
+	json.EndObject();
+	json.BeginObject("frustum");
+	gridCounts = run("grid",json,queries,[&grid,&results](const Query &q) {grid.QueryFrustum(q.frustum,results);});
+	linearCounts = run("linear",json,queries,[&emitters,&results,&inside](const Query &q) {
+		for(auto &emitter : emitters)
+		{
+			if(inside(q.frustum,emitter.second))
+				results.push_back(emitter.first);
+		}
+	});
+	// Cells that are entirely inside of the frustum skip the per-channel test, so emitters exactly on a plane may differ
+	json.Write("mismatches",countMismatches(gridCounts,linearCounts));
+	json.EndObject();
+	json.EndObject();
+}
+
+void al::FMBenchmark::RunEffectParameters(const Settings &settings,JsonWriter &json)
+{
+	auto system = CreateSystem();
+	auto measure = [&settings,&system](const std::function<void(IEffect&,float)> &set) -> std::pair<std::vector<double>,std::vector<double>> {
+		auto effect = system->CreateEffect();
+		std::vector<double> times;
+		std::vector<double> updateTimes;
+		if(effect == nullptr)
+			return {times,updateTimes};
+		set(*effect,0.f); // Creates the DSP
+		times.reserve(settings.effectUpdates);
+		for(auto i=0u;i<settings.effectUpdates;++i)
+		{
+			auto t0 = Clock::now();
+			set(*effect,static_cast<float>(i %100u) /100.f);
+			auto t1 = Clock::now();
+			times.push_back(elapsed_ns(t0,t1));
+			// Smoothing runs in the update
+			if((i %16u) == 15u)
+			{
+				system->Update();
+				updateTimes.push_back(elapsed_ns(t1,Clock::now()) /1'000'000.0);
+			}
+		}
+		return {times,updateTimes};
+	};
+	std::vector<std::pair<std::string,std::function<void(IEffect&,float)>>> effects = {
+		{"reverb",[](IEffect &effect,float f) {
+			al::EfxEaxReverbProperties props {};
+			props.flDecayTime = 0.5f +f *5.f;
+			effect.SetProperties(props);
+		}},
+		{"chorus",[](IEffect &effect,float f) {
+			al::EfxChorusProperties props {};
+			props.flRate = f *10.f;
+			effect.SetProperties(props);
+		}},
+		{"echo",[](IEffect &effect,float f) {
+			al::EfxEchoProperties props {};
+			props.flFeedback = f;
+			effect.SetProperties(props);
+		}},
+		{"ring_modulator",[](IEffect &effect,float f) {
+			al::EfxRingModulatorProperties props {};
+			props.flFrequency = 100.f +f *1'000.f;
+			effect.SetProperties(props);
+		}},
+		{"frequency_shifter",[](IEffect &effect,float f) {
+			al::EfxFrequencyShifterProperties props {};
+			props.flFrequency = f *1'000.f;
+			effect.SetProperties(props);
+		}}
+	};
+	json.BeginArray("effectParameters");
+	for(auto &pair : effects)
+	{
+		auto result = measure(pair.second);
+		json.BeginObject();
+		json.Write("effect",pair.first);
+		json.WriteTimings("setPropertiesNs",result.first);
+		json.WriteTimings("updateMs",result.second);
+		json.EndObject();
+	}
+	json.EndArray();
+}
+
+void al::FMBenchmark::RunDspEffects(const Settings &settings,JsonWriter &json)
+{
+	auto system = CreateSystem();
+	auto &lowLevelSystem = system->GetFMODLowLevelSystem();
+	auto frequency = system->GetMixerFrequency();
+	std::vector<std::pair<std::string,std::shared_ptr<FMCustomDsp>>> dsps;
+	auto ringModulator = FMRingModulator::Create(lowLevelSystem,frequency);
+	if(ringModulator != nullptr)
+	{
+		FMRingModulator::Parameters params {};
+		static_cast<FMRingModulator&>(ringModulator->GetProcessor()).SetParameters(params);
+		dsps.push_back({"ring_modulator",ringModulator});
+	}
+	auto frequencyShifter = FMFrequencyShifter::Create(lowLevelSystem,frequency);
+	if(frequencyShifter != nullptr)
+	{
+		FMFrequencyShifter::Parameters params {};
+		params.frequency = 200.f;
+		static_cast<FMFrequencyShifter&>(frequencyShifter->GetProcessor()).SetParameters(params);
+		dsps.push_back({"frequency_shifter",frequencyShifter});
+	}
+	auto autoWah = FMAutoWah::Create(lowLevelSystem,frequency);
+	if(autoWah != nullptr)
+		dsps.push_back({"auto_wah",autoWah});
+	auto vocalMorpher = FMVocalMorpher::Create(lowLevelSystem,frequency);
+	if(vocalMorpher != nullptr)
+		dsps.push_back({"vocal_morpher",vocalMorpher});
+
+	std::mt19937 rng {SEED};
+	std::uniform_real_distribution<float> dis {-0.5f,0.5f};
+	json.BeginArray("dspEffects");
+	for(auto &pair : dsps)
+	{
+		for(auto numChannels : {2,6})
+		{
+			// Processed in mixer-sized blocks
+			constexpr uint32_t blockSize = 1'024u;
+			std::vector<float> in(blockSize *numChannels);
+			std::vector<float> out(in.size());
+			for(auto &v : in)
+				v = dis(rng);
+			auto numBlocks = umath::max(settings.dspFrames /blockSize,1u);
+			auto t = Clock::now();
+			auto cycles = read_cycles();
+			for(auto i=0u;i<numBlocks;++i)
+				pair.second->Process(in.data(),out.data(),blockSize,numChannels);
+			cycles = read_cycles() -cycles;
+			auto ns = elapsed_ns(t,Clock::now());
+			auto numSamples = static_cast<double>(numBlocks) *blockSize *numChannels;
+			json.BeginObject();
+			json.Write("effect",pair.first);
+			json.Write("channels",static_cast<uint32_t>(numChannels));
+			json.Write("nsPerSample",ns /numSamples);
+			json.Write("cyclesPerSample",cycles /numSamples);
+			// Share of one core at the mixer's rate
+			json.Write("cpuPercent",ns /numSamples *numChannels *frequency /10'000'000.0);
+			json.EndObject();
+		}
+	}
+	json.EndArray();
+}
+
+void al::FMBenchmark::RunConvolution(const Settings &settings,JsonWriter &json)
+{
+	// The convolver doesn't depend on FMOD, only the mixer frequency is needed
+	auto frequency = 48'000u;
+	constexpr auto blockSize = FMConvolutionReverb::BLOCK_SIZE;
+	std::mt19937 rng {SEED};
+	std::uniform_real_distribution<float> dis {-1.f,1.f};
+	json.BeginArray("convolution");
+	for(auto length : settings.impulseResponseLengths)
+	{
+		// Exponentially decaying stereo noise, roughly what a measured room response looks like
+		auto numFrames = static_cast<uint32_t>(length *frequency);
+		std::vector<float> samples(numFrames *2u);
+		for(auto i=0u;i<numFrames;++i)
+		{
+			auto decay = std::exp(-6.9f *static_cast<float>(i) /numFrames);
+			samples[i *2u] = dis(rng) *decay;
+			samples[i *2u +1u] = dis(rng) *decay;
+		}
+		auto ir = FMImpulseResponse::Create(samples.data(),numFrames,2u,blockSize);
+		if(ir == nullptr)
+			continue;
+		FMConvolver convolver {blockSize,ir->GetPartitionCount()};
+		convolver.SetImpulseResponse(ir.get(),0u);
+
+		constexpr uint32_t mixerBlockSize = 1'024u;
+		std::vector<float> in(mixerBlockSize);
+		std::vector<float> outLeft(mixerBlockSize);
+		std::vector<float> outRight(mixerBlockSize);
+		for(auto &v : in)
+			v = dis(rng) *0.5f;
+		auto numBlocks = umath::max(settings.dspFrames /mixerBlockSize,1u);
+		auto t = Clock::now();
+		auto cycles = read_cycles();
+		for(auto i=0u;i<numBlocks;++i)
+			convolver.Process(in.data(),outLeft.data(),outRight.data(),mixerBlockSize);
+		cycles = read_cycles() -cycles;
+		auto ns = elapsed_ns(t,Clock::now());
+		auto processedFrames = static_cast<double>(numBlocks) *mixerBlockSize;
+		json.BeginObject();
+		json.Write("impulseResponseSeconds",static_cast<double>(length));
+		json.Write("partitions",ir->GetPartitionCount());
+		json.Write("nsPerFrame",ns /processedFrames);
+		json.Write("cyclesPerFrame",cycles /processedFrames);
+		json.Write("cpuPercent",ns /processedFrames *frequency /10'000'000.0);
+		json.EndObject();
+	}
+	json.EndArray();
+}
+
+void al::FMBenchmark::RunCommandQueue(const Settings &settings,JsonWriter &json)
+{
+	json.BeginArray("commandQueue");
+	for(auto numProducers : settings.producerCounts)
+	{
+		auto system = CreateSystem();
+		auto tone = CreateTone(*system);
+		if(tone == nullptr)
+			break;
+		auto &queue = system->GetCommandQueue();
+		constexpr uint32_t numChannels = 256u;
+		std::vector<PSoundChannel> channels;
+		std::vector<FMCommandQueue::ChannelHandle> handles;
+		for(auto i=0u;i<numChannels;++i)
+		{
+			auto channel = system->CreateSource(*tone);
+			if(channel == nullptr)
+				continue;
+			handles.push_back(queue.GetHandle(static_cast<FMSoundChannel&>(*channel)));
+			channels.push_back(channel);
+		}
+		if(handles.empty())
+			break;
+
+		// Every 64th command records when it was issued. A command is applied by the first drain that started after it was
+		// issued, the time until that drain has completed is its latency.
+		constexpr uint32_t sampleInterval = 64u;
+		std::vector<std::vector<Clock::time_point>> issueTimes(numProducers);
+		std::atomic<uint32_t> ready = 0u;
+		std::atomic<uint32_t> finished = 0u;
+		std::atomic<bool> start = false;
+		std::vector<std::thread> producers;
+		for(auto p=0u;p<numProducers;++p)
+		{
+			issueTimes[p].reserve(settings.commandsPerProducer /sampleInterval +1u);
+			producers.push_back(std::thread{[&,p]() {
+				auto &times = issueTimes[p];
+				++ready;
+				while(start.load() == false)
+					std::this_thread::yield();
+				for(auto i=0u;i<settings.commandsPerProducer;++i)
+				{
+					auto &handle = handles[(i +p) %handles.size()];
+					if((i %sampleInterval) == 0u)
+						times.push_back(Clock::now());
+					queue.SetGain(handle,static_cast<float>(i &0xFFu) /255.f);
+				}
+				++finished;
+			}});
+		}
+		while(ready.load() < numProducers)
+			std::this_thread::yield();
+
+		std::vector<std::pair<Clock::time_point,Clock::time_point>> drains;
+		std::vector<double> drainTimes;
+		auto t = Clock::now();
+		start = true;
+		for(;;)
+		{
+			auto bFinished = (finished.load() == numProducers);
+			auto t0 = Clock::now();
+			queue.Drain();
+			auto t1 = Clock::now();
+			drains.push_back({t0,t1});
+			drainTimes.push_back(elapsed_ns(t0,t1) /1'000.0);
+			if(bFinished)
+				break;
+		}
+		auto total = elapsed_ns(t,drains.back().second);
+		for(auto &thread : producers)
+			thread.join();
+
+		std::vector<double> latencies;
+		for(auto &times : issueTimes)
+		{
+			for(auto &issued : times)
+			{
+				auto it = std::lower_bound(drains.begin(),drains.end(),issued,[](const std::pair<Clock::time_point,Clock::time_point> &drain,const Clock::time_point &t) {
+					return drain.first < t;
+				});
+				if(it != drains.end())
+					latencies.push_back(elapsed_ns(issued,it->second) /1'000.0);
+			}
+		}
+		auto stats = queue.GetStats();
+		auto numCommands = static_cast<double>(numProducers) *settings.commandsPerProducer;
+		json.BeginObject();
+		json.Write("producers",numProducers);
+		json.Write("commands",static_cast<uint64_t>(numCommands));
+		json.Write("commandsPerSecond",(total > 0.0) ? (numCommands /(total /1'000'000'000.0)) : 0.0);
+		json.Write("drains",static_cast<uint64_t>(drains.size()));
+		json.Write("coalesced",stats.coalescedCommands);
+		json.Write("overflow",stats.overflowCommands);
+		json.WriteTimings("drainUs",drainTimes);
+		json.WriteTimings("latencyUs",latencies);
+		json.EndObject();
+		channels.clear();
+	}
+	json.EndArray();
+}
+
+std::string al::FMBenchmark::Run(const Settings &settings)
+{
+	JsonWriter json {};
+	json.BeginObject();
+	{
+		auto system = CreateSystem();
+		if(system == nullptr)
+			return {};
+		auto dspBufferSize = system->GetDSPBufferSize();
+		json.BeginObject("mixer");
+		json.Write("frequency",system->GetMixerFrequency());
+		json.Write("blockSize",dspBufferSize.first);
+		json.Write("hardwareThreads",std::thread::hardware_concurrency());
+		json.EndObject();
+	}
+	RunLoad(settings,json);
+	RunChannelChurn(settings,json);
+	RunUpdate(settings,json);
+	RunListener(settings,json);
+	RunSpatialQueries(settings,json);
+	RunEffectParameters(settings,json);
+	RunDspEffects(settings,json);
+	RunConvolution(settings,json);
+	RunCommandQueue(settings,json);
+	json.EndObject();
+	return json.GetString();
+}
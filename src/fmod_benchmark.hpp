@@ -0,0 +1,64 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_BENCHMARK_HPP__
+#define __FMOD_BENCHMARK_HPP__
+
+#include <cinttypes>
+#include <vector>
+#include <string>
+#include <memory>
+
+namespace al
+{
+	class FMSoundSystem;
+	class ISoundBuffer;
+	// Benchmarks of the module's hot paths. Every case runs on its own sound system with the non-realtime no-sound
+	// output, so no audio device is required and Update() includes the cost of mixing one block.
+	// The results are returned as JSON (see benchmark/ for the executable that writes them to a file).
+	// This header only depends on the standard library, so the executable can use it without the module's dependencies.
+	class FMBenchmark
+	{
+	public:
+		struct Settings
+		{
+			// Sound files for the load benchmark, loaded synchronously through DoLoadSound. Use one file per format
+			// that should be measured; all other cases use a generated tone.
+			std::vector<std::string> sounds = {};
+			uint32_t loadIterations = 8u;
+			// CreateChannel/Play/Stop cycles
+			uint32_t churnIterations = 10'000u;
+			// Active, moving channels for the Update() benchmark
+			std::vector<uint32_t> channelCounts = {100u,1'000u,5'000u};
+			uint32_t updateFrames = 300u;
+			uint32_t listenerUpdates = 10'000u;
+			// Radius and frustum queries of the spatial grid against a linear scan over the same emitters
+			uint32_t spatialEmitters = 10'000u;
+			uint32_t spatialQueries = 1'000u;
+			uint32_t effectUpdates = 10'000u;
+			// Frames processed per custom DSP effect and impulse response
+			uint32_t dspFrames = 192'000u;
+			std::vector<float> impulseResponseLengths = {0.5f,2.f,6.f}; // Seconds
+			// Producer threads for the command queue benchmark
+			std::vector<uint32_t> producerCounts = {1u,8u,16u};
+			uint32_t commandsPerProducer = 100'000u;
+		};
+		static std::string Run(const Settings &settings);
+	private:
+		class JsonWriter;
+		static std::shared_ptr<FMSoundSystem> CreateSystem();
+		static std::shared_ptr<ISoundBuffer> CreateTone(FMSoundSystem &system);
+		static void RunLoad(const Settings &settings,JsonWriter &json);
+		static void RunChannelChurn(const Settings &settings,JsonWriter &json);
+		static void RunUpdate(const Settings &settings,JsonWriter &json);
+		static void RunListener(const Settings &settings,JsonWriter &json);
+		static void RunSpatialQueries(const Settings &settings,JsonWriter &json);
+		static void RunEffectParameters(const Settings &settings,JsonWriter &json);
+		static void RunDspEffects(const Settings &settings,JsonWriter &json);
+		static void RunConvolution(const Settings &settings,JsonWriter &json);
+		static void RunCommandQueue(const Settings &settings,JsonWriter &json);
+	};
+};
+
+#endif
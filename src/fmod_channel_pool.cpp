@@ -0,0 +1,84 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_channel_pool.hpp"
+#include <new>
+
+al::FMChannelPool::FMChannelPool(size_t blockSize,uint32_t blocksPerSlab)
+{
+	// Blocks are kept at the default new-alignment, which is enough for any channel type
+	constexpr size_t alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+	if(blockSize < sizeof(FreeBlock))
+		blockSize = sizeof(FreeBlock);
+	m_blockSize = (blockSize +alignment -1) /alignment *alignment;
+	m_blocksPerSlab = (blocksPerSlab > 0u) ? blocksPerSlab : 1u;
+}
+al::FMChannelPool::~FMChannelPool()
+{
+	for(auto *slab : m_slabs)
+		::operator delete(slab);
+}
+
+size_t al::FMChannelPool::GetBlockSize() const {return m_blockSize;}
+al::FMChannelPool::Stats al::FMChannelPool::GetStats() const
+{
+	std::unique_lock<std::mutex> lock {m_mutex};
+	return m_stats;
+}
+
+void al::FMChannelPool::AddSlab()
+{
+	auto *slab = static_cast<uint8_t*>(::operator new(m_blockSize *m_blocksPerSlab));
+	m_slabs.push_back(slab);
+	for(auto i=m_blocksPerSlab;i>0u;--i)
+	{
+		auto *block = reinterpret_cast<FreeBlock*>(slab +(i -1u) *m_blockSize);
+		block->next = m_freeList;
+		m_freeList = block;
+	}
+	m_freeCount += m_blocksPerSlab;
+	++m_stats.heapAllocations;
+	++m_stats.slabCount;
+}
+
+void al::FMChannelPool::Reserve(uint32_t count)
+{
+	std::unique_lock<std::mutex> lock {m_mutex};
+	while(m_freeCount < count)
+		AddSlab();
+}
+
+void *al::FMChannelPool::Allocate(size_t size)
+{
+	std::unique_lock<std::mutex> lock {m_mutex};
+	++m_stats.allocations;
+	if(size > m_blockSize)
+	{
+		++m_stats.heapAllocations;
+		return ::operator new(size);
+	}
+	if(m_freeList == nullptr)
+		AddSlab();
+	auto *block = m_freeList;
+	m_freeList = block->next;
+	--m_freeCount;
+	++m_stats.liveBlocks;
+	return block;
+}
+
+void al::FMChannelPool::Deallocate(void *p,size_t size)
+{
+	std::unique_lock<std::mutex> lock {m_mutex};
+	++m_stats.deallocations;
+	if(size > m_blockSize)
+	{
+		::operator delete(p);
+		return;
+	}
+	auto *block = static_cast<FreeBlock*>(p);
+	block->next = m_freeList;
+	m_freeList = block;
+	++m_freeCount;
+	--m_stats.liveBlocks;
+}
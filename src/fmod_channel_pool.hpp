@@ -0,0 +1,86 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_CHANNEL_POOL_HPP__
+#define __FMOD_CHANNEL_POOL_HPP__
+
+#include <cinttypes>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <mutex>
+
+namespace al
+{
+	// Slab allocator for channel objects. Blocks are large enough for an FMSoundChannel including the shared_ptr control
+	// block, so a channel created with std::allocate_shared and FMChannelPoolAllocator takes a single block. Freed blocks
+	// are recycled, once enough slabs exist no heap allocations happen for new channels.
+	class FMChannelPool
+	{
+	public:
+		struct Stats
+		{
+			uint64_t allocations = 0ull;
+			uint64_t deallocations = 0ull;
+			// Slab allocations and oversized requests that bypassed the pool
+			uint64_t heapAllocations = 0ull;
+			uint32_t liveBlocks = 0u;
+			uint32_t slabCount = 0u;
+		};
+		FMChannelPool(size_t blockSize,uint32_t blocksPerSlab=64u);
+		~FMChannelPool();
+		FMChannelPool(const FMChannelPool&)=delete;
+		FMChannelPool &operator=(const FMChannelPool&)=delete;
+
+		void *Allocate(size_t size);
+		void Deallocate(void *p,size_t size);
+		// Makes sure at least this many blocks are available without further heap allocations
+		void Reserve(uint32_t count);
+
+		size_t GetBlockSize() const;
+		Stats GetStats() const;
+	private:
+		struct FreeBlock
+		{
+			FreeBlock *next;
+		};
+		void AddSlab();
+
+		size_t m_blockSize = 0;
+		uint32_t m_blocksPerSlab = 0u;
+		std::vector<void*> m_slabs = {};
+		FreeBlock *m_freeList = nullptr;
+		uint32_t m_freeCount = 0u;
+		Stats m_stats = {};
+		// Channels may be released from any thread that holds the last reference
+		mutable std::mutex m_mutex;
+	};
+
+	template<typename T>
+		class FMChannelPoolAllocator
+	{
+	public:
+		using value_type = T;
+		FMChannelPoolAllocator(const std::shared_ptr<FMChannelPool> &pool)
+			: m_pool{pool}
+		{}
+		template<typename U>
+			FMChannelPoolAllocator(const FMChannelPoolAllocator<U> &other)
+			: m_pool{other.m_pool}
+		{}
+		T *allocate(size_t n) {return static_cast<T*>(m_pool->Allocate(n *sizeof(T)));}
+		void deallocate(T *p,size_t n) {m_pool->Deallocate(p,n *sizeof(T));}
+		template<typename U>
+			bool operator==(const FMChannelPoolAllocator<U> &other) const {return m_pool == other.m_pool;}
+		template<typename U>
+			bool operator!=(const FMChannelPoolAllocator<U> &other) const {return m_pool != other.m_pool;}
+	private:
+		template<typename U>
+			friend class FMChannelPoolAllocator;
+		// The allocator is stored in the control block, so the pool stays alive as long as any channel does
+		std::shared_ptr<FMChannelPool> m_pool = nullptr;
+	};
+};
+
+#endif
@@ -0,0 +1,309 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_command_queue.hpp"
+#include "fmod_sound_system.hpp"
+#include "fmod_sound_source.hpp"
+#include <alsound_listener.hpp>
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+	std::atomic<uint64_t> g_nextQueueId = 1ull;
+	// Ring of the calling thread for the queue that was used last, saves walking the ring list on every command
+	struct ThreadRingCache
+	{
+		uint64_t queueId = 0ull;
+		void *ring = nullptr;
+	};
+	thread_local ThreadRingCache g_ringCache {};
+};
+
+al::FMCommandQueue::FMCommandQueue(FMSoundSystem &system)
+	: m_system{system},m_id{g_nextQueueId++}
+{}
+al::FMCommandQueue::~FMCommandQueue()
+{
+	auto *ring = m_rings.load();
+	while(ring != nullptr)
+	{
+		auto *next = ring->next;
+		delete ring;
+		ring = next;
+	}
+}
+
+al::FMCommandQueue::ProducerRing &al::FMCommandQueue::GetProducerRing()
+{
+	if(g_ringCache.queueId == m_id)
+		return *static_cast<ProducerRing*>(g_ringCache.ring);
+	// A thread keeps its ring for the lifetime of the queue. Thread ids may be reused once a thread has exited,
+	// in which case the new thread takes over the ring of the old one.
+	auto threadId = std::this_thread::get_id();
+	auto *ring = m_rings.load(std::memory_order_acquire);
+	while(ring != nullptr && ring->owner != threadId)
+		ring = ring->next;
+	if(ring == nullptr)
+	{
+		ring = new ProducerRing{};
+		ring->owner = threadId;
+		ring->next = m_rings.load(std::memory_order_relaxed);
+		while(m_rings.compare_exchange_weak(ring->next,ring,std::memory_order_release,std::memory_order_relaxed) == false);
+		++m_numRings;
+	}
+	g_ringCache = {m_id,ring};
+	return *ring;
+}
+
+void al::FMCommandQueue::Push(Target targetType,uint32_t target,uint32_t generation,Property property,const float *values,uint32_t numValues)
+{
+	auto &ring = GetProducerRing();
+	Command cmd;
+	cmd.sequence = m_sequence.fetch_add(1ull,std::memory_order_relaxed);
+	cmd.target = target;
+	cmd.generation = generation;
+	cmd.targetType = targetType;
+	cmd.property = property;
+	std::copy(values,values +numValues,cmd.values.begin());
+
+	auto writeIndex = ring.writeIndex.load(std::memory_order_relaxed);
+	if(writeIndex -ring.readIndex.load(std::memory_order_acquire) >= RING_CAPACITY)
+	{
+		// More commands than fit into the ring within a single frame, this shouldn't happen regularly
+		std::unique_lock<std::mutex> lock {m_overflowMutex};
+		m_overflow.push_back(cmd);
+		++m_overflowCount;
+		return;
+	}
+	ring.commands[writeIndex %RING_CAPACITY] = cmd;
+	ring.writeIndex.store(writeIndex +1u,std::memory_order_release);
+}
+
+void al::FMCommandQueue::SetPosition(ChannelHandle channel,const Vector3 &pos)
+{
+	float values[] = {pos.x,pos.y,pos.z};
+	Push(Target::Channel,channel.index,channel.generation,Property::Position,values,3u);
+}
+void al::FMCommandQueue::SetVelocity(ChannelHandle channel,const Vector3 &vel)
+{
+	float values[] = {vel.x,vel.y,vel.z};
+	Push(Target::Channel,channel.index,channel.generation,Property::Velocity,values,3u);
+}
+void al::FMCommandQueue::SetOrientation(ChannelHandle channel,const Vector3 &at,const Vector3 &up)
+{
+	float values[] = {at.x,at.y,at.z,up.x,up.y,up.z};
+	Push(Target::Channel,channel.index,channel.generation,Property::Orientation,values,6u);
+}
+void al::FMCommandQueue::SetGain(ChannelHandle channel,float gain) {Push(Target::Channel,channel.index,channel.generation,Property::Gain,&gain,1u);}
+void al::FMCommandQueue::SetPitch(ChannelHandle channel,float pitch) {Push(Target::Channel,channel.index,channel.generation,Property::Pitch,&pitch,1u);}
+void al::FMCommandQueue::Play(ChannelHandle channel) {Push(Target::Channel,channel.index,channel.generation,Property::Play,nullptr,0u);}
+void al::FMCommandQueue::Stop(ChannelHandle channel) {Push(Target::Channel,channel.index,channel.generation,Property::Stop,nullptr,0u);}
+void al::FMCommandQueue::Pause(ChannelHandle channel) {Push(Target::Channel,channel.index,channel.generation,Property::Pause,nullptr,0u);}
+void al::FMCommandQueue::Resume(ChannelHandle channel) {Push(Target::Channel,channel.index,channel.generation,Property::Resume,nullptr,0u);}
+
+void al::FMCommandQueue::SetListenerPosition(uint32_t listenerIndex,const Vector3 &pos)
+{
+	float values[] = {pos.x,pos.y,pos.z};
+	Push(Target::Listener,listenerIndex,0u,Property::Position,values,3u);
+}
+void al::FMCommandQueue::SetListenerVelocity(uint32_t listenerIndex,const Vector3 &vel)
+{
+	float values[] = {vel.x,vel.y,vel.z};
+	Push(Target::Listener,listenerIndex,0u,Property::Velocity,values,3u);
+}
+void al::FMCommandQueue::SetListenerOrientation(uint32_t listenerIndex,const Vector3 &at,const Vector3 &up)
+{
+	float values[] = {at.x,at.y,at.z,up.x,up.y,up.z};
+	Push(Target::Listener,listenerIndex,0u,Property::Orientation,values,6u);
+}
+void al::FMCommandQueue::SetListenerGain(uint32_t listenerIndex,float gain) {Push(Target::Listener,listenerIndex,0u,Property::Gain,&gain,1u);}
+
+uint32_t al::FMCommandQueue::Register(FMSoundChannel &channel)
+{
+	uint32_t index;
+	if(m_freeIndices.empty() == false)
+	{
+		index = m_freeIndices.back();
+		m_freeIndices.pop_back();
+	}
+	else
+	{
+		index = static_cast<uint32_t>(m_entries.size());
+		m_entries.push_back({});
+	}
+	auto &entry = m_entries[index];
+	entry.channel = &channel;
+	entry.appliedSequences = {};
+	return index;
+}
+void al::FMCommandQueue::Unregister(uint32_t index)
+{
+	if(index >= m_entries.size() || m_entries[index].channel == nullptr)
+		return;
+	// Queued commands for the old channel are dropped by the generation check
+	auto &entry = m_entries[index];
+	entry.channel = nullptr;
+	++entry.generation;
+	m_freeIndices.push_back(index);
+}
+al::FMCommandQueue::ChannelHandle al::FMCommandQueue::GetHandle(const FMSoundChannel &channel) const
+{
+	auto index = channel.m_commandIndex;
+	if(index >= m_entries.size())
+		return {};
+	return {index,m_entries[index].generation};
+}
+
+bool al::FMCommandQueue::IsNewer(AppliedSequences &sequences,const Command &cmd) const
+{
+	auto property = static_cast<uint32_t>(cmd.property);
+	if(property >= STATE_PROPERTY_COUNT)
+		return true;
+	// Sequence 0 is the first command ever issued, so it's stored off by one
+	if(cmd.sequence +1ull <= sequences[property])
+		return false;
+	sequences[property] = cmd.sequence +1ull;
+	return true;
+}
+void al::FMCommandQueue::Apply(const Command &cmd)
+{
+	auto &v = cmd.values;
+	if(cmd.targetType == Target::Listener)
+	{
+		auto *listener = m_system.GetListenerByIndex(cmd.target);
+		if(listener == nullptr)
+		{
+			++m_staleCommands;
+			return;
+		}
+		if(cmd.target >= m_listenerSequences.size())
+			m_listenerSequences.resize(cmd.target +1u,AppliedSequences{});
+		if(IsNewer(m_listenerSequences[cmd.target],cmd) == false)
+			return;
+		switch(cmd.property)
+		{
+		case Property::Position:
+			listener->SetPosition({v[0],v[1],v[2]});
+			break;
+		case Property::Velocity:
+			listener->SetVelocity({v[0],v[1],v[2]});
+			break;
+		case Property::Orientation:
+			listener->SetOrientation({v[0],v[1],v[2]},{v[3],v[4],v[5]});
+			break;
+		case Property::Gain:
+			listener->SetGain(v[0]);
+			break;
+		default:
+			return;
+		}
+		++m_appliedCommands;
+		return;
+	}
+	if(cmd.target >= m_entries.size() || m_entries[cmd.target].channel == nullptr || m_entries[cmd.target].generation != cmd.generation)
+	{
+		++m_staleCommands;
+		return;
+	}
+	auto &entry = m_entries[cmd.target];
+	if(IsNewer(entry.appliedSequences,cmd) == false)
+		return;
+	auto &channel = *entry.channel;
+	switch(cmd.property)
+	{
+	case Property::Position:
+		channel.SetPosition({v[0],v[1],v[2]});
+		break;
+	case Property::Velocity:
+		channel.SetVelocity({v[0],v[1],v[2]});
+		break;
+	case Property::Orientation:
+		channel.SetOrientation({v[0],v[1],v[2]},{v[3],v[4],v[5]});
+		break;
+	case Property::Gain:
+		channel.SetGain(v[0]);
+		break;
+	case Property::Pitch:
+		channel.SetPitch(v[0]);
+		break;
+	case Property::Play:
+		channel.Play();
+		break;
+	case Property::Stop:
+		channel.Stop();
+		break;
+	case Property::Pause:
+		channel.Pause();
+		break;
+	case Property::Resume:
+		channel.Resume();
+		break;
+	}
+	++m_appliedCommands;
+}
+
+void al::FMCommandQueue::Drain()
+{
+	auto t = std::chrono::steady_clock::now();
+	m_drained.clear();
+	for(auto *ring=m_rings.load(std::memory_order_acquire);ring!=nullptr;ring=ring->next)
+	{
+		auto readIndex = ring->readIndex.load(std::memory_order_relaxed);
+		auto writeIndex = ring->writeIndex.load(std::memory_order_acquire);
+		for(auto i=readIndex;i!=writeIndex;++i)
+			m_drained.push_back(ring->commands[i %RING_CAPACITY]);
+		ring->readIndex.store(writeIndex,std::memory_order_release);
+	}
+	{
+		std::unique_lock<std::mutex> lock {m_overflowMutex};
+		m_drained.insert(m_drained.end(),m_overflow.begin(),m_overflow.end());
+		m_overflow.clear();
+	}
+	if(m_drained.empty())
+		return;
+	m_queuedCommands += m_drained.size();
+
+	// Only the newest write per target and property survives; actions are kept as they are
+	m_latest.clear();
+	m_ordered.clear();
+	for(auto i=decltype(m_drained.size()){0u};i<m_drained.size();++i)
+	{
+		auto &cmd = m_drained[i];
+		if(static_cast<uint32_t>(cmd.property) >= STATE_PROPERTY_COUNT)
+		{
+			m_ordered.push_back(&cmd);
+			continue;
+		}
+		auto key = (static_cast<uint64_t>(cmd.targetType)<<40) | (static_cast<uint64_t>(cmd.property)<<32) | cmd.target;
+		auto it = m_latest.find(key);
+		if(it == m_latest.end())
+		{
+			m_latest.insert(std::make_pair(key,static_cast<uint32_t>(i)));
+			continue;
+		}
+		++m_coalescedCommands;
+		if(cmd.sequence > m_drained[it->second].sequence)
+			it->second = static_cast<uint32_t>(i);
+	}
+	for(auto &pair : m_latest)
+		m_ordered.push_back(&m_drained[pair.second]);
+	std::sort(m_ordered.begin(),m_ordered.end(),[](const Command *a,const Command *b) {return a->sequence < b->sequence;});
+	for(auto *cmd : m_ordered)
+		Apply(*cmd);
+	m_lastDrainTime = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() -t).count();
+}
+
+al::FMCommandQueue::Stats al::FMCommandQueue::GetStats() const
+{
+	Stats stats {};
+	stats.producerThreads = m_numRings;
+	stats.queuedCommands = m_queuedCommands;
+	stats.appliedCommands = m_appliedCommands;
+	stats.coalescedCommands = m_coalescedCommands;
+	stats.staleCommands = m_staleCommands;
+	stats.overflowCommands = m_overflowCount;
+	stats.lastDrainTime = m_lastDrainTime;
+	return stats;
+}
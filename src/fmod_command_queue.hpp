@@ -0,0 +1,152 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_COMMAND_QUEUE_HPP__
+#define __FMOD_COMMAND_QUEUE_HPP__
+
+#include <alsound_coordinate_system.hpp>
+#include <cinttypes>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <limits>
+#include <unordered_map>
+
+namespace al
+{
+	class FMSoundSystem;
+	class FMSoundChannel;
+	// Deferred channel and listener changes from any thread. Every producer thread writes into its own ring buffer
+	// without locks; the rings are drained in Update() on the main thread, where redundant writes to the same property
+	// are coalesced and the remaining commands are applied in the order they were issued.
+	// Producers only ever see handles, so a channel may be destroyed while commands for it are still queued.
+	class FMCommandQueue
+	{
+	public:
+		static constexpr uint32_t INVALID_INDEX = std::numeric_limits<uint32_t>::max();
+		// Commands per producer thread that can be queued between two drains before the (locked) overflow is used
+		static constexpr uint32_t RING_CAPACITY = 4'096u;
+		struct ChannelHandle
+		{
+			uint32_t index = INVALID_INDEX;
+			uint32_t generation = 0u;
+		};
+		struct Stats
+		{
+			uint32_t producerThreads = 0u;
+			uint64_t queuedCommands = 0ull;
+			uint64_t appliedCommands = 0ull;
+			uint64_t coalescedCommands = 0ull;
+			uint64_t staleCommands = 0ull; // Commands for channels that no longer existed
+			uint64_t overflowCommands = 0ull;
+			double lastDrainTime = 0.0; // Milliseconds
+		};
+
+		FMCommandQueue(FMSoundSystem &system);
+		~FMCommandQueue();
+
+		// Main thread
+		uint32_t Register(FMSoundChannel &channel);
+		void Unregister(uint32_t index);
+		// The handle can be passed to other threads, it stays valid (but unused) after the channel has been destroyed
+		ChannelHandle GetHandle(const FMSoundChannel &channel) const;
+		void Drain();
+		Stats GetStats() const;
+
+		// Any thread
+		void SetPosition(ChannelHandle channel,const Vector3 &pos);
+		void SetVelocity(ChannelHandle channel,const Vector3 &vel);
+		void SetOrientation(ChannelHandle channel,const Vector3 &at,const Vector3 &up);
+		void SetGain(ChannelHandle channel,float gain);
+		void SetPitch(ChannelHandle channel,float pitch);
+		void Play(ChannelHandle channel);
+		void Stop(ChannelHandle channel);
+		void Pause(ChannelHandle channel);
+		void Resume(ChannelHandle channel);
+
+		void SetListenerPosition(uint32_t listenerIndex,const Vector3 &pos);
+		void SetListenerVelocity(uint32_t listenerIndex,const Vector3 &vel);
+		void SetListenerOrientation(uint32_t listenerIndex,const Vector3 &at,const Vector3 &up);
+		void SetListenerGain(uint32_t listenerIndex,float gain);
+	private:
+		enum class Target : uint8_t
+		{
+			Channel = 0u,
+			Listener
+		};
+		static constexpr uint32_t STATE_PROPERTY_COUNT = 5u;
+		enum class Property : uint8_t
+		{
+			// States, only the last write per frame is applied
+			Position = 0u,
+			Velocity,
+			Orientation,
+			Gain,
+			Pitch,
+			// Actions, these are never coalesced
+			Play,
+			Stop,
+			Pause,
+			Resume
+		};
+		struct Command
+		{
+			uint64_t sequence;
+			uint32_t target;
+			uint32_t generation;
+			Target targetType;
+			Property property;
+			std::array<float,6> values;
+		};
+		// Single-producer/single-consumer ring, owned by one producer thread
+		struct alignas(64) ProducerRing
+		{
+			std::array<Command,RING_CAPACITY> commands;
+			alignas(64) std::atomic<uint32_t> writeIndex = 0u;
+			alignas(64) std::atomic<uint32_t> readIndex = 0u;
+			std::thread::id owner;
+			ProducerRing *next = nullptr;
+		};
+		// Sequence of the last applied write per state property. Producers can be up to one drain late, so older writes
+		// must not override newer ones that have already been applied.
+		using AppliedSequences = std::array<uint64_t,STATE_PROPERTY_COUNT>;
+		struct Entry
+		{
+			FMSoundChannel *channel = nullptr;
+			uint32_t generation = 0u;
+			AppliedSequences appliedSequences = {};
+		};
+		ProducerRing &GetProducerRing();
+		void Push(Target targetType,uint32_t target,uint32_t generation,Property property,const float *values,uint32_t numValues);
+		bool IsNewer(AppliedSequences &sequences,const Command &cmd) const;
+		void Apply(const Command &cmd);
+
+		FMSoundSystem &m_system;
+		uint64_t m_id = 0ull;
+		std::atomic<uint64_t> m_sequence = 0ull;
+		// Rings are only ever added, the list is walked without locks
+		std::atomic<ProducerRing*> m_rings = nullptr;
+		std::atomic<uint32_t> m_numRings = 0u;
+		std::mutex m_overflowMutex;
+		std::vector<Command> m_overflow = {};
+		std::atomic<uint64_t> m_overflowCount = 0ull;
+
+		// Main thread
+		std::vector<Entry> m_entries = {};
+		std::vector<uint32_t> m_freeIndices = {};
+		std::vector<AppliedSequences> m_listenerSequences = {};
+		std::vector<Command> m_drained = {};
+		std::vector<const Command*> m_ordered = {};
+		std::unordered_map<uint64_t,uint32_t> m_latest = {};
+		uint64_t m_queuedCommands = 0ull;
+		uint64_t m_appliedCommands = 0ull;
+		uint64_t m_coalescedCommands = 0ull;
+		uint64_t m_staleCommands = 0ull;
+		double m_lastDrainTime = 0.0;
+	};
+};
+
+#endif
@@ -0,0 +1,316 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_convolution.hpp"
+#include "fmod_sound_system.hpp"
+#include "fmod_decoder.hpp"
+#include <fmod_studio.hpp>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+
+std::shared_ptr<al::FMImpulseResponse> al::FMImpulseResponse::Create(const float *samples,uint32_t numFrames,uint32_t numChannels,uint32_t blockSize)
+{
+	if(numFrames == 0u || numChannels == 0u || blockSize == 0u)
+		return nullptr;
+	auto ir = std::shared_ptr<FMImpulseResponse>{new FMImpulseResponse{}};
+	ir->m_blockSize = blockSize;
+	ir->m_numChannels = umath::min(numChannels,2u);
+	ir->m_numPartitions = (numFrames +blockSize -1u) /blockSize;
+	auto numBins = ir->GetBinCount();
+	ir->m_spectraRe.resize(ir->m_numChannels *ir->m_numPartitions *numBins);
+	ir->m_spectraIm.resize(ir->m_spectraRe.size());
+
+	FMFFT fft {blockSize *2u};
+	std::vector<float> time(blockSize *2u);
+	// Folds the scale of the inverse transform into the spectra, so the convolution output doesn't need to be normalized
+	auto scale = 1.f /static_cast<float>(blockSize);
+	for(auto c=0u;c<ir->m_numChannels;++c)
+	{
+		for(auto p=0u;p<ir->m_numPartitions;++p)
+		{
+			std::fill(time.begin(),time.end(),0.f);
+			auto start = p *blockSize;
+			auto count = umath::min(blockSize,numFrames -start);
+			for(auto i=0u;i<count;++i)
+				time[i] = samples[(start +i) *numChannels +c] *scale;
+			auto offset = (c *ir->m_numPartitions +p) *numBins;
+			fft.Forward(time.data(),ir->m_spectraRe.data() +offset,ir->m_spectraIm.data() +offset);
+		}
+	}
+	return ir;
+}
+std::shared_ptr<al::FMImpulseResponse> al::FMImpulseResponse::Load(FMSoundSystem &system,const std::string &path,uint32_t blockSize,uint32_t maxFrames)
+{
+	// The decoder already converts to float at the mixer rate
+	auto decoder = FMDecoder::Create(system,path);
+	if(decoder == nullptr)
+		return nullptr;
+	auto numChannels = decoder->GetNumChannels();
+	std::vector<float> samples;
+	constexpr uint32_t chunkFrames = 4'096u;
+	auto numFrames = 0u;
+	while(numFrames < maxFrames)
+	{
+		auto count = umath::min(chunkFrames,maxFrames -numFrames);
+		samples.resize((numFrames +count) *numChannels);
+		auto numRead = decoder->Read(samples.data() +numFrames *numChannels,count);
+		numFrames += numRead;
+		if(numRead < count)
+			break;
+	}
+	if(numFrames == 0u)
+	{
+		std::cout<<"[FMOD] Impulse response '"<<path<<"' is empty!"<<std::endl;
+		return nullptr;
+	}
+	return Create(samples.data(),numFrames,numChannels,blockSize);
+}
+uint32_t al::FMImpulseResponse::GetBlockSize() const {return m_blockSize;}
+uint32_t al::FMImpulseResponse::GetPartitionCount() const {return m_numPartitions;}
+uint32_t al::FMImpulseResponse::GetChannelCount() const {return m_numChannels;}
+uint32_t al::FMImpulseResponse::GetBinCount() const {return m_blockSize +1u;}
+const float *al::FMImpulseResponse::GetSpectrumRe(uint32_t channel,uint32_t partition) const {return m_spectraRe.data() +(channel *m_numPartitions +partition) *GetBinCount();}
+const float *al::FMImpulseResponse::GetSpectrumIm(uint32_t channel,uint32_t partition) const {return m_spectraIm.data() +(channel *m_numPartitions +partition) *GetBinCount();}
+
+std::shared_ptr<al::FMImpulseResponse> al::FMImpulseResponseCache::Get(FMSoundSystem &system,const std::string &path,uint32_t blockSize,uint32_t maxFrames)
+{
+	auto it = m_impulseResponses.find(path);
+	if(it != m_impulseResponses.end() && it->second->GetBlockSize() == blockSize)
+		return it->second;
+	auto ir = FMImpulseResponse::Load(system,path,blockSize,maxFrames);
+	if(ir != nullptr)
+		m_impulseResponses[path] = ir;
+	return ir;
+}
+void al::FMImpulseResponseCache::Clear() {m_impulseResponses.clear();}
+
+////////////////
+
+al::FMConvolver::FMConvolver(uint32_t blockSize,uint32_t maxPartitions)
+	: m_fft{blockSize *2u},m_blockSize{blockSize},m_numBins{blockSize +1u},m_maxPartitions{umath::max(maxPartitions,1u)}
+{
+	m_fdlRe.resize(m_maxPartitions *m_numBins);
+	m_fdlIm.resize(m_fdlRe.size());
+	m_input.resize(blockSize *2u);
+	m_output.resize(blockSize *2u);
+	m_accRe.resize(m_numBins);
+	m_accIm.resize(m_numBins);
+	m_time.resize(blockSize *2u);
+	m_crossfadeOutput.resize(blockSize *2u);
+}
+uint32_t al::FMConvolver::GetBlockSize() const {return m_blockSize;}
+void al::FMConvolver::Reset()
+{
+	std::fill(m_fdlRe.begin(),m_fdlRe.end(),0.f);
+	std::fill(m_fdlIm.begin(),m_fdlIm.end(),0.f);
+	std::fill(m_input.begin(),m_input.end(),0.f);
+	std::fill(m_output.begin(),m_output.end(),0.f);
+	m_fill = 0u;
+}
+void al::FMConvolver::SetImpulseResponse(const FMImpulseResponse *ir,uint32_t crossfadeBlocks)
+{
+	if(ir != nullptr && ir->GetBlockSize() != m_blockSize)
+		return;
+	if(m_current == nullptr || crossfadeBlocks == 0u)
+	{
+		m_current = ir;
+		m_next = nullptr;
+		return;
+	}
+	// A crossfade that is still in progress is cut short
+	if(m_next != nullptr)
+		m_current = m_next;
+	m_next = ir;
+	m_crossfadeBlocks = crossfadeBlocks;
+	m_crossfadeBlock = 0u;
+}
+
+void al::FMConvolver::Convolve(const FMImpulseResponse &ir,uint32_t channel,float *out)
+{
+	std::fill(m_accRe.begin(),m_accRe.end(),0.f);
+	std::fill(m_accIm.begin(),m_accIm.end(),0.f);
+	auto numPartitions = umath::min(ir.GetPartitionCount(),m_maxPartitions);
+	auto irChannel = umath::min(channel,ir.GetChannelCount() -1u);
+	for(auto p=0u;p<numPartitions;++p)
+	{
+		// Partition p is applied to the input block from p blocks ago
+		auto idx = (m_fdlPos +m_maxPartitions -p) %m_maxPartitions;
+		FMFFT::MultiplyAccumulate(
+			m_fdlRe.data() +idx *m_numBins,m_fdlIm.data() +idx *m_numBins,
+			ir.GetSpectrumRe(irChannel,p),ir.GetSpectrumIm(irChannel,p),
+			m_accRe.data(),m_accIm.data(),m_numBins
+		);
+	}
+	m_fft.Inverse(m_accRe.data(),m_accIm.data(),m_time.data());
+	// Overlap-save: only the second half is free of circular aliasing
+	memcpy(out,m_time.data() +m_blockSize,m_blockSize *sizeof(float));
+}
+
+void al::FMConvolver::ProcessBlock()
+{
+	m_fdlPos = (m_fdlPos +1u) %m_maxPartitions;
+	m_fft.Forward(m_input.data(),m_fdlRe.data() +m_fdlPos *m_numBins,m_fdlIm.data() +m_fdlPos *m_numBins);
+	memcpy(m_input.data(),m_input.data() +m_blockSize,m_blockSize *sizeof(float));
+
+	auto numChannels = 1u;
+	if((m_current != nullptr && m_current->GetChannelCount() > 1u) || (m_next != nullptr && m_next->GetChannelCount() > 1u))
+		numChannels = 2u;
+	for(auto c=0u;c<2u;++c)
+	{
+		auto *out = m_output.data() +c *m_blockSize;
+		if(c >= numChannels)
+		{
+			memcpy(out,m_output.data(),m_blockSize *sizeof(float));
+			continue;
+		}
+		if(m_current != nullptr)
+			Convolve(*m_current,c,out);
+		else
+			std::fill(out,out +m_blockSize,0.f);
+		if(m_next == nullptr)
+			continue;
+		auto *outNext = m_crossfadeOutput.data() +c *m_blockSize;
+		Convolve(*m_next,c,outNext);
+		auto gainStart = static_cast<float>(m_crossfadeBlock) /static_cast<float>(m_crossfadeBlocks);
+		auto gainStep = 1.f /static_cast<float>(m_crossfadeBlocks *m_blockSize);
+		for(auto i=0u;i<m_blockSize;++i)
+		{
+			auto g = gainStart +i *gainStep;
+			out[i] = out[i] *(1.f -g) +outNext[i] *g;
+		}
+	}
+	if(m_next != nullptr && ++m_crossfadeBlock >= m_crossfadeBlocks)
+	{
+		m_current = m_next;
+		m_next = nullptr;
+	}
+}
+
+void al::FMConvolver::Process(const float *in,float *outLeft,float *outRight,uint32_t numFrames)
+{
+	auto offset = 0u;
+	while(offset < numFrames)
+	{
+		auto count = umath::min(m_blockSize -m_fill,numFrames -offset);
+		memcpy(m_input.data() +m_blockSize +m_fill,in +offset,count *sizeof(float));
+		memcpy(outLeft +offset,m_output.data() +m_fill,count *sizeof(float));
+		memcpy(outRight +offset,m_output.data() +m_blockSize +m_fill,count *sizeof(float));
+		m_fill += count;
+		offset += count;
+		if(m_fill < m_blockSize)
+			break;
+		ProcessBlock();
+		m_fill = 0u;
+	}
+}
+
+////////////////
+
+static constexpr uint32_t MAX_DSP_BLOCK_FRAMES = 4'096u;
+al::FMConvolutionReverb::FMConvolutionReverb(uint32_t maxPartitions)
+	: m_convolver{BLOCK_SIZE,maxPartitions}
+{
+	m_mono.resize(MAX_DSP_BLOCK_FRAMES);
+	m_wetLeft.resize(MAX_DSP_BLOCK_FRAMES);
+	m_wetRight.resize(MAX_DSP_BLOCK_FRAMES);
+}
+std::shared_ptr<al::FMConvolutionReverb> al::FMConvolutionReverb::Create(FMSoundSystem &system)
+{
+	auto &fmSystem = system.GetFMODLowLevelSystem();
+	auto frequency = system.GetMixerFrequency();
+	auto maxPartitions = static_cast<uint32_t>(std::ceil(MAX_IMPULSE_RESPONSE_LENGTH *frequency /BLOCK_SIZE));
+	auto reverb = std::shared_ptr<FMConvolutionReverb>{new FMConvolutionReverb{maxPartitions}};
+	reverb->m_frequency = frequency;
+
+	FMOD_DSP_DESCRIPTION desc {};
+	memset(&desc,0,sizeof(desc));
+	desc.pluginsdkversion = FMOD_PLUGIN_SDK_VERSION;
+	strncpy(desc.name,"Convolution Reverb",sizeof(desc.name) -1);
+	desc.numinputbuffers = 1;
+	desc.numoutputbuffers = 1;
+	desc.userdata = reverb.get();
+	desc.read = [](FMOD_DSP_STATE *state,float *inBuffer,float *outBuffer,uint32_t length,int32_t inChannels,int32_t *outChannels) -> FMOD_RESULT {
+		void *userData = nullptr;
+		state->functions->getuserdata(state,&userData);
+		auto *reverb = static_cast<FMConvolutionReverb*>(userData);
+		if(reverb == nullptr)
+			return FMOD_RESULT::FMOD_OK;
+		// Processed in pieces that fit into the preallocated scratch buffers
+		for(auto offset=0u;offset<length;offset+=MAX_DSP_BLOCK_FRAMES)
+		{
+			auto count = umath::min(length -offset,MAX_DSP_BLOCK_FRAMES);
+			reverb->Process(inBuffer +offset *inChannels,outBuffer +offset *(*outChannels),count,inChannels);
+		}
+		return FMOD_RESULT::FMOD_OK;
+	};
+	auto r = fmSystem.createDSP(&desc,&reverb->m_dsp);
+	al::check_result(r);
+	if(r != FMOD_OK)
+		return nullptr;
+	return reverb;
+}
+al::FMConvolutionReverb::~FMConvolutionReverb()
+{
+	// The mixer doesn't touch the convolver anymore once the DSP has been released
+	if(m_dsp != nullptr)
+		m_dsp->release();
+}
+FMOD::DSP *al::FMConvolutionReverb::GetFMODDsp() {return m_dsp;}
+
+void al::FMConvolutionReverb::SetImpulseResponse(const std::shared_ptr<FMImpulseResponse> &ir,float crossfadeTime)
+{
+	if(ir != nullptr && std::find(m_references.begin(),m_references.end(),ir) == m_references.end())
+		m_references.push_back(ir);
+	auto crossfadeBlocks = static_cast<uint32_t>(std::ceil(umath::max(crossfadeTime,0.f) *m_frequency /BLOCK_SIZE));
+	std::unique_lock<std::mutex> lock {m_pendingMutex};
+	m_pending = ir.get();
+	m_pendingCrossfadeBlocks = crossfadeBlocks;
+	m_bPending = true;
+}
+void al::FMConvolutionReverb::SetWetDryMix(float wet,float dry)
+{
+	m_wet = wet;
+	m_dry = dry;
+}
+
+void al::FMConvolutionReverb::Process(const float *in,float *out,uint32_t numFrames,int32_t numChannels)
+{
+	{
+		// Never block the mixer, a pending change is picked up with the next buffer instead
+		std::unique_lock<std::mutex> lock {m_pendingMutex,std::try_to_lock};
+		if(lock.owns_lock() && m_bPending)
+		{
+			m_convolver.SetImpulseResponse(m_pending,m_pendingCrossfadeBlocks);
+			m_bPending = false;
+		}
+	}
+	auto invChannels = 1.f /static_cast<float>(numChannels);
+	for(auto i=0u;i<numFrames;++i)
+	{
+		auto sum = 0.f;
+		for(auto c=0;c<numChannels;++c)
+			sum += in[i *numChannels +c];
+		m_mono[i] = sum *invChannels;
+	}
+	m_convolver.Process(m_mono.data(),m_wetLeft.data(),m_wetRight.data(),numFrames);
+
+	auto wet = m_wet.load();
+	auto dry = m_dry.load();
+	for(auto i=0u;i<numFrames;++i)
+	{
+		auto *frameIn = in +i *numChannels;
+		auto *frameOut = out +i *numChannels;
+		if(numChannels == 1)
+		{
+			frameOut[0] = frameIn[0] *dry +(m_wetLeft[i] +m_wetRight[i]) *0.5f *wet;
+			continue;
+		}
+		frameOut[0] = frameIn[0] *dry +m_wetLeft[i] *wet;
+		frameOut[1] = frameIn[1] *dry +m_wetRight[i] *wet;
+		for(auto c=2;c<numChannels;++c)
+			frameOut[c] = frameIn[c] *dry;
+	}
+}
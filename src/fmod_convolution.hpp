@@ -0,0 +1,130 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_CONVOLUTION_HPP__
+#define __FMOD_CONVOLUTION_HPP__
+
+#include "fmod_fft.hpp"
+#include <cinttypes>
+#include <memory>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+namespace FMOD
+{
+	class DSP;
+};
+namespace al
+{
+	class FMSoundSystem;
+	// Spectra of the partitions of an impulse response (mono or stereo), ready for uniformly partitioned convolution
+	class FMImpulseResponse
+	{
+	public:
+		static std::shared_ptr<FMImpulseResponse> Create(const float *samples,uint32_t numFrames,uint32_t numChannels,uint32_t blockSize);
+		// The impulse response is resampled to the mixer rate and truncated to maxFrames
+		static std::shared_ptr<FMImpulseResponse> Load(FMSoundSystem &system,const std::string &path,uint32_t blockSize,uint32_t maxFrames);
+		uint32_t GetBlockSize() const;
+		uint32_t GetPartitionCount() const;
+		uint32_t GetChannelCount() const;
+		uint32_t GetBinCount() const;
+		const float *GetSpectrumRe(uint32_t channel,uint32_t partition) const;
+		const float *GetSpectrumIm(uint32_t channel,uint32_t partition) const;
+	private:
+		FMImpulseResponse()=default;
+		uint32_t m_blockSize = 0u;
+		uint32_t m_numPartitions = 0u;
+		uint32_t m_numChannels = 0u;
+		std::vector<float> m_spectraRe = {};
+		std::vector<float> m_spectraIm = {};
+	};
+
+	// Impulse responses are loaded once per path; entries are only released with Clear()
+	class FMImpulseResponseCache
+	{
+	public:
+		std::shared_ptr<FMImpulseResponse> Get(FMSoundSystem &system,const std::string &path,uint32_t blockSize,uint32_t maxFrames);
+		void Clear();
+	private:
+		std::unordered_map<std::string,std::shared_ptr<FMImpulseResponse>> m_impulseResponses = {};
+	};
+
+	// Uniformly partitioned overlap-save convolution of a mono input with a mono or stereo impulse response, with a
+	// latency of one block. Nothing is allocated after Initialize(), so Process() can run on the mixer thread.
+	// Switching impulse responses crossfades between the outputs of both, which share the same input spectra.
+	class FMConvolver
+	{
+	public:
+		FMConvolver(uint32_t blockSize,uint32_t maxPartitions);
+		// The impulse response has to stay alive while it's in use; partitions beyond maxPartitions are ignored
+		void SetImpulseResponse(const FMImpulseResponse *ir,uint32_t crossfadeBlocks);
+		void Process(const float *in,float *outLeft,float *outRight,uint32_t numFrames);
+		void Reset();
+		uint32_t GetBlockSize() const;
+	private:
+		void ProcessBlock();
+		void Convolve(const FMImpulseResponse &ir,uint32_t channel,float *out);
+
+		FMFFT m_fft;
+		uint32_t m_blockSize = 0u;
+		uint32_t m_numBins = 0u;
+		uint32_t m_maxPartitions = 0u;
+		// Frequency-domain delay line of the input spectra
+		std::vector<float> m_fdlRe = {};
+		std::vector<float> m_fdlIm = {};
+		uint32_t m_fdlPos = 0u;
+		// Previous and current input block
+		std::vector<float> m_input = {};
+		uint32_t m_fill = 0u;
+		// Output of the last processed block per channel
+		std::vector<float> m_output = {};
+		std::vector<float> m_accRe = {};
+		std::vector<float> m_accIm = {};
+		std::vector<float> m_time = {};
+		std::vector<float> m_crossfadeOutput = {};
+		const FMImpulseResponse *m_current = nullptr;
+		const FMImpulseResponse *m_next = nullptr;
+		uint32_t m_crossfadeBlocks = 0u;
+		uint32_t m_crossfadeBlock = 0u;
+	};
+
+	// FMOD DSP that convolves its input with an impulse response. The input is downmixed to mono and the (mono or stereo)
+	// reverb is written to the front left and right speakers.
+	class FMConvolutionReverb
+	{
+	public:
+		static constexpr uint32_t BLOCK_SIZE = 512u;
+		static constexpr float MAX_IMPULSE_RESPONSE_LENGTH = 6.f; // Seconds
+		static std::shared_ptr<FMConvolutionReverb> Create(FMSoundSystem &system);
+		~FMConvolutionReverb();
+
+		void SetImpulseResponse(const std::shared_ptr<FMImpulseResponse> &ir,float crossfadeTime);
+		void SetWetDryMix(float wet,float dry);
+		FMOD::DSP *GetFMODDsp();
+	private:
+		FMConvolutionReverb(uint32_t maxPartitions);
+		void Process(const float *in,float *out,uint32_t numFrames,int32_t numChannels);
+
+		FMOD::DSP *m_dsp = nullptr;
+		uint32_t m_frequency = 0u;
+		FMConvolver m_convolver;
+		std::vector<float> m_mono = {};
+		std::vector<float> m_wetLeft = {};
+		std::vector<float> m_wetRight = {};
+		std::atomic<float> m_wet = 1.f;
+		std::atomic<float> m_dry = 0.f;
+		// Hand-over from the main thread to the mixer thread
+		std::mutex m_pendingMutex;
+		const FMImpulseResponse *m_pending = nullptr;
+		uint32_t m_pendingCrossfadeBlocks = 0u;
+		bool m_bPending = false;
+		// Every impulse response that was ever handed to the mixer stays alive until the DSP has been released
+		std::vector<std::shared_ptr<FMImpulseResponse>> m_references = {};
+	};
+};
+
+#endif
@@ -0,0 +1,61 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_custom_dsp.hpp"
+#include "fmod_sound_system.hpp"
+#include <fmod_studio.hpp>
+
+std::shared_ptr<al::FMCustomDsp> al::FMCustomDsp::Create(FMOD::System &system,const std::string &name,uint32_t frequency,std::unique_ptr<FMDspProcessor> processor,ReadCallback read)
+{
+	if(processor == nullptr)
+		return nullptr;
+	auto dsp = std::shared_ptr<FMCustomDsp>{new FMCustomDsp{}};
+	processor->Initialize(frequency);
+	dsp->m_processor = std::move(processor);
+	dsp->m_read = read;
+
+	FMOD_DSP_DESCRIPTION desc {};
+	memset(&desc,0,sizeof(desc));
+	desc.pluginsdkversion = FMOD_PLUGIN_SDK_VERSION;
+	strncpy(desc.name,name.c_str(),sizeof(desc.name) -1);
+	desc.numinputbuffers = 1;
+	desc.numoutputbuffers = 1;
+	desc.userdata = dsp.get();
+	desc.read = [](FMOD_DSP_STATE *state,float *inBuffer,float *outBuffer,uint32_t length,int32_t inChannels,int32_t *outChannels) -> FMOD_RESULT {
+		void *userData = nullptr;
+		state->functions->getuserdata(state,&userData);
+		auto *dsp = static_cast<FMCustomDsp*>(userData);
+		if(dsp == nullptr || *outChannels != inChannels)
+		{
+			memcpy(outBuffer,inBuffer,length *inChannels *sizeof(float));
+			return FMOD_RESULT::FMOD_OK;
+		}
+		dsp->Process(inBuffer,outBuffer,length,inChannels);
+		return FMOD_RESULT::FMOD_OK;
+	};
+	auto r = system.createDSP(&desc,&dsp->m_dsp);
+	al::check_result(r);
+	if(r != FMOD_OK)
+	{
+		dsp->m_dsp = nullptr;
+		return nullptr;
+	}
+	return dsp;
+}
+al::FMCustomDsp::~FMCustomDsp()
+{
+	// Releasing the DSP first guarantees that the mixer isn't using the processor anymore
+	if(m_dsp != nullptr)
+		m_dsp->release();
+}
+FMOD::DSP *al::FMCustomDsp::GetFMODDsp() {return m_dsp;}
+al::FMDspProcessor &al::FMCustomDsp::GetProcessor() {return *m_processor;}
+void al::FMCustomDsp::Process(const float *in,float *out,uint32_t numFrames,int32_t numChannels)
+{
+	for(auto offset=0u;offset<numFrames;offset+=MAX_BLOCK_FRAMES)
+	{
+		auto count = umath::min(numFrames -offset,MAX_BLOCK_FRAMES);
+		m_read(*m_processor,in +offset *numChannels,out +offset *numChannels,count,numChannels);
+	}
+}
@@ -0,0 +1,147 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_CUSTOM_DSP_HPP__
+#define __FMOD_CUSTOM_DSP_HPP__
+
+#include <cinttypes>
+#include <memory>
+#include <string>
+#include <mutex>
+#include <cstring>
+
+namespace FMOD
+{
+	class System;
+	class DSP;
+};
+namespace al
+{
+	class FMDspProcessor
+	{
+	public:
+		virtual ~FMDspProcessor()=default;
+		// Called once before the DSP is created
+		virtual void Initialize(uint32_t frequency) {m_frequency = frequency;}
+		uint32_t GetFrequency() const {return m_frequency;}
+	protected:
+		uint32_t m_frequency = 0u;
+	};
+
+	// Hands parameters from the main thread to the mixer thread without ever blocking the mixer
+	template<typename TParameters>
+		class FMDspParameters
+	{
+	public:
+		void Set(const TParameters &params)
+		{
+			std::unique_lock<std::mutex> lock {m_mutex};
+			m_pending = params;
+			m_bPending = true;
+		}
+		// Mixer thread; returns false if there are no new parameters (or they're currently being written)
+		bool Fetch(TParameters &outParams)
+		{
+			std::unique_lock<std::mutex> lock {m_mutex,std::try_to_lock};
+			if(lock.owns_lock() == false || m_bPending == false)
+				return false;
+			outParams = m_pending;
+			m_bPending = false;
+			return true;
+		}
+	private:
+		std::mutex m_mutex;
+		TParameters m_pending = {};
+		bool m_bPending = false;
+	};
+
+	// Linear ramp of a parameter across one block, so parameter changes never cause zipper noise
+	class FMDspRamp
+	{
+	public:
+		void SetTarget(float target)
+		{
+			m_target = target;
+			if(m_bInitialized)
+				return;
+			m_current = target;
+			m_bInitialized = true;
+		}
+		// Returns the value at the start of the block and the per-frame increment that reaches the target at its end
+		float Begin(uint32_t numFrames,float &outStep)
+		{
+			auto start = m_current;
+			outStep = (numFrames > 0u) ? ((m_target -m_current) /static_cast<float>(numFrames)) : 0.f;
+			m_current = m_target;
+			return start;
+		}
+		float GetTarget() const {return m_target;}
+	private:
+		float m_current = 0.f;
+		float m_target = 0.f;
+		bool m_bInitialized = false;
+	};
+
+	// Wraps a processor in an FMOD DSP (FMOD_DSP_DESCRIPTION). A processor implements
+	//   template<uint32_t TChannels> void Process(const float *in,float *out,uint32_t numFrames);
+	// which is instantiated for the common channel counts of the mixer, so the per-channel loops have a constant trip
+	// count and can be unrolled and vectorized. Other channel counts are passed through unchanged.
+	// Process() is never called with more than MAX_BLOCK_FRAMES frames, so scratch buffers can be allocated up front.
+	class FMCustomDsp
+	{
+	public:
+		static constexpr uint32_t MAX_BLOCK_FRAMES = 1'024u;
+		static constexpr uint32_t MAX_CHANNELS = 8u;
+		using ReadCallback = void(*)(FMDspProcessor&,const float*,float*,uint32_t,int32_t);
+		template<class TProcessor>
+			static std::shared_ptr<FMCustomDsp> Create(FMOD::System &system,const std::string &name,uint32_t frequency,std::unique_ptr<TProcessor> processor);
+		~FMCustomDsp();
+
+		FMOD::DSP *GetFMODDsp();
+		FMDspProcessor &GetProcessor();
+		// Runs the processor directly instead of through FMOD's mixer (e.g. for benchmarks); must not be called while
+		// the DSP is part of an active DSP graph
+		void Process(const float *in,float *out,uint32_t numFrames,int32_t numChannels);
+	private:
+		static std::shared_ptr<FMCustomDsp> Create(FMOD::System &system,const std::string &name,uint32_t frequency,std::unique_ptr<FMDspProcessor> processor,ReadCallback read);
+		template<class TProcessor>
+			static void Dispatch(FMDspProcessor &processor,const float *in,float *out,uint32_t numFrames,int32_t numChannels);
+		FMCustomDsp()=default;
+		FMOD::DSP *m_dsp = nullptr;
+		std::unique_ptr<FMDspProcessor> m_processor = nullptr;
+		ReadCallback m_read = nullptr;
+	};
+};
+
+template<class TProcessor>
+	std::shared_ptr<al::FMCustomDsp> al::FMCustomDsp::Create(FMOD::System &system,const std::string &name,uint32_t frequency,std::unique_ptr<TProcessor> processor)
+{
+	return Create(system,name,frequency,std::unique_ptr<FMDspProcessor>{processor.release()},&Dispatch<TProcessor>);
+}
+
+template<class TProcessor>
+	void al::FMCustomDsp::Dispatch(FMDspProcessor &processor,const float *in,float *out,uint32_t numFrames,int32_t numChannels)
+{
+	auto &p = static_cast<TProcessor&>(processor);
+	switch(numChannels)
+	{
+		case 1:
+			p.template Process<1>(in,out,numFrames);
+			break;
+		case 2:
+			p.template Process<2>(in,out,numFrames);
+			break;
+		case 6:
+			p.template Process<6>(in,out,numFrames);
+			break;
+		case 8:
+			p.template Process<8>(in,out,numFrames);
+			break;
+		default:
+			memcpy(out,in,numFrames *numChannels *sizeof(float));
+			break;
+	}
+}
+
+#endif
@@ -0,0 +1,367 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_decoder.hpp"
+#include "fmod_sound_system.hpp"
+#include <fmod_studio.hpp>
+#include <samplerate.h>
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <limits>
+
+// Number of source frames that are decoded at a time
+static constexpr uint32_t DECODE_CHUNK_FRAMES = 2'048u;
+
+al::FMDecoder::FMDecoder(FMSoundSystem &system)
+	: m_system{system}
+{}
+
+al::FMDecoder::~FMDecoder()
+{
+	// The playback stream calls back into this decoder, so it has to be released first
+	m_playbackSound = nullptr;
+	m_sourceSound = nullptr;
+	if(m_resampler != nullptr)
+		src_delete(m_resampler);
+}
+
+std::shared_ptr<al::FMDecoder> al::FMDecoder::Create(FMSoundSystem &system,const std::string &path,bool bConvertToMono)
+{
+	auto decoder = std::shared_ptr<FMDecoder>{new FMDecoder{system}};
+	decoder->m_self = decoder;
+	auto &fmSystem = system.GetFMODLowLevelSystem();
+	FMOD_CREATESOUNDEXINFO exInfo {};
+	memset(&exInfo,0,sizeof(exInfo));
+	exInfo.cbsize = sizeof(exInfo);
+	uint32_t mode = FMOD_CREATESTREAM | FMOD_OPENONLY;
+	auto *nameOrData = system.GetFileSystem().PrepareSound(path,mode,exInfo,decoder->m_fileData);
+	FMOD::Sound *sound = nullptr;
+	auto r = fmSystem.createSound(nameOrData,mode,&exInfo,&sound);
+	al::check_result(r);
+	if(r != FMOD_OK || sound == nullptr)
+		return nullptr;
+	decoder->m_sourceSound = std::shared_ptr<FMOD::Sound>(sound,[](FMOD::Sound *sound) {
+		al::check_result(sound->release());
+	});
+
+	FMOD_SOUND_TYPE type;
+	FMOD_SOUND_FORMAT format;
+	int32_t channels;
+	int32_t bits;
+	float frequency;
+	auto length = 0u;
+	if(sound->getFormat(&type,&format,&channels,&bits) != FMOD_OK || sound->getDefaults(&frequency,nullptr) != FMOD_OK || channels <= 0)
+		return nullptr;
+	switch(format)
+	{
+		case FMOD_SOUND_FORMAT_PCM8:
+		case FMOD_SOUND_FORMAT_PCM16:
+		case FMOD_SOUND_FORMAT_PCM24:
+		case FMOD_SOUND_FORMAT_PCM32:
+		case FMOD_SOUND_FORMAT_PCMFLOAT:
+			break;
+		default:
+			return nullptr;
+	}
+	al::check_result(sound->getLength(&length,FMOD_TIMEUNIT_PCM));
+	decoder->m_sourceChannels = channels;
+	decoder->m_sourceFormat = format;
+	decoder->m_sourceBytesPerSample = bits /8;
+	decoder->m_sourceLength = length;
+	// Surround sources are folded down to stereo, since that's the widest channel config a decoder can report
+	decoder->m_channels = bConvertToMono ? 1u : umath::min(static_cast<uint32_t>(channels),2u);
+	if(decoder->InitializeResampler(static_cast<uint32_t>(frequency)) == false || decoder->InitializePlayback() == false)
+		return nullptr;
+	return decoder;
+}
+
+std::shared_ptr<al::FMDecoder> al::FMDecoder::Create(FMSoundSystem &system,const Generator &generator,uint32_t frequency,uint32_t numChannels)
+{
+	if(generator == nullptr || numChannels == 0u || frequency == 0u)
+		return nullptr;
+	auto decoder = std::shared_ptr<FMDecoder>{new FMDecoder{system}};
+	decoder->m_self = decoder;
+	decoder->m_generator = generator;
+	decoder->m_sourceChannels = numChannels;
+	decoder->m_sourceFormat = FMOD_SOUND_FORMAT_PCMFLOAT;
+	decoder->m_sourceBytesPerSample = sizeof(float);
+	decoder->m_channels = umath::min(numChannels,2u);
+	if(decoder->InitializeResampler(frequency) == false || decoder->InitializePlayback() == false)
+		return nullptr;
+	return decoder;
+}
+
+bool al::FMDecoder::InitializeResampler(uint32_t sourceFrequency)
+{
+	auto outputFrequency = 0;
+	al::check_result(m_system.GetFMODLowLevelSystem().getSoftwareFormat(&outputFrequency,nullptr,nullptr));
+	m_frequency = (outputFrequency > 0) ? static_cast<uint32_t>(outputFrequency) : sourceFrequency;
+	m_ratio = static_cast<double>(m_frequency) /static_cast<double>(sourceFrequency);
+	m_floatBuffer.resize(DECODE_CHUNK_FRAMES *m_sourceChannels);
+	auto maxOutputFrames = static_cast<uint32_t>(std::ceil(DECODE_CHUNK_FRAMES *m_ratio)) +64u;
+	m_resampleBuffer.resize(maxOutputFrames *m_channels);
+	// Every chunk is fully drained before the next one is decoded, so a few chunks are enough
+	m_ring.resize(maxOutputFrames *4u *m_channels);
+	if(sourceFrequency == m_frequency)
+		return true;
+	auto err = 0;
+	m_resampler = src_new(SRC_SINC_FASTEST,static_cast<int>(m_channels),&err);
+	if(m_resampler == nullptr)
+	{
+		std::cout<<"[FMOD] Unable to create resampler: "<<src_strerror(err)<<std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool al::FMDecoder::InitializePlayback()
+{
+	FMOD_CREATESOUNDEXINFO exInfo {};
+	memset(&exInfo,0,sizeof(exInfo));
+	exInfo.cbsize = sizeof(exInfo);
+	exInfo.numchannels = m_channels;
+	exInfo.defaultfrequency = m_frequency;
+	exInfo.format = FMOD_SOUND_FORMAT_PCMFLOAT;
+	exInfo.decodebuffersize = DECODE_CHUNK_FRAMES;
+	// Procedural sources have no known length
+	auto byteLength = GetLength() *m_channels *sizeof(float);
+	exInfo.length = (m_generator == nullptr && byteLength > 0ull && byteLength < std::numeric_limits<uint32_t>::max()) ? static_cast<uint32_t>(byteLength) : std::numeric_limits<uint32_t>::max();
+	exInfo.userdata = this;
+	exInfo.pcmreadcallback = [](FMOD_SOUND *sound,void *data,uint32_t dataLen) -> FMOD_RESULT {
+		void *userData = nullptr;
+		reinterpret_cast<FMOD::Sound*>(sound)->getUserData(&userData);
+		auto *decoder = static_cast<FMDecoder*>(userData);
+		if(decoder == nullptr)
+			return FMOD_RESULT::FMOD_OK;
+		auto frameSize = decoder->m_channels *sizeof(float);
+		auto numFrames = dataLen /frameSize;
+		auto numRead = decoder->Read(data,numFrames);
+		// Silence after the end of the stream
+		memset(static_cast<uint8_t*>(data) +numRead *frameSize,0,(numFrames -numRead) *frameSize);
+		return FMOD_RESULT::FMOD_OK;
+	};
+	exInfo.pcmsetposcallback = [](FMOD_SOUND *sound,int32_t subSound,uint32_t position,FMOD_TIMEUNIT posType) -> FMOD_RESULT {
+		void *userData = nullptr;
+		reinterpret_cast<FMOD::Sound*>(sound)->getUserData(&userData);
+		auto *decoder = static_cast<FMDecoder*>(userData);
+		if(decoder == nullptr || posType != FMOD_TIMEUNIT_PCM)
+			return FMOD_RESULT::FMOD_OK;
+		decoder->Seek(position);
+		return FMOD_RESULT::FMOD_OK;
+	};
+	FMOD::Sound *sound = nullptr;
+	auto r = m_system.GetFMODLowLevelSystem().createSound(nullptr,FMOD_OPENUSER | FMOD_CREATESTREAM,&exInfo,&sound);
+	al::check_result(r);
+	if(r != FMOD_OK || sound == nullptr)
+		return false;
+	m_playbackSound = std::shared_ptr<FMOD::Sound>(sound,[](FMOD::Sound *sound) {
+		al::check_result(sound->release());
+	});
+	m_channelDefaults = get_channel_defaults(*sound);
+	return true;
+}
+
+uint32_t al::FMDecoder::GetFrequency() const {return m_frequency;}
+al::ChannelConfig al::FMDecoder::GetChannelConfig() const {return (m_channels == 1u) ? al::ChannelConfig::Mono : al::ChannelConfig::Stereo;}
+al::SampleType al::FMDecoder::GetSampleType() const {return al::SampleType::Float32;}
+uint64_t al::FMDecoder::GetLength() const {return static_cast<uint64_t>(std::round(m_sourceLength *m_ratio));}
+std::pair<uint64_t,uint64_t> al::FMDecoder::GetLoopPoints() const {return {0ull,GetLength()};}
+uint32_t al::FMDecoder::GetNumChannels() const {return m_channels;}
+bool al::FMDecoder::IsSeekable() const {return m_generator == nullptr;}
+std::shared_ptr<al::FMDecoder> al::FMDecoder::GetSharedPtr() {return m_self.lock();}
+const FMOD::Sound *al::FMDecoder::GetFMODSound() const {return const_cast<FMDecoder*>(this)->GetFMODSound();}
+FMOD::Sound *al::FMDecoder::GetFMODSound() {return m_playbackSound.get();}
+const al::FMChannelDefaults &al::FMDecoder::GetChannelDefaults() const {return m_channelDefaults;}
+
+bool al::FMDecoder::Seek(uint64_t pos)
+{
+	std::unique_lock<std::mutex> lock {m_mutex};
+	if(m_sourceSound == nullptr)
+		return false; // Procedural sources can't be seeked
+	auto sourcePos = static_cast<uint64_t>(pos /m_ratio);
+	if(sourcePos > m_sourceLength)
+		return false;
+	if(m_sourceSound->seekData(static_cast<uint32_t>(sourcePos)) != FMOD_OK)
+		return false;
+	if(m_resampler != nullptr)
+		src_reset(m_resampler);
+	m_ringRead = 0u;
+	m_ringCount = 0u;
+	m_bSourceEnded = false;
+	m_bEnded = false;
+	return true;
+}
+
+uint32_t al::FMDecoder::Read(void *ptr,uint32_t count)
+{
+	std::unique_lock<std::mutex> lock {m_mutex};
+	auto *out = static_cast<float*>(ptr);
+	auto numRead = 0u;
+	while(numRead < count)
+	{
+		if(m_ringCount == 0u && Fill() == false)
+			break;
+		numRead += ReadRing(out +numRead *m_channels,count -numRead);
+	}
+	return numRead;
+}
+
+uint32_t al::FMDecoder::ReadSource(uint32_t frames)
+{
+	if(m_bSourceEnded)
+		return 0u;
+	if(m_generator != nullptr)
+	{
+		auto numFrames = m_generator(m_floatBuffer.data(),frames);
+		if(numFrames == 0u)
+			m_bSourceEnded = true;
+		return numFrames;
+	}
+	auto frameSize = m_sourceChannels *m_sourceBytesPerSample;
+	m_rawBuffer.resize(frames *frameSize);
+	auto numBytes = 0u;
+	auto r = m_sourceSound->readData(m_rawBuffer.data(),static_cast<uint32_t>(m_rawBuffer.size()),&numBytes);
+	if(r != FMOD_OK)
+	{
+		if(r != FMOD_ERR_FILE_EOF)
+			al::check_result(r);
+		m_bSourceEnded = true;
+	}
+	auto numFrames = numBytes /frameSize;
+	auto numSamples = numFrames *m_sourceChannels;
+	auto *in = m_rawBuffer.data();
+	auto *out = m_floatBuffer.data();
+	switch(m_sourceFormat)
+	{
+		case FMOD_SOUND_FORMAT_PCM8:
+			for(auto i=decltype(numSamples){0u};i<numSamples;++i)
+				out[i] = reinterpret_cast<const int8_t*>(in)[i] /128.f;
+			break;
+		case FMOD_SOUND_FORMAT_PCM16:
+			src_short_to_float_array(reinterpret_cast<const short*>(in),out,static_cast<int>(numSamples));
+			break;
+		case FMOD_SOUND_FORMAT_PCM24:
+			for(auto i=decltype(numSamples){0u};i<numSamples;++i)
+			{
+				auto *s = in +i *3u;
+				auto v = static_cast<int32_t>((static_cast<uint32_t>(s[0])<<8) | (static_cast<uint32_t>(s[1])<<16) | (static_cast<uint32_t>(s[2])<<24));
+				out[i] = (v >>8) /8'388'608.f;
+			}
+			break;
+		case FMOD_SOUND_FORMAT_PCM32:
+			src_int_to_float_array(reinterpret_cast<const int*>(in),out,static_cast<int>(numSamples));
+			break;
+		case FMOD_SOUND_FORMAT_PCMFLOAT:
+			memcpy(out,in,numSamples *sizeof(float));
+			break;
+	}
+	return numFrames;
+}
+
+void al::FMDecoder::Downmix(uint32_t frames)
+{
+	auto srcChannels = m_sourceChannels;
+	if(srcChannels == m_channels)
+		return;
+	// In-place; every output frame is written at or before the input frame it's read from
+	auto *__restrict data = m_floatBuffer.data();
+	if(m_channels == 1u)
+	{
+		auto scale = 1.f /srcChannels;
+		for(auto i=decltype(frames){0u};i<frames;++i)
+		{
+			auto *frame = data +i *srcChannels;
+			auto sum = 0.f;
+			for(auto c=decltype(srcChannels){0u};c<srcChannels;++c)
+				sum += frame[c];
+			data[i] = sum *scale;
+		}
+		return;
+	}
+	// Surround to stereo: the front pair is kept and the remaining channels are spread across both sides
+	auto extraScale = 0.5f /(srcChannels -2u);
+	for(auto i=decltype(frames){0u};i<frames;++i)
+	{
+		auto *frame = data +i *srcChannels;
+		auto extra = 0.f;
+		for(auto c=decltype(srcChannels){2u};c<srcChannels;++c)
+			extra += frame[c];
+		extra *= extraScale;
+		auto l = frame[0] +extra;
+		auto r = frame[1] +extra;
+		data[i *2u] = l;
+		data[i *2u +1u] = r;
+	}
+}
+
+bool al::FMDecoder::Fill()
+{
+	if(m_bEnded)
+		return false;
+	auto numFrames = ReadSource(DECODE_CHUNK_FRAMES);
+	Downmix(numFrames);
+	if(m_resampler == nullptr)
+	{
+		WriteRing(m_floatBuffer.data(),numFrames);
+		if(m_bSourceEnded)
+			m_bEnded = true;
+		return numFrames > 0u || m_bEnded == false;
+	}
+	SRC_DATA data {};
+	data.data_in = m_floatBuffer.data();
+	data.input_frames = numFrames;
+	data.src_ratio = m_ratio;
+	data.end_of_input = m_bSourceEnded ? 1 : 0;
+	auto numWritten = 0u;
+	for(;;)
+	{
+		data.data_out = m_resampleBuffer.data();
+		data.output_frames = static_cast<long>(m_resampleBuffer.size() /m_channels);
+		auto err = src_process(m_resampler,&data);
+		if(err != 0)
+		{
+			std::cout<<"[FMOD] Resampling failed: "<<src_strerror(err)<<std::endl;
+			m_bEnded = true;
+			break;
+		}
+		WriteRing(m_resampleBuffer.data(),static_cast<uint32_t>(data.output_frames_gen));
+		numWritten += data.output_frames_gen;
+		data.data_in += data.input_frames_used *m_channels;
+		data.input_frames -= data.input_frames_used;
+		if(data.input_frames_used == 0 && data.output_frames_gen == 0)
+		{
+			// The resampler has been flushed completely
+			if(m_bSourceEnded)
+				m_bEnded = true;
+			break;
+		}
+		if(data.input_frames == 0 && data.end_of_input == 0)
+			break;
+	}
+	return numWritten > 0u || m_bEnded == false;
+}
+
+void al::FMDecoder::WriteRing(const float *data,uint32_t frames)
+{
+	auto capacity = static_cast<uint32_t>(m_ring.size() /m_channels);
+	frames = umath::min(frames,capacity -m_ringCount);
+	auto writePos = (m_ringRead +m_ringCount) %capacity;
+	auto first = umath::min(frames,capacity -writePos);
+	memcpy(m_ring.data() +writePos *m_channels,data,first *m_channels *sizeof(float));
+	memcpy(m_ring.data(),data +first *m_channels,(frames -first) *m_channels *sizeof(float));
+	m_ringCount += frames;
+}
+
+uint32_t al::FMDecoder::ReadRing(float *out,uint32_t frames)
+{
+	auto capacity = static_cast<uint32_t>(m_ring.size() /m_channels);
+	frames = umath::min(frames,m_ringCount);
+	auto first = umath::min(frames,capacity -m_ringRead);
+	memcpy(out,m_ring.data() +m_ringRead *m_channels,first *m_channels *sizeof(float));
+	memcpy(out +first *m_channels,m_ring.data(),(frames -first) *m_channels *sizeof(float));
+	m_ringRead = (m_ringRead +frames) %capacity;
+	m_ringCount -= frames;
+	return frames;
+}
@@ -0,0 +1,98 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_DECODER_HPP__
+#define __FMOD_DECODER_HPP__
+
+#include <alsound_decoder.hpp>
+#include "fmod_sound_buffer.hpp"
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <functional>
+
+namespace FMOD
+{
+	class Sound;
+};
+struct SRC_STATE_tag;
+namespace al
+{
+	class FMSoundSystem;
+	// Incrementally decodes a sound (or generates procedural audio) into a fixed-size ring buffer. The output is always
+	// 32-bit float at the mixer sample rate; other rates are converted with libsamplerate and the channels can optionally
+	// be downmixed to mono. Channels created from a decoder play it through an FMOD_OPENUSER stream, so nothing is
+	// decoded ahead of playback.
+	class FMDecoder
+		: public Decoder
+	{
+	public:
+		// Writes up to 'frames' interleaved float frames and returns the number of frames written; 0 ends the stream
+		using Generator = std::function<uint32_t(float*,uint32_t)>;
+
+		static std::shared_ptr<FMDecoder> Create(FMSoundSystem &system,const std::string &path,bool bConvertToMono=false);
+		static std::shared_ptr<FMDecoder> Create(FMSoundSystem &system,const Generator &generator,uint32_t frequency,uint32_t numChannels);
+		virtual ~FMDecoder() override;
+
+		virtual uint32_t GetFrequency() const override;
+		virtual ChannelConfig GetChannelConfig() const override;
+		virtual SampleType GetSampleType() const override;
+		virtual uint64_t GetLength() const override;
+		virtual bool Seek(uint64_t pos) override;
+		virtual std::pair<uint64_t,uint64_t> GetLoopPoints() const override;
+		virtual uint32_t Read(void *ptr,uint32_t count) override;
+
+		uint32_t GetNumChannels() const;
+		// Procedural sources (generators) can only be played forward, so channels can't be moved to a different offset
+		bool IsSeekable() const;
+		// Channels keep their decoder alive through this
+		std::shared_ptr<FMDecoder> GetSharedPtr();
+		// FMOD_OPENUSER stream that pulls its data from this decoder
+		const FMOD::Sound *GetFMODSound() const;
+		FMOD::Sound *GetFMODSound();
+		const FMChannelDefaults &GetChannelDefaults() const;
+	private:
+		FMDecoder(FMSoundSystem &system);
+		bool InitializeResampler(uint32_t sourceFrequency);
+		bool InitializePlayback();
+		uint32_t ReadSource(uint32_t frames);
+		void Downmix(uint32_t frames);
+		// Decodes and resamples the next chunk into the ring buffer; returns false once the stream has ended
+		bool Fill();
+		void WriteRing(const float *data,uint32_t frames);
+		uint32_t ReadRing(float *out,uint32_t frames);
+
+		FMSoundSystem &m_system;
+		std::weak_ptr<FMDecoder> m_self = {};
+		std::mutex m_mutex;
+		// Source
+		std::shared_ptr<std::vector<uint8_t>> m_fileData = nullptr;
+		std::shared_ptr<FMOD::Sound> m_sourceSound = nullptr;
+		Generator m_generator = nullptr;
+		uint32_t m_sourceChannels = 0u;
+		uint32_t m_sourceFormat = 0u; // FMOD_SOUND_FORMAT
+		uint32_t m_sourceBytesPerSample = 0u;
+		uint64_t m_sourceLength = 0ull;
+		bool m_bSourceEnded = false;
+		// Output
+		std::shared_ptr<FMOD::Sound> m_playbackSound = nullptr;
+		FMChannelDefaults m_channelDefaults = {};
+		uint32_t m_frequency = 0u;
+		uint32_t m_channels = 0u;
+		bool m_bEnded = false;
+		// Resampling
+		SRC_STATE_tag *m_resampler = nullptr;
+		double m_ratio = 1.0;
+		// Scratch buffers for a single chunk
+		std::vector<uint8_t> m_rawBuffer = {};
+		std::vector<float> m_floatBuffer = {};
+		std::vector<float> m_resampleBuffer = {};
+		// Ring buffer of decoded output frames
+		std::vector<float> m_ring = {};
+		uint32_t m_ringRead = 0u;
+		uint32_t m_ringCount = 0u;
+	};
+};
+
+#endif
@@ -0,0 +1,462 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_dsp_effects.hpp"
+#include "fmod_sound_system.hpp"
+#include <fmod_studio.hpp>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define FMDSP_SSE
+#endif
+
+namespace
+{
+	constexpr float PI = 3.14159265358979323846f;
+	// Filter coefficients of the modulated effects are recalculated every CONTROL_FRAMES frames and interpolated in between
+	constexpr uint32_t CONTROL_FRAMES = 32u;
+
+	// Parabolic approximation of sin(2 *pi *t) for t in [0,1), the error is below 0.001
+	float sine_turns(float t)
+	{
+		auto y = t -0.5f;
+		auto p = 8.f *y -16.f *y *std::abs(y);
+		p += 0.225f *(p *std::abs(p) -p);
+		return -p;
+	}
+	float waveform_sample(al::FMWaveform waveform,float t)
+	{
+		switch(waveform)
+		{
+			case al::FMWaveform::Triangle:
+				return 4.f *std::abs(t -0.5f) -1.f;
+			case al::FMWaveform::Sawtooth:
+				return 2.f *t -1.f;
+			case al::FMWaveform::Square:
+				return (t < 0.5f) ? 1.f : -1.f;
+			default:
+				return sine_turns(t);
+		}
+	}
+	// Writes the phase (in turns) of every frame; the increment changes linearly by step per frame
+	float advance_phases(float phase,float increment,float step,float *outPhases,uint32_t numFrames)
+	{
+		for(auto i=0u;i<numFrames;++i)
+		{
+			outPhases[i] = phase;
+			phase += increment;
+			increment += step;
+			if(phase >= 1.f)
+				phase -= std::floor(phase);
+		}
+		return phase;
+	}
+	// Evaluates the waveform at every phase shifted by offset (in turns, [0,1))
+	void evaluate_waveform(al::FMWaveform waveform,const float *phases,float offset,float *out,uint32_t numFrames)
+	{
+		auto i = 0u;
+#if defined(FMDSP_SSE)
+		auto one = _mm_set1_ps(1.f);
+		auto half = _mm_set1_ps(0.5f);
+		auto absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		auto vOffset = _mm_set1_ps(offset);
+		for(;i +4u<=numFrames;i+=4u)
+		{
+			auto t = _mm_add_ps(_mm_loadu_ps(phases +i),vOffset);
+			t = _mm_sub_ps(t,_mm_and_ps(_mm_cmpge_ps(t,one),one));
+			__m128 r;
+			switch(waveform)
+			{
+				case al::FMWaveform::Triangle:
+					r = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(4.f),_mm_and_ps(_mm_sub_ps(t,half),absMask)),one);
+					break;
+				case al::FMWaveform::Sawtooth:
+					r = _mm_sub_ps(_mm_add_ps(t,t),one);
+					break;
+				case al::FMWaveform::Square:
+					r = _mm_sub_ps(one,_mm_and_ps(_mm_cmpge_ps(t,half),_mm_set1_ps(2.f)));
+					break;
+				default:
+				{
+					auto y = _mm_sub_ps(t,half);
+					auto p = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(8.f),y),_mm_mul_ps(_mm_set1_ps(16.f),_mm_mul_ps(y,_mm_and_ps(y,absMask))));
+					p = _mm_add_ps(p,_mm_mul_ps(_mm_set1_ps(0.225f),_mm_sub_ps(_mm_mul_ps(p,_mm_and_ps(p,absMask)),p)));
+					r = _mm_sub_ps(_mm_setzero_ps(),p);
+					break;
+				}
+			}
+			_mm_storeu_ps(out +i,r);
+		}
+#endif
+		for(;i<numFrames;++i)
+		{
+			auto t = phases[i] +offset;
+			if(t >= 1.f)
+				t -= 1.f;
+			out[i] = waveform_sample(waveform,t);
+		}
+	}
+	void multiply(const float *a,const float *b,float *out,uint32_t count)
+	{
+		auto i = 0u;
+#if defined(FMDSP_SSE)
+		for(;i +4u<=count;i+=4u)
+			_mm_storeu_ps(out +i,_mm_mul_ps(_mm_loadu_ps(a +i),_mm_loadu_ps(b +i)));
+#endif
+		for(;i<count;++i)
+			out[i] = a[i] *b[i];
+	}
+	void multiply_add(const float *a,const float *ga,const float *b,const float *gb,float *out,uint32_t count)
+	{
+		auto i = 0u;
+#if defined(FMDSP_SSE)
+		for(;i +4u<=count;i+=4u)
+		{
+			auto va = _mm_mul_ps(_mm_loadu_ps(a +i),_mm_loadu_ps(ga +i));
+			auto vb = _mm_mul_ps(_mm_loadu_ps(b +i),_mm_loadu_ps(gb +i));
+			_mm_storeu_ps(out +i,_mm_add_ps(va,vb));
+		}
+#endif
+		for(;i<count;++i)
+			out[i] = a[i] *ga[i] +b[i] *gb[i];
+	}
+	// Repeats a per-frame value for every channel so it can be applied to the interleaved samples in one pass
+	template<uint32_t TChannels>
+		const float *expand_frames(const float *perFrame,float *scratch,uint32_t numFrames)
+	{
+		if constexpr(TChannels == 1u)
+			return perFrame;
+		else
+		{
+			for(auto f=0u;f<numFrames;++f)
+			{
+				for(auto c=0u;c<TChannels;++c)
+					scratch[f *TChannels +c] = perFrame[f];
+			}
+			return scratch;
+		}
+	}
+
+	// Zero-delay feedback state-variable filter; coefficients are {a1,a2,a3,k}
+	std::array<float,4> calc_bandpass_coefficients(float cutoff,float q,float frequency)
+	{
+		auto g = std::tan(PI *umath::clamp(cutoff /frequency,0.0001f,0.49f));
+		auto k = 1.f /q;
+		auto a1 = 1.f /(1.f +g *(g +k));
+		auto a2 = g *a1;
+		return {a1,a2,g *a2,k};
+	}
+	// Returns the bandpass output normalized to unity gain at the center frequency
+	float process_bandpass(float x,std::array<float,2> &state,const std::array<float,4> &coefficients)
+	{
+		auto v3 = x -state[1];
+		auto v1 = coefficients[0] *state[0] +coefficients[1] *v3;
+		auto v2 = state[1] +coefficients[1] *state[0] +coefficients[2] *v3;
+		state[0] = 2.f *v1 -state[0];
+		state[1] = 2.f *v2 -state[1];
+		return coefficients[3] *v1;
+	}
+
+	// Allpass coefficients (squared) of the two Hilbert chains by Olli Niemitalo
+	constexpr std::array<float,4> HILBERT_REAL = {
+		0.6923878f *0.6923878f,0.9360654322959f *0.9360654322959f,0.9882295226860f *0.9882295226860f,0.9987488452737f *0.9987488452737f
+	};
+	constexpr std::array<float,4> HILBERT_IMAG = {
+		0.4021921162426f *0.4021921162426f,0.8561710882420f *0.8561710882420f,0.9722909545651f *0.9722909545651f,0.9952884791278f *0.9952884791278f
+	};
+	float process_allpass_chain(float x,std::array<std::array<float,4>,4> &stages,const std::array<float,4> &coefficients)
+	{
+		for(auto i=0u;i<stages.size();++i)
+		{
+			auto &s = stages[i];
+			auto y = coefficients[i] *(x +s[3]) -s[1];
+			s[1] = s[0];
+			s[0] = x;
+			s[3] = s[2];
+			s[2] = y;
+			x = y;
+		}
+		return x;
+	}
+
+	// F1-F3 in Hz; consonants use the neutral vowel
+	constexpr std::array<std::array<float,al::FMVocalMorpher::FORMANT_COUNT>,15> VOWEL_FORMANTS = {{
+		{800.f,1'150.f,2'900.f}, // A
+		{350.f,2'000.f,2'800.f}, // E
+		{270.f,2'140.f,2'950.f}, // I
+		{450.f,800.f,2'830.f}, // O
+		{325.f,700.f,2'700.f}, // U
+		{730.f,1'090.f,2'440.f}, // AA
+		{660.f,1'720.f,2'410.f}, // AE
+		{520.f,1'190.f,2'390.f}, // AH
+		{570.f,840.f,2'410.f}, // AO
+		{530.f,1'840.f,2'480.f}, // EH
+		{490.f,1'350.f,1'690.f}, // ER
+		{390.f,1'990.f,2'550.f}, // IH
+		{270.f,2'290.f,3'010.f}, // IY
+		{440.f,1'020.f,2'240.f}, // UH
+		{300.f,870.f,2'240.f} // UW
+	}};
+	constexpr std::array<float,al::FMVocalMorpher::FORMANT_COUNT> FORMANT_BANDWIDTHS = {80.f,100.f,120.f};
+	constexpr std::array<float,al::FMVocalMorpher::FORMANT_COUNT> FORMANT_GAINS = {1.f,0.6f,0.3f};
+	const std::array<float,al::FMVocalMorpher::FORMANT_COUNT> &get_formants(al::FMVocalMorpher::Phoneme phoneme)
+	{
+		auto idx = static_cast<size_t>(phoneme);
+		return VOWEL_FORMANTS[(idx < VOWEL_FORMANTS.size()) ? idx : static_cast<size_t>(al::FMVocalMorpher::Phoneme::AH)];
+	}
+};
+
+//////////////////////////
+
+std::shared_ptr<al::FMCustomDsp> al::FMRingModulator::Create(FMOD::System &system,uint32_t frequency)
+{
+	return FMCustomDsp::Create(system,"Ring Modulator",frequency,std::make_unique<FMRingModulator>());
+}
+void al::FMRingModulator::Initialize(uint32_t frequency)
+{
+	FMDspProcessor::Initialize(frequency);
+	m_phases.resize(FMCustomDsp::MAX_BLOCK_FRAMES);
+	m_modulator.resize(FMCustomDsp::MAX_BLOCK_FRAMES);
+	m_expanded.resize(FMCustomDsp::MAX_BLOCK_FRAMES *FMCustomDsp::MAX_CHANNELS);
+	ApplyParameters({});
+}
+void al::FMRingModulator::SetParameters(const Parameters &params) {m_pending.Set(params);}
+void al::FMRingModulator::ApplyParameters(const Parameters &params)
+{
+	m_waveform = params.waveform;
+	m_increment.SetTarget(params.frequency /static_cast<float>(m_frequency));
+	// One-pole highpass
+	m_highpass.SetTarget(1.f /(1.f +2.f *PI *params.highpassCutoff /static_cast<float>(m_frequency)));
+}
+template<uint32_t TChannels>
+	void al::FMRingModulator::Process(const float *in,float *out,uint32_t numFrames)
+{
+	Parameters params;
+	if(m_pending.Fetch(params))
+		ApplyParameters(params);
+	float incrementStep;
+	auto increment = m_increment.Begin(numFrames,incrementStep);
+	m_phase = advance_phases(m_phase,increment,incrementStep,m_phases.data(),numFrames);
+	evaluate_waveform(m_waveform,m_phases.data(),0.f,m_modulator.data(),numFrames);
+
+	float highpassStep;
+	auto highpass = m_highpass.Begin(numFrames,highpassStep);
+	for(auto f=0u;f<numFrames;++f)
+	{
+		for(auto c=0u;c<TChannels;++c)
+		{
+			auto x = in[f *TChannels +c];
+			auto y = highpass *(m_prevOut[c] +x -m_prevIn[c]);
+			m_prevIn[c] = x;
+			m_prevOut[c] = y;
+			out[f *TChannels +c] = y;
+		}
+		highpass += highpassStep;
+	}
+	auto *modulator = expand_frames<TChannels>(m_modulator.data(),m_expanded.data(),numFrames);
+	multiply(out,modulator,out,numFrames *TChannels);
+}
+
+//////////////////////////
+
+std::shared_ptr<al::FMCustomDsp> al::FMFrequencyShifter::Create(FMOD::System &system,uint32_t frequency)
+{
+	return FMCustomDsp::Create(system,"Frequency Shifter",frequency,std::make_unique<FMFrequencyShifter>());
+}
+void al::FMFrequencyShifter::Initialize(uint32_t frequency)
+{
+	FMDspProcessor::Initialize(frequency);
+	m_phases.resize(FMCustomDsp::MAX_BLOCK_FRAMES);
+	m_cos.resize(FMCustomDsp::MAX_BLOCK_FRAMES);
+	m_sin.resize(FMCustomDsp::MAX_BLOCK_FRAMES);
+	m_expandedCos.resize(FMCustomDsp::MAX_BLOCK_FRAMES *FMCustomDsp::MAX_CHANNELS);
+	m_expandedSin.resize(FMCustomDsp::MAX_BLOCK_FRAMES *FMCustomDsp::MAX_CHANNELS);
+	m_real.resize(FMCustomDsp::MAX_BLOCK_FRAMES *FMCustomDsp::MAX_CHANNELS);
+	m_imag.resize(FMCustomDsp::MAX_BLOCK_FRAMES *FMCustomDsp::MAX_CHANNELS);
+	m_increment.SetTarget(m_params.frequency /static_cast<float>(m_frequency));
+}
+void al::FMFrequencyShifter::SetParameters(const Parameters &params) {m_pending.Set(params);}
+template<uint32_t TChannels>
+	void al::FMFrequencyShifter::Process(const float *in,float *out,uint32_t numFrames)
+{
+	if(m_pending.Fetch(m_params))
+		m_increment.SetTarget(m_params.frequency /static_cast<float>(m_frequency));
+	float incrementStep;
+	auto increment = m_increment.Begin(numFrames,incrementStep);
+	m_phase = advance_phases(m_phase,increment,incrementStep,m_phases.data(),numFrames);
+	evaluate_waveform(FMWaveform::Sine,m_phases.data(),0.25f,m_cos.data(),numFrames);
+	evaluate_waveform(FMWaveform::Sine,m_phases.data(),0.f,m_sin.data(),numFrames);
+
+	// Odd channels are the right speakers in all of FMOD's speaker layouts
+	std::array<float,TChannels> signs;
+	auto anyOff = false;
+	for(auto c=0u;c<TChannels;++c)
+	{
+		auto dir = (c %2u == 0u) ? m_params.leftDirection : m_params.rightDirection;
+		// The imaginary chain lags the real one, so I *cos +Q *sin shifts up and I *cos -Q *sin shifts down
+		signs[c] = (dir == Direction::Up) ? 1.f : -1.f;
+		anyOff |= (dir == Direction::Off);
+	}
+	for(auto f=0u;f<numFrames;++f)
+	{
+		for(auto c=0u;c<TChannels;++c)
+		{
+			auto &hilbert = m_hilbert[c];
+			auto x = in[f *TChannels +c];
+			auto i = f *TChannels +c;
+			m_real[i] = hilbert.realDelay;
+			hilbert.realDelay = process_allpass_chain(x,hilbert.real,HILBERT_REAL);
+			m_imag[i] = signs[c] *process_allpass_chain(x,hilbert.imag,HILBERT_IMAG);
+		}
+	}
+	auto *vCos = expand_frames<TChannels>(m_cos.data(),m_expandedCos.data(),numFrames);
+	auto *vSin = expand_frames<TChannels>(m_sin.data(),m_expandedSin.data(),numFrames);
+	multiply_add(m_real.data(),vCos,m_imag.data(),vSin,out,numFrames *TChannels);
+	if(anyOff == false)
+		return;
+	for(auto c=0u;c<TChannels;++c)
+	{
+		auto dir = (c %2u == 0u) ? m_params.leftDirection : m_params.rightDirection;
+		if(dir != Direction::Off)
+			continue;
+		for(auto f=0u;f<numFrames;++f)
+			out[f *TChannels +c] = in[f *TChannels +c];
+	}
+}
+
+//////////////////////////
+
+std::shared_ptr<al::FMCustomDsp> al::FMAutoWah::Create(FMOD::System &system,uint32_t frequency)
+{
+	return FMCustomDsp::Create(system,"Auto Wah",frequency,std::make_unique<FMAutoWah>());
+}
+void al::FMAutoWah::Initialize(uint32_t frequency)
+{
+	FMDspProcessor::Initialize(frequency);
+	m_peakGain.SetTarget(m_params.peakGain);
+}
+void al::FMAutoWah::SetParameters(const Parameters &params) {m_pending.Set(params);}
+template<uint32_t TChannels>
+	void al::FMAutoWah::Process(const float *in,float *out,uint32_t numFrames)
+{
+	constexpr auto minCutoff = 20.f;
+	constexpr auto maxCutoff = 2'500.f;
+	if(m_pending.Fetch(m_params))
+		m_peakGain.SetTarget(umath::clamp(m_params.peakGain,0.00003f,31.62f)); // Limited to +30dB
+	auto frequency = static_cast<float>(m_frequency);
+	auto attack = std::exp(-1.f /(umath::max(m_params.attackTime,0.0001f) *frequency));
+	auto release = std::exp(-1.f /(umath::max(m_params.releaseTime,0.0001f) *frequency));
+	// EFX resonance ranges from 2 to 1000
+	auto q = umath::clamp(std::sqrt(m_params.resonance),0.7f,30.f);
+	float gainStep;
+	auto gain = m_peakGain.Begin(numFrames,gainStep);
+	for(auto offset=0u;offset<numFrames;offset+=CONTROL_FRAMES)
+	{
+		auto count = umath::min(numFrames -offset,CONTROL_FRAMES);
+		auto *blockIn = in +offset *TChannels;
+		auto *blockOut = out +offset *TChannels;
+		// Envelope at the end of the control block determines the target cutoff
+		for(auto f=0u;f<count;++f)
+		{
+			auto level = 0.f;
+			for(auto c=0u;c<TChannels;++c)
+				level += std::abs(blockIn[f *TChannels +c]);
+			level /= static_cast<float>(TChannels);
+			auto coefficient = (level > m_envelope) ? attack : release;
+			m_envelope = level +coefficient *(m_envelope -level);
+		}
+		auto env = umath::clamp(m_envelope,0.f,1.f);
+		auto target = calc_bandpass_coefficients(minCutoff *std::pow(maxCutoff /minCutoff,env),q,frequency);
+		if(m_bCoefficientsInitialized == false)
+		{
+			m_coefficients = target;
+			m_bCoefficientsInitialized = true;
+		}
+		std::array<float,4> step;
+		for(auto i=0u;i<step.size();++i)
+			step[i] = (target[i] -m_coefficients[i]) /static_cast<float>(count);
+		for(auto f=0u;f<count;++f)
+		{
+			for(auto i=0u;i<step.size();++i)
+				m_coefficients[i] += step[i];
+			// Peaking filter: the band around the cutoff is boosted by the peak gain
+			for(auto c=0u;c<TChannels;++c)
+			{
+				auto x = blockIn[f *TChannels +c];
+				blockOut[f *TChannels +c] = x +(gain -1.f) *process_bandpass(x,m_filter[c],m_coefficients);
+			}
+			gain += gainStep;
+		}
+		m_coefficients = target;
+	}
+}
+
+//////////////////////////
+
+std::shared_ptr<al::FMCustomDsp> al::FMVocalMorpher::Create(FMOD::System &system,uint32_t frequency)
+{
+	return FMCustomDsp::Create(system,"Vocal Morpher",frequency,std::make_unique<FMVocalMorpher>());
+}
+void al::FMVocalMorpher::SetParameters(const Parameters &params) {m_pending.Set(params);}
+template<uint32_t TChannels>
+	void al::FMVocalMorpher::Process(const float *in,float *out,uint32_t numFrames)
+{
+	m_pending.Fetch(m_params);
+	auto frequency = static_cast<float>(m_frequency);
+	auto increment = umath::max(m_params.rate,0.f) /frequency;
+	auto &formantsA = get_formants(m_params.phonemeA);
+	auto &formantsB = get_formants(m_params.phonemeB);
+	auto tuningA = std::exp2(static_cast<float>(m_params.phonemeACoarseTuning) /12.f);
+	auto tuningB = std::exp2(static_cast<float>(m_params.phonemeBCoarseTuning) /12.f);
+	for(auto offset=0u;offset<numFrames;offset+=CONTROL_FRAMES)
+	{
+		auto count = umath::min(numFrames -offset,CONTROL_FRAMES);
+		auto *blockIn = in +offset *TChannels;
+		auto *blockOut = out +offset *TChannels;
+		m_phase += increment *static_cast<float>(count);
+		m_phase -= std::floor(m_phase);
+		// Morph factor between phoneme A (0) and B (1)
+		auto morph = 0.5f +0.5f *waveform_sample(m_params.waveform,m_phase);
+
+		std::array<std::array<float,4>,FORMANT_COUNT> targets;
+		for(auto i=0u;i<FORMANT_COUNT;++i)
+		{
+			// Interpolated logarithmically, which is how the formants are perceived
+			auto fa = formantsA[i] *tuningA;
+			auto fb = formantsB[i] *tuningB;
+			auto cutoff = fa *std::pow(fb /fa,morph);
+			targets[i] = calc_bandpass_coefficients(cutoff,umath::max(cutoff /FORMANT_BANDWIDTHS[i],0.5f),frequency);
+			targets[i][3] *= FORMANT_GAINS[i];
+		}
+		if(m_bCoefficientsInitialized == false)
+		{
+			m_coefficients = targets;
+			m_bCoefficientsInitialized = true;
+		}
+		std::array<std::array<float,4>,FORMANT_COUNT> steps;
+		for(auto i=0u;i<FORMANT_COUNT;++i)
+		{
+			for(auto j=0u;j<4u;++j)
+				steps[i][j] = (targets[i][j] -m_coefficients[i][j]) /static_cast<float>(count);
+		}
+		for(auto f=0u;f<count;++f)
+		{
+			for(auto i=0u;i<FORMANT_COUNT;++i)
+			{
+				for(auto j=0u;j<4u;++j)
+					m_coefficients[i][j] += steps[i][j];
+			}
+			for(auto c=0u;c<TChannels;++c)
+			{
+				auto x = blockIn[f *TChannels +c];
+				auto y = 0.f;
+				for(auto i=0u;i<FORMANT_COUNT;++i)
+					y += process_bandpass(x,m_filters[c][i],m_coefficients[i]);
+				blockOut[f *TChannels +c] = y;
+			}
+		}
+		m_coefficients = targets;
+	}
+}
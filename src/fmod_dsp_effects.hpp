@@ -0,0 +1,161 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_DSP_EFFECTS_HPP__
+#define __FMOD_DSP_EFFECTS_HPP__
+
+#include "fmod_custom_dsp.hpp"
+#include <array>
+#include <vector>
+
+namespace al
+{
+	// Effects FMOD has no built-in DSP for. Parameters can be set from any thread at any rate, the DSPs ramp towards
+	// them over one mixer block.
+	enum class FMWaveform : uint8_t
+	{
+		Sine = 0u,
+		Triangle,
+		Sawtooth,
+		Square
+	};
+
+	class FMRingModulator
+		: public FMDspProcessor
+	{
+	public:
+		struct Parameters
+		{
+			float frequency = 440.f;
+			float highpassCutoff = 800.f;
+			FMWaveform waveform = FMWaveform::Sine;
+		};
+		static std::shared_ptr<FMCustomDsp> Create(FMOD::System &system,uint32_t frequency);
+		virtual void Initialize(uint32_t frequency) override;
+		void SetParameters(const Parameters &params);
+		template<uint32_t TChannels>
+			void Process(const float *in,float *out,uint32_t numFrames);
+	private:
+		void ApplyParameters(const Parameters &params);
+		FMDspParameters<Parameters> m_pending;
+		FMWaveform m_waveform = FMWaveform::Sine;
+		FMDspRamp m_increment;
+		FMDspRamp m_highpass;
+		float m_phase = 0.f;
+		std::array<float,FMCustomDsp::MAX_CHANNELS> m_prevIn = {};
+		std::array<float,FMCustomDsp::MAX_CHANNELS> m_prevOut = {};
+		std::vector<float> m_phases = {};
+		std::vector<float> m_modulator = {};
+		std::vector<float> m_expanded = {};
+	};
+
+	class FMFrequencyShifter
+		: public FMDspProcessor
+	{
+	public:
+		enum class Direction : uint8_t
+		{
+			Down = 0u,
+			Up,
+			Off
+		};
+		struct Parameters
+		{
+			float frequency = 0.f;
+			Direction leftDirection = Direction::Down;
+			Direction rightDirection = Direction::Down;
+		};
+		static std::shared_ptr<FMCustomDsp> Create(FMOD::System &system,uint32_t frequency);
+		virtual void Initialize(uint32_t frequency) override;
+		void SetParameters(const Parameters &params);
+		template<uint32_t TChannels>
+			void Process(const float *in,float *out,uint32_t numFrames);
+	private:
+		static constexpr uint32_t HILBERT_STAGES = 4u;
+		// Two chains of first-order allpass sections in z^-2 whose outputs are 90 degrees apart
+		struct Hilbert
+		{
+			std::array<std::array<float,4>,HILBERT_STAGES> real = {}; // x[n-1],x[n-2],y[n-1],y[n-2]
+			std::array<std::array<float,4>,HILBERT_STAGES> imag = {};
+			float realDelay = 0.f;
+		};
+		FMDspParameters<Parameters> m_pending;
+		Parameters m_params = {};
+		FMDspRamp m_increment;
+		float m_phase = 0.f;
+		std::array<Hilbert,FMCustomDsp::MAX_CHANNELS> m_hilbert = {};
+		std::vector<float> m_phases = {};
+		std::vector<float> m_cos = {};
+		std::vector<float> m_sin = {};
+		std::vector<float> m_expandedCos = {};
+		std::vector<float> m_expandedSin = {};
+		std::vector<float> m_real = {};
+		std::vector<float> m_imag = {};
+	};
+
+	class FMAutoWah
+		: public FMDspProcessor
+	{
+	public:
+		struct Parameters
+		{
+			float attackTime = 0.06f;
+			float releaseTime = 0.06f;
+			float resonance = 1'000.f;
+			float peakGain = 11.22f;
+		};
+		static std::shared_ptr<FMCustomDsp> Create(FMOD::System &system,uint32_t frequency);
+		virtual void Initialize(uint32_t frequency) override;
+		void SetParameters(const Parameters &params);
+		template<uint32_t TChannels>
+			void Process(const float *in,float *out,uint32_t numFrames);
+	private:
+		FMDspParameters<Parameters> m_pending;
+		Parameters m_params = {};
+		FMDspRamp m_peakGain;
+		float m_envelope = 0.f;
+		// State-variable bandpass filter, the coefficients are interpolated between control blocks
+		std::array<float,4> m_coefficients = {};
+		bool m_bCoefficientsInitialized = false;
+		std::array<std::array<float,2>,FMCustomDsp::MAX_CHANNELS> m_filter = {};
+	};
+
+	class FMVocalMorpher
+		: public FMDspProcessor
+	{
+	public:
+		// Same order as the EFX phonemes
+		enum class Phoneme : uint8_t
+		{
+			A = 0u,E,I,O,U,AA,AE,AH,AO,EH,ER,IH,IY,UH,UW,
+			B,D,F,G,J,K,L,M,N,P,R,S,T,V,Z,
+
+			Count
+		};
+		struct Parameters
+		{
+			Phoneme phonemeA = Phoneme::A;
+			int32_t phonemeACoarseTuning = 0;
+			Phoneme phonemeB = Phoneme::ER;
+			int32_t phonemeBCoarseTuning = 0;
+			FMWaveform waveform = FMWaveform::Sine;
+			float rate = 1.41f;
+		};
+		static constexpr uint32_t FORMANT_COUNT = 3u;
+		static std::shared_ptr<FMCustomDsp> Create(FMOD::System &system,uint32_t frequency);
+		void SetParameters(const Parameters &params);
+		template<uint32_t TChannels>
+			void Process(const float *in,float *out,uint32_t numFrames);
+	private:
+		FMDspParameters<Parameters> m_pending;
+		Parameters m_params = {};
+		float m_phase = 0.f;
+		// One state-variable bandpass filter per formant, the coefficients are interpolated between control blocks
+		std::array<std::array<float,4>,FORMANT_COUNT> m_coefficients = {};
+		bool m_bCoefficientsInitialized = false;
+		std::array<std::array<std::array<float,2>,FORMANT_COUNT>,FMCustomDsp::MAX_CHANNELS> m_filters = {};
+	};
+};
+
+#endif
@@ -4,89 +4,344 @@
 
 #include "fmod_effect.hpp"
 #include "fmod_sound_system.hpp"
+#include "fmod_convolution.hpp"
+#include "fmod_dsp_effects.hpp"
 #include <fmod_studio.hpp>
+#include <cmath>
 
-al::FMEffect::FMEffect(ISoundSystem &soundSys,const std::shared_ptr<FMOD::DSP> &dsp)
-	: IEffect{soundSys},m_fmDsp(dsp)
+namespace
+{
+	// Indexed by FMEffect::Type
+	constexpr std::array<FMOD_DSP_TYPE,13> DSP_TYPES = {
+		FMOD_DSP_TYPE_SFXREVERB,
+		FMOD_DSP_TYPE_CHORUS,
+		FMOD_DSP_TYPE_DISTORTION,
+		FMOD_DSP_TYPE_ECHO,
+		FMOD_DSP_TYPE_FLANGE,
+		FMOD_DSP_TYPE_PITCHSHIFT,
+		FMOD_DSP_TYPE_COMPRESSOR,
+		FMOD_DSP_TYPE_MULTIBAND_EQ,
+		FMOD_DSP_TYPE_UNKNOWN, // Custom DSP, see FMConvolutionReverb
+		// Custom DSPs, see fmod_dsp_effects.hpp
+		FMOD_DSP_TYPE_UNKNOWN,
+		FMOD_DSP_TYPE_UNKNOWN,
+		FMOD_DSP_TYPE_UNKNOWN,
+		FMOD_DSP_TYPE_UNKNOWN
+	};
+	// Time constant of the parameter smoothing in seconds
+	constexpr float SMOOTHING_TIME = 0.05f;
+	float gain_to_db(float gain) {return 20.f *std::log10(umath::max(gain,0.00001f));}
+	// Converts an EFX band width in octaves to a filter Q
+	float octaves_to_q(float octaves)
+	{
+		auto f = std::exp2(umath::max(octaves,0.01f));
+		return std::sqrt(f) /(f -1.f);
+	}
+};
+
+al::FMEffect::FMEffect(ISoundSystem &soundSys)
+	: IEffect{soundSys}
 {}
+al::FMEffect::~FMEffect()
+{
+	GetSoundSystem().RemoveEffect(*this);
+}
+al::FMSoundSystem &al::FMEffect::GetSoundSystem() {return static_cast<FMSoundSystem&>(m_soundSystem);}
 const std::shared_ptr<FMOD::DSP> &al::FMEffect::GetFMODDsp() const {return const_cast<al::FMEffect*>(this)->GetFMODDsp();}
 std::shared_ptr<FMOD::DSP> &al::FMEffect::GetFMODDsp() {return m_fmDsp;}
 
+al::FMEffect::DspState *al::FMEffect::Activate(Type type)
+{
+	static_assert(DSP_TYPES.size() == static_cast<size_t>(Type::Count));
+	auto &state = m_dspStates[static_cast<size_t>(type)];
+	if(state.dsp == nullptr && type == Type::Convolution)
+	{
+		m_convolution = FMConvolutionReverb::Create(GetSoundSystem());
+		if(m_convolution == nullptr)
+			return nullptr;
+		// The DSP is owned by the convolution reverb
+		state.dsp = std::shared_ptr<FMOD::DSP>(m_convolution,m_convolution->GetFMODDsp());
+	}
+	if(state.dsp == nullptr && DSP_TYPES[static_cast<size_t>(type)] == FMOD_DSP_TYPE_UNKNOWN)
+	{
+		auto &system = GetSoundSystem();
+		auto &lowLevelSystem = system.GetFMODLowLevelSystem();
+		auto frequency = system.GetMixerFrequency();
+		switch(type)
+		{
+			case Type::FrequencyShifter:
+				state.custom = FMFrequencyShifter::Create(lowLevelSystem,frequency);
+				break;
+			case Type::VocalMorpher:
+				state.custom = FMVocalMorpher::Create(lowLevelSystem,frequency);
+				break;
+			case Type::RingModulator:
+				state.custom = FMRingModulator::Create(lowLevelSystem,frequency);
+				break;
+			case Type::AutoWah:
+				state.custom = FMAutoWah::Create(lowLevelSystem,frequency);
+				break;
+			default:
+				break;
+		}
+		if(state.custom == nullptr)
+			return nullptr;
+		state.dsp = std::shared_ptr<FMOD::DSP>(state.custom,state.custom->GetFMODDsp());
+	}
+	if(state.dsp == nullptr)
+	{
+		// Only happens the first time a type is used, afterwards the DSP is reused
+		FMOD::DSP *dsp;
+		auto r = GetSoundSystem().GetFMODLowLevelSystem().createDSPByType(DSP_TYPES[static_cast<size_t>(type)],&dsp);
+		al::check_result(r);
+		if(r != FMOD_OK)
+			return nullptr;
+		state.dsp = std::shared_ptr<FMOD::DSP>(dsp,[](FMOD::DSP *dsp) {
+			al::check_result(dsp->release());
+		});
+		if(type == Type::Equalizer)
+		{
+			// Same band layout as the EFX equalizer
+			dsp->setParameterInt(FMOD_DSP_MULTIBAND_EQ_A_FILTER,FMOD_DSP_MULTIBAND_EQ_FILTER_LOWSHELF);
+			dsp->setParameterInt(FMOD_DSP_MULTIBAND_EQ_B_FILTER,FMOD_DSP_MULTIBAND_EQ_FILTER_PEAKING);
+			dsp->setParameterInt(FMOD_DSP_MULTIBAND_EQ_C_FILTER,FMOD_DSP_MULTIBAND_EQ_FILTER_PEAKING);
+			dsp->setParameterInt(FMOD_DSP_MULTIBAND_EQ_D_FILTER,FMOD_DSP_MULTIBAND_EQ_FILTER_HIGHSHELF);
+		}
+	}
+	m_fmDsp = state.dsp;
+	return &state;
+}
+
+void al::FMEffect::SetParameter(DspState &state,int32_t index,float value,bool smooth)
+{
+	if(index < 0 || index >= static_cast<int32_t>(MAX_PARAMETERS))
+		return;
+	auto &param = state.parameters[index];
+	if(param.initialized && param.target == value)
+		return;
+	param.target = value;
+	if(smooth && param.initialized)
+	{
+		// Applied incrementally by Update()
+		state.smoothing = true;
+		return;
+	}
+	param.current = value;
+	param.initialized = true;
+	al::check_result(state.dsp->setParameterFloat(index,value));
+}
+
+template<typename T,size_t N>
+	void al::FMEffect::ApplyParameters(Type type,const T &props,const std::array<ParameterMapping<T>,N> &mappings)
+{
+	auto *state = Activate(type);
+	if(state == nullptr)
+		return;
+	for(auto &mapping : mappings)
+		SetParameter(*state,mapping.index,mapping.get(props),mapping.smooth);
+}
+
+template<class TProcessor>
+	void al::FMEffect::SetCustomParameters(Type type,const typename TProcessor::Parameters &params)
+{
+	// Custom DSPs interpolate their parameters themselves
+	auto *state = Activate(type);
+	if(state != nullptr)
+		static_cast<TProcessor&>(state->custom->GetProcessor()).SetParameters(params);
+}
+
+void al::FMEffect::Update(float dt)
+{
+	auto factor = 1.f -std::exp(-dt /SMOOTHING_TIME);
+	for(auto &state : m_dspStates)
+	{
+		if(state.smoothing == false)
+			continue;
+		state.smoothing = false;
+		for(auto i=decltype(state.parameters.size()){0u};i<state.parameters.size();++i)
+		{
+			auto &param = state.parameters[i];
+			if(param.initialized == false || param.current == param.target)
+				continue;
+			auto delta = param.target -param.current;
+			if(std::abs(delta) <= 0.001f *umath::max(std::abs(param.target),1.f))
+				param.current = param.target;
+			else
+			{
+				param.current += delta *factor;
+				state.smoothing = true;
+			}
+			al::check_result(state.dsp->setParameterFloat(static_cast<int32_t>(i),param.current));
+		}
+	}
+}
+
 void al::FMEffect::SetProperties(al::EfxChorusProperties props)
 {
-	FMOD::DSP *dsp;
-	al::check_result(static_cast<FMSoundSystem&>(m_soundSystem).GetFMODLowLevelSystem().createDSPByType(FMOD_DSP_TYPE_CHORUS,&dsp));
-	m_fmDsp = std::shared_ptr<FMOD::DSP>(dsp,[](FMOD::DSP *dsp) {
-		al::check_result(dsp->release());
-	});
-	dsp->setParameterFloat(FMOD_DSP_ECHO_DELAY,props.flDelay);
-	dsp->setParameterFloat(FMOD_DSP_ECHO_FEEDBACK,props.flFeedback);
-	//dsp->setParameterFloat(FMOD_DSP_ECHO_DRYLEVEL,props.);
-	//dsp->setParameterFloat(FMOD_DSP_ECHO_WETLEVEL,props.);
+	using Props = al::EfxChorusProperties;
+	static constexpr std::array<ParameterMapping<Props>,3> mappings = {{
+		{FMOD_DSP_CHORUS_MIX,[](const Props &p) -> float {return 50.f;},false},
+		{FMOD_DSP_CHORUS_RATE,[](const Props &p) -> float {return umath::clamp(p.flRate,0.f,20.f);},true},
+		{FMOD_DSP_CHORUS_DEPTH,[](const Props &p) -> float {return umath::clamp(p.flDepth *100.f,0.f,100.f);},true}
+	}};
+	ApplyParameters(Type::Chorus,props,mappings);
 }
 
 void al::FMEffect::SetProperties(al::EfxEaxReverbProperties props)
 {
-	// TODO
+	using Props = al::EfxEaxReverbProperties;
+	static constexpr std::array<ParameterMapping<Props>,13> mappings = {{
+		{FMOD_DSP_SFXREVERB_DECAYTIME,[](const Props &p) -> float {return umath::clamp(p.flDecayTime *1'000.f,100.f,20'000.f);},true},
+		{FMOD_DSP_SFXREVERB_EARLYDELAY,[](const Props &p) -> float {return umath::clamp(p.flReflectionsDelay *1'000.f,0.f,300.f);},false},
+		{FMOD_DSP_SFXREVERB_LATEDELAY,[](const Props &p) -> float {return umath::clamp(p.flLateReverbDelay *1'000.f,0.f,100.f);},false},
+		{FMOD_DSP_SFXREVERB_HFREFERENCE,[](const Props &p) -> float {return umath::clamp(p.flHFReference,20.f,20'000.f);},true},
+		{FMOD_DSP_SFXREVERB_HFDECAYRATIO,[](const Props &p) -> float {return umath::clamp(p.flDecayHFRatio *100.f,10.f,100.f);},true},
+		{FMOD_DSP_SFXREVERB_DIFFUSION,[](const Props &p) -> float {return umath::clamp(p.flDiffusion *100.f,0.f,100.f);},true},
+		{FMOD_DSP_SFXREVERB_DENSITY,[](const Props &p) -> float {return umath::clamp(p.flDensity *100.f,0.f,100.f);},true},
+		{FMOD_DSP_SFXREVERB_LOWSHELFFREQUENCY,[](const Props &p) -> float {return umath::clamp(p.flLFReference,20.f,1'000.f);},true},
+		{FMOD_DSP_SFXREVERB_LOWSHELFGAIN,[](const Props &p) -> float {return umath::clamp(gain_to_db(p.flGainLF),-36.f,12.f);},true},
+		{FMOD_DSP_SFXREVERB_HIGHCUT,[](const Props &p) -> float {
+			// Same approximation FMOD uses to convert I3DL2 room HF attenuation into a cutoff
+			if(p.flGainHF >= 1.f)
+				return 20'000.f;
+			auto gainHF = umath::max(p.flGainHF,0.0001f);
+			return umath::clamp(p.flHFReference /std::sqrt((1.f -gainHF) /gainHF),20.f,20'000.f);
+		},true},
+		{FMOD_DSP_SFXREVERB_EARLYLATEMIX,[](const Props &p) -> float {
+			auto total = p.flReflectionsGain +p.flLateReverbGain;
+			return (total > 0.f) ? (p.flLateReverbGain /total *100.f) : 50.f;
+		},true},
+		{FMOD_DSP_SFXREVERB_WETLEVEL,[](const Props &p) -> float {return umath::clamp(gain_to_db(p.flGain *umath::max(p.flReflectionsGain,p.flLateReverbGain)),-80.f,20.f);},true},
+		{FMOD_DSP_SFXREVERB_DRYLEVEL,[](const Props &p) -> float {return 0.f;},false}
+	}};
+	ApplyParameters(Type::Reverb,props,mappings);
 }
 
 void al::FMEffect::SetProperties(al::EfxDistortionProperties props)
 {
-	FMOD::DSP *dsp;
-	al::check_result(static_cast<FMSoundSystem&>(m_soundSystem).GetFMODLowLevelSystem().createDSPByType(FMOD_DSP_TYPE_DISTORTION,&dsp));
-	m_fmDsp = std::shared_ptr<FMOD::DSP>(dsp,[](FMOD::DSP *dsp) {
-		al::check_result(dsp->release());
-	});
-	dsp->setParameterFloat(FMOD_DSP_DISTORTION_LEVEL,props.flGain);
+	using Props = al::EfxDistortionProperties;
+	static constexpr std::array<ParameterMapping<Props>,1> mappings = {{
+		{FMOD_DSP_DISTORTION_LEVEL,[](const Props &p) -> float {return umath::clamp(p.flEdge,0.f,1.f);},true}
+	}};
+	ApplyParameters(Type::Distortion,props,mappings);
 }
 void al::FMEffect::SetProperties(al::EfxEchoProperties props)
 {
-	FMOD::DSP *dsp;
-	al::check_result(static_cast<FMSoundSystem&>(m_soundSystem).GetFMODLowLevelSystem().createDSPByType(FMOD_DSP_TYPE_ECHO,&dsp));
-	m_fmDsp = std::shared_ptr<FMOD::DSP>(dsp,[](FMOD::DSP *dsp) {
-		al::check_result(dsp->release());
-	});
-	dsp->setParameterFloat(FMOD_DSP_ECHO_DELAY,props.flDelay);
-	dsp->setParameterFloat(FMOD_DSP_ECHO_FEEDBACK,props.flFeedback);
-	//dsp->setParameterFloat(FMOD_DSP_ECHO_DRYLEVEL,props.);
-	//dsp->setParameterFloat(FMOD_DSP_ECHO_WETLEVEL,props.);
+	using Props = al::EfxEchoProperties;
+	static constexpr std::array<ParameterMapping<Props>,2> mappings = {{
+		// Changing the delay resets the echo buffer
+		{FMOD_DSP_ECHO_DELAY,[](const Props &p) -> float {return umath::clamp(p.flDelay *1'000.f,10.f,5'000.f);},false},
+		{FMOD_DSP_ECHO_FEEDBACK,[](const Props &p) -> float {return umath::clamp(p.flFeedback *100.f,0.f,100.f);},true}
+	}};
+	ApplyParameters(Type::Echo,props,mappings);
 }
 void al::FMEffect::SetProperties(al::EfxFlangerProperties props)
 {
-	FMOD::DSP *dsp;
-	al::check_result(static_cast<FMSoundSystem&>(m_soundSystem).GetFMODLowLevelSystem().createDSPByType(FMOD_DSP_TYPE_FLANGE,&dsp));
-	m_fmDsp = std::shared_ptr<FMOD::DSP>(dsp,[](FMOD::DSP *dsp) {
-		al::check_result(dsp->release());
-	});
-	//dsp->setParameterFloat(FMOD_DSP_FLANGE_MIX,props.); // FMOD TODO
-	dsp->setParameterFloat(FMOD_DSP_FLANGE_DEPTH,props.flDepth);
-	dsp->setParameterFloat(FMOD_DSP_FLANGE_RATE,props.flRate);
+	using Props = al::EfxFlangerProperties;
+	static constexpr std::array<ParameterMapping<Props>,2> mappings = {{
+		//{FMOD_DSP_FLANGE_MIX,...}, // FMOD TODO
+		{FMOD_DSP_FLANGE_DEPTH,[](const Props &p) -> float {return umath::clamp(p.flDepth,0.01f,1.f);},true},
+		{FMOD_DSP_FLANGE_RATE,[](const Props &p) -> float {return umath::clamp(p.flRate,0.f,20.f);},true}
+	}};
+	ApplyParameters(Type::Flanger,props,mappings);
 }
 void al::FMEffect::SetProperties(al::EfxFrequencyShifterProperties props)
 {
-	// FMOD TODO
+	FMFrequencyShifter::Parameters params {};
+	params.frequency = umath::clamp(props.flFrequency,0.f,24'000.f);
+	params.leftDirection = static_cast<FMFrequencyShifter::Direction>(umath::clamp(props.iLeftDirection,0,2));
+	params.rightDirection = static_cast<FMFrequencyShifter::Direction>(umath::clamp(props.iRightDirection,0,2));
+	SetCustomParameters<FMFrequencyShifter>(Type::FrequencyShifter,params);
 }
 void al::FMEffect::SetProperties(al::EfxVocalMorpherProperties props)
 {
-	// FMOD TODO
+	constexpr auto numPhonemes = static_cast<int32_t>(FMVocalMorpher::Phoneme::Count);
+	FMVocalMorpher::Parameters params {};
+	params.phonemeA = static_cast<FMVocalMorpher::Phoneme>(umath::clamp(props.iPhonemeA,0,numPhonemes -1));
+	params.phonemeACoarseTuning = umath::clamp(props.iPhonemeACoarseTuning,-24,24);
+	params.phonemeB = static_cast<FMVocalMorpher::Phoneme>(umath::clamp(props.iPhonemeB,0,numPhonemes -1));
+	params.phonemeBCoarseTuning = umath::clamp(props.iPhonemeBCoarseTuning,-24,24);
+	// EFX: sinusoid, triangle, sawtooth
+	params.waveform = static_cast<FMWaveform>(umath::clamp(props.iWaveform,0,2));
+	params.rate = umath::clamp(props.flRate,0.f,10.f);
+	SetCustomParameters<FMVocalMorpher>(Type::VocalMorpher,params);
 }
 void al::FMEffect::SetProperties(al::EfxPitchShifterProperties props)
 {
-	// FMOD TODO
+	using Props = al::EfxPitchShifterProperties;
+	static constexpr std::array<ParameterMapping<Props>,1> mappings = {{
+		{FMOD_DSP_PITCHSHIFT_PITCH,[](const Props &p) -> float {
+			auto semitones = static_cast<float>(p.iCoarseTune) +static_cast<float>(p.iFineTune) /100.f;
+			return umath::clamp(std::exp2(semitones /12.f),0.5f,2.f);
+		},true}
+	}};
+	ApplyParameters(Type::PitchShifter,props,mappings);
 }
 void al::FMEffect::SetProperties(al::EfxRingModulatorProperties props)
 {
-	// FMOD TODO
+	FMRingModulator::Parameters params {};
+	params.frequency = umath::clamp(props.flFrequency,0.f,8'000.f);
+	params.highpassCutoff = umath::clamp(props.flHighpassCutoff,0.f,24'000.f);
+	// EFX: sinusoid, sawtooth, square
+	switch(props.iWaveform)
+	{
+		case 1:
+			params.waveform = FMWaveform::Sawtooth;
+			break;
+		case 2:
+			params.waveform = FMWaveform::Square;
+			break;
+		default:
+			params.waveform = FMWaveform::Sine;
+			break;
+	}
+	SetCustomParameters<FMRingModulator>(Type::RingModulator,params);
 }
 void al::FMEffect::SetProperties(al::EfxAutoWahProperties props)
 {
-	// FMOD TODO
+	FMAutoWah::Parameters params {};
+	params.attackTime = umath::clamp(props.flAttackTime,0.0001f,1.f);
+	params.releaseTime = umath::clamp(props.flReleaseTime,0.0001f,1.f);
+	params.resonance = umath::clamp(props.flResonance,2.f,1'000.f);
+	params.peakGain = props.flPeakGain;
+	SetCustomParameters<FMAutoWah>(Type::AutoWah,params);
 }
 void al::FMEffect::SetProperties(al::EfxCompressor props)
 {
-	// FMOD TODO
+	// The EFX compressor only has an on/off switch, FMOD's defaults are used for everything else
+	auto *state = Activate(Type::Compressor);
+	if(state != nullptr)
+		al::check_result(state->dsp->setBypass(props.iOnOff == 0));
+}
+bool al::FMEffect::SetImpulseResponse(const std::string &path,float crossfadeTime)
+{
+	auto &system = GetSoundSystem();
+	auto maxFrames = static_cast<uint32_t>(FMConvolutionReverb::MAX_IMPULSE_RESPONSE_LENGTH *system.GetMixerFrequency());
+	auto ir = system.GetImpulseResponseCache().Get(system,path,FMConvolutionReverb::BLOCK_SIZE,maxFrames);
+	if(ir == nullptr || Activate(Type::Convolution) == nullptr)
+		return false;
+	m_convolution->SetImpulseResponse(ir,crossfadeTime);
+	return true;
+}
+void al::FMEffect::SetConvolutionMix(float wet,float dry)
+{
+	if(Activate(Type::Convolution) != nullptr)
+		m_convolution->SetWetDryMix(wet,dry);
 }
 void al::FMEffect::SetProperties(al::EfxEqualizer props)
 {
-	// FMOD TODO
+	using Props = al::EfxEqualizer;
+	static constexpr std::array<ParameterMapping<Props>,10> mappings = {{
+		{FMOD_DSP_MULTIBAND_EQ_A_FREQUENCY,[](const Props &p) -> float {return umath::clamp(p.flLowCutoff,20.f,22'000.f);},true},
+		{FMOD_DSP_MULTIBAND_EQ_A_GAIN,[](const Props &p) -> float {return umath::clamp(gain_to_db(p.flLowGain),-30.f,30.f);},true},
+		{FMOD_DSP_MULTIBAND_EQ_B_FREQUENCY,[](const Props &p) -> float {return umath::clamp(p.flMid1Center,20.f,22'000.f);},true},
+		{FMOD_DSP_MULTIBAND_EQ_B_Q,[](const Props &p) -> float {return umath::clamp(octaves_to_q(p.flMid1Width),0.1f,10.f);},true},
+		{FMOD_DSP_MULTIBAND_EQ_B_GAIN,[](const Props &p) -> float {return umath::clamp(gain_to_db(p.flMid1Gain),-30.f,30.f);},true},
+		{FMOD_DSP_MULTIBAND_EQ_C_FREQUENCY,[](const Props &p) -> float {return umath::clamp(p.flMid2Center,20.f,22'000.f);},true},
+		{FMOD_DSP_MULTIBAND_EQ_C_Q,[](const Props &p) -> float {return umath::clamp(octaves_to_q(p.flMid2Width),0.1f,10.f);},true},
+		{FMOD_DSP_MULTIBAND_EQ_C_GAIN,[](const Props &p) -> float {return umath::clamp(gain_to_db(p.flMid2Gain),-30.f,30.f);},true},
+		{FMOD_DSP_MULTIBAND_EQ_D_FREQUENCY,[](const Props &p) -> float {return umath::clamp(p.flHighCutoff,20.f,22'000.f);},true},
+		{FMOD_DSP_MULTIBAND_EQ_D_GAIN,[](const Props &p) -> float {return umath::clamp(gain_to_db(p.flHighGain),-30.f,30.f);},true}
+	}};
+	ApplyParameters(Type::Equalizer,props,mappings);
 }
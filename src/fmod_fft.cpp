@@ -0,0 +1,214 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_fft.hpp"
+#include <cmath>
+
+#if defined(__AVX__)
+	#include <immintrin.h>
+	#define FMFFT_AVX
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#include <xmmintrin.h>
+	#define FMFFT_SSE
+#endif
+
+al::FMFFT::FMFFT(uint32_t size)
+	: m_size{size},m_half{size /2u}
+{
+	constexpr auto pi = 3.14159265358979323846;
+	auto numBits = 0u;
+	while((1u<<numBits) < m_half)
+		++numBits;
+	m_bitReverse.resize(m_half);
+	for(auto i=0u;i<m_half;++i)
+	{
+		auto r = 0u;
+		for(auto b=0u;b<numBits;++b)
+		{
+			if(i &(1u<<b))
+				r |= 1u<<(numBits -1u -b);
+		}
+		m_bitReverse[i] = r;
+	}
+
+	auto numTwiddles = (m_half > 0u) ? (m_half -1u) : 0u;
+	m_twiddleRe.resize(numTwiddles);
+	m_twiddleIm.resize(numTwiddles);
+	for(auto h=1u;h<m_half;h*=2u)
+	{
+		for(auto j=0u;j<h;++j)
+		{
+			auto angle = -pi *static_cast<double>(j) /static_cast<double>(h);
+			m_twiddleRe[h -1u +j] = static_cast<float>(std::cos(angle));
+			m_twiddleIm[h -1u +j] = static_cast<float>(std::sin(angle));
+		}
+	}
+	m_realTwiddleRe.resize(m_half +1u);
+	m_realTwiddleIm.resize(m_half +1u);
+	for(auto k=0u;k<=m_half;++k)
+	{
+		auto angle = -2.0 *pi *static_cast<double>(k) /static_cast<double>(m_size);
+		m_realTwiddleRe[k] = static_cast<float>(std::cos(angle));
+		m_realTwiddleIm[k] = static_cast<float>(std::sin(angle));
+	}
+	m_workRe.resize(m_half);
+	m_workIm.resize(m_half);
+}
+uint32_t al::FMFFT::GetSize() const {return m_size;}
+uint32_t al::FMFFT::GetBinCount() const {return m_half +1u;}
+
+void al::FMFFT::Transform(float *re,float *im) const
+{
+	// Iterative radix-2 decimation in time, the input is expected in bit-reversed order
+	for(auto h=1u;h<m_half;h*=2u)
+	{
+		auto *twRe = m_twiddleRe.data() +(h -1u);
+		auto *twIm = m_twiddleIm.data() +(h -1u);
+		for(auto s=0u;s<m_half;s+=2u *h)
+		{
+			auto *aRe = re +s;
+			auto *aIm = im +s;
+			auto *bRe = aRe +h;
+			auto *bIm = aIm +h;
+			auto j = 0u;
+#if defined(FMFFT_AVX)
+			for(;j +8u<=h;j+=8u)
+			{
+				auto wr = _mm256_loadu_ps(twRe +j);
+				auto wi = _mm256_loadu_ps(twIm +j);
+				auto br = _mm256_loadu_ps(bRe +j);
+				auto bi = _mm256_loadu_ps(bIm +j);
+				auto tr = _mm256_sub_ps(_mm256_mul_ps(wr,br),_mm256_mul_ps(wi,bi));
+				auto ti = _mm256_add_ps(_mm256_mul_ps(wr,bi),_mm256_mul_ps(wi,br));
+				auto ar = _mm256_loadu_ps(aRe +j);
+				auto ai = _mm256_loadu_ps(aIm +j);
+				_mm256_storeu_ps(bRe +j,_mm256_sub_ps(ar,tr));
+				_mm256_storeu_ps(bIm +j,_mm256_sub_ps(ai,ti));
+				_mm256_storeu_ps(aRe +j,_mm256_add_ps(ar,tr));
+				_mm256_storeu_ps(aIm +j,_mm256_add_ps(ai,ti));
+			}
+#endif
+#if defined(FMFFT_AVX) || defined(FMFFT_SSE)
+			for(;j +4u<=h;j+=4u)
+			{
+				auto wr = _mm_loadu_ps(twRe +j);
+				auto wi = _mm_loadu_ps(twIm +j);
+				auto br = _mm_loadu_ps(bRe +j);
+				auto bi = _mm_loadu_ps(bIm +j);
+				auto tr = _mm_sub_ps(_mm_mul_ps(wr,br),_mm_mul_ps(wi,bi));
+				auto ti = _mm_add_ps(_mm_mul_ps(wr,bi),_mm_mul_ps(wi,br));
+				auto ar = _mm_loadu_ps(aRe +j);
+				auto ai = _mm_loadu_ps(aIm +j);
+				_mm_storeu_ps(bRe +j,_mm_sub_ps(ar,tr));
+				_mm_storeu_ps(bIm +j,_mm_sub_ps(ai,ti));
+				_mm_storeu_ps(aRe +j,_mm_add_ps(ar,tr));
+				_mm_storeu_ps(aIm +j,_mm_add_ps(ai,ti));
+			}
+#endif
+			for(;j<h;++j)
+			{
+				auto tr = twRe[j] *bRe[j] -twIm[j] *bIm[j];
+				auto ti = twRe[j] *bIm[j] +twIm[j] *bRe[j];
+				bRe[j] = aRe[j] -tr;
+				bIm[j] = aIm[j] -ti;
+				aRe[j] += tr;
+				aIm[j] += ti;
+			}
+		}
+	}
+}
+
+void al::FMFFT::Forward(const float *in,float *outRe,float *outIm)
+{
+	// Even samples become the real part, odd samples the imaginary part
+	for(auto n=0u;n<m_half;++n)
+	{
+		m_workRe[m_bitReverse[n]] = in[2u *n];
+		m_workIm[m_bitReverse[n]] = in[2u *n +1u];
+	}
+	Transform(m_workRe.data(),m_workIm.data());
+	// Separate the spectra of the even and odd samples and combine them into the spectrum of the real signal
+	for(auto k=0u;k<=m_half;++k)
+	{
+		auto ka = (k < m_half) ? k : 0u;
+		auto kb = (k > 0u) ? (m_half -k) : 0u;
+		auto ar = m_workRe[ka];
+		auto ai = m_workIm[ka];
+		auto br = m_workRe[kb];
+		auto bi = -m_workIm[kb];
+		auto evenRe = 0.5f *(ar +br);
+		auto evenIm = 0.5f *(ai +bi);
+		auto oddRe = 0.5f *(ai -bi);
+		auto oddIm = -0.5f *(ar -br);
+		auto wr = m_realTwiddleRe[k];
+		auto wi = m_realTwiddleIm[k];
+		outRe[k] = evenRe +wr *oddRe -wi *oddIm;
+		outIm[k] = evenIm +wr *oddIm +wi *oddRe;
+	}
+}
+
+void al::FMFFT::Inverse(const float *inRe,const float *inIm,float *out)
+{
+	for(auto k=0u;k<m_half;++k)
+	{
+		auto ar = inRe[k];
+		auto ai = inIm[k];
+		auto cr = inRe[m_half -k];
+		auto ci = -inIm[m_half -k];
+		auto evenRe = 0.5f *(ar +cr);
+		auto evenIm = 0.5f *(ai +ci);
+		// (a -c) *conj(w) /2
+		auto dr = 0.5f *(ar -cr);
+		auto di = 0.5f *(ai -ci);
+		auto wr = m_realTwiddleRe[k];
+		auto wi = -m_realTwiddleIm[k];
+		auto oddRe = dr *wr -di *wi;
+		auto oddIm = dr *wi +di *wr;
+		m_workRe[m_bitReverse[k]] = evenRe -oddIm;
+		m_workIm[m_bitReverse[k]] = evenIm +oddRe;
+	}
+	// Swapping real and imaginary parts turns the forward transform into the inverse one
+	Transform(m_workIm.data(),m_workRe.data());
+	for(auto n=0u;n<m_half;++n)
+	{
+		out[2u *n] = m_workRe[n];
+		out[2u *n +1u] = m_workIm[n];
+	}
+}
+
+void al::FMFFT::MultiplyAccumulate(const float *aRe,const float *aIm,const float *bRe,const float *bIm,float *accRe,float *accIm,uint32_t numBins)
+{
+	auto i = 0u;
+#if defined(FMFFT_AVX)
+	for(;i +8u<=numBins;i+=8u)
+	{
+		auto ar = _mm256_loadu_ps(aRe +i);
+		auto ai = _mm256_loadu_ps(aIm +i);
+		auto br = _mm256_loadu_ps(bRe +i);
+		auto bi = _mm256_loadu_ps(bIm +i);
+		auto re = _mm256_sub_ps(_mm256_mul_ps(ar,br),_mm256_mul_ps(ai,bi));
+		auto im = _mm256_add_ps(_mm256_mul_ps(ar,bi),_mm256_mul_ps(ai,br));
+		_mm256_storeu_ps(accRe +i,_mm256_add_ps(_mm256_loadu_ps(accRe +i),re));
+		_mm256_storeu_ps(accIm +i,_mm256_add_ps(_mm256_loadu_ps(accIm +i),im));
+	}
+#endif
+#if defined(FMFFT_AVX) || defined(FMFFT_SSE)
+	for(;i +4u<=numBins;i+=4u)
+	{
+		auto ar = _mm_loadu_ps(aRe +i);
+		auto ai = _mm_loadu_ps(aIm +i);
+		auto br = _mm_loadu_ps(bRe +i);
+		auto bi = _mm_loadu_ps(bIm +i);
+		auto re = _mm_sub_ps(_mm_mul_ps(ar,br),_mm_mul_ps(ai,bi));
+		auto im = _mm_add_ps(_mm_mul_ps(ar,bi),_mm_mul_ps(ai,br));
+		_mm_storeu_ps(accRe +i,_mm_add_ps(_mm_loadu_ps(accRe +i),re));
+		_mm_storeu_ps(accIm +i,_mm_add_ps(_mm_loadu_ps(accIm +i),im));
+	}
+#endif
+	for(;i<numBins;++i)
+	{
+		accRe[i] += aRe[i] *bRe[i] -aIm[i] *bIm[i];
+		accIm[i] += aRe[i] *bIm[i] +aIm[i] *bRe[i];
+	}
+}
@@ -0,0 +1,49 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_FFT_HPP__
+#define __FMOD_FFT_HPP__
+
+#include <cinttypes>
+#include <vector>
+
+namespace al
+{
+	// Real-input FFT of a fixed power-of-two size, computed as a complex FFT of half the size. Spectra are stored in
+	// split format (separate real and imaginary arrays) with size /2 +1 bins, which keeps the butterflies and the
+	// spectral multiply-accumulate vectorizable. The SIMD paths are selected at compile time (__AVX__ / SSE).
+	// Transforms aren't normalized: Inverse(Forward(x)) == x *size /2.
+	class FMFFT
+	{
+	public:
+		FMFFT(uint32_t size);
+		uint32_t GetSize() const;
+		uint32_t GetBinCount() const;
+
+		// in has GetSize() samples, outRe/outIm have GetBinCount() elements
+		void Forward(const float *in,float *outRe,float *outIm);
+		// inRe/inIm have GetBinCount() elements and are not modified, out has GetSize() samples
+		void Inverse(const float *inRe,const float *inIm,float *out);
+
+		// accRe/accIm += a *b for numBins complex values
+		static void MultiplyAccumulate(const float *aRe,const float *aIm,const float *bRe,const float *bIm,float *accRe,float *accIm,uint32_t numBins);
+	private:
+		// In-place complex FFT of size m_half; the inverse transform is done by swapping the real and imaginary parts
+		void Transform(float *re,float *im) const;
+
+		uint32_t m_size = 0u;
+		uint32_t m_half = 0u;
+		std::vector<uint32_t> m_bitReverse = {};
+		// Twiddles of all stages, the stage with half-size h starts at offset h -1
+		std::vector<float> m_twiddleRe = {};
+		std::vector<float> m_twiddleIm = {};
+		// Twiddles of the real-to-complex post-processing step
+		std::vector<float> m_realTwiddleRe = {};
+		std::vector<float> m_realTwiddleIm = {};
+		std::vector<float> m_workRe = {};
+		std::vector<float> m_workIm = {};
+	};
+};
+
+#endif
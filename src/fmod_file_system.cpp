@@ -0,0 +1,325 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_file_system.hpp"
+#include "fmod_sound_system.hpp"
+#include <fmod_studio.hpp>
+#include <fsys/filesystem.h>
+#include <algorithm>
+#include <cstring>
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <Windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+namespace al
+{
+	// Read-only mapping of a file on disk
+	class FMMappedFile
+	{
+	public:
+		FMMappedFile()=default;
+		FMMappedFile(const FMMappedFile&)=delete;
+		FMMappedFile &operator=(const FMMappedFile&)=delete;
+		~FMMappedFile() {Close();}
+		bool Open(const std::string &path);
+		void Close();
+		const uint8_t *GetData() const {return m_data;}
+		uint64_t GetSize() const {return m_size;}
+	private:
+		const uint8_t *m_data = nullptr;
+		uint64_t m_size = 0ull;
+#ifdef _WIN32
+		HANDLE m_file = INVALID_HANDLE_VALUE;
+		HANDLE m_mapping = nullptr;
+#endif
+	};
+};
+
+#ifdef _WIN32
+bool al::FMMappedFile::Open(const std::string &path)
+{
+	m_file = CreateFileA(path.c_str(),GENERIC_READ,FILE_SHARE_READ,nullptr,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,nullptr);
+	if(m_file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if(GetFileSizeEx(m_file,&size) == FALSE || size.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+	m_mapping = CreateFileMappingA(m_file,nullptr,PAGE_READONLY,0,0,nullptr);
+	if(m_mapping == nullptr)
+	{
+		Close();
+		return false;
+	}
+	m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping,FILE_MAP_READ,0,0,0));
+	if(m_data == nullptr)
+	{
+		Close();
+		return false;
+	}
+	m_size = static_cast<uint64_t>(size.QuadPart);
+	return true;
+}
+void al::FMMappedFile::Close()
+{
+	if(m_data != nullptr)
+		UnmapViewOfFile(m_data);
+	if(m_mapping != nullptr)
+		CloseHandle(m_mapping);
+	if(m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+	m_data = nullptr;
+	m_mapping = nullptr;
+	m_file = INVALID_HANDLE_VALUE;
+	m_size = 0ull;
+}
+#else
+bool al::FMMappedFile::Open(const std::string &path)
+{
+	auto fd = open(path.c_str(),O_RDONLY);
+	if(fd == -1)
+		return false;
+	struct stat st;
+	if(fstat(fd,&st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+	auto *data = mmap(nullptr,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	// The mapping stays valid after the descriptor has been closed
+	close(fd);
+	if(data == MAP_FAILED)
+		return false;
+	m_data = static_cast<const uint8_t*>(data);
+	m_size = static_cast<uint64_t>(st.st_size);
+	return true;
+}
+void al::FMMappedFile::Close()
+{
+	if(m_data != nullptr)
+		munmap(const_cast<uint8_t*>(m_data),m_size);
+	m_data = nullptr;
+	m_size = 0ull;
+}
+#endif
+
+struct al::FMFileSystem::File
+{
+	// nullptr if the file was opened without a file system (i.e. without fileuserdata), reads are serviced immediately
+	FMFileSystem *fileSystem = nullptr;
+	// Only set if the file can't be accessed in place
+	VFilePtr file = nullptr;
+	std::mutex fileMutex = {};
+
+	FMMappedFile mapping = {};
+	MemoryData memory = nullptr;
+	const uint8_t *data = nullptr;
+	uint64_t size = 0ull;
+};
+
+al::FMFileSystem::~FMFileSystem() {Shutdown();}
+
+const al::FMFileSystem::Settings &al::FMFileSystem::GetSettings() const {return m_settings;}
+
+void al::FMFileSystem::Initialize(FMOD::System &system,const Settings &settings)
+{
+	Shutdown();
+	m_settings = settings;
+	m_bRunning = true;
+	m_threads.reserve(settings.ioThreadCount);
+	for(auto i=decltype(settings.ioThreadCount){0u};i<settings.ioThreadCount;++i)
+		m_threads.push_back(std::thread{[this]() {RunWorker();}});
+
+	al::check_result(system.setFileSystem(
+		[](const char *name,uint32_t *fileSize,void **handle,void *userData) -> FMOD_RESULT {
+			auto f = FileManager::OpenFile(name,"rb");
+			if(f == nullptr)
+				return FMOD_RESULT::FMOD_ERR_FILE_NOTFOUND;
+			auto *fileSystem = static_cast<FMFileSystem*>(userData);
+			auto file = std::make_unique<File>();
+			file->fileSystem = fileSystem;
+			file->size = f->GetSize();
+			switch(f->GetType())
+			{
+				case VFILE_VIRTUAL:
+					file->memory = static_cast<VFilePtrInternalVirtual&>(*f).GetData();
+					if(file->memory != nullptr)
+						file->data = file->memory->data();
+					break;
+				case VFILE_LOCAL:
+					if((fileSystem == nullptr || fileSystem->m_settings.memoryMapFiles) && file->mapping.Open(static_cast<VFilePtrInternalReal&>(*f).GetPath()))
+					{
+						file->data = file->mapping.GetData();
+						file->size = file->mapping.GetSize();
+					}
+					break;
+			}
+			if(file->data == nullptr)
+				file->file = f;
+			*fileSize = static_cast<uint32_t>(file->size);
+			*handle = file.release();
+			return FMOD_RESULT::FMOD_OK;
+		},[](void *handle,void *userData) -> FMOD_RESULT {
+			// FMOD cancels all outstanding reads of the file before closing it
+			delete static_cast<File*>(handle);
+			return FMOD_RESULT::FMOD_OK;
+		},nullptr,nullptr,
+		[](FMOD_ASYNCREADINFO *info,void *userData) -> FMOD_RESULT {
+			auto *fileSystem = static_cast<File*>(info->handle)->fileSystem;
+			if(fileSystem == nullptr)
+			{
+				Service(*info);
+				return FMOD_RESULT::FMOD_OK;
+			}
+			fileSystem->Enqueue(*info);
+			return FMOD_RESULT::FMOD_OK;
+		},[](FMOD_ASYNCREADINFO *info,void *userData) -> FMOD_RESULT {
+			auto *fileSystem = static_cast<File*>(info->handle)->fileSystem;
+			if(fileSystem != nullptr)
+				fileSystem->Cancel(*info);
+			return FMOD_RESULT::FMOD_OK;
+		},settings.blockAlign
+	));
+}
+
+void al::FMFileSystem::Shutdown()
+{
+	{
+		std::unique_lock<std::mutex> lock {m_queueMutex};
+		m_bRunning = false;
+	}
+	m_queueCondition.notify_all();
+	for(auto &thread : m_threads)
+		thread.join();
+	m_threads.clear();
+}
+
+uint32_t al::FMFileSystem::GetPendingReadCount() const
+{
+	std::unique_lock<std::mutex> lock {m_queueMutex};
+	return static_cast<uint32_t>(m_queue.size() +m_activeReads.size());
+}
+
+al::FMFileSystem::FileInfo al::FMFileSystem::QueryFile(const std::string &path)
+{
+	FileInfo info {};
+	auto f = FileManager::OpenFile(path.c_str(),"rb");
+	if(f == nullptr)
+		return info;
+	info.exists = true;
+	info.size = f->GetSize();
+	if(f->GetType() != VFILE_VIRTUAL)
+		return info;
+	auto data = static_cast<VFilePtrInternalVirtual&>(*f).GetData();
+	if(data != nullptr && data->empty() == false)
+		info.memory = data;
+	return info;
+}
+al::FMFileSystem::MemoryData al::FMFileSystem::FindMemoryData(const std::string &path) {return QueryFile(path).memory;}
+
+const char *al::FMFileSystem::PrepareSound(const std::string &path,uint32_t &inOutMode,FMOD_CREATESOUNDEXINFO &exInfo,MemoryData &outData)
+{
+	return PrepareSound(path,QueryFile(path),inOutMode,exInfo,outData);
+}
+const char *al::FMFileSystem::PrepareSound(const std::string &path,const FileInfo &info,uint32_t &inOutMode,FMOD_CREATESOUNDEXINFO &exInfo,MemoryData &outData)
+{
+	outData = info.memory;
+	if(outData == nullptr)
+	{
+		exInfo.fileuserdata = this;
+		return path.c_str();
+	}
+	inOutMode |= FMOD_OPENMEMORY_POINT;
+	exInfo.length = static_cast<uint32_t>(outData->size());
+	return reinterpret_cast<const char*>(outData->data());
+}
+
+uint32_t al::FMFileSystem::Read(File &file,uint64_t offset,void *buffer,uint32_t size)
+{
+	if(file.data != nullptr)
+	{
+		if(offset >= file.size)
+			return 0u;
+		auto numBytes = static_cast<uint32_t>(umath::min(static_cast<uint64_t>(size),file.size -offset));
+		memcpy(buffer,file.data +offset,numBytes);
+		return numBytes;
+	}
+	std::unique_lock<std::mutex> lock {file.fileMutex};
+	file.file->Seek(offset);
+	return static_cast<uint32_t>(file.file->Read(buffer,size));
+}
+
+void al::FMFileSystem::Service(FMOD_ASYNCREADINFO &info)
+{
+	info.bytesread = Read(*static_cast<File*>(info.handle),info.offset,info.buffer,info.sizebytes);
+	// FMOD expects EOF only if fewer bytes than requested could be read
+	info.done(&info,(info.bytesread < info.sizebytes) ? FMOD_RESULT::FMOD_ERR_FILE_EOF : FMOD_RESULT::FMOD_OK);
+}
+
+bool al::FMFileSystem::ReadRequest::operator<(const ReadRequest &other) const
+{
+	if(priority != other.priority)
+		return priority < other.priority;
+	return sequence > other.sequence;
+}
+
+void al::FMFileSystem::Enqueue(FMOD_ASYNCREADINFO &info)
+{
+	std::unique_lock<std::mutex> lock {m_queueMutex};
+	if(m_bRunning == false || m_threads.empty())
+	{
+		lock.unlock();
+		Service(info);
+		return;
+	}
+	m_queue.push_back({&info,info.priority,m_nextSequence++});
+	std::push_heap(m_queue.begin(),m_queue.end());
+	lock.unlock();
+	m_queueCondition.notify_one();
+}
+
+void al::FMFileSystem::Cancel(FMOD_ASYNCREADINFO &info)
+{
+	std::unique_lock<std::mutex> lock {m_queueMutex};
+	auto it = std::find_if(m_queue.begin(),m_queue.end(),[&info](const ReadRequest &request) {return request.info == &info;});
+	if(it != m_queue.end())
+	{
+		m_queue.erase(it);
+		std::make_heap(m_queue.begin(),m_queue.end());
+		return;
+	}
+	// The read is already being serviced, FMOD requires us to block until it has completed
+	m_completeCondition.wait(lock,[this,&info]() {return m_activeReads.find(&info) == m_activeReads.end();});
+}
+
+void al::FMFileSystem::RunWorker()
+{
+	std::unique_lock<std::mutex> lock {m_queueMutex};
+	for(;;)
+	{
+		m_queueCondition.wait(lock,[this]() {return m_queue.empty() == false || m_bRunning == false;});
+		if(m_queue.empty())
+			break;
+		std::pop_heap(m_queue.begin(),m_queue.end());
+		auto *info = m_queue.back().info;
+		m_queue.pop_back();
+		m_activeReads.insert(info);
+		lock.unlock();
+
+		Service(*info);
+
+		lock.lock();
+		m_activeReads.erase(info);
+		m_completeCondition.notify_all();
+	}
+}
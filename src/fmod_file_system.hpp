@@ -0,0 +1,94 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_FILE_SYSTEM_HPP__
+#define __FMOD_FILE_SYSTEM_HPP__
+
+#include <cinttypes>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_set>
+
+namespace FMOD
+{
+	class System;
+};
+struct FMOD_ASYNCREADINFO;
+struct FMOD_CREATESOUNDEXINFO;
+namespace al
+{
+	// Routes FMOD file access through the VFS. Reads are issued through FMOD's asynchronous file callbacks and serviced
+	// by a pool of I/O threads, so slow reads never block the FMOD file/stream thread. Files on disk are memory-mapped
+	// and files that the VFS already holds in memory are read in place.
+	class FMFileSystem
+	{
+	public:
+		struct Settings
+		{
+			// Number of I/O threads; with 0 threads, reads are serviced on the FMOD thread that issued them
+			uint32_t ioThreadCount = 2u;
+			// Alignment of FMOD file reads in bytes, -1 uses the FMOD default (2048) and 0 disables FMOD's file buffering
+			int32_t blockAlign = -1;
+			bool memoryMapFiles = true;
+		};
+		// Data of a file that is held in memory by the VFS
+		using MemoryData = std::shared_ptr<std::vector<uint8_t>>;
+
+		FMFileSystem()=default;
+		~FMFileSystem();
+		void Initialize(FMOD::System &system,const Settings &settings);
+		void Shutdown();
+		const Settings &GetSettings() const;
+
+		struct FileInfo
+		{
+			bool exists = false;
+			uint64_t size = 0ull;
+			MemoryData memory = nullptr; // Only set if the VFS holds the file in memory
+		};
+		// Looks the file up in the VFS; this opens the file once, so the result should be passed on to PrepareSound
+		static FileInfo QueryFile(const std::string &path);
+
+		// Prepares a createSound call for the specified file. If the VFS already holds the file in memory, the data is
+		// opened in place with FMOD_OPENMEMORY_POINT and has to be kept alive (outData) until the sound has been released.
+		// Returns the name_or_data argument for createSound.
+		const char *PrepareSound(const std::string &path,uint32_t &inOutMode,FMOD_CREATESOUNDEXINFO &exInfo,MemoryData &outData);
+		// Same as above, for a file that has already been looked up
+		const char *PrepareSound(const std::string &path,const FileInfo &info,uint32_t &inOutMode,FMOD_CREATESOUNDEXINFO &exInfo,MemoryData &outData);
+		static MemoryData FindMemoryData(const std::string &path);
+
+		uint32_t GetPendingReadCount() const;
+	private:
+		struct File;
+		struct ReadRequest
+		{
+			FMOD_ASYNCREADINFO *info = nullptr;
+			int32_t priority = 0;
+			uint64_t sequence = 0ull;
+			bool operator<(const ReadRequest &other) const;
+		};
+		static uint32_t Read(File &file,uint64_t offset,void *buffer,uint32_t size);
+		static void Service(FMOD_ASYNCREADINFO &info);
+		void Enqueue(FMOD_ASYNCREADINFO &info);
+		void Cancel(FMOD_ASYNCREADINFO &info);
+		void RunWorker();
+
+		Settings m_settings = {};
+		std::vector<std::thread> m_threads = {};
+		mutable std::mutex m_queueMutex = {};
+		std::condition_variable m_queueCondition = {};
+		std::condition_variable m_completeCondition = {};
+		// Max-heap ordered by FMOD priority (0-100, higher for starving streams), then by submission order
+		std::vector<ReadRequest> m_queue = {};
+		std::unordered_set<FMOD_ASYNCREADINFO*> m_activeReads = {};
+		uint64_t m_nextSequence = 0ull;
+		bool m_bRunning = false;
+	};
+};
+
+#endif
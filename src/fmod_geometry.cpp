@@ -0,0 +1,451 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_geometry.hpp"
+#include "fmod_sound_system.hpp"
+#include <fmod_studio.hpp>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace
+{
+	// Triangles whose normals differ less than this are considered coplanar
+	constexpr float COPLANAR_THRESHOLD = 0.9999f;
+	// FMOD polygons are convex, simplification produces triangles and quads
+	struct Polygon
+	{
+		std::array<Vector3,4> vertices;
+		uint32_t count;
+		uint32_t mesh;
+	};
+	struct QuantizedVertex
+	{
+		int64_t x;
+		int64_t y;
+		int64_t z;
+		bool operator==(const QuantizedVertex &other) const {return x == other.x && y == other.y && z == other.z;}
+	};
+	struct QuantizedVertexHash
+	{
+		size_t operator()(const QuantizedVertex &v) const
+		{
+			auto h = static_cast<uint64_t>(v.x) *0x9E3779B97F4A7C15ull;
+			h ^= static_cast<uint64_t>(v.y) +0x9E3779B97F4A7C15ull +(h<<6) +(h>>2);
+			h ^= static_cast<uint64_t>(v.z) +0x9E3779B97F4A7C15ull +(h<<6) +(h>>2);
+			return static_cast<size_t>(h);
+		}
+	};
+	uint64_t get_cell_key(int32_t x,int32_t y,int32_t z)
+	{
+		constexpr uint64_t mask = (1ull<<21) -1ull;
+		return ((static_cast<uint64_t>(x) &mask)<<42) | ((static_cast<uint64_t>(y) &mask)<<21) | (static_cast<uint64_t>(z) &mask);
+	}
+
+	// Runs func for all indices in [0,count) on up to numThreads threads, including the calling one
+	template<class TFunc>
+		void parallel_for(uint32_t count,uint32_t numThreads,const std::atomic<bool> &cancel,const TFunc &func)
+	{
+		std::atomic<uint32_t> next = 0u;
+		auto worker = [&]() {
+			for(;;)
+			{
+				if(cancel)
+					return;
+				auto i = next++;
+				if(i >= count)
+					return;
+				func(i);
+			}
+		};
+		numThreads = umath::max(umath::min(numThreads,count),1u);
+		std::vector<std::thread> threads {};
+		threads.reserve(numThreads -1u);
+		for(auto i=1u;i<numThreads;++i)
+			threads.push_back(std::thread{worker});
+		worker();
+		for(auto &t : threads)
+			t.join();
+	}
+
+	// Welds the vertices, drops degenerate and tiny triangles and merges pairs of coplanar triangles into convex quads
+	uint32_t simplify_mesh(const al::FMGeometryManager::Mesh &mesh,uint32_t meshIndex,const al::FMGeometryManager::Settings &settings,std::vector<Polygon> &outPolygons)
+	{
+		auto invWeld = 1.f /umath::max(settings.weldDistance,0.0001f);
+		std::unordered_map<QuantizedVertex,uint32_t,QuantizedVertexHash> weldMap {};
+		weldMap.reserve(mesh.vertices.size());
+		std::vector<uint32_t> remap(mesh.vertices.size());
+		std::vector<Vector3> vertices {};
+		vertices.reserve(mesh.vertices.size());
+		for(auto i=decltype(mesh.vertices.size()){0u};i<mesh.vertices.size();++i)
+		{
+			auto &v = mesh.vertices[i];
+			QuantizedVertex key {
+				static_cast<int64_t>(std::floor(v.x *invWeld +0.5f)),
+				static_cast<int64_t>(std::floor(v.y *invWeld +0.5f)),
+				static_cast<int64_t>(std::floor(v.z *invWeld +0.5f))
+			};
+			auto it = weldMap.find(key);
+			if(it == weldMap.end())
+			{
+				it = weldMap.insert(std::make_pair(key,static_cast<uint32_t>(vertices.size()))).first;
+				vertices.push_back(v);
+			}
+			remap[i] = it->second;
+		}
+
+		struct Triangle
+		{
+			std::array<uint32_t,3> indices;
+			Vector3 normal;
+			bool merged;
+		};
+		auto numInputTriangles = static_cast<uint32_t>(mesh.indices.size() /3);
+		std::vector<Triangle> triangles {};
+		triangles.reserve(numInputTriangles);
+		for(auto i=0u;i<numInputTriangles;++i)
+		{
+			std::array<uint32_t,3> indices {};
+			auto valid = true;
+			for(auto j=0u;j<3u;++j)
+			{
+				auto idx = mesh.indices[i *3 +j];
+				if(idx >= remap.size())
+				{
+					valid = false;
+					break;
+				}
+				indices[j] = remap[idx];
+			}
+			if(valid == false || indices[0] == indices[1] || indices[1] == indices[2] || indices[0] == indices[2])
+				continue;
+			auto n = uvec::cross(vertices[indices[1]] -vertices[indices[0]],vertices[indices[2]] -vertices[indices[0]]);
+			auto l = uvec::length(n);
+			if(l *0.5f < settings.minTriangleArea)
+				continue;
+			triangles.push_back({indices,n /l,false});
+		}
+
+		// Edges shared by exactly two triangles are merge candidates
+		constexpr auto NON_MANIFOLD = std::numeric_limits<uint32_t>::max();
+		auto getEdgeKey = [](uint32_t a,uint32_t b) {return (static_cast<uint64_t>(umath::min(a,b))<<32) | umath::max(a,b);};
+		std::unordered_map<uint64_t,std::array<uint32_t,2>> edges {};
+		edges.reserve(triangles.size() *3);
+		for(auto i=decltype(triangles.size()){0u};i<triangles.size();++i)
+		{
+			for(auto e=0u;e<3u;++e)
+			{
+				auto key = getEdgeKey(triangles[i].indices[e],triangles[i].indices[(e +1) %3]);
+				auto it = edges.find(key);
+				if(it == edges.end())
+					edges.insert(std::make_pair(key,std::array<uint32_t,2>{static_cast<uint32_t>(i),NON_MANIFOLD}));
+				else if(it->second[1] == NON_MANIFOLD && it->second[0] != NON_MANIFOLD)
+					it->second[1] = static_cast<uint32_t>(i);
+				else
+					it->second = {NON_MANIFOLD,NON_MANIFOLD};
+			}
+		}
+		for(auto i=decltype(triangles.size()){0u};i<triangles.size();++i)
+		{
+			auto &tri = triangles[i];
+			if(tri.merged)
+				continue;
+			tri.merged = true;
+			Polygon polygon {};
+			polygon.mesh = meshIndex;
+			polygon.count = 3u;
+			for(auto j=0u;j<3u;++j)
+				polygon.vertices[j] = vertices[tri.indices[j]];
+			// The longest edge first, that's usually the diagonal of a quad that was split into triangles
+			std::array<uint32_t,3> edgeOrder {0u,1u,2u};
+			std::sort(edgeOrder.begin(),edgeOrder.end(),[&tri,&vertices](uint32_t e0,uint32_t e1) {
+				return uvec::length_sqr(vertices[tri.indices[(e0 +1) %3]] -vertices[tri.indices[e0]]) > uvec::length_sqr(vertices[tri.indices[(e1 +1) %3]] -vertices[tri.indices[e1]]);
+			});
+			for(auto e : edgeOrder)
+			{
+				auto a = tri.indices[e];
+				auto b = tri.indices[(e +1) %3];
+				auto c = tri.indices[(e +2) %3];
+				auto it = edges.find(getEdgeKey(a,b));
+				if(it == edges.end() || it->second[1] == NON_MANIFOLD)
+					continue;
+				auto &other = triangles[(it->second[0] == i) ? it->second[1] : it->second[0]];
+				if(other.merged || uvec::dot(tri.normal,other.normal) < COPLANAR_THRESHOLD)
+					continue;
+				auto w = other.indices[0];
+				for(auto idx : other.indices)
+				{
+					if(idx != a && idx != b)
+						w = idx;
+				}
+				// The opposite vertex goes between a and b, which keeps the winding
+				std::array<Vector3,4> quad {vertices[a],vertices[w],vertices[b],vertices[c]};
+				auto convex = true;
+				for(auto k=0u;k<4u;++k)
+				{
+					auto cross = uvec::cross(quad[(k +1) %4] -quad[k],quad[(k +2) %4] -quad[(k +1) %4]);
+					if(uvec::dot(cross,tri.normal) <= 0.f)
+					{
+						convex = false;
+						break;
+					}
+				}
+				if(convex == false)
+					continue;
+				other.merged = true;
+				polygon.vertices = quad;
+				polygon.count = 4u;
+				break;
+			}
+			outPolygons.push_back(polygon);
+		}
+		return numInputTriangles;
+	}
+};
+
+al::FMGeometryManager::FMGeometryManager(FMSoundSystem &system)
+	: m_system{system}
+{}
+al::FMGeometryManager::~FMGeometryManager()
+{
+	CancelBuild();
+	ReleaseCells(m_cells);
+}
+
+void al::FMGeometryManager::Build(std::vector<Mesh> &&meshes)
+{
+	CancelBuild();
+	m_bBuilding = true;
+	m_buildThread = std::thread{[this,meshes=std::move(meshes),settings=m_settings]() mutable {
+		RunBuild(std::move(meshes),settings);
+	}};
+}
+bool al::FMGeometryManager::IsBuilding() const {return m_bBuilding;}
+void al::FMGeometryManager::WaitForBuild()
+{
+	if(m_buildThread.joinable())
+		m_buildThread.join();
+}
+void al::FMGeometryManager::CancelBuild()
+{
+	m_bCancelBuild = true;
+	WaitForBuild();
+	m_bCancelBuild = false;
+	std::unique_lock<std::mutex> lock {m_resultMutex};
+	if(m_result != nullptr)
+		ReleaseCells(m_result->cells);
+	m_result = nullptr;
+}
+void al::FMGeometryManager::ReleaseCells(std::vector<Cell> &cells)
+{
+	for(auto &cell : cells)
+	{
+		if(cell.geometry != nullptr)
+			cell.geometry->release();
+	}
+	cells.clear();
+}
+void al::FMGeometryManager::Clear()
+{
+	CancelBuild();
+	ReleaseCells(m_cells);
+	m_inputTriangles = 0u;
+	m_buildTime = 0.0;
+	m_activeCells = 0u;
+	m_activePolygons = 0u;
+}
+
+void al::FMGeometryManager::RunBuild(std::vector<Mesh> meshes,Settings settings)
+{
+	auto t = std::chrono::steady_clock::now();
+	auto numThreads = (settings.workerThreads > 0u) ? settings.workerThreads : umath::max(std::thread::hardware_concurrency(),1u);
+	auto result = std::make_unique<BuildResult>();
+
+	// Simplification, one mesh per task
+	std::vector<std::vector<Polygon>> meshPolygons(meshes.size());
+	std::vector<uint32_t> meshTriangles(meshes.size(),0u);
+	parallel_for(static_cast<uint32_t>(meshes.size()),numThreads,m_bCancelBuild,[&](uint32_t i) {
+		meshTriangles[i] = simplify_mesh(meshes[i],i,settings,meshPolygons[i]);
+	});
+
+	// Spatial chunking by polygon centroid
+	auto invCellSize = 1.f /umath::max(settings.cellSize,1.f);
+	std::unordered_map<uint64_t,std::vector<const Polygon*>> cellPolygons {};
+	auto maxExtent = 0.f;
+	for(auto i=decltype(meshPolygons.size()){0u};i<meshPolygons.size();++i)
+	{
+		result->inputTriangles += meshTriangles[i];
+		for(auto &polygon : meshPolygons[i])
+		{
+			Vector3 centroid {};
+			for(auto j=0u;j<polygon.count;++j)
+			{
+				centroid += polygon.vertices[j];
+				auto v = al::to_audio_position(polygon.vertices[j]);
+				maxExtent = umath::max(maxExtent,umath::max(std::abs(v.x),umath::max(std::abs(v.y),std::abs(v.z))));
+			}
+			centroid /= static_cast<float>(polygon.count);
+			auto key = get_cell_key(
+				static_cast<int32_t>(std::floor(centroid.x *invCellSize)),
+				static_cast<int32_t>(std::floor(centroid.y *invCellSize)),
+				static_cast<int32_t>(std::floor(centroid.z *invCellSize))
+			);
+			cellPolygons[key].push_back(&polygon);
+		}
+	}
+	std::vector<const std::vector<const Polygon*>*> cellList {};
+	cellList.reserve(cellPolygons.size());
+	for(auto &pair : cellPolygons)
+		cellList.push_back(&pair.second);
+
+	// The world size has to be known before any geometry is created
+	auto &lowLevelSystem = m_system.GetFMODLowLevelSystem();
+	if(m_bCancelBuild == false && cellList.empty() == false)
+		al::check_result(lowLevelSystem.setGeometrySettings(maxExtent *1.01f +1.f));
+
+	// FMOD's geometry API is thread-safe, so each cell is built by a worker
+	result->cells.resize(cellList.size());
+	parallel_for(static_cast<uint32_t>(cellList.size()),numThreads,m_bCancelBuild,[&](uint32_t i) {
+		auto &polygons = *cellList[i];
+		auto numVertices = 0u;
+		for(auto *polygon : polygons)
+			numVertices += polygon->count;
+		auto &cell = result->cells[i];
+		auto r = lowLevelSystem.createGeometry(static_cast<int32_t>(polygons.size()),static_cast<int32_t>(numVertices),&cell.geometry);
+		if(r != FMOD_OK)
+		{
+			al::check_result(r);
+			cell.geometry = nullptr;
+			return;
+		}
+		// Inactive until the main thread takes over the cell
+		cell.geometry->setActive(false);
+		cell.min = polygons.front()->vertices[0];
+		cell.max = cell.min;
+		for(auto *polygon : polygons)
+		{
+			std::array<FMOD_VECTOR,4> fmVertices {};
+			for(auto j=0u;j<polygon->count;++j)
+			{
+				auto &v = polygon->vertices[j];
+				cell.min = {umath::min(cell.min.x,v.x),umath::min(cell.min.y,v.y),umath::min(cell.min.z,v.z)};
+				cell.max = {umath::max(cell.max.x,v.x),umath::max(cell.max.y,v.y),umath::max(cell.max.z,v.z)};
+				fmVertices[j] = al::to_custom_vector<FMOD_VECTOR>(al::to_audio_position(v));
+			}
+			auto &mesh = meshes[polygon->mesh];
+			int32_t polygonIndex;
+			if(cell.geometry->addPolygon(mesh.directOcclusion,mesh.reverbOcclusion,mesh.doubleSided,static_cast<int32_t>(polygon->count),fmVertices.data(),&polygonIndex) == FMOD_OK)
+				++cell.polygons;
+		}
+	});
+	result->buildTime = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() -t).count();
+
+	if(m_bCancelBuild)
+		ReleaseCells(result->cells);
+	else
+	{
+		std::unique_lock<std::mutex> lock {m_resultMutex};
+		m_result = std::move(result);
+	}
+	m_bBuilding = false;
+}
+
+void al::FMGeometryManager::SetSettings(const Settings &settings)
+{
+	m_settings = settings;
+	m_bActivationDirty = true;
+}
+const al::FMGeometryManager::Settings &al::FMGeometryManager::GetSettings() const {return m_settings;}
+al::FMGeometryManager::Stats al::FMGeometryManager::GetStats() const
+{
+	Stats stats {};
+	stats.inputTriangles = m_inputTriangles;
+	for(auto &cell : m_cells)
+		stats.polygons += cell.polygons;
+	stats.activePolygons = m_activePolygons;
+	stats.cells = static_cast<uint32_t>(m_cells.size());
+	stats.activeCells = m_activeCells;
+	stats.buildTime = m_buildTime;
+	stats.geometryCpuUsage = m_geometryCpuUsage;
+	stats.queries = m_lastQueries;
+	stats.queryTime = m_lastQueryTime;
+	return stats;
+}
+
+bool al::FMGeometryManager::GetOcclusion(const Vector3 &listenerPos,const Vector3 &sourcePos,float &outDirectOcclusion,float &outReverbOcclusion)
+{
+	auto t = std::chrono::steady_clock::now();
+	auto fmListener = al::to_custom_vector<FMOD_VECTOR>(al::to_audio_position(listenerPos));
+	auto fmSource = al::to_custom_vector<FMOD_VECTOR>(al::to_audio_position(sourcePos));
+	auto r = m_system.GetFMODLowLevelSystem().getGeometryOcclusion(&fmListener,&fmSource,&outDirectOcclusion,&outReverbOcclusion);
+	++m_queries;
+	m_queryTime += std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() -t).count();
+	al::check_result(r);
+	return r == FMOD_OK;
+}
+
+void al::FMGeometryManager::Update(const Vector3 &listenerPos,bool bWaitForBuild)
+{
+	if(bWaitForBuild)
+		WaitForBuild();
+	{
+		std::unique_lock<std::mutex> lock {m_resultMutex,std::try_to_lock};
+		if(lock.owns_lock() && m_result != nullptr)
+		{
+			ReleaseCells(m_cells);
+			m_cells = std::move(m_result->cells);
+			m_inputTriangles = m_result->inputTriangles;
+			m_buildTime = m_result->buildTime;
+			m_result = nullptr;
+			m_bActivationDirty = true;
+		}
+	}
+	if(m_buildThread.joinable() && m_bBuilding == false)
+		m_buildThread.join();
+
+	// The active set is only re-evaluated when the listener enters a different cell
+	auto invCellSize = 1.f /umath::max(m_settings.cellSize,1.f);
+	std::array<int32_t,3> listenerCell {
+		static_cast<int32_t>(std::floor(listenerPos.x *invCellSize)),
+		static_cast<int32_t>(std::floor(listenerPos.y *invCellSize)),
+		static_cast<int32_t>(std::floor(listenerPos.z *invCellSize))
+	};
+	if(listenerCell != m_listenerCell || m_bActivationDirty)
+	{
+		m_listenerCell = listenerCell;
+		m_bActivationDirty = false;
+		m_activeCells = 0u;
+		m_activePolygons = 0u;
+		auto radiusSqr = m_settings.activeRadius *m_settings.activeRadius;
+		for(auto &cell : m_cells)
+		{
+			if(cell.geometry == nullptr)
+				continue;
+			Vector3 closest {
+				umath::clamp(listenerPos.x,cell.min.x,cell.max.x),
+				umath::clamp(listenerPos.y,cell.min.y,cell.max.y),
+				umath::clamp(listenerPos.z,cell.min.z,cell.max.z)
+			};
+			auto active = uvec::length_sqr(closest -listenerPos) <= radiusSqr;
+			if(active)
+			{
+				++m_activeCells;
+				m_activePolygons += cell.polygons;
+			}
+			if(active == cell.active)
+				continue;
+			cell.active = active;
+			al::check_result(cell.geometry->setActive(active));
+		}
+	}
+
+	FMOD_CPU_USAGE usage {};
+	if(m_system.GetFMODLowLevelSystem().getCPUUsage(&usage) == FMOD_OK)
+		m_geometryCpuUsage = usage.geometry;
+	m_lastQueries = m_queries;
+	m_lastQueryTime = m_queryTime;
+	m_queries = 0u;
+	m_queryTime = 0.0;
+}
@@ -0,0 +1,130 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_GEOMETRY_HPP__
+#define __FMOD_GEOMETRY_HPP__
+
+#include <alsound_coordinate_system.hpp>
+#include <cinttypes>
+#include <vector>
+#include <array>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <limits>
+
+namespace FMOD
+{
+	class Geometry;
+};
+namespace al
+{
+	class FMSoundSystem;
+	// Occlusion through FMOD's geometry engine. Level meshes (in game space) are simplified and converted into FMOD geometry
+	// on worker threads. The geometry is split into cells of a uniform grid and only the cells around the listener are
+	// active, so FMOD's occlusion queries only have to consider nearby polygons.
+	class FMGeometryManager
+	{
+	public:
+		struct Mesh
+		{
+			std::vector<Vector3> vertices = {};
+			std::vector<uint32_t> indices = {}; // Triangle list
+			float directOcclusion = 1.f;
+			float reverbOcclusion = 1.f;
+			bool doubleSided = true;
+		};
+		struct Settings
+		{
+			// Cell size in game units
+			float cellSize = 2'048.f;
+			// Cells that are closer to the listener than this are active
+			float activeRadius = 4'096.f;
+			// Vertices closer than this are merged
+			float weldDistance = 1.f;
+			// Smaller triangles are dropped
+			float minTriangleArea = 4.f;
+			// 0 uses all hardware threads
+			uint32_t workerThreads = 0u;
+		};
+		struct Stats
+		{
+			uint32_t inputTriangles = 0u;
+			uint32_t polygons = 0u;
+			uint32_t activePolygons = 0u;
+			uint32_t cells = 0u;
+			uint32_t activeCells = 0u;
+			double buildTime = 0.0; // Milliseconds
+			// CPU usage of FMOD's geometry thread in percent, i.e. the cost of the occlusion queries of all channels
+			float geometryCpuUsage = 0.f;
+			// Explicit queries through GetOcclusion() since the last Update()
+			uint32_t queries = 0u;
+			double queryTime = 0.0; // Milliseconds
+		};
+
+		FMGeometryManager(FMSoundSystem &system);
+		~FMGeometryManager();
+
+		// Replaces the current geometry. The build runs in the background, the new geometry is used once it's complete.
+		void Build(std::vector<Mesh> &&meshes);
+		bool IsBuilding() const;
+		void WaitForBuild();
+		void Clear();
+
+		// Only affects geometry that is built afterwards, except for the active radius
+		void SetSettings(const Settings &settings);
+		const Settings &GetSettings() const;
+		Stats GetStats() const;
+
+		// Positions in game space; returns false if the occlusion couldn't be determined
+		bool GetOcclusion(const Vector3 &listenerPos,const Vector3 &sourcePos,float &outDirectOcclusion,float &outReverbOcclusion);
+
+		// If bWaitForBuild is set, a build that is still running is waited for and its result is used right away
+		void Update(const Vector3 &listenerPos,bool bWaitForBuild=false);
+	private:
+		struct Cell
+		{
+			FMOD::Geometry *geometry = nullptr;
+			Vector3 min = {};
+			Vector3 max = {};
+			uint32_t polygons = 0u;
+			bool active = false;
+		};
+		struct BuildResult
+		{
+			std::vector<Cell> cells = {};
+			uint32_t inputTriangles = 0u;
+			double buildTime = 0.0;
+		};
+		void RunBuild(std::vector<Mesh> meshes,Settings settings);
+		void CancelBuild();
+		void ReleaseCells(std::vector<Cell> &cells);
+
+		FMSoundSystem &m_system;
+		Settings m_settings = {};
+		std::vector<Cell> m_cells = {};
+		uint32_t m_inputTriangles = 0u;
+		double m_buildTime = 0.0;
+		std::array<int32_t,3> m_listenerCell = {
+			std::numeric_limits<int32_t>::max(),std::numeric_limits<int32_t>::max(),std::numeric_limits<int32_t>::max()
+		};
+		bool m_bActivationDirty = true;
+		uint32_t m_activeCells = 0u;
+		uint32_t m_activePolygons = 0u;
+		float m_geometryCpuUsage = 0.f;
+		uint32_t m_queries = 0u;
+		double m_queryTime = 0.0;
+		uint32_t m_lastQueries = 0u;
+		double m_lastQueryTime = 0.0;
+
+		std::thread m_buildThread;
+		std::atomic<bool> m_bCancelBuild = false;
+		std::atomic<bool> m_bBuilding = false;
+		mutable std::mutex m_resultMutex;
+		std::unique_ptr<BuildResult> m_result = nullptr;
+	};
+};
+
+#endif
@@ -0,0 +1,681 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_hrtf.hpp"
+#include "fmod_sound_system.hpp"
+#include "fmod_sound_source.hpp"
+#include "fmod_listener.hpp"
+#include <fmod_studio.hpp>
+#include <fsys/filesystem.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+	constexpr float SQRT_HALF = 0.70710678118654752f;
+	constexpr float RAD_TO_DEG = 57.295779513082321f;
+	// Little-endian reader for the .mhr format
+	class MhrReader
+	{
+	public:
+		MhrReader(const uint8_t *data,size_t size)
+			: m_data{data},m_size{size}
+		{}
+		bool IsValid() const {return m_bValid;}
+		uint32_t ReadUInt(uint32_t numBytes)
+		{
+			if(m_pos +numBytes > m_size)
+			{
+				m_bValid = false;
+				return 0u;
+			}
+			auto v = 0u;
+			for(auto i=0u;i<numBytes;++i)
+				v |= static_cast<uint32_t>(m_data[m_pos +i])<<(i *8u);
+			m_pos += numBytes;
+			return v;
+		}
+		// Signed 16 or 24 bit sample, normalized
+		float ReadSample(uint32_t numBytes)
+		{
+			auto v = ReadUInt(numBytes);
+			auto shift = 32u -numBytes *8u;
+			auto s = static_cast<int32_t>(v<<shift)>>shift;
+			return static_cast<float>(s) /static_cast<float>(1u<<(numBytes *8u -1u));
+		}
+		bool ReadMagic(const char *magic)
+		{
+			auto len = strlen(magic);
+			if(m_pos +len > m_size || memcmp(m_data +m_pos,magic,len) != 0)
+				return false;
+			m_pos += len;
+			return true;
+		}
+	private:
+		const uint8_t *m_data = nullptr;
+		size_t m_size = 0;
+		size_t m_pos = 0;
+		bool m_bValid = true;
+	};
+	struct MhrElevation
+	{
+		uint32_t numAzimuths = 0u;
+		uint32_t irOffset = 0u;
+	};
+	bool is_channel_gone(FMOD_RESULT r) {return r == FMOD_ERR_INVALID_HANDLE || r == FMOD_ERR_CHANNEL_STOLEN;}
+	float dot(const std::array<float,3> &a,const std::array<float,3> &b) {return a[0] *b[0] +a[1] *b[1] +a[2] *b[2];}
+	std::array<float,3> normalize(const std::array<float,3> &v)
+	{
+		auto l = std::sqrt(dot(v,v));
+		return (l > 0.f) ? std::array<float,3>{v[0] /l,v[1] /l,v[2] /l} : v;
+	}
+};
+
+std::shared_ptr<al::FMHrtfDataSet> al::FMHrtfDataSet::Load(const std::string &path,uint32_t frequency)
+{
+	auto f = FileManager::OpenFile(path.c_str(),"rb");
+	if(f == nullptr)
+	{
+		std::cout<<"[FMOD] Unable to open HRTF '"<<path<<"'!"<<std::endl;
+		return nullptr;
+	}
+	std::vector<uint8_t> data(f->GetSize());
+	if(f->Read(data.data(),data.size()) != data.size())
+		return nullptr;
+	auto hrtf = Create(data.data(),data.size(),frequency);
+	if(hrtf == nullptr)
+		std::cout<<"[FMOD] HRTF '"<<path<<"' is not a supported .mhr file!"<<std::endl;
+	return hrtf;
+}
+
+std::shared_ptr<al::FMHrtfDataSet> al::FMHrtfDataSet::Create(const uint8_t *data,size_t size,uint32_t frequency)
+{
+	MhrReader reader {data,size};
+	auto version = 0u;
+	if(reader.ReadMagic("MinPHR03"))
+		version = 3u;
+	else if(reader.ReadMagic("MinPHR02"))
+		version = 2u;
+	else
+		return nullptr;
+	auto rate = reader.ReadUInt(4u);
+	auto sampleBytes = 3u;
+	if(version == 2u)
+		sampleBytes = (reader.ReadUInt(1u) == 0u) ? 2u : 3u;
+	auto stereo = (reader.ReadUInt(1u) != 0u);
+	auto irSize = reader.ReadUInt(1u);
+	auto numFields = reader.ReadUInt(1u);
+	if(reader.IsValid() == false || rate == 0u || irSize == 0u || numFields == 0u)
+		return nullptr;
+
+	// Only the farthest field is used
+	std::vector<MhrElevation> elevations;
+	auto bestDistance = 0u;
+	auto numIrs = 0u;
+	for(auto fi=0u;fi<numFields;++fi)
+	{
+		auto distance = reader.ReadUInt(2u);
+		auto numElevations = reader.ReadUInt(1u);
+		std::vector<MhrElevation> fieldElevations(numElevations);
+		for(auto &ev : fieldElevations)
+		{
+			ev.numAzimuths = reader.ReadUInt(1u);
+			ev.irOffset = numIrs;
+			numIrs += ev.numAzimuths;
+		}
+		if(elevations.empty() || distance > bestDistance)
+		{
+			elevations = std::move(fieldElevations);
+			bestDistance = distance;
+		}
+	}
+	if(reader.IsValid() == false || elevations.size() < 2u || std::any_of(elevations.begin(),elevations.end(),[](const MhrElevation &ev) {return ev.numAzimuths == 0u;}))
+		return nullptr;
+
+	auto numEars = stereo ? 2u : 1u;
+	std::vector<float> coefficients(numIrs *irSize *numEars);
+	for(auto i=0u;i<numIrs;++i)
+	{
+		for(auto j=0u;j<irSize;++j)
+		{
+			for(auto e=0u;e<numEars;++e)
+				coefficients[(i *numEars +e) *irSize +j] = reader.ReadSample(sampleBytes);
+		}
+	}
+	// Version 3 stores delays with two fractional bits
+	auto delayScale = (version == 3u) ? 0.25f : 1.f;
+	std::vector<float> delays(numIrs *numEars);
+	auto maxDelay = 0.f;
+	for(auto &d : delays)
+	{
+		d = static_cast<float>(reader.ReadUInt(1u)) *delayScale;
+		maxDelay = umath::max(maxDelay,d);
+	}
+	if(reader.IsValid() == false)
+		return nullptr;
+
+	// Without measurements for the right ear, it mirrors the left ear
+	auto getIr = [&](uint32_t ev,uint32_t az,uint32_t ear,const float *&outIr,float &outDelay) {
+		auto &elevation = elevations[ev];
+		az %= elevation.numAzimuths;
+		if(stereo == false && ear == 1u)
+		{
+			az = (elevation.numAzimuths -az) %elevation.numAzimuths;
+			ear = 0u;
+		}
+		auto idx = (elevation.irOffset +az) *numEars +ear;
+		outIr = coefficients.data() +idx *irSize;
+		outDelay = delays[idx];
+	};
+
+	auto hrtf = std::shared_ptr<FMHrtfDataSet>{new FMHrtfDataSet{}};
+	hrtf->m_numAzimuths = 360u /GRID_RESOLUTION;
+	hrtf->m_numElevations = 180u /GRID_RESOLUTION +1u;
+	hrtf->m_grid.reserve(hrtf->m_numAzimuths *hrtf->m_numElevations);
+	auto numFrames = irSize +static_cast<uint32_t>(std::ceil(maxDelay)) +1u;
+	auto ratio = static_cast<float>(frequency) /static_cast<float>(rate);
+	auto numResampledFrames = static_cast<uint32_t>(std::ceil(static_cast<float>(numFrames) *ratio));
+	std::vector<float> ir(numFrames *2u);
+	std::vector<float> resampled(numResampledFrames *2u);
+	for(auto e=0u;e<hrtf->m_numElevations;++e)
+	{
+		auto elevation = -90.f +static_cast<float>(e *GRID_RESOLUTION);
+		auto evPos = (elevation +90.f) /180.f *static_cast<float>(elevations.size() -1u);
+		auto ev0 = umath::min(static_cast<uint32_t>(evPos),static_cast<uint32_t>(elevations.size() -1u));
+		auto ev1 = umath::min(ev0 +1u,static_cast<uint32_t>(elevations.size() -1u));
+		auto evWeight = evPos -static_cast<float>(ev0);
+		for(auto a=0u;a<hrtf->m_numAzimuths;++a)
+		{
+			auto azimuth = static_cast<float>(a *GRID_RESOLUTION);
+			std::fill(ir.begin(),ir.end(),0.f);
+			for(auto ear=0u;ear<2u;++ear)
+			{
+				// Bilinear interpolation between the four closest measurements; the delay is interpolated separately
+				// and applied afterwards, which keeps the minimum-phase responses from smearing
+				std::array<std::pair<const float*,float>,4> sources;
+				auto delay = 0.f;
+				auto numSources = 0u;
+				for(auto ev : {ev0,ev1})
+				{
+					auto wEv = (ev == ev0) ? (1.f -evWeight) : evWeight;
+					if(ev0 == ev1)
+						wEv = (numSources == 0u) ? 1.f : 0.f;
+					auto numAzimuths = elevations[ev].numAzimuths;
+					auto azPos = azimuth /360.f *static_cast<float>(numAzimuths);
+					auto az0 = static_cast<uint32_t>(azPos);
+					auto azWeight = azPos -static_cast<float>(az0);
+					for(auto i=0u;i<2u;++i)
+					{
+						const float *src;
+						float srcDelay;
+						getIr(ev,az0 +i,ear,src,srcDelay);
+						auto w = wEv *((i == 0u) ? (1.f -azWeight) : azWeight);
+						sources[numSources++] = {src,w};
+						delay += srcDelay *w;
+					}
+				}
+				auto delayFrames = static_cast<uint32_t>(delay);
+				auto frac = delay -static_cast<float>(delayFrames);
+				for(auto &src : sources)
+				{
+					if(src.second == 0.f)
+						continue;
+					for(auto j=0u;j<irSize;++j)
+					{
+						auto v = src.first[j] *src.second;
+						ir[(delayFrames +j) *2u +ear] += v *(1.f -frac);
+						ir[(delayFrames +j +1u) *2u +ear] += v *frac;
+					}
+				}
+			}
+			auto *samples = ir.data();
+			auto frames = numFrames;
+			if(rate != frequency)
+			{
+				// Linear resampling; the scale keeps the gain of the filter unchanged
+				auto scale = 1.f /ratio;
+				for(auto j=0u;j<numResampledFrames;++j)
+				{
+					auto pos = static_cast<float>(j) /ratio;
+					auto i0 = static_cast<uint32_t>(pos);
+					auto t = pos -static_cast<float>(i0);
+					for(auto ear=0u;ear<2u;++ear)
+					{
+						auto s0 = (i0 < numFrames) ? ir[i0 *2u +ear] : 0.f;
+						auto s1 = (i0 +1u < numFrames) ? ir[(i0 +1u) *2u +ear] : 0.f;
+						resampled[j *2u +ear] = (s0 +(s1 -s0) *t) *scale;
+					}
+				}
+				samples = resampled.data();
+				frames = numResampledFrames;
+			}
+			auto cell = FMImpulseResponse::Create(samples,frames,2u,BLOCK_SIZE);
+			if(cell == nullptr)
+				return nullptr;
+			hrtf->m_maxPartitions = umath::max(hrtf->m_maxPartitions,cell->GetPartitionCount());
+			hrtf->m_memoryUsage += static_cast<uint64_t>(cell->GetChannelCount()) *cell->GetPartitionCount() *cell->GetBinCount() *2u *sizeof(float);
+			hrtf->m_grid.push_back(cell);
+		}
+	}
+	return hrtf;
+}
+const al::FMImpulseResponse &al::FMHrtfDataSet::GetImpulseResponse(float azimuth,float elevation) const
+{
+	auto resolution = static_cast<float>(GRID_RESOLUTION);
+	azimuth = std::fmod(azimuth,360.f);
+	if(azimuth < 0.f)
+		azimuth += 360.f;
+	auto a = static_cast<uint32_t>(azimuth /resolution +0.5f) %m_numAzimuths;
+	auto e = static_cast<uint32_t>(umath::clamp((elevation +90.f) /resolution +0.5f,0.f,static_cast<float>(m_numElevations -1u)));
+	return *m_grid[e *m_numAzimuths +a];
+}
+uint32_t al::FMHrtfDataSet::GetMaxPartitionCount() const {return m_maxPartitions;}
+uint64_t al::FMHrtfDataSet::GetMemoryUsage() const {return m_memoryUsage;}
+
+////////////////
+
+class al::FMBinauralRenderer::CaptureProcessor
+	: public FMDspProcessor
+{
+public:
+	CaptureProcessor(Slot &slot)
+		: m_slot{slot}
+	{}
+	template<uint32_t TChannels>
+		void Process(const float *in,float *out,uint32_t numFrames)
+	{
+		// The signal includes the channel's volume and was panned to the center of the front speakers. Since the channel's
+		// 3D level is 0, FMOD hasn't applied any distance rolloff; the renderer applies it before the convolution.
+		auto &slot = m_slot;
+		auto count = umath::min(numFrames,static_cast<uint32_t>(slot.input.size()) -slot.inputWrite);
+		auto *dst = slot.input.data() +slot.inputWrite;
+		if constexpr(TChannels == 1u)
+			memcpy(dst,in,count *sizeof(float));
+		else
+		{
+			for(auto f=0u;f<count;++f)
+				dst[f] = (in[f *TChannels] +in[f *TChannels +1u]) *SQRT_HALF;
+		}
+		slot.inputWrite += count;
+		memset(out,0,numFrames *TChannels *sizeof(float));
+	}
+private:
+	Slot &m_slot;
+};
+
+class al::FMBinauralRenderer::MixerProcessor
+	: public FMDspProcessor
+{
+public:
+	MixerProcessor(FMBinauralRenderer &renderer,Group &group)
+		: m_renderer{renderer},m_group{group}
+	{}
+	template<uint32_t TChannels>
+		void Process(const float *in,float *out,uint32_t numFrames) {m_renderer.Mix<TChannels>(m_group,in,out,numFrames);}
+private:
+	FMBinauralRenderer &m_renderer;
+	Group &m_group;
+};
+
+al::FMBinauralRenderer::Slot::Slot(uint32_t maxPartitions)
+	: convolver{FMHrtfDataSet::BLOCK_SIZE,maxPartitions}
+{
+	// Room for a few mixer blocks, in case FMOD processes the channel in larger pieces than the renderer
+	input.resize(FMCustomDsp::MAX_BLOCK_FRAMES *4u);
+}
+
+std::unique_ptr<al::FMBinauralRenderer> al::FMBinauralRenderer::Create(FMSoundSystem &system,const std::shared_ptr<FMHrtfDataSet> &hrtf,uint32_t maxSources)
+{
+	if(hrtf == nullptr)
+		return nullptr;
+	auto renderer = std::unique_ptr<FMBinauralRenderer>{new FMBinauralRenderer{system,hrtf}};
+	auto &lowLevelSystem = system.GetFMODLowLevelSystem();
+	renderer->m_frequency = system.GetMixerFrequency();
+	al::check_result(lowLevelSystem.get3DSettings(nullptr,nullptr,&renderer->m_rolloffScale));
+	// All slots are allocated up front, the mixer never allocates
+	renderer->m_slots.reserve(maxSources);
+	renderer->m_freeSlots.reserve(maxSources);
+	for(auto i=0u;i<maxSources;++i)
+	{
+		auto slot = std::make_unique<Slot>(hrtf->GetMaxPartitionCount());
+		slot->capture = FMCustomDsp::Create(lowLevelSystem,"Binaural Capture",renderer->m_frequency,std::make_unique<CaptureProcessor>(*slot));
+		if(slot->capture == nullptr)
+			return nullptr;
+		renderer->m_slots.push_back(std::move(slot));
+		renderer->m_freeSlots.push_back(maxSources -1u -i);
+	}
+	renderer->m_maxSources = maxSources;
+	return renderer;
+}
+al::FMBinauralRenderer::FMBinauralRenderer(FMSoundSystem &system,const std::shared_ptr<FMHrtfDataSet> &hrtf)
+	: m_system{system},m_hrtf{hrtf}
+{}
+al::FMBinauralRenderer::~FMBinauralRenderer()
+{
+	for(auto i=0u;i<m_slots.size();++i)
+		RemoveSource(i);
+	for(auto &group : m_groups)
+	{
+		if(group->group == nullptr)
+			continue;
+		if(group->mixer != nullptr)
+			al::check_result(group->group->removeDSP(group->mixer->GetFMODDsp()));
+		al::check_result(group->group->release());
+	}
+	m_groups.clear();
+}
+
+al::FMBinauralRenderer::Group *al::FMBinauralRenderer::FindGroup(FMOD::ChannelGroup *parent)
+{
+	auto it = std::find_if(m_groups.begin(),m_groups.end(),[parent](const std::unique_ptr<Group> &group) {return group->parent == parent;});
+	if(it != m_groups.end())
+		return it->get();
+	auto &lowLevelSystem = m_system.GetFMODLowLevelSystem();
+	auto group = std::make_unique<Group>();
+	group->index = static_cast<uint32_t>(m_groups.size());
+	group->parent = parent;
+	group->wetLeft.resize(FMCustomDsp::MAX_BLOCK_FRAMES);
+	group->wetRight.resize(FMCustomDsp::MAX_BLOCK_FRAMES);
+	auto r = lowLevelSystem.createChannelGroup("Binaural",&group->group);
+	al::check_result(r);
+	if(r != FMOD_OK)
+		return nullptr;
+	// The binaural mix is routed through the group the channels came from, so its volume and effects still apply
+	if(parent != nullptr)
+		r = parent->addGroup(group->group,false);
+	if(r == FMOD_OK)
+	{
+		group->mixer = FMCustomDsp::Create(lowLevelSystem,"Binaural Renderer",m_frequency,std::make_unique<MixerProcessor>(*this,*group));
+		if(group->mixer == nullptr)
+			r = FMOD_ERR_MEMORY;
+	}
+	// The group's tail receives the mix of all of its channels, i.e. it's processed after their capture DSPs
+	if(r == FMOD_OK)
+		r = group->group->addDSP(FMOD_CHANNELCONTROL_DSP_TAIL,group->mixer->GetFMODDsp());
+	if(r != FMOD_OK)
+	{
+		al::check_result(r);
+		group->group->release();
+		return nullptr;
+	}
+	m_groups.push_back(std::move(group));
+	return m_groups.back().get();
+}
+
+bool al::FMBinauralRenderer::AddSource(FMSoundChannel &channel)
+{
+	if(channel.m_binauralSlot != INVALID_SLOT)
+		RemoveSource(channel.m_binauralSlot);
+	auto *fmChannel = channel.GetInternalSource();
+	if(fmChannel == nullptr)
+		return false;
+	if(m_freeSlots.empty() || m_numActive >= m_maxSources)
+	{
+		++m_rejectedSources;
+		return false;
+	}
+	auto slotIndex = m_freeSlots.back();
+	auto &slot = *m_slots[slotIndex];
+
+	FMOD::Sound *sound = nullptr;
+	auto numInputChannels = 1;
+	if(fmChannel->getCurrentSound(&sound) == FMOD_OK && sound != nullptr)
+		sound->getFormat(nullptr,nullptr,&numInputChannels,nullptr);
+	numInputChannels = umath::clamp(numInputChannels,1,2);
+	FMOD_SPEAKERMODE speakerMode;
+	al::check_result(m_system.GetFMODLowLevelSystem().getSoftwareFormat(nullptr,&speakerMode,nullptr));
+	auto numSpeakers = 0;
+	al::check_result(m_system.GetFMODLowLevelSystem().getSpeakerModeChannels(speakerMode,&numSpeakers));
+	if(numSpeakers < 2)
+		return false;
+
+	// 2D panning with a fixed matrix, which the capture DSP folds back into mono: mono sources are centered on the front
+	// speakers, stereo sources go to front left and right
+	std::array<float,FMCustomDsp::MAX_CHANNELS *2u> matrix {};
+	if(numInputChannels == 1)
+		matrix[0] = matrix[1] = SQRT_HALF;
+	else
+	{
+		matrix[0] = 1.f;
+		matrix[1 *2 +1] = 1.f;
+	}
+	auto r = fmChannel->set3DLevel(0.f);
+	if(r == FMOD_OK)
+		r = fmChannel->setMixMatrix(matrix.data(),umath::min(numSpeakers,static_cast<int32_t>(FMCustomDsp::MAX_CHANNELS)),numInputChannels,numInputChannels);
+	if(r == FMOD_OK)
+		r = fmChannel->getChannelGroup(&slot.previousGroup);
+	auto *group = (r == FMOD_OK) ? FindGroup(slot.previousGroup) : nullptr;
+	if(r == FMOD_OK && group == nullptr)
+		r = FMOD_ERR_INTERNAL;
+	// Added last, after the auxiliary sends, so the sends still receive the signal
+	if(r == FMOD_OK)
+		r = fmChannel->addDSP(FMOD_CHANNELCONTROL_DSP_HEAD,slot.capture->GetFMODDsp());
+	if(r == FMOD_OK)
+		r = fmChannel->setChannelGroup(group->group);
+	if(r != FMOD_OK)
+	{
+		if(is_channel_gone(r) == false)
+			al::check_result(r);
+		fmChannel->removeDSP(slot.capture->GetFMODDsp());
+		fmChannel->set3DLevel(1.f);
+		return false;
+	}
+	m_freeSlots.pop_back();
+	++m_numActive;
+	slot.owner = &channel;
+	slot.channel = fmChannel;
+	slot.group = group->index;
+	auto pos = GetListenerSpacePosition(slot);
+	slot.ir = &FindImpulseResponse(pos);
+	slot.gain = CalcDistanceGain(slot,std::sqrt(dot(pos,pos)));
+	++slot.generation;
+	slot.parameters.Set({slot.ir,slot.gain,slot.group,slot.generation,true});
+	channel.m_binauralSlot = slotIndex;
+	return true;
+}
+void al::FMBinauralRenderer::RemoveSource(FMSoundChannel &channel)
+{
+	if(channel.m_binauralSlot != INVALID_SLOT)
+		RemoveSource(channel.m_binauralSlot);
+}
+void al::FMBinauralRenderer::RemoveSource(uint32_t slotIndex)
+{
+	if(slotIndex >= m_slots.size())
+		return;
+	auto &slot = *m_slots[slotIndex];
+	if(slot.owner == nullptr)
+		return;
+	slot.parameters.Set({nullptr,1.f,slot.group,slot.generation,false});
+	// The FMOD channel may already have ended, in which case it has dropped the DSP by itself
+	auto r = slot.channel->removeDSP(slot.capture->GetFMODDsp());
+	if(r == FMOD_OK)
+	{
+		slot.channel->set3DLevel(1.f);
+		if(slot.previousGroup != nullptr)
+			slot.channel->setChannelGroup(slot.previousGroup);
+	}
+	else if(is_channel_gone(r) == false)
+		al::check_result(r);
+	slot.owner->m_binauralSlot = INVALID_SLOT;
+	slot.owner = nullptr;
+	slot.channel = nullptr;
+	slot.previousGroup = nullptr;
+	slot.ir = nullptr;
+	m_freeSlots.push_back(slotIndex);
+	--m_numActive;
+}
+
+std::array<float,3> al::FMBinauralRenderer::GetListenerSpacePosition(const Slot &slot) const
+{
+	FMOD_VECTOR pos {0.f,0.f,0.f};
+	slot.channel->get3DAttributes(&pos,nullptr);
+	// Head-relative positions are in FMOD's right-handed listener space, where forward is -Z
+	if((slot.owner->m_fmMode &FMOD_3D_HEADRELATIVE) != 0)
+		return {pos.x,pos.y,-pos.z};
+	std::array<float,3> rel {pos.x -m_listenerPosition[0],pos.y -m_listenerPosition[1],pos.z -m_listenerPosition[2]};
+	return {dot(rel,m_listenerRight),dot(rel,m_listenerUp),dot(rel,m_listenerForward)};
+}
+float al::FMBinauralRenderer::CalcDistanceGain(const Slot &slot,float distance) const
+{
+	auto distanceRange = slot.owner->GetAudioDistanceRange();
+	auto minDistance = distanceRange.first;
+	auto maxDistance = distanceRange.second;
+	if(distance <= minDistance)
+		return 1.f;
+	distance = umath::min(distance,maxDistance);
+	auto linear = (maxDistance > minDistance) ? ((maxDistance -distance) /(maxDistance -minDistance)) : 1.f;
+	auto inverse = minDistance /(minDistance +m_rolloffScale *(distance -minDistance));
+	auto mode = slot.owner->m_fmMode;
+	if((mode &FMOD_3D_LINEARROLLOFF) != 0)
+		return linear;
+	if((mode &FMOD_3D_LINEARSQUAREROLLOFF) != 0)
+		return linear *linear;
+	if((mode &FMOD_3D_INVERSETAPEREDROLLOFF) != 0)
+		return inverse *linear *linear;
+	return inverse;
+}
+const al::FMImpulseResponse &al::FMBinauralRenderer::FindImpulseResponse(const std::array<float,3> &dir) const
+{
+	auto azimuth = std::atan2(dir[0],dir[2]) *RAD_TO_DEG;
+	auto elevation = std::atan2(dir[1],std::sqrt(dir[0] *dir[0] +dir[2] *dir[2])) *RAD_TO_DEG;
+	return m_hrtf->GetImpulseResponse(azimuth,elevation);
+}
+
+void al::FMBinauralRenderer::Update(const FMListener &listener)
+{
+	auto &attr = listener.GetFMODAttributes();
+	m_listenerPosition = {attr.position.x,attr.position.y,attr.position.z};
+	m_listenerForward = normalize({attr.forward.x,attr.forward.y,attr.forward.z});
+	m_listenerUp = normalize({attr.up.x,attr.up.y,attr.up.z});
+	// Right-handed coordinate system (FMOD_INIT_3D_RIGHTHANDED)
+	auto &f = m_listenerForward;
+	auto &u = m_listenerUp;
+	m_listenerRight = normalize({f[1] *u[2] -f[2] *u[1],f[2] *u[0] -f[0] *u[2],f[0] *u[1] -f[1] *u[0]});
+
+	// One pass over all sources; the parameters are only handed to the mixer if the grid cell or the rolloff has changed
+	for(auto i=0u;i<m_slots.size();++i)
+	{
+		auto &slot = *m_slots[i];
+		if(slot.owner == nullptr)
+			continue;
+		bool playing;
+		if(is_channel_gone(slot.channel->isPlaying(&playing)))
+		{
+			RemoveSource(i);
+			continue;
+		}
+		auto pos = GetListenerSpacePosition(slot);
+		auto *ir = &FindImpulseResponse(pos);
+		auto gain = CalcDistanceGain(slot,std::sqrt(dot(pos,pos)));
+		if(ir == slot.ir && gain == slot.gain)
+			continue;
+		slot.ir = ir;
+		slot.gain = gain;
+		slot.parameters.Set({ir,gain,slot.group,slot.generation,true});
+	}
+}
+
+template<uint32_t TChannels>
+	void al::FMBinauralRenderer::Mix(Group &group,const float *in,float *out,uint32_t numFrames)
+{
+	memcpy(out,in,numFrames *TChannels *sizeof(float));
+	if constexpr(TChannels < 2u)
+		return;
+	else
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		auto numSourceFrames = 0ull;
+		for(auto &ptrSlot : m_slots)
+		{
+			auto &slot = *ptrSlot;
+			SlotParameters params;
+			if(slot.parameters.Fetch(params))
+			{
+				if(params.generation != slot.mixerParameters.generation)
+				{
+					// A new channel, nothing of the previous one may leak into it
+					slot.convolver.Reset();
+					slot.convolver.SetImpulseResponse(params.ir,0u);
+					slot.gainRamp = {};
+				}
+				else if(params.ir != slot.mixerParameters.ir && params.ir != nullptr)
+					slot.convolver.SetImpulseResponse(params.ir,1u);
+				slot.mixerParameters = params;
+				slot.gainRamp.SetTarget(params.gain);
+			}
+			if(slot.mixerParameters.active == false)
+			{
+				slot.inputRead = slot.inputWrite = 0u;
+				continue;
+			}
+			// Slots of other groups are mixed by their own renderer DSP
+			if(slot.mixerParameters.group != group.index)
+				continue;
+			auto count = umath::min(slot.inputWrite -slot.inputRead,numFrames);
+			if(count == 0u)
+				continue;
+			auto *input = slot.input.data() +slot.inputRead;
+			float gainStep;
+			auto gain = slot.gainRamp.Begin(count,gainStep);
+			for(auto f=0u;f<count;++f)
+			{
+				gain += gainStep;
+				input[f] *= gain;
+			}
+			slot.convolver.Process(input,group.wetLeft.data(),group.wetRight.data(),count);
+			for(auto f=0u;f<count;++f)
+			{
+				out[f *TChannels] += group.wetLeft[f];
+				out[f *TChannels +1u] += group.wetRight[f];
+			}
+			slot.inputRead += count;
+			if(slot.inputRead == slot.inputWrite)
+				slot.inputRead = slot.inputWrite = 0u;
+			numSourceFrames += count;
+		}
+		if(numSourceFrames == 0ull)
+			return;
+		auto t = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -t0).count();
+		m_processTime += static_cast<uint64_t>(t);
+		m_processedSourceFrames += numSourceFrames;
+	}
+}
+
+bool al::FMBinauralRenderer::SetMaxSources(uint32_t maxSources)
+{
+	if(maxSources > m_slots.size())
+	{
+		std::cout<<"[FMOD] Unable to raise the binaural source limit to "<<maxSources<<", only "<<m_slots.size()<<" slots have been allocated!"<<std::endl;
+		return false;
+	}
+	m_maxSources = maxSources;
+	return true;
+}
+uint32_t al::FMBinauralRenderer::GetMaxSources() const {return m_maxSources;}
+uint32_t al::FMBinauralRenderer::GetSlotCount() const {return static_cast<uint32_t>(m_slots.size());}
+uint32_t al::FMBinauralRenderer::GetAffordableSourceCount(double cpuBudget) const
+{
+	auto cost = GetStats().sourceCost;
+	if(cost <= 0.0)
+		return static_cast<uint32_t>(m_slots.size());
+	return static_cast<uint32_t>(umath::min(cpuBudget /cost,static_cast<double>(m_slots.size())));
+}
+al::FMBinauralRenderer::Stats al::FMBinauralRenderer::GetStats() const
+{
+	Stats stats {};
+	stats.activeSources = m_numActive;
+	stats.maxSources = m_maxSources;
+	stats.rejectedSources = m_rejectedSources;
+	auto frames = m_processedSourceFrames.load();
+	if(frames > 0ull && m_frequency > 0u)
+	{
+		auto audioTime = static_cast<double>(frames) /static_cast<double>(m_frequency);
+		stats.sourceCost = static_cast<double>(m_processTime.load()) *1e-9 /audioTime;
+	}
+	return stats;
+}
+const al::FMHrtfDataSet &al::FMBinauralRenderer::GetDataSet() const {return *m_hrtf;}
@@ -0,0 +1,166 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_HRTF_HPP__
+#define __FMOD_HRTF_HPP__
+
+#include "fmod_convolution.hpp"
+#include "fmod_custom_dsp.hpp"
+#include <cinttypes>
+#include <memory>
+#include <vector>
+#include <array>
+#include <string>
+#include <atomic>
+#include <limits>
+
+namespace FMOD
+{
+	class Channel;
+	class ChannelGroup;
+};
+namespace al
+{
+	class FMSoundSystem;
+	class FMSoundChannel;
+	class FMListener;
+	// Head-related impulse responses in the OpenAL Soft format (.mhr, version 2 and 3), e.g. converted from SOFA files
+	// with makemhr. The measured responses are interpolated onto a regular grid of directions once at load time and
+	// stored as spectra, so looking up the filter for a direction is a table access.
+	class FMHrtfDataSet
+	{
+	public:
+		static constexpr uint32_t BLOCK_SIZE = 128u;
+		static constexpr uint32_t GRID_RESOLUTION = 5u; // Degrees
+		static std::shared_ptr<FMHrtfDataSet> Load(const std::string &path,uint32_t frequency);
+		static std::shared_ptr<FMHrtfDataSet> Create(const uint8_t *data,size_t size,uint32_t frequency);
+
+		// Azimuth in degrees clockwise from the front, elevation in degrees from -90 (below) to 90 (above)
+		const FMImpulseResponse &GetImpulseResponse(float azimuth,float elevation) const;
+		uint32_t GetMaxPartitionCount() const;
+		uint64_t GetMemoryUsage() const;
+	private:
+		FMHrtfDataSet()=default;
+		std::vector<std::shared_ptr<FMImpulseResponse>> m_grid = {};
+		uint32_t m_numAzimuths = 0u;
+		uint32_t m_numElevations = 0u;
+		uint32_t m_maxPartitions = 0u;
+		uint64_t m_memoryUsage = 0ull;
+	};
+
+	// Renders 3D channels binaurally. A capture DSP at the end of each channel's DSP chain takes the signal and silences
+	// the direct output; the renderer DSP then convolves all captured sources in one batch per mixer block. FMOD's 3D
+	// panning is disabled for these channels, which also disables its distance rolloff, so the renderer applies the
+	// rolloff itself. Channels are moved into a binaural channel group below the group they were playing in, so the
+	// renderer is always processed after them and its output still passes through the volume and effects of that group.
+	// Rendering is intended for headphones, the result is written to the front left and right speakers.
+	class FMBinauralRenderer
+	{
+	public:
+		static constexpr uint32_t INVALID_SLOT = std::numeric_limits<uint32_t>::max();
+		struct Stats
+		{
+			uint32_t activeSources = 0u;
+			uint32_t maxSources = 0u;
+			// Channels that were rendered with regular panning because the source limit was reached
+			uint64_t rejectedSources = 0ull;
+			// Average CPU time per second of rendered audio for a single source, i.e. the fraction of a core one binaural source costs
+			double sourceCost = 0.0;
+		};
+		static std::unique_ptr<FMBinauralRenderer> Create(FMSoundSystem &system,const std::shared_ptr<FMHrtfDataSet> &hrtf,uint32_t maxSources);
+		~FMBinauralRenderer();
+
+		// Returns false if the channel has to use regular panning
+		bool AddSource(FMSoundChannel &channel);
+		void RemoveSource(FMSoundChannel &channel);
+		// Updates the filters of all sources for the listener's orientation
+		void Update(const FMListener &listener);
+
+		// Can be lowered at runtime to cap the binaural CPU cost; sources beyond the limit keep rendering until they're removed.
+		// The slots are allocated when the renderer is created, so values above GetSlotCount() are rejected.
+		bool SetMaxSources(uint32_t maxSources);
+		uint32_t GetMaxSources() const;
+		uint32_t GetSlotCount() const;
+		// Number of sources that fit into the given fraction of a CPU core, based on the measured cost so far
+		uint32_t GetAffordableSourceCount(double cpuBudget) const;
+		Stats GetStats() const;
+		const FMHrtfDataSet &GetDataSet() const;
+	private:
+		class CaptureProcessor;
+		class MixerProcessor;
+		struct SlotParameters
+		{
+			const FMImpulseResponse *ir = nullptr;
+			float gain = 1.f; // Distance rolloff
+			uint32_t group = 0u;
+			uint32_t generation = 0u;
+			bool active = false;
+		};
+		// One binaural group (and renderer DSP) per channel group that binaural channels were playing in
+		struct Group
+		{
+			uint32_t index = 0u;
+			FMOD::ChannelGroup *parent = nullptr;
+			FMOD::ChannelGroup *group = nullptr;
+			std::shared_ptr<FMCustomDsp> mixer = nullptr;
+			// Mixer output scratch
+			std::vector<float> wetLeft = {};
+			std::vector<float> wetRight = {};
+		};
+		struct Slot
+		{
+			Slot(uint32_t maxPartitions);
+			// Main thread
+			FMSoundChannel *owner = nullptr;
+			FMOD::Channel *channel = nullptr;
+			FMOD::ChannelGroup *previousGroup = nullptr;
+			const FMImpulseResponse *ir = nullptr;
+			float gain = 1.f;
+			uint32_t group = 0u;
+			uint32_t generation = 0u;
+			FMDspParameters<SlotParameters> parameters;
+			// Mixer thread
+			SlotParameters mixerParameters = {};
+			FMDspRamp gainRamp = {};
+			FMConvolver convolver;
+			std::vector<float> input = {};
+			uint32_t inputRead = 0u;
+			uint32_t inputWrite = 0u;
+			// Released first, so the capture DSP never outlives the slot
+			std::shared_ptr<FMCustomDsp> capture = nullptr;
+		};
+		FMBinauralRenderer(FMSoundSystem &system,const std::shared_ptr<FMHrtfDataSet> &hrtf);
+		void RemoveSource(uint32_t slotIndex);
+		// Returns nullptr if the group couldn't be created
+		Group *FindGroup(FMOD::ChannelGroup *parent);
+		// Position of the slot's channel in the listener's basis (right, up, forward)
+		std::array<float,3> GetListenerSpacePosition(const Slot &slot) const;
+		const FMImpulseResponse &FindImpulseResponse(const std::array<float,3> &dir) const;
+		// Same as FMOD's distance rolloff for the channel's rolloff mode and min/max distance
+		float CalcDistanceGain(const Slot &slot,float distance) const;
+		template<uint32_t TChannels>
+			void Mix(Group &group,const float *in,float *out,uint32_t numFrames);
+
+		FMSoundSystem &m_system;
+		std::shared_ptr<FMHrtfDataSet> m_hrtf = nullptr;
+		uint32_t m_frequency = 0u;
+		float m_rolloffScale = 1.f;
+		std::vector<std::unique_ptr<Slot>> m_slots = {};
+		std::vector<uint32_t> m_freeSlots = {};
+		uint32_t m_numActive = 0u;
+		uint32_t m_maxSources = 0u;
+		uint64_t m_rejectedSources = 0ull;
+		// Listener basis in audio space, from the last Update()
+		std::array<float,3> m_listenerPosition = {0.f,0.f,0.f};
+		std::array<float,3> m_listenerRight = {1.f,0.f,0.f};
+		std::array<float,3> m_listenerUp = {0.f,1.f,0.f};
+		std::array<float,3> m_listenerForward = {0.f,0.f,-1.f};
+		std::atomic<uint64_t> m_processTime = 0ull; // Nanoseconds
+		std::atomic<uint64_t> m_processedSourceFrames = 0ull;
+		// Only grows; the mixer DSPs reference their group directly
+		std::vector<std::unique_ptr<Group>> m_groups = {};
+	};
+};
+
+#endif
@@ -7,8 +7,8 @@
 #include <alsound_coordinate_system.hpp>
 #include <fmod_studio.hpp>
 
-al::FMListener::FMListener(al::ISoundSystem &system)
-	: IListener{system}
+al::FMListener::FMListener(al::ISoundSystem &system,uint32_t index)
+	: IListener{system},m_index{index}
 {}
 void al::FMListener::DoSetMetersPerUnit(float mu)
 {
@@ -20,30 +20,45 @@ void al::FMListener::SetGain(float gain)
 }
 void al::FMListener::SetPosition(const Vector3 &pos)
 {
+	m_gamePosition = pos;
 	auto posAudio = al::to_audio_position(pos);
-	auto &fmodSys = static_cast<FMSoundSystem&>(m_soundSystem).GetFMODSystem();
-	FMOD_3D_ATTRIBUTES attributes;
-	al::check_result(fmodSys.getListenerAttributes(0,&attributes));
-	attributes.position = {posAudio.x,posAudio.y,posAudio.z};
-	al::check_result(fmodSys.setListenerAttributes(0,&attributes));
+	m_attributes.position = {posAudio.x,posAudio.y,posAudio.z};
+	m_bAttributesDirty = true;
 }
 void al::FMListener::SetVelocity(const Vector3 &vel)
 {
 	auto velAudio = al::to_audio_position(vel);
-	auto &fmodSys = static_cast<FMSoundSystem&>(m_soundSystem).GetFMODSystem();
-	FMOD_3D_ATTRIBUTES attributes;
-	al::check_result(fmodSys.getListenerAttributes(0,&attributes));
-	attributes.velocity = {velAudio.x,velAudio.y,velAudio.z};
-	al::check_result(fmodSys.setListenerAttributes(0,&attributes));
+	m_attributes.velocity = {velAudio.x,velAudio.y,velAudio.z};
+	m_bAttributesDirty = true;
 }
 void al::FMListener::SetOrientation(const Vector3 &at,const Vector3 &up)
 {
 	auto atAudio = al::to_audio_direction(at);
 	auto atUp = al::to_audio_direction(up);
-	auto &fmodSys = static_cast<FMSoundSystem&>(m_soundSystem).GetFMODSystem();
-	FMOD_3D_ATTRIBUTES attributes;
-	al::check_result(fmodSys.getListenerAttributes(0,&attributes));
-	attributes.forward = {atAudio.x,atAudio.y,atAudio.z};
-	attributes.up = {atUp.x,atUp.y,atUp.z};
-	al::check_result(fmodSys.setListenerAttributes(0,&attributes));
+	m_attributes.forward = {atAudio.x,atAudio.y,atAudio.z};
+	m_attributes.up = {atUp.x,atUp.y,atUp.z};
+	m_bAttributesDirty = true;
+}
+void al::FMListener::SetWeight(float weight)
+{
+	m_weight = weight;
+	m_bWeightDirty = true;
+}
+float al::FMListener::GetWeight() const {return m_weight;}
+uint32_t al::FMListener::GetIndex() const {return m_index;}
+Vector3 al::FMListener::GetAudioPosition() const {return {m_attributes.position.x,m_attributes.position.y,m_attributes.position.z};}
+const Vector3 &al::FMListener::GetGamePosition() const {return m_gamePosition;}
+const FMOD_3D_ATTRIBUTES &al::FMListener::GetFMODAttributes() const {return m_attributes;}
+void al::FMListener::Commit(FMOD::Studio::System &fmSystem)
+{
+	if(m_bAttributesDirty)
+	{
+		al::check_result(fmSystem.setListenerAttributes(m_index,&m_attributes));
+		m_bAttributesDirty = false;
+	}
+	if(m_bWeightDirty)
+	{
+		al::check_result(fmSystem.setListenerWeight(m_index,m_weight));
+		m_bWeightDirty = false;
+	}
 }
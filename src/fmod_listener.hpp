@@ -6,7 +6,15 @@
 #define __FMOD_LISTENER_HPP__
 
 #include <alsound_listener.hpp>
+#include <fmod_common.h>
 
+namespace FMOD
+{
+	namespace Studio
+	{
+		class System;
+	};
+};
 namespace al
 {
 	class FMSoundSystem;
@@ -18,10 +26,34 @@ namespace al
 		virtual void SetPosition(const Vector3 &pos) override;
 		virtual void SetVelocity(const Vector3 &vel) override;
 		virtual void SetOrientation(const Vector3 &at,const Vector3 &up) override;
+
+		// Relative weight of this listener if multiple listeners are active (split-screen)
+		void SetWeight(float weight);
+		float GetWeight() const;
+		uint32_t GetIndex() const;
+		Vector3 GetAudioPosition() const;
+		// Last position passed to SetPosition, in game space (the base class position isn't kept up to date)
+		const Vector3 &GetGamePosition() const;
+		// Attributes in audio space, as they're passed to FMOD
+		const FMOD_3D_ATTRIBUTES &GetFMODAttributes() const;
 	protected:
-		FMListener(al::ISoundSystem &system);
+		FMListener(al::ISoundSystem &system,uint32_t index=0u);
 		virtual void DoSetMetersPerUnit(float mu) override;
+		// Pushes the locally cached attributes to FMOD, if they have changed since the last commit
+		void Commit(FMOD::Studio::System &fmSystem);
 		friend FMSoundSystem;
+	private:
+		uint32_t m_index = 0u;
+		float m_weight = 1.f;
+		bool m_bAttributesDirty = true;
+		bool m_bWeightDirty = false;
+		Vector3 m_gamePosition = {};
+		FMOD_3D_ATTRIBUTES m_attributes = {
+			{0.f,0.f,0.f},
+			{0.f,0.f,0.f},
+			{0.f,0.f,1.f},
+			{0.f,1.f,0.f}
+		};
 	};
 };
 
@@ -0,0 +1,55 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_load_policy.hpp"
+#include "fmod_sound_system.hpp"
+#include <fmod_studio.hpp>
+#include <algorithm>
+#include <cctype>
+
+static bool is_in_category(const std::string &path,const std::vector<std::string> &categories)
+{
+	if(categories.empty())
+		return false;
+	auto lpath = path;
+	std::transform(lpath.begin(),lpath.end(),lpath.begin(),[](unsigned char c) {return static_cast<char>(std::tolower(c));});
+	std::replace(lpath.begin(),lpath.end(),'\\','/');
+	return std::find_if(categories.begin(),categories.end(),[&lpath](const std::string &category) {
+		return lpath.find(category) != std::string::npos;
+	}) != categories.end();
+}
+
+static bool should_stream(const al::FMLoadPolicy &policy,const std::string &path,uint64_t fileSize)
+{
+	if(is_in_category(path,policy.streamCategories))
+		return true;
+	return policy.streamMinFileSize > 0ull && fileSize >= policy.streamMinFileSize;
+}
+
+static bool should_compress(const al::FMLoadPolicy &policy,const std::string &path)
+{
+	if(policy.compressSamples == false && is_in_category(path,policy.compressedCategories) == false)
+		return false;
+	auto dotPos = path.find_last_of('.');
+	if(dotPos == std::string::npos)
+		return false;
+	auto ext = path.substr(dotPos +1);
+	std::transform(ext.begin(),ext.end(),ext.begin(),[](unsigned char c) {return static_cast<char>(std::tolower(c));});
+	return std::find(policy.compressedExtensions.begin(),policy.compressedExtensions.end(),ext) != policy.compressedExtensions.end();
+}
+
+al::FMLoadParameters al::get_load_parameters(const FMLoadPolicy &policy,const std::string &path,uint64_t fileSize,bool allowCompression)
+{
+	FMLoadParameters params {};
+	params.stream = should_stream(policy,path,fileSize);
+	if(params.stream == false)
+	{
+		params.compressed = allowCompression && should_compress(policy,path);
+		params.mode = params.compressed ? (FMOD_DEFAULT | FMOD_CREATECOMPRESSEDSAMPLE) : FMOD_DEFAULT;
+		return params;
+	}
+	params.mode = FMOD_DEFAULT | FMOD_CREATESTREAM;
+	params.decodeBufferSize = policy.streamPrefetchFrames;
+	return params;
+}
@@ -0,0 +1,51 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_LOAD_POLICY_HPP__
+#define __FMOD_LOAD_POLICY_HPP__
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+#include <memory>
+
+namespace al
+{
+	// Determines how sound files are loaded by FMSoundSystem::DoLoadSound
+	struct FMLoadPolicy
+	{
+		// Sounds are streamed from disk instead of being decoded into memory if either of these apply. Only the file size
+		// is checked, so the decision never requires opening the file header. A streamed sound can only be played by one
+		// FMOD channel at a time; further channels that play the same buffer open a stream of their own.
+		uint64_t streamMinFileSize = 8ull *1'024ull *1'024ull; // 0 disables the check
+		std::vector<std::string> streamCategories = {"music/"};
+
+		// Size of the file buffer of each stream (System::setStreamBufferSize)
+		uint32_t streamFileBufferSize = 64 *1'024;
+		// Number of PCM frames that are decoded when the stream is opened, so playback can start without waiting
+		// for the stream thread. 0 uses the FMOD default (400ms).
+		uint32_t streamPrefetchFrames = 0u;
+
+		// Samples that aren't streamed can be kept compressed in memory (FMOD_CREATECOMPRESSEDSAMPLE) and are
+		// decoded by the mixer during playback, which trades mixer CPU time for memory. This applies to all
+		// samples if compressSamples is enabled, or to those matching one of the categories (or full paths) otherwise.
+		// FMOD only supports this for some formats (e.g. MP3 and IMA ADPCM), other files are decoded as usual.
+		bool compressSamples = false;
+		std::vector<std::string> compressedCategories = {};
+		std::vector<std::string> compressedExtensions = {"mp3","mp2","wav","fsb"};
+	};
+	struct FMLoadParameters
+	{
+		uint32_t mode = 0u; // FMOD_MODE
+		bool stream = false;
+		bool compressed = false;
+		uint32_t decodeBufferSize = 0u;
+		// File data held by the VFS if the sound is opened in place (FMOD_OPENMEMORY_POINT), must outlive the FMOD sound
+		std::shared_ptr<std::vector<uint8_t>> memory = nullptr;
+	};
+	// fileSize is the size of the file in the VFS (see FMFileSystem::QueryFile)
+	FMLoadParameters get_load_parameters(const FMLoadPolicy &policy,const std::string &path,uint64_t fileSize,bool allowCompression=true);
+};
+
+#endif
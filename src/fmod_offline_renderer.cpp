@@ -0,0 +1,227 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_offline_renderer.hpp"
+#include "fmod_sound_system.hpp"
+#include "fmod_custom_dsp.hpp"
+#include <fmod_studio.hpp>
+#include <fsys/filesystem.h>
+#include <chrono>
+#include <cmath>
+
+namespace
+{
+	constexpr uint16_t WAVE_FORMAT_PCM = 1u;
+	constexpr uint16_t WAVE_FORMAT_IEEE_FLOAT = 3u;
+	// Little-endian byte access, independent of the host's alignment requirements
+	uint32_t read_le(const uint8_t *data,uint32_t numBytes)
+	{
+		auto v = 0u;
+		for(auto i=0u;i<numBytes;++i)
+			v |= static_cast<uint32_t>(data[i])<<(i *8u);
+		return v;
+	}
+	void write_le(std::vector<uint8_t> &data,uint32_t v,uint32_t numBytes)
+	{
+		for(auto i=0u;i<numBytes;++i)
+			data.push_back(static_cast<uint8_t>((v>>(i *8u)) &0xFFu));
+	}
+	void write_tag(std::vector<uint8_t> &data,const char *tag) {data.insert(data.end(),tag,tag +4);}
+};
+
+class al::FMOfflineRenderer::CaptureProcessor
+	: public FMDspProcessor
+{
+public:
+	CaptureProcessor(Buffer &buffer)
+		: m_buffer{buffer}
+	{}
+	template<uint32_t TChannels>
+		void Process(const float *in,float *out,uint32_t numFrames)
+	{
+		// The NRT mixer runs on the thread that calls FMSoundSystem::Update(), so the buffer can be written directly
+		auto &buffer = m_buffer;
+		buffer.channels = TChannels;
+		buffer.samples.insert(buffer.samples.end(),in,in +numFrames *TChannels);
+		memcpy(out,in,numFrames *TChannels *sizeof(float));
+	}
+private:
+	Buffer &m_buffer;
+};
+
+std::unique_ptr<al::FMOfflineRenderer> al::FMOfflineRenderer::Create(FMSoundSystem &system,bool bCapture)
+{
+	auto &lowLevelSystem = system.GetFMODLowLevelSystem();
+	auto renderer = std::unique_ptr<FMOfflineRenderer>{new FMOfflineRenderer{system}};
+	renderer->m_blockSize = system.GetDSPBufferSize().first;
+	renderer->m_capture.frequency = system.GetMixerFrequency();
+	if(bCapture == false)
+		return renderer;
+	renderer->m_captureDsp = FMCustomDsp::Create(lowLevelSystem,"Offline Capture",renderer->m_capture.frequency,std::make_unique<CaptureProcessor>(renderer->m_capture));
+	if(renderer->m_captureDsp == nullptr)
+		return nullptr;
+	FMOD::ChannelGroup *masterGroup = nullptr;
+	al::check_result(lowLevelSystem.getMasterChannelGroup(&masterGroup));
+	if(masterGroup == nullptr)
+		return nullptr;
+	// The head is the output end of the group's DSP chain, after the master fader and all effects of the master group,
+	// i.e. this is exactly what would be sent to the device. The tail is the input end and would miss all of them.
+	al::check_result(masterGroup->addDSP(FMOD_CHANNELCONTROL_DSP_HEAD,renderer->m_captureDsp->GetFMODDsp()));
+	return renderer;
+}
+al::FMOfflineRenderer::FMOfflineRenderer(FMSoundSystem &system)
+	: m_system{system}
+{}
+al::FMOfflineRenderer::~FMOfflineRenderer()
+{
+	if(m_captureDsp == nullptr)
+		return;
+	FMOD::ChannelGroup *masterGroup = nullptr;
+	if(m_system.GetFMODLowLevelSystem().getMasterChannelGroup(&masterGroup) == FMOD_OK && masterGroup != nullptr)
+		masterGroup->removeDSP(m_captureDsp->GetFMODDsp());
+	m_captureDsp = nullptr;
+}
+
+void al::FMOfflineRenderer::Render(double seconds,const SceneScript &script)
+{
+	auto numFrames = static_cast<uint64_t>(std::ceil(seconds *m_capture.frequency));
+	auto numBlocks = (numFrames +m_blockSize -1u) /m_blockSize;
+	if(m_captureDsp != nullptr)
+		m_capture.samples.reserve(m_capture.samples.size() +numBlocks *m_blockSize *umath::max(m_capture.channels,2u));
+	auto t = std::chrono::steady_clock::now();
+	for(auto i=decltype(numBlocks){0u};i<numBlocks;++i)
+	{
+		if(script != nullptr)
+			script(GetTime());
+		m_system.Update();
+	}
+	m_wallTime += std::chrono::duration<double>(std::chrono::steady_clock::now() -t).count();
+}
+void al::FMOfflineRenderer::OnBlockMixed() {m_frames += m_blockSize;}
+double al::FMOfflineRenderer::GetBlockDuration() const {return static_cast<double>(m_blockSize) /m_capture.frequency;}
+double al::FMOfflineRenderer::GetTime() const {return static_cast<double>(m_frames) /m_capture.frequency;}
+al::FMOfflineRenderer::Stats al::FMOfflineRenderer::GetStats() const
+{
+	Stats stats {};
+	stats.frames = m_frames;
+	stats.renderedTime = GetTime();
+	stats.wallTime = m_wallTime;
+	stats.realtimeFactor = (m_wallTime > 0.0) ? (stats.renderedTime /m_wallTime) : 0.0;
+	return stats;
+}
+
+const al::FMOfflineRenderer::Buffer &al::FMOfflineRenderer::GetCapture() const {return m_capture;}
+void al::FMOfflineRenderer::ClearCapture() {m_capture.samples.clear();}
+bool al::FMOfflineRenderer::SaveCapture(const std::string &path) const {return SaveWav(path,m_capture);}
+
+al::FMOfflineRenderer::CompareResult al::FMOfflineRenderer::Compare(const Buffer &a,const Buffer &b,float tolerance)
+{
+	CompareResult result {};
+	if(a.channels != b.channels || a.frequency != b.frequency || a.channels == 0u)
+		return result;
+	auto framesA = a.samples.size() /a.channels;
+	auto framesB = b.samples.size() /b.channels;
+	result.comparedFrames = umath::min(framesA,framesB);
+	result.frameCountDifference = umath::max(framesA,framesB) -result.comparedFrames;
+	auto numSamples = result.comparedFrames *a.channels;
+	auto sumSqr = 0.0;
+	for(auto i=decltype(numSamples){0u};i<numSamples;++i)
+	{
+		auto err = std::abs(a.samples[i] -b.samples[i]);
+		result.maxError = umath::max(result.maxError,err);
+		sumSqr += static_cast<double>(err) *err;
+	}
+	if(numSamples > 0u)
+		result.rmsError = static_cast<float>(std::sqrt(sumSqr /numSamples));
+	result.match = (result.frameCountDifference == 0u && result.maxError <= tolerance);
+	return result;
+}
+al::FMOfflineRenderer::CompareResult al::FMOfflineRenderer::CompareToGolden(const std::string &goldenPath,float tolerance) const
+{
+	Buffer golden {};
+	if(LoadWav(goldenPath,golden) == false)
+	{
+		std::cout<<"[FMOD] Unable to load golden render '"<<goldenPath<<"'!"<<std::endl;
+		return {};
+	}
+	return Compare(m_capture,golden,tolerance);
+}
+
+bool al::FMOfflineRenderer::LoadWav(const std::string &path,Buffer &outBuffer)
+{
+	auto f = FileManager::OpenFile(path.c_str(),"rb");
+	if(f == nullptr)
+		return false;
+	std::vector<uint8_t> data(f->GetSize());
+	if(f->Read(data.data(),data.size()) != data.size() || data.size() < 12u)
+		return false;
+	if(memcmp(data.data(),"RIFF",4) != 0 || memcmp(data.data() +8,"WAVE",4) != 0)
+		return false;
+	auto format = 0u;
+	auto bitsPerSample = 0u;
+	outBuffer = {};
+	for(size_t offset=12u;offset +8u<=data.size();)
+	{
+		auto *chunk = data.data() +offset;
+		auto size = read_le(chunk +4,4u);
+		auto *body = chunk +8;
+		if(offset +8u +size > data.size())
+			return false;
+		if(memcmp(chunk,"fmt ",4) == 0 && size >= 16u)
+		{
+			format = read_le(body,2u);
+			outBuffer.channels = read_le(body +2,2u);
+			outBuffer.frequency = read_le(body +4,4u);
+			bitsPerSample = read_le(body +14,2u);
+		}
+		else if(memcmp(chunk,"data",4) == 0)
+		{
+			if(format == WAVE_FORMAT_IEEE_FLOAT && bitsPerSample == 32u)
+			{
+				outBuffer.samples.resize(size /sizeof(float));
+				memcpy(outBuffer.samples.data(),body,outBuffer.samples.size() *sizeof(float));
+			}
+			else if(format == WAVE_FORMAT_PCM && bitsPerSample == 16u)
+			{
+				outBuffer.samples.resize(size /sizeof(int16_t));
+				for(auto i=decltype(outBuffer.samples.size()){0u};i<outBuffer.samples.size();++i)
+					outBuffer.samples[i] = static_cast<int16_t>(read_le(body +i *2u,2u)) /32'768.f;
+			}
+			else
+				return false;
+			return outBuffer.channels > 0u;
+		}
+		offset += 8u +size +(size &1u); // Chunks are padded to an even size
+	}
+	return false;
+}
+bool al::FMOfflineRenderer::SaveWav(const std::string &path,const Buffer &buffer)
+{
+	auto dataSize = static_cast<uint32_t>(buffer.samples.size() *sizeof(float));
+	std::vector<uint8_t> data;
+	data.reserve(44u +dataSize);
+	write_tag(data,"RIFF");
+	write_le(data,36u +dataSize,4u);
+	write_tag(data,"WAVE");
+	write_tag(data,"fmt ");
+	write_le(data,16u,4u);
+	write_le(data,WAVE_FORMAT_IEEE_FLOAT,2u);
+	write_le(data,buffer.channels,2u);
+	write_le(data,buffer.frequency,4u);
+	write_le(data,buffer.frequency *buffer.channels *sizeof(float),4u); // Bytes per second
+	write_le(data,buffer.channels *sizeof(float),2u); // Block align
+	write_le(data,32u,2u);
+	write_tag(data,"data");
+	write_le(data,dataSize,4u);
+	auto *samples = reinterpret_cast<const uint8_t*>(buffer.samples.data());
+	data.insert(data.end(),samples,samples +dataSize);
+
+	auto f = FileManager::OpenFile<VFilePtrReal>(path.c_str(),"wb");
+	if(f == nullptr)
+	{
+		std::cout<<"[FMOD] Unable to write '"<<path<<"'!"<<std::endl;
+		return false;
+	}
+	return f->Write(data.data(),data.size()) == data.size();
+}
@@ -0,0 +1,87 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_OFFLINE_RENDERER_HPP__
+#define __FMOD_OFFLINE_RENDERER_HPP__
+
+#include <cinttypes>
+#include <vector>
+#include <memory>
+#include <string>
+#include <functional>
+
+namespace al
+{
+	class FMSoundSystem;
+	class FMCustomDsp;
+	// Non-realtime rendering without an audio device (FMOD_OUTPUTTYPE_NOSOUND_NRT / WAVWRITER_NRT), see
+	// FMSystemCreateInfo::offline. Every FMSoundSystem::Update() mixes exactly one DSP block and advances the simulated time
+	// by the block's duration, so the same scene script always produces the same output, as fast as the CPU allows.
+	// Sounds should be loaded synchronously by the script, asynchronous loads finish after an arbitrary number of blocks.
+	class FMOfflineRenderer
+	{
+	public:
+		// Called before every block with the simulated time of the block's start in seconds
+		using SceneScript = std::function<void(double)>;
+		struct Stats
+		{
+			uint64_t frames = 0ull;
+			double renderedTime = 0.0; // Seconds
+			double wallTime = 0.0; // Seconds
+			// Rendered time per wall-clock time, i.e. how many times faster than realtime the scene was mixed
+			double realtimeFactor = 0.0;
+		};
+		struct CompareResult
+		{
+			bool match = false;
+			float maxError = 0.f;
+			float rmsError = 0.f;
+			uint64_t comparedFrames = 0ull;
+			// Frames that are only in one of the two renders, these always count as a mismatch
+			uint64_t frameCountDifference = 0ull;
+		};
+		// Interleaved 32-bit float samples
+		struct Buffer
+		{
+			std::vector<float> samples = {};
+			uint32_t channels = 0u;
+			uint32_t frequency = 0u;
+		};
+
+		static std::unique_ptr<FMOfflineRenderer> Create(FMSoundSystem &system,bool bCapture);
+		~FMOfflineRenderer();
+
+		// Renders at least the given number of seconds (rounded up to whole blocks)
+		void Render(double seconds,const SceneScript &script=nullptr);
+		// Called by FMSoundSystem::Update()
+		void OnBlockMixed();
+		double GetBlockDuration() const;
+		double GetTime() const;
+		Stats GetStats() const;
+
+		// Mixer output since the renderer was created (or since the last ClearCapture()), empty if capturing is disabled
+		const Buffer &GetCapture() const;
+		void ClearCapture();
+		bool SaveCapture(const std::string &path) const;
+
+		// Both renders have to have the same channel count and frequency; the tolerance is the maximum absolute error per sample
+		static CompareResult Compare(const Buffer &a,const Buffer &b,float tolerance);
+		CompareResult CompareToGolden(const std::string &goldenPath,float tolerance) const;
+
+		// 16-bit PCM and 32-bit float WAV files
+		static bool LoadWav(const std::string &path,Buffer &outBuffer);
+		static bool SaveWav(const std::string &path,const Buffer &buffer);
+	private:
+		class CaptureProcessor;
+		FMOfflineRenderer(FMSoundSystem &system);
+		FMSoundSystem &m_system;
+		std::shared_ptr<FMCustomDsp> m_captureDsp = nullptr;
+		Buffer m_capture = {};
+		uint32_t m_blockSize = 0u;
+		uint64_t m_frames = 0ull;
+		double m_wallTime = 0.0;
+	};
+};
+
+#endif
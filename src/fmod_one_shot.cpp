@@ -0,0 +1,139 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_one_shot.hpp"
+#include "fmod_sound_system.hpp"
+#include "fmod_sound_buffer.hpp"
+#include <fmod_studio.hpp>
+
+al::FMOneShotPlayer::FMOneShotPlayer(FMSoundSystem &system)
+	: m_system{system}
+{}
+
+void al::FMOneShotPlayer::SetMaxOneShots(uint32_t count)
+{
+	StopAll();
+	m_slots.clear();
+	m_slots.resize(count);
+	m_freeSlots.clear();
+	m_freeSlots.reserve(count);
+	for(auto i=count;i>0u;--i)
+	{
+		m_slots[i -1u].player = this;
+		m_freeSlots.push_back(i -1u);
+	}
+}
+uint32_t al::FMOneShotPlayer::GetMaxOneShots() const {return static_cast<uint32_t>(m_slots.size());}
+const al::FMOneShotPlayer::Stats &al::FMOneShotPlayer::GetStats() const {return m_stats;}
+
+al::FMOneShotPlayer::Slot *al::FMOneShotPlayer::FindSlot(FMOneShotHandle handle)
+{
+	if(handle.index >= m_slots.size())
+		return nullptr;
+	auto &slot = m_slots[handle.index];
+	if(slot.channel == nullptr || slot.generation != handle.generation)
+		return nullptr;
+	return &slot;
+}
+
+void al::FMOneShotPlayer::Release(Slot &slot)
+{
+	if(slot.channel == nullptr)
+		return;
+	// Detach first, so the END callback of a stopped channel can't release the slot a second time
+	slot.channel->setUserData(nullptr);
+	slot.channel = nullptr;
+	++slot.generation;
+	if(slot.buffer != nullptr)
+		slot.buffer->RemoveChannelReference();
+	slot.buffer = nullptr;
+	m_freeSlots.push_back(static_cast<uint32_t>(&slot -m_slots.data()));
+	--m_stats.active;
+}
+
+al::FMOneShotHandle al::FMOneShotPlayer::Play(FMSoundBuffer &buffer,const Vector3 &pos,float gain,float pitch,uint32_t priority)
+{
+	auto *sound = buffer.GetFMODSound();
+	// Playing a stream would steal it from the channel that is already playing it
+	if(sound == nullptr || buffer.IsReady() == false || buffer.IsStreamed())
+		return {};
+	if(m_freeSlots.empty())
+	{
+		++m_stats.dropped;
+		return {};
+	}
+	auto &defaults = buffer.GetChannelDefaults();
+	FMOD::Channel *channel = nullptr;
+	auto r = m_system.GetFMODLowLevelSystem().playSound(sound,nullptr,true,&channel);
+	al::check_result(r);
+	if(r != FMOD_OK || channel == nullptr)
+		return {};
+
+	// Everything is set in one pass while the channel is still paused; values that match the defaults
+	// of the sound are already in place
+	auto mode = (defaults.mode &~(FMOD_2D | FMOD_3D_HEADRELATIVE | FMOD_LOOP_NORMAL | FMOD_LOOP_BIDI)) | FMOD_3D | FMOD_3D_WORLDRELATIVE | FMOD_LOOP_OFF;
+	if(mode != defaults.mode)
+		al::check_result(channel->setMode(mode));
+	auto fmPos = al::to_custom_vector<FMOD_VECTOR>(al::to_audio_position(pos));
+	FMOD_VECTOR fmVel {0.f,0.f,0.f};
+	al::check_result(channel->set3DAttributes(&fmPos,&fmVel));
+	if(priority != defaults.priority)
+		al::check_result(channel->setPriority(priority));
+	if(gain != 1.f)
+		al::check_result(channel->setVolume(gain));
+	if(pitch != 1.f)
+		al::check_result(channel->setPitch(pitch));
+
+	auto idx = m_freeSlots.back();
+	m_freeSlots.pop_back();
+	auto &slot = m_slots[idx];
+	slot.channel = channel;
+	slot.buffer = &buffer;
+	// The buffer must not be evicted while it's playing
+	buffer.AddChannelReference();
+	al::check_result(channel->setUserData(&slot));
+	al::check_result(channel->setCallback([](FMOD_CHANNELCONTROL *channelControl,FMOD_CHANNELCONTROL_TYPE controlType,FMOD_CHANNELCONTROL_CALLBACK_TYPE callbackType,void *commandData1,void *commandData2) -> FMOD_RESULT {
+		if(callbackType != FMOD_CHANNELCONTROL_CALLBACK_END)
+			return FMOD_RESULT::FMOD_OK;
+		void *userData = nullptr;
+		reinterpret_cast<FMOD::ChannelControl*>(channelControl)->getUserData(&userData);
+		auto *slot = static_cast<Slot*>(userData);
+		if(slot != nullptr && slot->player != nullptr)
+			slot->player->Release(*slot);
+		return FMOD_RESULT::FMOD_OK;
+	}));
+	++m_stats.active;
+	++m_stats.played;
+	if(channel->setPaused(false) != FMOD_OK)
+	{
+		// Release() detaches the slot from the channel, the paused channel itself has to be stopped as well
+		Release(slot);
+		channel->stop();
+		return {};
+	}
+	return {idx,slot.generation};
+}
+
+void al::FMOneShotPlayer::Stop(FMOneShotHandle handle)
+{
+	auto *slot = FindSlot(handle);
+	if(slot == nullptr)
+		return;
+	auto *channel = slot->channel;
+	Release(*slot);
+	channel->stop();
+}
+bool al::FMOneShotPlayer::IsPlaying(FMOneShotHandle handle) const {return const_cast<FMOneShotPlayer*>(this)->FindSlot(handle) != nullptr;}
+
+void al::FMOneShotPlayer::StopAll()
+{
+	for(auto &slot : m_slots)
+	{
+		auto *channel = slot.channel;
+		if(channel == nullptr)
+			continue;
+		Release(slot);
+		channel->stop();
+	}
+}
@@ -0,0 +1,74 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_ONE_SHOT_HPP__
+#define __FMOD_ONE_SHOT_HPP__
+
+#include <alsound_coordinate_system.hpp>
+#include <cinttypes>
+#include <vector>
+#include <limits>
+
+namespace FMOD
+{
+	class Channel;
+};
+namespace al
+{
+	class FMSoundSystem;
+	class FMSoundBuffer;
+	// Handles stay valid until the one-shot has ended; afterwards the slot may be reused and the generation
+	// check makes the old handle a no-op.
+	struct FMOneShotHandle
+	{
+		static constexpr uint32_t INVALID_INDEX = std::numeric_limits<uint32_t>::max();
+		uint32_t index = INVALID_INDEX;
+		uint32_t generation = 0u;
+		bool IsValid() const {return index != INVALID_INDEX;}
+	};
+	// Fire-and-forget playback directly on FMOD channels, without an FMSoundChannel object. One-shots are
+	// tracked in a fixed slot table, so playing them doesn't allocate. They aren't managed by FMVoiceManager,
+	// FMOD's own channel priorities decide which ones are audible.
+	class FMOneShotPlayer
+	{
+	public:
+		struct Stats
+		{
+			uint32_t active = 0u;
+			uint64_t played = 0ull;
+			// One-shots that couldn't be played because all slots were in use
+			uint64_t dropped = 0ull;
+		};
+		FMOneShotPlayer(FMSoundSystem &system);
+		FMOneShotPlayer(const FMOneShotPlayer&)=delete;
+		FMOneShotPlayer &operator=(const FMOneShotPlayer&)=delete;
+		// Must not be called while one-shots are playing
+		void SetMaxOneShots(uint32_t count);
+		uint32_t GetMaxOneShots() const;
+
+		// The position is in game space
+		FMOneShotHandle Play(FMSoundBuffer &buffer,const Vector3 &pos,float gain,float pitch,uint32_t priority);
+		void Stop(FMOneShotHandle handle);
+		bool IsPlaying(FMOneShotHandle handle) const;
+		void StopAll();
+		const Stats &GetStats() const;
+	private:
+		struct Slot
+		{
+			FMOneShotPlayer *player = nullptr;
+			FMOD::Channel *channel = nullptr;
+			FMSoundBuffer *buffer = nullptr;
+			uint32_t generation = 0u;
+		};
+		Slot *FindSlot(FMOneShotHandle handle);
+		void Release(Slot &slot);
+
+		FMSoundSystem &m_system;
+		std::vector<Slot> m_slots = {};
+		std::vector<uint32_t> m_freeSlots = {};
+		Stats m_stats = {};
+	};
+};
+
+#endif
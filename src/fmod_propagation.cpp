@@ -0,0 +1,553 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_propagation.hpp"
+#include "fmod_sound_system.hpp"
+#include "fmod_sound_source.hpp"
+#include <fmod_studio.hpp>
+#include <algorithm>
+#include <chrono>
+#include <queue>
+#include <cmath>
+
+namespace
+{
+	// EFX air absorption, gainHF per meter for an air absorption factor of 1
+	constexpr float AIR_ABSORPTION_GAIN_HF = 0.99426f;
+	constexpr float RAD_TO_DEG = 57.295779513082321f;
+	// Changes below this aren't audible, so the FMOD calls are skipped
+	constexpr float APPLY_EPSILON = 0.001f;
+};
+
+al::FMPropagationGraph::FMPropagationGraph()
+{
+	m_thread = std::thread{[this]() {RunWorker();}};
+}
+al::FMPropagationGraph::~FMPropagationGraph()
+{
+	{
+		std::unique_lock<std::mutex> lock {m_mutex};
+		m_bRunning = false;
+	}
+	m_condition.notify_one();
+	m_thread.join();
+}
+
+al::FMPropagationGraph::RoomId al::FMPropagationGraph::AddRoom(const Vector3 &min,const Vector3 &max)
+{
+	RoomId room;
+	if(m_freeRooms.empty() == false)
+	{
+		room = m_freeRooms.back();
+		m_freeRooms.pop_back();
+	}
+	else
+	{
+		room = static_cast<RoomId>(m_rooms.size());
+		m_rooms.push_back({});
+	}
+	m_rooms[room] = {};
+	m_rooms[room].valid = true;
+	AddRoomBounds(room,min,max);
+	InvalidateTopology(true);
+	return room;
+}
+void al::FMPropagationGraph::AddRoomBounds(RoomId room,const Vector3 &min,const Vector3 &max)
+{
+	if(room >= m_rooms.size() || m_rooms[room].valid == false)
+		return;
+	m_rooms[room].bounds.push_back({
+		{umath::min(min.x,max.x),umath::min(min.y,max.y),umath::min(min.z,max.z)},
+		{umath::max(min.x,max.x),umath::max(min.y,max.y),umath::max(min.z,max.z)}
+	});
+	InvalidateRooms();
+}
+void al::FMPropagationGraph::RemoveRoom(RoomId room)
+{
+	if(room >= m_rooms.size() || m_rooms[room].valid == false)
+		return;
+	auto portals = m_rooms[room].portals;
+	for(auto portal : portals)
+		RemovePortal(portal);
+	m_rooms[room] = {};
+	m_freeRooms.push_back(room);
+	InvalidateRooms();
+	InvalidateTopology(true);
+}
+bool al::FMPropagationGraph::IsInRoom(RoomId room,const Vector3 &pos) const
+{
+	if(room >= m_rooms.size())
+		return false;
+	for(auto &bounds : m_rooms[room].bounds)
+	{
+		if(pos.x >= bounds.min.x && pos.y >= bounds.min.y && pos.z >= bounds.min.z && pos.x <= bounds.max.x && pos.y <= bounds.max.y && pos.z <= bounds.max.z)
+			return true;
+	}
+	return false;
+}
+al::FMPropagationGraph::RoomId al::FMPropagationGraph::FindRoom(const Vector3 &pos) const
+{
+	for(auto i=decltype(m_rooms.size()){0u};i<m_rooms.size();++i)
+	{
+		if(IsInRoom(static_cast<RoomId>(i),pos))
+			return static_cast<RoomId>(i);
+	}
+	return INVALID_ROOM;
+}
+
+al::FMPropagationGraph::PortalId al::FMPropagationGraph::AddPortal(RoomId roomA,RoomId roomB,const Vector3 &pos,float openness)
+{
+	if(roomA == roomB || roomA >= m_rooms.size() || roomB >= m_rooms.size() || m_rooms[roomA].valid == false || m_rooms[roomB].valid == false)
+		return INVALID_PORTAL;
+	PortalId portal;
+	if(m_freePortals.empty() == false)
+	{
+		portal = m_freePortals.back();
+		m_freePortals.pop_back();
+	}
+	else
+	{
+		portal = static_cast<PortalId>(m_portals.size());
+		m_portals.push_back({});
+	}
+	auto &p = m_portals[portal];
+	p = {};
+	p.rooms = {roomA,roomB};
+	p.position = pos;
+	p.openness = umath::clamp(openness,0.f,1.f);
+	p.valid = true;
+	m_rooms[roomA].portals.push_back(portal);
+	m_rooms[roomB].portals.push_back(portal);
+	InvalidateTopology(true);
+	return portal;
+}
+void al::FMPropagationGraph::RemovePortal(PortalId portal)
+{
+	if(portal >= m_portals.size() || m_portals[portal].valid == false)
+		return;
+	for(auto room : m_portals[portal].rooms)
+	{
+		auto &portals = m_rooms[room].portals;
+		auto it = std::find(portals.begin(),portals.end(),portal);
+		if(it != portals.end())
+			portals.erase(it);
+	}
+	m_portals[portal] = {};
+	m_freePortals.push_back(portal);
+	InvalidateTopology(true);
+}
+void al::FMPropagationGraph::SetPortalOpenness(PortalId portal,float openness)
+{
+	if(portal >= m_portals.size() || m_portals[portal].valid == false)
+		return;
+	openness = umath::clamp(openness,0.f,1.f);
+	if(openness == m_portals[portal].openness)
+		return;
+	m_portals[portal].openness = openness;
+	InvalidateTopology(false);
+}
+float al::FMPropagationGraph::GetPortalOpenness(PortalId portal) const
+{
+	return (portal < m_portals.size() && m_portals[portal].valid) ? m_portals[portal].openness : 0.f;
+}
+void al::FMPropagationGraph::SetPortalTransmission(PortalId portal,float closedGain,float closedGainHF)
+{
+	if(portal >= m_portals.size() || m_portals[portal].valid == false)
+		return;
+	m_portals[portal].closedGain = umath::clamp(closedGain,0.f,1.f);
+	m_portals[portal].closedGainHF = umath::clamp(closedGainHF,0.f,1.f);
+	InvalidateTopology(false);
+}
+void al::FMPropagationGraph::Clear()
+{
+	m_rooms.clear();
+	m_freeRooms.clear();
+	m_portals.clear();
+	m_freePortals.clear();
+	InvalidateRooms();
+	InvalidateTopology(true);
+}
+
+void al::FMPropagationGraph::SetSettings(const Settings &settings)
+{
+	m_settings = settings;
+	// Forces a new path update
+	++m_version;
+}
+const al::FMPropagationGraph::Settings &al::FMPropagationGraph::GetSettings() const {return m_settings;}
+al::FMPropagationGraph::Stats al::FMPropagationGraph::GetStats() const
+{
+	Stats stats {};
+	stats.roomCount = static_cast<uint32_t>(m_rooms.size() -m_freeRooms.size());
+	stats.portalCount = static_cast<uint32_t>(m_portals.size() -m_freePortals.size());
+	stats.skippedPathUpdates = m_skippedPathUpdates;
+	stats.appliedChannels = m_appliedChannels;
+	std::unique_lock<std::mutex> lock {m_mutex};
+	stats.pathUpdates = m_pathUpdates;
+	stats.lastPathUpdateTime = m_lastPathUpdateTime;
+	return stats;
+}
+
+void al::FMPropagationGraph::InvalidateRooms()
+{
+	for(auto &entry : m_entries)
+		entry.roomValid = false;
+	m_bAllDirty = true;
+	// The listener may be in a different room now
+	++m_version;
+}
+void al::FMPropagationGraph::InvalidateTopology(bool bEdgesChanged)
+{
+	m_bEdgesDirty = m_bEdgesDirty || bEdgesChanged;
+	m_bTransmissionDirty = true;
+	++m_version;
+}
+std::shared_ptr<const al::FMPropagationGraph::Topology> al::FMPropagationGraph::GetTopology()
+{
+	if(m_topology != nullptr && m_bEdgesDirty == false && m_bTransmissionDirty == false)
+		return m_topology;
+	auto topology = std::make_shared<Topology>();
+	if(m_topology != nullptr && m_bEdgesDirty == false)
+		topology->graph = m_topology->graph; // Only the openness has changed
+	else
+	{
+		// Every portal is connected to all other portals of the rooms it leads into
+		auto graph = std::make_shared<Graph>();
+		auto numNodes = m_portals.size() *2;
+		graph->positions.resize(m_portals.size());
+		graph->nodeRooms.resize(numNodes,INVALID_ROOM);
+		graph->edgeOffsets.resize(numNodes +1,0u);
+		graph->roomPortals.resize(m_rooms.size());
+		for(auto i=decltype(m_rooms.size()){0u};i<m_rooms.size();++i)
+			graph->roomPortals[i] = m_rooms[i].portals;
+		for(auto p=decltype(m_portals.size()){0u};p<m_portals.size();++p)
+		{
+			auto &portal = m_portals[p];
+			graph->positions[p] = portal.position;
+			for(auto i=0u;i<2u;++i)
+			{
+				auto node = p *2 +i;
+				graph->edgeOffsets[node] = static_cast<uint32_t>(graph->edges.size());
+				if(portal.valid == false)
+					continue;
+				auto room = portal.rooms[i];
+				graph->nodeRooms[node] = room;
+				for(auto q : m_rooms[room].portals)
+				{
+					if(q == p)
+						continue;
+					auto &other = m_portals[q];
+					auto exit = (other.rooms[0] == room) ? 1u : 0u;
+					graph->edges.push_back({q *2u +exit,uvec::length(portal.position -other.position)});
+				}
+			}
+		}
+		graph->edgeOffsets[numNodes] = static_cast<uint32_t>(graph->edges.size());
+		topology->graph = graph;
+	}
+	topology->transmission.resize(m_portals.size());
+	for(auto p=decltype(m_portals.size()){0u};p<m_portals.size();++p)
+	{
+		auto &portal = m_portals[p];
+		topology->transmission[p] = {
+			umath::lerp(portal.closedGain,1.f,portal.openness),
+			umath::lerp(portal.closedGainHF,1.f,portal.openness)
+		};
+	}
+	m_topology = topology;
+	m_bEdgesDirty = false;
+	m_bTransmissionDirty = false;
+	return m_topology;
+}
+
+float al::FMPropagationGraph::GetTransmissionCost(const Settings &settings,float gain)
+{
+	return settings.transmissionDistance *-std::log2(umath::max(gain,0.0001f));
+}
+void al::FMPropagationGraph::ComputePaths(const Job &job,Paths &outPaths)
+{
+	// Dijkstra from the listener over the directed portals. The cost is the path length plus a penalty for the
+	// transmission loss, the gain is accumulated along the cheapest path.
+	outPaths.topology = job.topology;
+	outPaths.listenerRoom = job.listenerRoom;
+	auto &graph = *job.topology->graph;
+	auto &transmission = job.topology->transmission;
+	auto &nodes = outPaths.nodes;
+	nodes.assign(graph.nodeRooms.size(),{});
+	if(job.listenerRoom >= graph.roomPortals.size())
+		return;
+	using QueueItem = std::pair<float,uint32_t>;
+	std::priority_queue<QueueItem,std::vector<QueueItem>,std::greater<QueueItem>> queue {};
+	auto relax = [&](uint32_t node,float length,float gain,float gainHF,float cost) {
+		if(length > job.settings.maxPathLength || cost >= nodes[node].cost)
+			return;
+		nodes[node] = {cost,length,gain,gainHF};
+		queue.push({cost,node});
+	};
+	for(auto p : graph.roomPortals[job.listenerRoom])
+	{
+		auto node = p *2u +((graph.nodeRooms[p *2u] == job.listenerRoom) ? 1u : 0u);
+		auto length = uvec::length(job.listenerPos -graph.positions[p]);
+		auto &t = transmission[p];
+		relax(node,length,t[0],t[1],length +GetTransmissionCost(job.settings,t[0]));
+	}
+	while(queue.empty() == false)
+	{
+		auto item = queue.top();
+		queue.pop();
+		auto node = item.second;
+		auto path = nodes[node];
+		if(item.first > path.cost)
+			continue; // Outdated entry
+		for(auto e=graph.edgeOffsets[node];e<graph.edgeOffsets[node +1];++e)
+		{
+			auto &edge = graph.edges[e];
+			auto &t = transmission[edge.node /2u];
+			relax(
+				edge.node,path.length +edge.length,path.gain *t[0],path.gainHF *t[1],
+				path.cost +edge.length +GetTransmissionCost(job.settings,t[0])
+			);
+		}
+	}
+}
+void al::FMPropagationGraph::RunWorker()
+{
+	std::unique_lock<std::mutex> lock {m_mutex};
+	for(;;)
+	{
+		m_condition.wait(lock,[this]() {return m_bRunning == false || m_pendingJob != nullptr;});
+		if(m_bRunning == false)
+			return;
+		auto job = std::move(m_pendingJob);
+		m_bJobActive = true;
+		lock.unlock();
+
+		auto t = std::chrono::steady_clock::now();
+		auto paths = std::make_unique<Paths>();
+		ComputePaths(*job,*paths);
+		auto dt = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() -t).count();
+
+		lock.lock();
+		// Results that haven't been picked up yet are outdated
+		m_completedPaths = std::move(paths);
+		++m_pathUpdates;
+		m_lastPathUpdateTime = dt;
+		m_bJobActive = false;
+		m_completeCondition.notify_all();
+	}
+}
+void al::FMPropagationGraph::TakeCompletedPaths()
+{
+	if(m_completedPaths == nullptr)
+		return;
+	m_paths = std::move(*m_completedPaths);
+	m_completedPaths = nullptr;
+	m_bAllDirty = true;
+}
+
+std::array<float,2> al::FMPropagationGraph::GetPathGain(const Vector3 &listenerPos,RoomId room,const Vector3 &pos) const
+{
+	if(m_paths.topology == nullptr || m_paths.listenerRoom == INVALID_ROOM || room == INVALID_ROOM || room == m_paths.listenerRoom)
+		return {1.f,1.f};
+	auto &graph = *m_paths.topology->graph;
+	if(room >= graph.roomPortals.size())
+		return {1.f,1.f}; // The room didn't exist yet when the paths were computed
+	const NodePath *best = nullptr;
+	auto bestCost = std::numeric_limits<float>::max();
+	auto bestLength = 0.f;
+	for(auto p : graph.roomPortals[room])
+	{
+		auto &path = m_paths.nodes[p *2u +((graph.nodeRooms[p *2u] == room) ? 0u : 1u)];
+		if(path.cost == std::numeric_limits<float>::max())
+			continue;
+		auto d = uvec::length(graph.positions[p] -pos);
+		if(path.cost +d >= bestCost)
+			continue;
+		best = &path;
+		bestCost = path.cost +d;
+		bestLength = path.length +d;
+	}
+	if(best == nullptr)
+		return {0.f,0.f};
+	// The detour around the portals attenuates the sound on top of the distance attenuation of the direct line,
+	// high frequencies diffract less than low frequencies
+	auto detour = umath::max(bestLength -uvec::length(listenerPos -pos),0.f);
+	auto diffraction = std::exp2(-detour /umath::max(m_settings.diffractionDistance,0.001f));
+	return {best->gain *diffraction,best->gainHF *diffraction *diffraction};
+}
+void al::FMPropagationGraph::ApplyChannel(Entry &entry,const Vector3 &listenerPos)
+{
+	entry.dirty = false;
+	auto &channel = *entry.channel;
+	if(channel.Is3D() == false)
+		return;
+	auto &data = channel.m_soundSourceData;
+	auto &pos = data.position;
+	auto relListenerPos = listenerPos;
+	std::array<float,2> path {1.f,1.f};
+	if(data.relativeToListener)
+		relListenerPos = {}; // Never occluded
+	else
+	{
+		if(entry.roomValid == false || entry.roomPosition != pos)
+		{
+			// Sources rarely leave their room, so the previous room is checked first
+			if(IsInRoom(entry.room,pos) == false)
+				entry.room = FindRoom(pos);
+			entry.roomPosition = pos;
+			entry.roomValid = true;
+		}
+		path = GetPathGain(listenerPos,entry.room,pos);
+	}
+
+	auto gain = path[0] *data.directFilter.first;
+	auto gainHF = path[1] *data.directFilter.second;
+	if(data.airAbsorptionFactor > 0.f)
+		gainHF *= std::pow(AIR_ABSORPTION_GAIN_HF,data.airAbsorptionFactor *al::to_audio_distance(uvec::length(pos -relListenerPos)));
+	// FMOD only attenuates the volume outside of the cone, the high frequency part is applied here
+	auto &coneAngles = data.coneAngles;
+	if(coneAngles.second < 360.f && data.outerConeGains.second < 1.f)
+	{
+		auto &forward = data.orientation.first;
+		auto toListener = relListenerPos -pos;
+		auto l = uvec::length(forward) *uvec::length(toListener);
+		if(l > 0.f)
+		{
+			auto angle = std::acos(umath::clamp(uvec::dot(forward,toListener) /l,-1.f,1.f)) *RAD_TO_DEG *2.f;
+			auto f = (angle <= coneAngles.first) ? 0.f :
+				(angle >= coneAngles.second) ? 1.f :
+				((angle -coneAngles.first) /umath::max(coneAngles.second -coneAngles.first,0.001f));
+			gainHF *= umath::lerp(1.f,data.outerConeGains.second,f);
+		}
+	}
+
+	// Broadband attenuation goes through the occlusion, the remaining high frequency loss through the channel's lowpass.
+	// The auxiliary sends aren't affected by the direct filter.
+	auto directOcclusion = 1.f -umath::clamp(gain,0.f,1.f);
+	auto reverbOcclusion = 1.f -umath::clamp(path[0],0.f,1.f);
+	auto lowpassGain = umath::clamp(gainHF,0.f,1.f);
+	if(std::abs(directOcclusion -entry.directOcclusion) > APPLY_EPSILON || std::abs(reverbOcclusion -entry.reverbOcclusion) > APPLY_EPSILON)
+	{
+		entry.directOcclusion = directOcclusion;
+		entry.reverbOcclusion = reverbOcclusion;
+		channel.CheckResultAndUpdateValidity(channel.GetInternalSource()->set3DOcclusion(directOcclusion,reverbOcclusion));
+		++m_appliedChannels;
+	}
+	if(std::abs(lowpassGain -entry.lowpassGain) > APPLY_EPSILON && channel.GetInternalSource() != nullptr)
+	{
+		entry.lowpassGain = lowpassGain;
+		channel.CheckResultAndUpdateValidity(channel.GetInternalSource()->setLowPassGain(lowpassGain));
+		++m_appliedChannels;
+	}
+}
+
+al::FMPropagationGraph::Handle al::FMPropagationGraph::Register(FMSoundChannel &channel)
+{
+	Handle handle;
+	if(m_freeHandles.empty() == false)
+	{
+		handle = m_freeHandles.back();
+		m_freeHandles.pop_back();
+	}
+	else
+	{
+		handle = static_cast<Handle>(m_entries.size());
+		m_entries.push_back({});
+	}
+	m_entries[handle] = {};
+	m_entries[handle].channel = &channel;
+	m_dirtyHandles.push_back(handle);
+	return handle;
+}
+void al::FMPropagationGraph::Unregister(Handle handle)
+{
+	if(handle >= m_entries.size() || m_entries[handle].channel == nullptr)
+		return;
+	// Stale entries in the dirty list are skipped during the update
+	m_entries[handle] = {};
+	m_entries[handle].dirty = false;
+	m_freeHandles.push_back(handle);
+}
+void al::FMPropagationGraph::MarkDirty(Handle handle,bool bNewChannel)
+{
+	if(handle >= m_entries.size() || m_entries[handle].channel == nullptr)
+		return;
+	auto &entry = m_entries[handle];
+	if(bNewChannel)
+	{
+		// FMOD defaults of a new channel
+		entry.directOcclusion = 0.f;
+		entry.reverbOcclusion = 0.f;
+		entry.lowpassGain = 1.f;
+	}
+	if(entry.dirty)
+		return;
+	entry.dirty = true;
+	m_dirtyHandles.push_back(handle);
+}
+
+void al::FMPropagationGraph::Update(const Vector3 &listenerPos,bool bWaitForPaths)
+{
+	// Pick up the latest paths from the worker
+	{
+		std::unique_lock<std::mutex> lock {m_mutex,std::try_to_lock};
+		if(lock.owns_lock())
+			TakeCompletedPaths();
+	}
+
+	// Request new paths if the listener has moved far enough or the graph has changed
+	auto listenerRoom = IsInRoom(m_requestedRoom,listenerPos) ? m_requestedRoom : FindRoom(listenerPos);
+	if(m_version != m_requestedVersion || listenerRoom != m_requestedRoom || uvec::length(listenerPos -m_requestedPos) > m_settings.listenerMoveThreshold)
+	{
+		auto job = std::make_unique<Job>();
+		job->topology = GetTopology();
+		job->settings = m_settings;
+		job->listenerRoom = listenerRoom;
+		job->listenerPos = listenerPos;
+		{
+			std::unique_lock<std::mutex> lock {m_mutex};
+			// Replaces a job that hasn't been started yet
+			m_pendingJob = std::move(job);
+		}
+		m_condition.notify_one();
+		m_requestedVersion = m_version;
+		m_requestedRoom = listenerRoom;
+		m_requestedPos = listenerPos;
+	}
+	else
+		++m_skippedPathUpdates;
+	if(bWaitForPaths)
+	{
+		std::unique_lock<std::mutex> lock {m_mutex};
+		m_completeCondition.wait(lock,[this]() {return m_pendingJob == nullptr && m_bJobActive == false;});
+		TakeCompletedPaths();
+	}
+
+	// Air absorption and the cone depend on the listener position, so a listener move affects all channels
+	if(listenerPos != m_lastListenerPos)
+	{
+		m_lastListenerPos = listenerPos;
+		m_bAllDirty = true;
+	}
+	m_appliedChannels = 0u;
+	if(m_bAllDirty)
+	{
+		for(auto &entry : m_entries)
+		{
+			if(entry.channel != nullptr)
+				ApplyChannel(entry,listenerPos);
+		}
+		m_bAllDirty = false;
+	}
+	else
+	{
+		for(auto handle : m_dirtyHandles)
+		{
+			auto &entry = m_entries[handle];
+			if(entry.channel != nullptr && entry.dirty)
+				ApplyChannel(entry,listenerPos);
+		}
+	}
+	m_dirtyHandles.clear();
+}
@@ -0,0 +1,212 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_PROPAGATION_HPP__
+#define __FMOD_PROPAGATION_HPP__
+
+#include <alsound_coordinate_system.hpp>
+#include <cinttypes>
+#include <vector>
+#include <array>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace al
+{
+	class FMSoundChannel;
+	// Precomputed room/portal graph (in game space) for occlusion without raycasts. Whenever the listener moves, the
+	// shortest acoustic paths from the listener to all portals are computed on a worker thread; each channel then only
+	// has to look at the portals of its own room. The resulting attenuation is combined with the channel's direct filter,
+	// air absorption and outer cone gain and applied to all channels in a single pass in Update().
+	class FMPropagationGraph
+	{
+	public:
+		using Handle = uint32_t;
+		using RoomId = uint32_t;
+		using PortalId = uint32_t;
+		static constexpr Handle INVALID_HANDLE = std::numeric_limits<Handle>::max();
+		static constexpr RoomId INVALID_ROOM = std::numeric_limits<RoomId>::max();
+		static constexpr PortalId INVALID_PORTAL = std::numeric_limits<PortalId>::max();
+		struct Settings
+		{
+			// Path cost of a portal that halves the gain, in game units. Higher values prefer open detours over closed doors.
+			float transmissionDistance = 512.f;
+			// Detour over the direct line (in game units) at which diffraction around corners halves the gain
+			float diffractionDistance = 512.f;
+			// Paths longer than this aren't followed, sources behind them are fully occluded
+			float maxPathLength = 8'192.f;
+			// The paths are only recomputed once the listener has moved this far (or has entered a different room)
+			float listenerMoveThreshold = 16.f;
+		};
+		struct Stats
+		{
+			uint32_t roomCount = 0u;
+			uint32_t portalCount = 0u;
+			uint64_t pathUpdates = 0ull;
+			uint64_t skippedPathUpdates = 0ull;
+			double lastPathUpdateTime = 0.0; // Milliseconds, measured on the worker thread
+			// FMOD calls made by the last pass, channels whose values didn't change are skipped
+			uint32_t appliedChannels = 0u;
+		};
+
+		FMPropagationGraph();
+		~FMPropagationGraph();
+
+		// Rooms are unions of axis-aligned boxes. Points that aren't inside of any room are never occluded.
+		RoomId AddRoom(const Vector3 &min,const Vector3 &max);
+		void AddRoomBounds(RoomId room,const Vector3 &min,const Vector3 &max);
+		// Also removes all portals of the room
+		void RemoveRoom(RoomId room);
+		RoomId FindRoom(const Vector3 &pos) const;
+
+		// Openness goes from 0 (closed) to 1 (open). A closed portal still lets through closedGain/closedGainHF, e.g. a door.
+		PortalId AddPortal(RoomId roomA,RoomId roomB,const Vector3 &pos,float openness=1.f);
+		void RemovePortal(PortalId portal);
+		void SetPortalOpenness(PortalId portal,float openness);
+		float GetPortalOpenness(PortalId portal) const;
+		void SetPortalTransmission(PortalId portal,float closedGain,float closedGainHF);
+		void Clear();
+
+		void SetSettings(const Settings &settings);
+		const Settings &GetSettings() const;
+		Stats GetStats() const;
+
+		Handle Register(FMSoundChannel &channel);
+		void Unregister(Handle handle);
+		// Has to be called whenever the position or the filter parameters of the channel have changed. bNewChannel
+		// has to be set if the FMOD channel has been replaced, so all values are reapplied.
+		void MarkDirty(Handle handle,bool bNewChannel=false);
+
+		// If bWaitForPaths is set, paths that have been requested are waited for and applied in the same update
+		// (e.g. for deterministic offline renders), otherwise they're applied once the worker has finished them
+		void Update(const Vector3 &listenerPos,bool bWaitForPaths=false);
+	private:
+		struct Bounds
+		{
+			Vector3 min;
+			Vector3 max;
+		};
+		struct Room
+		{
+			std::vector<Bounds> bounds = {};
+			std::vector<PortalId> portals = {};
+			bool valid = false;
+		};
+		struct Portal
+		{
+			std::array<RoomId,2> rooms = {INVALID_ROOM,INVALID_ROOM};
+			Vector3 position = {};
+			float openness = 1.f;
+			float closedGain = 0.1f;
+			float closedGainHF = 0.02f;
+			bool valid = false;
+		};
+		// Graph nodes are directed portals: node 2 *p +i is portal p, entered towards p.rooms[i]
+		struct Edge
+		{
+			uint32_t node;
+			float length;
+		};
+		// Immutable snapshots, shared with the worker thread
+		struct Graph
+		{
+			std::vector<Vector3> positions = {}; // Per portal
+			std::vector<RoomId> nodeRooms = {}; // Per node, the room the node leads into
+			std::vector<uint32_t> edgeOffsets = {}; // Per node +1
+			std::vector<Edge> edges = {};
+			std::vector<std::vector<PortalId>> roomPortals = {}; // Per room
+		};
+		struct Topology
+		{
+			std::shared_ptr<const Graph> graph = nullptr;
+			std::vector<std::array<float,2>> transmission = {}; // Per portal, gain and gainHF
+		};
+		struct NodePath
+		{
+			float cost = std::numeric_limits<float>::max();
+			float length = 0.f;
+			float gain = 0.f;
+			float gainHF = 0.f;
+		};
+		struct Paths
+		{
+			std::shared_ptr<const Topology> topology = nullptr;
+			RoomId listenerRoom = INVALID_ROOM;
+			std::vector<NodePath> nodes = {};
+		};
+		struct Job
+		{
+			std::shared_ptr<const Topology> topology = nullptr;
+			Settings settings = {};
+			RoomId listenerRoom = INVALID_ROOM;
+			Vector3 listenerPos = {};
+		};
+		struct Entry
+		{
+			FMSoundChannel *channel = nullptr;
+			RoomId room = INVALID_ROOM;
+			Vector3 roomPosition = {};
+			bool roomValid = false;
+			bool dirty = true;
+			// Last values passed to FMOD
+			float directOcclusion = 0.f;
+			float reverbOcclusion = 0.f;
+			float lowpassGain = 1.f;
+		};
+		bool IsInRoom(RoomId room,const Vector3 &pos) const;
+		void InvalidateRooms();
+		void InvalidateTopology(bool bEdgesChanged);
+		std::shared_ptr<const Topology> GetTopology();
+		static float GetTransmissionCost(const Settings &settings,float gain);
+		static void ComputePaths(const Job &job,Paths &outPaths);
+		void RunWorker();
+		// m_mutex has to be locked
+		void TakeCompletedPaths();
+		// Attenuation of the path from the listener to the given position, in gain and gainHF
+		std::array<float,2> GetPathGain(const Vector3 &listenerPos,RoomId room,const Vector3 &pos) const;
+		void ApplyChannel(Entry &entry,const Vector3 &listenerPos);
+
+		Settings m_settings = {};
+		std::vector<Room> m_rooms = {};
+		std::vector<RoomId> m_freeRooms = {};
+		std::vector<Portal> m_portals = {};
+		std::vector<PortalId> m_freePortals = {};
+		uint64_t m_version = 0ull;
+		// Rebuilt lazily; edges only change with the rooms and portals, transmission also changes with the openness
+		std::shared_ptr<const Topology> m_topology = nullptr;
+		bool m_bEdgesDirty = true;
+		bool m_bTransmissionDirty = true;
+
+		std::vector<Entry> m_entries = {};
+		std::vector<Handle> m_freeHandles = {};
+		std::vector<Handle> m_dirtyHandles = {};
+		bool m_bAllDirty = false;
+		Vector3 m_lastListenerPos = {};
+
+		// Main thread copy of the latest results
+		Paths m_paths = {};
+		RoomId m_requestedRoom = INVALID_ROOM;
+		Vector3 m_requestedPos = {};
+		uint64_t m_requestedVersion = std::numeric_limits<uint64_t>::max();
+		uint64_t m_skippedPathUpdates = 0ull;
+		uint32_t m_appliedChannels = 0u;
+
+		// Worker thread
+		std::thread m_thread;
+		mutable std::mutex m_mutex;
+		std::condition_variable m_condition;
+		std::condition_variable m_completeCondition;
+		bool m_bRunning = true;
+		bool m_bJobActive = false;
+		std::unique_ptr<Job> m_pendingJob = nullptr;
+		std::unique_ptr<Paths> m_completedPaths = nullptr;
+		uint64_t m_pathUpdates = 0ull;
+		double m_lastPathUpdateTime = 0.0;
+	};
+};
+
+#endif
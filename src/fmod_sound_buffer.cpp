@@ -4,28 +4,113 @@
 
 #include "fmod_sound_buffer.hpp"
 #include "fmod_sound_system.hpp"
+#include "fmod_sound_buffer_cache.hpp"
 #include <fmod_studio.hpp>
 
-al::FMSoundBuffer::FMSoundBuffer(FMOD::System &system,const std::shared_ptr<FMOD::Sound> &sound)
-	: m_fmSystem(system),m_fmSound(sound)
+al::FMSoundBuffer::FMSoundBuffer(FMOD::System &system,const std::shared_ptr<FMOD::Sound> &sound,const std::string &name)
+	: m_fmSystem(system),m_fmSound(sound),m_name(name)
 {}
 const FMOD::Sound *al::FMSoundBuffer::GetFMODSound() const {return const_cast<al::FMSoundBuffer*>(this)->GetFMODSound();}
 FMOD::Sound *al::FMSoundBuffer::GetFMODSound() {return m_fmSound.get();}
 
 al::FMSoundBuffer::~FMSoundBuffer()
 {
+	if(m_cache != nullptr)
+		m_cache->Remove(*this);
+}
+
+al::FMSoundBuffer::LoadState al::FMSoundBuffer::GetLoadState() const {return m_loadState;}
+void al::FMSoundBuffer::SetLoadState(LoadState state) {m_loadState = state;}
+void al::FMSoundBuffer::SetFMODSound(const std::shared_ptr<FMOD::Sound> &sound)
+{
+	m_fmSound = sound;
+	m_size = 0u;
+	m_bChannelDefaultsValid = false;
+}
+void al::FMSoundBuffer::SetFileData(const std::shared_ptr<std::vector<uint8_t>> &data) {m_fileData = data;}
+const al::FMChannelDefaults &al::FMSoundBuffer::GetChannelDefaults() const
+{
+	if(m_bChannelDefaultsValid == false && m_fmSound != nullptr)
+	{
+		m_channelDefaults = get_channel_defaults(*m_fmSound);
+		m_bChannelDefaultsValid = true;
+	}
+	return m_channelDefaults;
+}
+
+al::FMChannelDefaults al::get_channel_defaults(FMOD::Sound &sound)
+{
+	FMChannelDefaults defaults {};
+	FMOD_MODE mode;
+	if(sound.getMode(&mode) == FMOD_OK)
+		defaults.mode = mode;
+	float frequency;
+	int32_t priority;
+	if(sound.getDefaults(&frequency,&priority) == FMOD_OK)
+		defaults.priority = static_cast<uint32_t>(priority);
+	sound.get3DMinMaxDistance(&defaults.minDistance,&defaults.maxDistance);
+	sound.get3DConeSettings(&defaults.coneInsideAngle,&defaults.coneOutsideAngle,&defaults.coneOutsideVolume);
+	return defaults;
 }
 
 bool al::FMSoundBuffer::IsReady() const
 {
+	if(m_fmSound == nullptr)
+		return false;
 	FMOD_OPENSTATE openState;
 	uint32_t percentBuffered;
 	bool starving,diskBusy;
 	al::check_result(m_fmSound->getOpenState(&openState,&percentBuffered,&starving,&diskBusy));
-	return openState != FMOD_OPENSTATE_LOADING && 
-		openState != FMOD_OPENSTATE_ERROR && 
-		openState != FMOD_OPENSTATE_CONNECTING; // TODO: What about FMOD_OPENSTATE_BUFFERING?
+	switch(openState)
+	{
+		case FMOD_OPENSTATE_LOADING:
+		case FMOD_OPENSTATE_ERROR:
+		case FMOD_OPENSTATE_CONNECTING:
+			return false;
+		case FMOD_OPENSTATE_BUFFERING:
+			// A stream that is refilling its buffer can still be played, unless it has run out of data entirely
+			return starving == false;
+		default:
+			return true;
+	}
+}
+void al::FMSoundBuffer::SetStreamInfo(uint32_t fileBufferSize,uint32_t decodeBufferFrames)
+{
+	m_bStreamed = true;
+	m_streamFileBufferSize = fileBufferSize;
+	m_streamDecodeBufferFrames = decodeBufferFrames;
+	m_size = 0u;
 }
+bool al::FMSoundBuffer::IsStreamed() const {return m_bStreamed;}
+void al::FMSoundBuffer::SetCompressed(bool compressed)
+{
+	m_bCompressed = compressed;
+	m_size = 0u;
+}
+bool al::FMSoundBuffer::IsCompressed() const {return m_bCompressed;}
+al::FMSoundBuffer::StreamState al::FMSoundBuffer::GetStreamState() const
+{
+	if(m_bStreamed == false || m_fmSound == nullptr)
+		return {};
+	return GetStreamState(*m_fmSound);
+}
+al::FMSoundBuffer::StreamState al::FMSoundBuffer::GetStreamState(FMOD::Sound &sound)
+{
+	StreamState state {};
+	FMOD_OPENSTATE openState;
+	bool diskBusy;
+	al::check_result(sound.getOpenState(&openState,&state.percentBuffered,&state.starving,&diskBusy));
+	state.buffering = (openState == FMOD_OPENSTATE_BUFFERING);
+	return state;
+}
+bool al::FMSoundBuffer::AcquireStream()
+{
+	if(m_bStreamInUse)
+		return false;
+	m_bStreamInUse = true;
+	return true;
+}
+void al::FMSoundBuffer::ReleaseStream() {m_bStreamInUse = false;}
 
 uint64_t al::FMSoundBuffer::GetLength() const
 {
@@ -37,6 +122,8 @@ uint64_t al::FMSoundBuffer::GetLength() const
 }
 uint32_t al::FMSoundBuffer::GetFrequency() const
 {
+	if(m_fmSound == nullptr)
+		return 0u;
 	float frequency;
 	int32_t priority;
 	al::check_result(m_fmSound->getDefaults(&frequency,&priority));
@@ -44,12 +131,16 @@ uint32_t al::FMSoundBuffer::GetFrequency() const
 }
 al::ChannelConfig al::FMSoundBuffer::GetChannelConfig() const
 {
+	if(m_fmSound == nullptr)
+		return al::ChannelConfig::Mono;
 	int32_t channels;
 	al::check_result(m_fmSound->getFormat(nullptr,nullptr,&channels,nullptr));
 	return (channels >= 2) ? al::ChannelConfig::Stereo : al::ChannelConfig::Mono;
 }
 al::SampleType al::FMSoundBuffer::GetSampleType() const
 {
+	if(m_fmSound == nullptr)
+		return al::SampleType::Int16;
 	FMOD_SOUND_FORMAT format;
 	al::check_result(m_fmSound->getFormat(nullptr,&format,nullptr,nullptr));
 	switch(format)
@@ -59,6 +150,7 @@ al::SampleType al::FMSoundBuffer::GetSampleType() const
 		case FMOD_SOUND_FORMAT_PCM8:
 			return al::SampleType::UInt8;
 		case FMOD_SOUND_FORMAT_PCM16:
+		case FMOD_SOUND_FORMAT_BITSTREAM: // Compressed samples are decoded to 16 bit
 			return al::SampleType::Int16;
 		default:
 			// FMOD TODO
@@ -68,11 +160,37 @@ al::SampleType al::FMSoundBuffer::GetSampleType() const
 }
 uint32_t al::FMSoundBuffer::GetSize() const
 {
-	// FMOD TODO
-	return 0u;
+	if(m_size > 0u || IsReady() == false)
+		return m_size;
+	if(m_bStreamed)
+	{
+		// Only the stream buffers are resident
+		auto decodeFrames = m_streamDecodeBufferFrames;
+		if(decodeFrames == 0u)
+			decodeFrames = GetFrequency() *400u /1'000u; // FMOD default decode buffer size
+		int32_t channels = 0;
+		int32_t bits = 0;
+		al::check_result(m_fmSound->getFormat(nullptr,nullptr,&channels,&bits));
+		m_size = m_streamFileBufferSize +decodeFrames *static_cast<uint32_t>(channels) *static_cast<uint32_t>(bits /8);
+		return m_size;
+	}
+	auto size = 0u;
+	if(m_bCompressed)
+	{
+		// Compressed samples keep the encoded file data in memory
+		al::check_result(m_fmSound->getLength(&size,FMOD_TIMEUNIT_RAWBYTES));
+		m_size = size;
+		return m_size;
+	}
+	// Size of the decoded sample data
+	al::check_result(m_fmSound->getLength(&size,FMOD_TIMEUNIT_PCMBYTES));
+	m_size = size;
+	return m_size;
 }
 void al::FMSoundBuffer::SetLoopFramePoints(uint32_t start,uint32_t end)
 {
+	if(m_fmSound == nullptr)
+		return;
 	al::check_result(m_fmSound->setLoopPoints(start,FMOD_TIMEUNIT_PCM,end,FMOD_TIMEUNIT_PCM));
 }
 void al::FMSoundBuffer::SetLoopTimePoints(float tStart,float tEnd)
@@ -93,6 +211,8 @@ void al::FMSoundBuffer::SetLoopTimePoints(float tStart,float tEnd)
 }
 std::pair<uint64_t,uint64_t> al::FMSoundBuffer::GetLoopFramePoints() const
 {
+	if(m_fmSound == nullptr)
+		return {0ull,0ull};
 	uint32_t start,end;
 	al::check_result(m_fmSound->getLoopPoints(&start,FMOD_TIMEUNIT_PCM,&end,FMOD_TIMEUNIT_PCM));
 	return {start,end};
@@ -100,12 +220,20 @@ std::pair<uint64_t,uint64_t> al::FMSoundBuffer::GetLoopFramePoints() const
 
 std::string al::FMSoundBuffer::GetName() const
 {
-	// FMOD TODO
-	static std::string r = "";
-	return r;
+	return m_name;
 }
 bool al::FMSoundBuffer::IsInUse() const
 {
-	// FMOD TODO
-	return true;
+	// Pending buffers must not be released before their load has completed
+	return m_channelReferences > 0u || m_loadState == LoadState::Loading;
+}
+void al::FMSoundBuffer::AddChannelReference() {++m_channelReferences;}
+void al::FMSoundBuffer::RemoveChannelReference()
+{
+	if(m_channelReferences == 0u)
+		return;
+	if(--m_channelReferences == 0u && m_cache != nullptr)
+		m_cache->OnBufferIdle();
 }
+uint32_t al::FMSoundBuffer::GetChannelReferenceCount() const {return m_channelReferences;}
+void al::FMSoundBuffer::SetCache(FMSoundBufferCache *cache) {m_cache = cache;}
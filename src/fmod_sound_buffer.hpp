@@ -6,6 +6,7 @@
 #define __FMOD_SOUND_BUFFER_HPP__
 
 #include <alsound_buffer.hpp>
+#include <vector>
 
 namespace FMOD
 {
@@ -18,11 +19,24 @@ namespace FMOD
 };
 namespace al
 {
+	class FMSoundBufferCache;
+	// State a freshly created FMOD channel inherits from its sound. Channel setup only has to touch what differs from these.
+	struct FMChannelDefaults
+	{
+		uint32_t mode = 0u; // FMOD_MODE
+		uint32_t priority = 128u;
+		float minDistance = 1.f;
+		float maxDistance = 10'000.f;
+		float coneInsideAngle = 360.f;
+		float coneOutsideAngle = 360.f;
+		float coneOutsideVolume = 1.f;
+	};
+	FMChannelDefaults get_channel_defaults(FMOD::Sound &sound);
 	class FMSoundBuffer
 		: public ISoundBuffer
 	{
 	public:
-		FMSoundBuffer(FMOD::System &system,const std::shared_ptr<FMOD::Sound> &sound);
+		FMSoundBuffer(FMOD::System &system,const std::shared_ptr<FMOD::Sound> &sound,const std::string &name="");
 		virtual ~FMSoundBuffer() override;
 
 		virtual bool IsReady() const override;
@@ -31,6 +45,8 @@ namespace al
 		virtual void SetLoopFramePoints(uint32_t start,uint32_t end) override;
 		virtual void SetLoopTimePoints(float tStart,float tEnd) override;
 
+		// The format of buffers that are still loading (see GetLoadState) is unknown; until the load has completed these
+		// return placeholders (frequency and length 0, mono, 16-bit)
 		virtual uint32_t GetFrequency() const override;
 		virtual ChannelConfig GetChannelConfig() const override;
 		virtual SampleType GetSampleType() const override;
@@ -42,9 +58,62 @@ namespace al
 
 		const FMOD::Sound *GetFMODSound() const;
 		FMOD::Sound *GetFMODSound();
+
+		// Number of channels that currently reference this buffer
+		void AddChannelReference();
+		void RemoveChannelReference();
+		uint32_t GetChannelReferenceCount() const;
+		void SetCache(FMSoundBufferCache *cache);
+
+		struct StreamState
+		{
+			bool buffering = false;
+			bool starving = false;
+			uint32_t percentBuffered = 100u;
+		};
+		void SetStreamInfo(uint32_t fileBufferSize,uint32_t decodeBufferFrames);
+		bool IsStreamed() const;
+		StreamState GetStreamState() const;
+		static StreamState GetStreamState(FMOD::Sound &sound);
+		// An FMOD stream can only be played by one channel at a time. The first channel acquires the buffer's stream,
+		// all others have to open their own (see FMSoundSystem::OpenStreamInstance).
+		bool AcquireStream();
+		void ReleaseStream();
+		// Compressed samples stay encoded in memory and are decoded during playback
+		void SetCompressed(bool compressed);
+		bool IsCompressed() const;
+
+		// Buffers of asynchronous loads are created before their FMOD sound exists
+		enum class LoadState : uint8_t
+		{
+			Loaded = 0u,
+			Loading,
+			Failed
+		};
+		LoadState GetLoadState() const;
+		void SetLoadState(LoadState state);
+		void SetFMODSound(const std::shared_ptr<FMOD::Sound> &sound);
+		// Keeps the file data alive for sounds that FMOD reads in place (FMOD_OPENMEMORY_POINT)
+		void SetFileData(const std::shared_ptr<std::vector<uint8_t>> &data);
+		// Queried from the FMOD sound once and cached; only valid if the buffer is ready
+		const FMChannelDefaults &GetChannelDefaults() const;
 	private:
 		FMOD::System &m_fmSystem;
+		// Has to be destroyed after the FMOD sound
+		std::shared_ptr<std::vector<uint8_t>> m_fileData = nullptr;
 		std::shared_ptr<FMOD::Sound> m_fmSound = nullptr;
+		std::string m_name;
+		FMSoundBufferCache *m_cache = nullptr;
+		uint32_t m_channelReferences = 0u;
+		mutable uint32_t m_size = 0u;
+		bool m_bStreamed = false;
+		bool m_bStreamInUse = false;
+		bool m_bCompressed = false;
+		uint32_t m_streamFileBufferSize = 0u;
+		uint32_t m_streamDecodeBufferFrames = 0u;
+		LoadState m_loadState = LoadState::Loaded;
+		mutable FMChannelDefaults m_channelDefaults = {};
+		mutable bool m_bChannelDefaultsValid = false;
 	};
 };
 
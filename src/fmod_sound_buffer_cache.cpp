@@ -0,0 +1,113 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_sound_buffer_cache.hpp"
+#include "fmod_sound_buffer.hpp"
+
+al::FMSoundBufferCache::~FMSoundBufferCache()
+{
+	for(auto &entry : m_lru)
+		entry.buffer->SetCache(nullptr);
+}
+
+void al::FMSoundBufferCache::SetMemoryBudget(uint64_t bytes)
+{
+	m_stats.budgetBytes = bytes;
+	m_bEvictionPending = true;
+}
+uint64_t al::FMSoundBufferCache::GetMemoryBudget() const {return m_stats.budgetBytes;}
+
+void al::FMSoundBufferCache::Add(FMSoundBuffer &buffer,const std::string &path,bool mono)
+{
+	Remove(buffer);
+	Entry entry {};
+	entry.buffer = &buffer;
+	entry.path = path;
+	entry.mono = mono;
+	entry.size = buffer.GetSize();
+	m_lru.push_front(entry);
+	m_entries[&buffer] = m_lru.begin();
+	m_stats.residentBytes += entry.size;
+	++m_stats.bufferCount;
+	buffer.SetCache(this);
+	m_bEvictionPending = true;
+}
+void al::FMSoundBufferCache::Remove(FMSoundBuffer &buffer)
+{
+	auto it = m_entries.find(&buffer);
+	if(it == m_entries.end())
+		return;
+	m_stats.residentBytes -= it->second->size;
+	--m_stats.bufferCount;
+	m_lru.erase(it->second);
+	m_entries.erase(it);
+	buffer.SetCache(nullptr);
+}
+void al::FMSoundBufferCache::UpdateSize(FMSoundBuffer &buffer)
+{
+	auto it = m_entries.find(&buffer);
+	if(it == m_entries.end())
+		return;
+	auto &entry = *it->second;
+	m_stats.residentBytes -= entry.size;
+	entry.size = buffer.GetSize();
+	m_stats.residentBytes += entry.size;
+	m_bEvictionPending = true;
+}
+void al::FMSoundBufferCache::SetMono(FMSoundBuffer &buffer,bool mono)
+{
+	auto it = m_entries.find(&buffer);
+	if(it == m_entries.end())
+		return;
+	it->second->mono = mono;
+}
+void al::FMSoundBufferCache::Touch(FMSoundBuffer &buffer)
+{
+	auto it = m_entries.find(&buffer);
+	if(it == m_entries.end())
+		return;
+	// The first use after a load was already counted as a miss
+	if(it->second->fresh)
+		it->second->fresh = false;
+	else
+		++m_stats.hits;
+	m_lru.splice(m_lru.begin(),m_lru,it->second);
+}
+std::vector<al::FMSoundBufferCache::BufferInfo> al::FMSoundBufferCache::GetBuffers() const
+{
+	std::vector<BufferInfo> buffers;
+	buffers.reserve(m_lru.size());
+	for(auto &entry : m_lru)
+		buffers.push_back({entry.path,entry.mono,entry.size});
+	return buffers;
+}
+void al::FMSoundBufferCache::RecordMiss() {++m_stats.misses;}
+void al::FMSoundBufferCache::OnBufferIdle() {m_bEvictionPending = true;}
+
+void al::FMSoundBufferCache::EnforceBudget(const EvictCallback &evict)
+{
+	// Only walk the list if something has changed that could make eviction possible
+	if(m_bEvictionPending == false)
+		return;
+	m_bEvictionPending = false;
+	if(m_stats.budgetBytes == 0ull)
+		return;
+	auto it = m_lru.end();
+	while(m_stats.residentBytes > m_stats.budgetBytes && it != m_lru.begin())
+	{
+		--it;
+		if(it->buffer->IsInUse())
+			continue;
+		auto entry = *it;
+		it = m_lru.erase(it);
+		m_entries.erase(entry.buffer);
+		m_stats.residentBytes -= entry.size;
+		--m_stats.bufferCount;
+		++m_stats.evictions;
+		entry.buffer->SetCache(nullptr);
+		evict(entry.path,entry.mono);
+	}
+}
+
+const al::FMSoundBufferCache::Stats &al::FMSoundBufferCache::GetStats() const {return m_stats;}
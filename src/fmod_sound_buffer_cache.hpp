@@ -0,0 +1,79 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_SOUND_BUFFER_CACHE_HPP__
+#define __FMOD_SOUND_BUFFER_CACHE_HPP__
+
+#include <cinttypes>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <vector>
+
+namespace al
+{
+	class FMSoundBuffer;
+	// Keeps track of the resident memory of all loaded sound buffers and evicts the least recently used
+	// idle buffers once the memory budget has been exceeded.
+	class FMSoundBufferCache
+	{
+	public:
+		struct Stats
+		{
+			uint64_t hits = 0ull;
+			uint64_t misses = 0ull;
+			uint64_t evictions = 0ull;
+			uint64_t residentBytes = 0ull;
+			uint64_t budgetBytes = 0ull;
+			uint32_t bufferCount = 0u;
+		};
+		struct BufferInfo
+		{
+			std::string path;
+			bool mono = false;
+			uint64_t bytes = 0ull;
+		};
+		using EvictCallback = std::function<void(const std::string&,bool)>;
+		~FMSoundBufferCache();
+
+		// A budget of 0 disables eviction
+		void SetMemoryBudget(uint64_t bytes);
+		uint64_t GetMemoryBudget() const;
+
+		void Add(FMSoundBuffer &buffer,const std::string &path,bool mono);
+		void Remove(FMSoundBuffer &buffer);
+		// Re-reads the size of the buffer, e.g. after an asynchronous load has completed
+		void UpdateSize(FMSoundBuffer &buffer);
+		// Moves the buffer to the other channel slot of its path, so it's evicted from the right one
+		void SetMono(FMSoundBuffer &buffer,bool mono);
+		// Marks the buffer as most recently used
+		void Touch(FMSoundBuffer &buffer);
+		void RecordMiss();
+		void OnBufferIdle();
+
+		// Evicts idle buffers, least recently used first, until the resident memory fits into the budget.
+		// The callback has to release the buffer with the specified path and channel slot.
+		void EnforceBudget(const EvictCallback &evict);
+
+		const Stats &GetStats() const;
+		// Resident memory per buffer, most recently used first
+		std::vector<BufferInfo> GetBuffers() const;
+	private:
+		struct Entry
+		{
+			FMSoundBuffer *buffer = nullptr;
+			std::string path;
+			bool mono = false;
+			bool fresh = true;
+			uint64_t size = 0ull;
+		};
+		std::list<Entry> m_lru = {}; // Most recently used first
+		std::unordered_map<FMSoundBuffer*,std::list<Entry>::iterator> m_entries = {};
+		Stats m_stats = {};
+		bool m_bEvictionPending = false;
+	};
+};
+
+#endif
@@ -0,0 +1,209 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_sound_loader.hpp"
+#include "fmod_sound_system.hpp"
+#include "fmod_sound_buffer.hpp"
+#include <fmod_studio.hpp>
+#include <cstring>
+#include <algorithm>
+
+bool al::FMSoundLoader::QueueOrder::operator()(const Request *a,const Request *b) const
+{
+	if(a->priority != b->priority)
+		return a->priority > b->priority;
+	return a->sequence < b->sequence;
+}
+
+al::FMSoundLoader::FMSoundLoader(FMSoundSystem &system)
+	: m_system{system}
+{}
+al::FMSoundLoader::~FMSoundLoader() {Clear();}
+
+void al::FMSoundLoader::Clear()
+{
+	m_queue.clear();
+	m_inFlight.clear();
+	m_callbackRequests.clear();
+	// Releasing a sound that is still loading blocks until FMOD has finished with it
+	m_requests.clear();
+}
+
+void al::FMSoundLoader::SetMaxConcurrentLoads(uint32_t count) {m_maxConcurrentLoads = umath::max(count,1u);}
+uint32_t al::FMSoundLoader::GetMaxConcurrentLoads() const {return m_maxConcurrentLoads;}
+uint32_t al::FMSoundLoader::GetQueuedCount() const {return static_cast<uint32_t>(m_queue.size());}
+uint32_t al::FMSoundLoader::GetInFlightCount() const {return static_cast<uint32_t>(m_inFlight.size());}
+
+void al::FMSoundLoader::Enqueue(const PSoundBuffer &buffer,const std::string &path,bool mono,int32_t priority)
+{
+	auto *key = static_cast<FMSoundBuffer*>(buffer.get());
+	if(m_requests.find(key) != m_requests.end())
+		return;
+	auto request = std::make_unique<Request>();
+	request->path = path;
+	request->mono = mono;
+	request->priority = priority;
+	request->sequence = m_nextSequence++;
+	request->key = key;
+	request->buffer = buffer;
+	key->SetLoadState(FMSoundBuffer::LoadState::Loading);
+	m_queue.insert(request.get());
+	m_requests[key] = std::move(request);
+}
+
+al::FMSoundLoader::RequestId al::FMSoundLoader::AddCallback(FMSoundBuffer &buffer,int32_t priority,const Callback &callback)
+{
+	auto it = m_requests.find(&buffer);
+	if(it == m_requests.end())
+		return INVALID_REQUEST;
+	auto &request = *it->second;
+	if(priority > request.priority && request.started == false)
+	{
+		m_queue.erase(&request);
+		request.priority = priority;
+		m_queue.insert(&request);
+	}
+	auto id = m_nextRequestId++;
+	request.callbacks.push_back({id,callback});
+	m_callbackRequests[id] = &request;
+	return id;
+}
+
+bool al::FMSoundLoader::Cancel(RequestId requestId)
+{
+	auto it = m_callbackRequests.find(requestId);
+	if(it == m_callbackRequests.end())
+		return false;
+	auto &request = *it->second;
+	m_callbackRequests.erase(it);
+	auto itCb = std::find_if(request.callbacks.begin(),request.callbacks.end(),[requestId](const std::pair<RequestId,Callback> &pair) {
+		return pair.first == requestId;
+	});
+	if(itCb != request.callbacks.end())
+		request.callbacks.erase(itCb);
+	if(request.callbacks.empty() == false || request.started)
+		return true;
+	// Drop the load entirely if no channel is waiting for the buffer either
+	auto buffer = request.buffer.lock();
+	if(buffer != nullptr && static_cast<FMSoundBuffer&>(*buffer).GetChannelReferenceCount() > 0u)
+		return true;
+	m_queue.erase(&request);
+	auto path = request.path;
+	auto mono = request.mono;
+	m_requests.erase(request.key);
+	if(buffer != nullptr)
+	{
+		static_cast<FMSoundBuffer&>(*buffer).SetLoadState(FMSoundBuffer::LoadState::Failed);
+		buffer = nullptr;
+		m_system.EvictSoundBuffer(path,mono);
+	}
+	return true;
+}
+
+void al::FMSoundLoader::Submit(Request &request)
+{
+	request.started = true;
+	if(request.buffer.expired())
+	{
+		Complete(request,false);
+		return;
+	}
+	auto &fmSystem = m_system.GetFMODLowLevelSystem();
+	auto fileInfo = FMFileSystem::QueryFile(request.path);
+	request.params = al::get_load_parameters(m_system.GetLoadPolicy(),request.path,fileInfo.size,request.allowCompression);
+	FMOD_CREATESOUNDEXINFO exInfo {};
+	memset(&exInfo,0,sizeof(exInfo));
+	exInfo.cbsize = sizeof(exInfo);
+	exInfo.decodebuffersize = request.params.decodeBufferSize;
+	auto *nameOrData = m_system.GetFileSystem().PrepareSound(request.path,fileInfo,request.params.mode,exInfo,request.params.memory);
+	FMOD::Sound *sound = nullptr;
+	auto r = fmSystem.createSound(nameOrData,request.params.mode | FMOD_NONBLOCKING,&exInfo,&sound);
+	if(r != FMOD_OK || sound == nullptr)
+	{
+		if(RetryUncompressed(request))
+			return;
+		al::check_result(r);
+		Complete(request,false);
+		return;
+	}
+	request.sound = std::shared_ptr<FMOD::Sound>(sound,[](FMOD::Sound *sound) {
+		al::check_result(sound->release());
+	});
+	m_inFlight.push_back(&request);
+}
+
+bool al::FMSoundLoader::RetryUncompressed(Request &request)
+{
+	if(request.params.compressed == false || request.allowCompression == false)
+		return false;
+	// The codec of this file doesn't support compressed samples, load it decoded instead
+	request.allowCompression = false;
+	request.sound = nullptr;
+	Submit(request);
+	return true;
+}
+
+void al::FMSoundLoader::Complete(Request &request,bool success)
+{
+	auto buffer = request.buffer.lock();
+	auto *fmBuffer = static_cast<FMSoundBuffer*>(buffer.get());
+	if(fmBuffer != nullptr)
+	{
+		if(success)
+			m_system.OnSoundLoaded(*fmBuffer,request.sound,request.params);
+		else
+			fmBuffer->SetLoadState(FMSoundBuffer::LoadState::Failed);
+	}
+	else
+		success = false;
+	// The callbacks may queue new loads, so the request has to be removed before they're invoked
+	auto callbacks = std::move(request.callbacks);
+	for(auto &pair : callbacks)
+		m_callbackRequests.erase(pair.first);
+	auto path = request.path;
+	auto mono = request.mono;
+	m_requests.erase(request.key);
+	// Don't keep the failed buffer around, otherwise later loads of the same file would never be retried
+	if(success == false && fmBuffer != nullptr)
+		m_system.EvictSoundBuffer(path,mono);
+	for(auto &pair : callbacks)
+	{
+		if(pair.second != nullptr)
+			pair.second(success ? fmBuffer : nullptr);
+	}
+}
+
+void al::FMSoundLoader::Update()
+{
+	// Collect finished loads first, completing them may modify the lists
+	std::vector<std::pair<Request*,bool>> completed {};
+	for(auto it=m_inFlight.begin();it!=m_inFlight.end();)
+	{
+		auto &request = **it;
+		FMOD_OPENSTATE openState;
+		uint32_t percentBuffered;
+		bool starving,diskBusy;
+		auto r = request.sound->getOpenState(&openState,&percentBuffered,&starving,&diskBusy);
+		if(r == FMOD_OK && (openState == FMOD_OPENSTATE_LOADING || openState == FMOD_OPENSTATE_CONNECTING))
+		{
+			++it;
+			continue;
+		}
+		completed.push_back({&request,r == FMOD_OK && openState != FMOD_OPENSTATE_ERROR});
+		it = m_inFlight.erase(it);
+	}
+	for(auto &pair : completed)
+	{
+		if(pair.second == false && RetryUncompressed(*pair.first))
+			continue;
+		Complete(*pair.first,pair.second);
+	}
+
+	while(m_inFlight.size() < m_maxConcurrentLoads && m_queue.empty() == false)
+	{
+		auto *request = *m_queue.begin();
+		m_queue.erase(m_queue.begin());
+		Submit(*request);
+	}
+}
@@ -0,0 +1,84 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_SOUND_LOADER_HPP__
+#define __FMOD_SOUND_LOADER_HPP__
+
+#include "fmod_load_policy.hpp"
+#include <alsound_buffer.hpp>
+#include <memory>
+#include <functional>
+#include <set>
+#include <unordered_map>
+
+namespace FMOD
+{
+	class Sound;
+};
+namespace al
+{
+	class FMSoundSystem;
+	class FMSoundBuffer;
+	// Loads sounds without blocking the calling thread. Requests are started in order of their priority, with
+	// a limited number of FMOD_NONBLOCKING loads in flight at any time. All requests for the same buffer are
+	// coalesced into a single load.
+	class FMSoundLoader
+	{
+	public:
+		using RequestId = uint64_t;
+		// Called with nullptr if the load has failed or was dropped
+		using Callback = std::function<void(FMSoundBuffer*)>;
+		static constexpr RequestId INVALID_REQUEST = 0ull;
+
+		FMSoundLoader(FMSoundSystem &system);
+		~FMSoundLoader();
+
+		void Enqueue(const PSoundBuffer &buffer,const std::string &path,bool mono,int32_t priority=0);
+		// Adds a completion callback to the pending load of the buffer and raises its priority if necessary
+		RequestId AddCallback(FMSoundBuffer &buffer,int32_t priority,const Callback &callback);
+		// Removes the callback. If nothing else is waiting for the load and it hasn't started yet, the load is dropped.
+		bool Cancel(RequestId requestId);
+
+		void Update();
+		void Clear();
+
+		void SetMaxConcurrentLoads(uint32_t count);
+		uint32_t GetMaxConcurrentLoads() const;
+		uint32_t GetQueuedCount() const;
+		uint32_t GetInFlightCount() const;
+	private:
+		struct Request
+		{
+			std::string path;
+			bool mono = false;
+			int32_t priority = 0;
+			uint64_t sequence = 0ull;
+			FMSoundBuffer *key = nullptr;
+			std::weak_ptr<ISoundBuffer> buffer = {};
+			std::vector<std::pair<RequestId,Callback>> callbacks = {};
+			FMLoadParameters params = {};
+			std::shared_ptr<FMOD::Sound> sound = nullptr;
+			bool started = false;
+			bool allowCompression = true;
+		};
+		struct QueueOrder
+		{
+			bool operator()(const Request *a,const Request *b) const;
+		};
+		void Submit(Request &request);
+		bool RetryUncompressed(Request &request);
+		void Complete(Request &request,bool success);
+
+		FMSoundSystem &m_system;
+		uint32_t m_maxConcurrentLoads = 4u;
+		uint64_t m_nextSequence = 0ull;
+		RequestId m_nextRequestId = 1ull;
+		std::unordered_map<FMSoundBuffer*,std::unique_ptr<Request>> m_requests = {};
+		std::set<Request*,QueueOrder> m_queue = {};
+		std::vector<Request*> m_inFlight = {};
+		std::unordered_map<RequestId,Request*> m_callbackRequests = {};
+	};
+};
+
+#endif
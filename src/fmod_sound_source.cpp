@@ -5,90 +5,207 @@
 #include "fmod_sound_source.hpp"
 #include "fmod_sound_buffer.hpp"
 #include "fmod_sound_system.hpp"
+#include "fmod_decoder.hpp"
+#include "fmod_auxiliary_effect_slot.hpp"
+#include "fmod_hrtf.hpp"
 #include <alsound_coordinate_system.hpp>
 #include <fmod_studio.hpp>
+#include <cmath>
 
 al::FMSoundChannel::FMSoundChannel(ISoundSystem &system,ISoundBuffer &buffer)
 	: ISoundChannel(system,buffer)
-{}
+{
+	m_transformHandle = GetTransformStore().Register(*this);
+	m_voiceHandle = GetVoiceManager().Register(*this);
+	m_gridHandle = GetSpatialGrid().Register(*this);
+	GetSpatialGrid().SetPosition(m_gridHandle,m_soundSourceData.position);
+	m_propagationHandle = GetPropagationGraph().Register(*this);
+	m_commandIndex = GetCommandQueue().Register(*this);
+	static_cast<FMSoundBuffer&>(buffer).AddChannelReference();
+}
 al::FMSoundChannel::FMSoundChannel(ISoundSystem &system,Decoder &decoder)
-	: ISoundChannel(system,decoder)
-{}
+	: ISoundChannel(system,decoder),m_decoder{static_cast<FMDecoder&>(decoder).GetSharedPtr()}
+{
+	m_transformHandle = GetTransformStore().Register(*this);
+	m_voiceHandle = GetVoiceManager().Register(*this);
+	m_gridHandle = GetSpatialGrid().Register(*this);
+	GetSpatialGrid().SetPosition(m_gridHandle,m_soundSourceData.position);
+	m_propagationHandle = GetPropagationGraph().Register(*this);
+	m_commandIndex = GetCommandQueue().Register(*this);
+}
+al::FMSoundChannel::~FMSoundChannel()
+{
+	DetachBinaural();
+	for(auto i=0u;i<m_auxiliarySends.size();++i)
+		DoRemoveInternalEffect(i);
+	GetTransformStore().Unregister(m_transformHandle);
+	GetVoiceManager().Unregister(m_voiceHandle);
+	GetSpatialGrid().Unregister(m_gridHandle);
+	GetPropagationGraph().Unregister(m_propagationHandle);
+	GetCommandQueue().Unregister(m_commandIndex);
+	auto buffer = m_buffer.lock();
+	if(buffer != nullptr)
+	{
+		if(m_bOwnsStream)
+			static_cast<FMSoundBuffer&>(*buffer).ReleaseStream();
+		static_cast<FMSoundBuffer&>(*buffer).RemoveChannelReference();
+	}
+}
+al::FMTransformStore &al::FMSoundChannel::GetTransformStore() {return static_cast<FMSoundSystem&>(m_system).GetTransformStore();}
+al::FMVoiceManager &al::FMSoundChannel::GetVoiceManager() {return static_cast<FMSoundSystem&>(m_system).GetVoiceManager();}
+al::FMSpatialGrid &al::FMSoundChannel::GetSpatialGrid() {return static_cast<FMSoundSystem&>(m_system).GetSpatialGrid();}
+al::FMPropagationGraph &al::FMSoundChannel::GetPropagationGraph() {return static_cast<FMSoundSystem&>(m_system).GetPropagationGraph();}
+al::FMCommandQueue &al::FMSoundChannel::GetCommandQueue() {return static_cast<FMSoundSystem&>(m_system).GetCommandQueue();}
 void al::FMSoundChannel::SetSource(FMOD::Channel *source)
+{
+	SetSource(source,0u);
+	if(m_source == nullptr)
+		return;
+	// The mode is only queried if it isn't known already, afterwards it's owned by this channel
+	FMOD_MODE mode;
+	if(CheckResultAndUpdateValidity(m_source->getMode(&mode)))
+		m_fmMode = mode;
+}
+void al::FMSoundChannel::SetSource(FMOD::Channel *source,uint32_t mode)
 {
 	m_source = source;
+	m_fmMode = (source != nullptr) ? mode : 0u;
+	m_bPlaying = false;
+	m_bStarving = false;
 }
 void al::FMSoundChannel::Update()
 {
 	ISoundChannel::Update();
-	if(m_source != nullptr)
-		m_soundSourceData.offset = GetOffset();
+	if(m_bSchedulePlay && m_source == nullptr)
+		UpdateScheduledPlay();
+	if(m_source == nullptr)
+		return;
+	// Refresh the only state that changes on FMOD's side without us touching it
+	auto playing = false;
+	if(CheckResultAndUpdateValidity(m_source->isPlaying(&playing)) == false)
+		return;
+	m_bPlaying = playing;
+	if(playing == false)
+		return;
+	uint32_t pos;
+	if(CheckResultAndUpdateValidity(m_source->getPosition(&pos,FMOD_TIMEUNIT_PCM)))
+		m_soundSourceData.offset = pos;
+	if(m_bStreamed)
+		UpdateStreamStarvation();
+}
+void al::FMSoundChannel::UpdateScheduledPlay()
+{
+	// The buffer is still being loaded asynchronously
+	auto buffer = m_buffer.lock();
+	if(buffer == nullptr || static_cast<FMSoundBuffer&>(*buffer).GetLoadState() == FMSoundBuffer::LoadState::Failed)
+	{
+		m_bSchedulePlay = false;
+		return;
+	}
+	if(buffer->IsReady())
+		Play();
+}
+void al::FMSoundChannel::UpdateStreamStarvation()
+{
+	auto buffer = m_buffer.lock();
+	if(buffer == nullptr || m_source == nullptr)
+		return;
+	auto starving = (m_streamInstance != nullptr) ? FMSoundBuffer::GetStreamState(*m_streamInstance).starving : static_cast<FMSoundBuffer&>(*buffer).GetStreamState().starving;
+	if(starving == m_bStarving)
+		return;
+	// Muting a starving stream avoids the stutter of repeated buffer underruns until it has caught up again
+	if(CheckResultAndUpdateValidity(m_source->setMute(starving)))
+		m_bStarving = starving;
 }
 
 void al::FMSoundChannel::SetFrameOffset(uint64_t offset)
 {
+	if(m_decoder != nullptr && m_decoder->IsSeekable() == false)
+	{
+		std::cout<<"[FMOD] Unable to change the offset of a channel with a procedural decoder!"<<std::endl;
+		return;
+	}
 	m_soundSourceData.offset = offset;
+	m_virtualOffset = static_cast<double>(offset);
 	if(m_source != nullptr)
 		CheckResultAndUpdateValidity(m_source->setPosition(offset,FMOD_TIMEUNIT_PCM));
 }
 uint64_t al::FMSoundChannel::GetFrameOffset(uint64_t *latency) const
 {
-	if(m_source != nullptr)
-	{
-		uint32_t pos;
-		if(CheckResultAndUpdateValidity(m_source->getPosition(&pos,FMOD_TIMEUNIT_PCM)))
-			return pos;
-	}
 	return m_soundSourceData.offset;
 }
 
 void al::FMSoundChannel::Stop()
 {
+	DetachBinaural();
 	if(m_source != nullptr)
 		CheckResultAndUpdateValidity(m_source->stop());
 	m_bSchedulePlay = false;
+	m_bPlaying = false;
+	m_bVirtual = false;
+	m_bPaused = false;
 }
 
 void al::FMSoundChannel::Pause()
 {
+	// Virtual voices simply stop advancing
+	m_bPaused = true;
 	if(m_source != nullptr)
 		CheckResultAndUpdateValidity(m_source->setPaused(true));
 }
 
 void al::FMSoundChannel::Play()
 {
-	InitializeChannel();
 	m_soundSourceData.offset = 0ull;
-	if(m_source != nullptr)
-		CheckResultAndUpdateValidity(m_source->setPosition(0u,FMOD_TIMEUNIT_MS));
-	if(m_source != nullptr)
-		CheckResultAndUpdateValidity(m_source->setPaused(false));
+	m_bPaused = false;
+	m_bVirtual = false;
+	GetVoiceManager().OnPlay(m_voiceHandle);
+	if(InitializeChannel() == false && m_source != nullptr)
+	{
+		CheckResultAndUpdateValidity(m_source->setPosition(0u,FMOD_TIMEUNIT_PCM));
+		// The previous FMOD channel may have ended or been stolen in the meantime
+		if(m_source == nullptr)
+			InitializeChannel();
+	}
+	if(m_source == nullptr)
+	{
+		if(m_bVirtual)
+		{
+			// Over the voice budget, the voice manager will make this a real channel once it's audible enough
+			m_bSchedulePlay = false;
+			m_bPlaying = true;
+			return;
+		}
+		// Start automatically once the buffer has finished loading
+		auto buffer = m_buffer.lock();
+		if(buffer != nullptr && static_cast<FMSoundBuffer&>(*buffer).GetLoadState() == FMSoundBuffer::LoadState::Loading)
+			m_bSchedulePlay = true;
+		return;
+	}
+	m_bSchedulePlay = false;
+	if(CheckResultAndUpdateValidity(m_source->setPaused(false)))
+		m_bPlaying = true;
 }
 
 void al::FMSoundChannel::Resume()
 {
-	if(m_source == nullptr)
+	// A new channel continues from the last known offset
+	m_bPaused = false;
+	if(m_source == nullptr && InitializeChannel() == false)
 	{
-		auto offset = GetFrameOffset();
-		Play();
-		SetFrameOffset(offset);
+		if(m_bVirtual)
+			m_bPlaying = true;
 		return;
 	}
-	if(m_source != nullptr)
-		CheckResultAndUpdateValidity(m_source->setPaused(false));
+	if(CheckResultAndUpdateValidity(m_source->setPaused(false)))
+		m_bPlaying = true;
 }
 
 bool al::FMSoundChannel::IsPlaying() const
 {
 	if(m_bSchedulePlay == true)
 		return true;
-	if(m_source != nullptr)
-	{
-		auto r = false;
-		if(CheckResultAndUpdateValidity(m_source->isPlaying(&r)))
-			return r;
-	}
-	return false;
+	return (m_source != nullptr || m_bVirtual) && m_bPlaying;
 }
 bool al::FMSoundChannel::IsPaused() const
 {
@@ -97,220 +214,178 @@ bool al::FMSoundChannel::IsPaused() const
 
 void al::FMSoundChannel::SetPriority(uint32_t priority)
 {
+	if(priority == m_soundSourceData.priority)
+		return;
 	m_soundSourceData.priority = priority;
 	if(m_source != nullptr)
 		CheckResultAndUpdateValidity(m_source->setPriority(priority));
 }
 uint32_t al::FMSoundChannel::GetPriority() const
 {
-	if(m_source != nullptr)
-	{
-		int32_t priority;
-		if(CheckResultAndUpdateValidity(m_source->getPriority(&priority)))
-			return priority;
-	}
 	return m_soundSourceData.priority;
 }
 
 void al::FMSoundChannel::SetLooping(bool bLoop)
 {
+	if(bLoop == m_soundSourceData.looping)
+		return;
 	m_soundSourceData.looping = bLoop;
 	if(m_source != nullptr)
-	{
-		FMOD_MODE mode;
-		if(CheckResultAndUpdateValidity(m_source->getMode(&mode)))
-		{
-			mode &= ~(FMOD_LOOP_OFF | FMOD_LOOP_NORMAL | FMOD_LOOP_BIDI);
-			if(bLoop == false)
-				mode |= FMOD_LOOP_OFF;
-			else
-				mode |= FMOD_LOOP_NORMAL;
-			CheckResultAndUpdateValidity(m_source->setMode(mode));
-		}
-	}
+		SetFMODMode(CalcFMODMode());
 }
 bool al::FMSoundChannel::IsLooping() const
 {
-	if(m_source != nullptr)
-	{
-		FMOD_MODE mode;
-		if(CheckResultAndUpdateValidity(m_source->getMode(&mode)))
-			return !(mode &FMOD_LOOP_OFF) && (mode &(FMOD_LOOP_NORMAL | FMOD_LOOP_BIDI)) != 0;
-	}
 	return m_soundSourceData.looping;
 }
 
 void al::FMSoundChannel::SetPitch(float pitch)
 {
+	if(pitch == m_soundSourceData.pitch)
+		return;
 	m_soundSourceData.pitch = pitch;
 	if(m_source != nullptr)
 		CheckResultAndUpdateValidity(m_source->setPitch(pitch));
 }
 float al::FMSoundChannel::GetPitch() const
 {
-	if(m_source != nullptr)
-	{
-		auto pitch = 0.f;
-		if(CheckResultAndUpdateValidity(m_source->getPitch(&pitch)))
-			return pitch;
-	}
 	return m_soundSourceData.pitch;
 }
 
 void al::FMSoundChannel::SetGain(float gain)
 {
+	if(gain == m_soundSourceData.gain)
+		return;
 	m_soundSourceData.gain = gain;
 	if(m_source != nullptr)
 		CheckResultAndUpdateValidity(m_source->setVolume(gain));
 }
 float al::FMSoundChannel::GetGain() const
 {
-	if(m_source != nullptr)
-	{
-		auto gain = 0.f;
-		if(CheckResultAndUpdateValidity(m_source->getVolume(&gain)))
-			return gain;
-	}
 	return m_soundSourceData.gain;
 }
 
 void al::FMSoundChannel::SetDistanceRange(float refDist,float maxDist)
 {
 	refDist = umath::min(refDist,maxDist);
-	auto refDistAudio = al::to_audio_distance(refDist);
-	auto maxDistAudio = al::to_audio_distance(maxDist);
-	if(maxDistAudio == std::numeric_limits<float>::infinity())
-		maxDistAudio = std::numeric_limits<float>::max();
+	if(refDist == m_soundSourceData.distanceRange.first && maxDist == m_soundSourceData.distanceRange.second)
+		return;
 	m_soundSourceData.distanceRange = {refDist,maxDist};
-	if(Is3D() && m_source != nullptr)
-		CheckResultAndUpdateValidity(m_source->set3DMinMaxDistance(refDistAudio,maxDistAudio));
+	if(Is3D())
+		ApplyDistanceRange();
 }
 
 std::pair<float,float> al::FMSoundChannel::GetDistanceRange() const
 {
-	if(Is3D() && m_source != nullptr)
-	{
-		float minDist,maxDist;
-		if(CheckResultAndUpdateValidity(m_source->get3DMinMaxDistance(&minDist,&maxDist)))
-			return {al::to_game_distance(minDist),al::to_game_distance(maxDist)};
-	}
 	return m_soundSourceData.distanceRange;
 }
 
 void al::FMSoundChannel::SetPosition(const Vector3 &pos)
 {
-	auto posAudio = al::to_audio_position(pos);
 	m_soundSourceData.position = pos;
-	UpdateMode();
-	if(Is3D() && m_source != nullptr)
-	{
-		auto fmPos = al::to_custom_vector<FMOD_VECTOR>(posAudio);
-		CheckResultAndUpdateValidity(m_source->set3DAttributes(&fmPos,nullptr));
-		return;
-	}
+	GetTransformStore().SetPosition(m_transformHandle,pos);
+	if(IsRelative())
+		UpdateMode(); // The position only affects the mode of relative sources
+	else
+		GetSpatialGrid().SetPosition(m_gridHandle,pos);
+	GetPropagationGraph().MarkDirty(m_propagationHandle);
 }
 
 Vector3 al::FMSoundChannel::GetPosition() const
 {
-	if(Is3D() && m_source != nullptr)
-	{
-		FMOD_VECTOR pos;
-		if(CheckResultAndUpdateValidity(m_source->get3DAttributes(&pos,nullptr)))
-			return al::to_game_position({pos.x,pos.y,pos.z});
-	}
+	// The FMOD channel only receives the position with the next transform flush
 	return m_soundSourceData.position;
 }
 
 void al::FMSoundChannel::SetVelocity(const Vector3 &vel)
 {
-	auto velAudio = al::to_audio_position(vel);
 	m_soundSourceData.velocity = vel;
-	UpdateMode();
-	if(Is3D() && m_source != nullptr)
-	{
-		auto fmVel = al::to_custom_vector<FMOD_VECTOR>(velAudio);
-		CheckResultAndUpdateValidity(m_source->set3DAttributes(nullptr,&fmVel));
-		return;
-	}
+	GetTransformStore().SetVelocity(m_transformHandle,vel);
+	if(IsRelative())
+		UpdateMode();
 }
 Vector3 al::FMSoundChannel::GetVelocity() const
 {
-	if(Is3D() && m_source != nullptr)
-	{
-		FMOD_VECTOR vel;
-		if(CheckResultAndUpdateValidity(m_source->get3DAttributes(nullptr,&vel)))
-			return al::to_game_position({vel.x,vel.y,vel.z});
-	}
 	return m_soundSourceData.velocity;
 }
 
 void al::FMSoundChannel::SetDirection(const Vector3 &dir)
 {
-	auto dirAudio = al::to_audio_direction(dir);
-	// FMOD TODO
+	SetOrientation(dir,m_soundSourceData.orientation.second);
 }
 Vector3 al::FMSoundChannel::GetDirection() const
 {
-	// FMOD TODO
-	return {};
+	return m_soundSourceData.orientation.first;
 }
 
 void al::FMSoundChannel::SetOrientation(const Vector3 &at,const Vector3 &up)
 {
-	auto atAudio = al::to_audio_direction(at);
-	auto atUp = al::to_audio_direction(up);
-	// FMOD TODO
-	//FMOD_VECTOR orientation {at.x,at.y,at.z};
-	//al::fmod::check_result(m_source->set3DConeOrientation(&orientation));
+	m_soundSourceData.orientation = {at,up};
+	// Only the forward vector is relevant for the FMOD cone orientation
+	GetTransformStore().SetOrientation(m_transformHandle,at);
+	if(m_soundSourceData.coneAngles.second < 360.f)
+		GetPropagationGraph().MarkDirty(m_propagationHandle);
 }
 std::pair<Vector3,Vector3> al::FMSoundChannel::GetOrientation() const
 {
-	// FMOD TODO
-	return {{},{}};
+	return m_soundSourceData.orientation;
+}
+
+void al::FMSoundChannel::Apply3DAttributes(const Vector3 &posAudio,const Vector3 &velAudio,const Vector3 *forwardAudio)
+{
+	if(m_source == nullptr || Is3D() == false)
+		return;
+	auto fmPos = al::to_custom_vector<FMOD_VECTOR>(posAudio);
+	auto fmVel = al::to_custom_vector<FMOD_VECTOR>(velAudio);
+	if(CheckResultAndUpdateValidity(m_source->set3DAttributes(&fmPos,&fmVel)) == false || forwardAudio == nullptr)
+		return;
+	auto fmForward = al::to_custom_vector<FMOD_VECTOR>(*forwardAudio);
+	CheckResultAndUpdateValidity(m_source->set3DConeOrientation(&fmForward));
 }
 
 void al::FMSoundChannel::SetConeAngles(float inner,float outer)
 {
+	if(inner == m_soundSourceData.coneAngles.first && outer == m_soundSourceData.coneAngles.second)
+		return;
 	m_soundSourceData.coneAngles = {inner,outer};
-	UpdateMode();
-	if(Is3D() && m_source != nullptr)
-	{
-		float t,volume;
-		m_source->get3DConeSettings(&t,&t,&volume);
-		CheckResultAndUpdateValidity(m_source->set3DConeSettings(inner,outer,volume));
-	}
+	if(IsRelative())
+		UpdateMode(); // The cone only affects the mode of relative sources
+	if(Is3D())
+		CheckResultAndUpdateValidity(m_source->set3DConeSettings(inner,outer,m_soundSourceData.outerConeGains.first));
+	GetPropagationGraph().MarkDirty(m_propagationHandle);
 }
 std::pair<float,float> al::FMSoundChannel::GetConeAngles() const
 {
-	if(Is3D() && m_source != nullptr)
-	{
-		float inner,outer;
-		if(CheckResultAndUpdateValidity(m_source->get3DConeSettings(&inner,&outer,nullptr)))
-			return {inner,outer};
-	}
 	return m_soundSourceData.coneAngles;
 }
 
 void al::FMSoundChannel::SetOuterConeGains(float gain,float gainHF)
 {
-	// FMOD TODO
+	auto &gains = m_soundSourceData.outerConeGains;
+	if(gain == gains.first && gainHF == gains.second)
+		return;
+	auto bGainChanged = (gain != gains.first);
+	gains = {gain,gainHF};
+	if(bGainChanged && Is3D())
+	{
+		auto &coneAngles = m_soundSourceData.coneAngles;
+		CheckResultAndUpdateValidity(m_source->set3DConeSettings(coneAngles.first,coneAngles.second,gain));
+	}
+	// FMOD has no high frequency cone attenuation
+	GetPropagationGraph().MarkDirty(m_propagationHandle);
 }
 
 std::pair<float,float> al::FMSoundChannel::GetOuterConeGains() const
 {
-	// FMOD TODO
-	return {0.f,0.f};
+	return m_soundSourceData.outerConeGains;
 }
 
 float al::FMSoundChannel::GetOuterConeGain() const
 {
-	// FMOD TODO
-	return 0.f;
+	return m_soundSourceData.outerConeGains.first;
 }
 float al::FMSoundChannel::GetOuterConeGainHF() const
 {
-	// FMOD TODO
-	return 0.f;
+	return m_soundSourceData.outerConeGains.second;
 }
 
 void al::FMSoundChannel::SetRolloffFactors(float factor,float roomFactor)
@@ -337,28 +412,30 @@ float al::FMSoundChannel::GetRoomRolloffFactor() const
 
 void al::FMSoundChannel::SetDopplerFactor(float factor)
 {
+	if(factor == m_soundSourceData.dopplerFactor)
+		return;
 	m_soundSourceData.dopplerFactor = factor;
-	if(Is3D() && m_source != nullptr)
+	if(Is3D())
 		CheckResultAndUpdateValidity(m_source->set3DDopplerLevel(factor));
 }
 float al::FMSoundChannel::GetDopplerFactor() const
 {
-	if(Is3D() && m_source != nullptr)
-	{
-		auto factor = 0.f;
-		if(CheckResultAndUpdateValidity(m_source->get3DDopplerLevel(&factor)))
-			return factor;
-	}
 	return m_soundSourceData.dopplerFactor;
 }
 
 void al::FMSoundChannel::SetRelative(bool bRelative)
 {
-	auto bRelativeOld = IsRelative();
+	if(bRelative == m_soundSourceData.relativeToListener)
+		return;
 	m_soundSourceData.relativeToListener = bRelative;
+	// Relative positions have no meaning in world space
+	if(bRelative)
+		GetSpatialGrid().Remove(m_gridHandle);
+	else
+		GetSpatialGrid().SetPosition(m_gridHandle,m_soundSourceData.position);
 	UpdateMode();
-	if(bRelative != bRelativeOld)
-		CallCallbacks<void,bool>("OnRelativeChanged",bRelative);
+	GetPropagationGraph().MarkDirty(m_propagationHandle);
+	CallCallbacks<void,bool>("OnRelativeChanged",bRelative);
 }
 bool al::FMSoundChannel::IsRelative() const
 {
@@ -387,12 +464,22 @@ std::pair<float,float> al::FMSoundChannel::GetStereoAngles() const
 
 void al::FMSoundChannel::SetAirAbsorptionFactor(float factor)
 {
-	// FMOD TODO
+	if(factor == m_soundSourceData.airAbsorptionFactor)
+		return;
+	m_soundSourceData.airAbsorptionFactor = factor;
+	GetPropagationGraph().MarkDirty(m_propagationHandle);
 }
 float al::FMSoundChannel::GetAirAbsorptionFactor() const
 {
-	// FMOD TODO
-	return 0.f;
+	return m_soundSourceData.airAbsorptionFactor;
+}
+void al::FMSoundChannel::SetDirectFilter(const EffectParams &params)
+{
+	std::pair<float,float> filter {params.gain,params.gainHF};
+	if(filter == m_soundSourceData.directFilter)
+		return;
+	m_soundSourceData.directFilter = filter;
+	GetPropagationGraph().MarkDirty(m_propagationHandle);
 }
 
 void al::FMSoundChannel::SetGainAuto(bool directHF,bool send,bool sendHF)
@@ -425,85 +512,293 @@ void al::FMSoundChannel::SetFMOD3DAttributesEffective(bool b)
 	m_b3DAttributesEffective = b;
 	UpdateMode();
 }
-void al::FMSoundChannel::UpdateMode()
+uint32_t al::FMSoundChannel::CalcFMODMode() const
 {
-	FMOD_MODE mode;
-	if(CheckResultAndUpdateValidity(m_source->getMode(&mode)) == false)
-		return;
-	auto oldMode = mode;
-	mode &= ~(FMOD_2D | FMOD_3D | FMOD_3D_HEADRELATIVE | FMOD_3D_WORLDRELATIVE);
+	auto mode = m_fmMode;
+	mode &= ~(FMOD_2D | FMOD_3D | FMOD_3D_HEADRELATIVE | FMOD_3D_WORLDRELATIVE | FMOD_LOOP_OFF | FMOD_LOOP_NORMAL | FMOD_LOOP_BIDI);
+	mode |= m_soundSourceData.looping ? FMOD_LOOP_NORMAL : FMOD_LOOP_OFF;
 	if(m_b3DAttributesEffective == false)
-		mode |= FMOD_2D;
-	else
-	{
-		if(IsRelative() == false)
-			mode |= FMOD_3D | FMOD_3D_WORLDRELATIVE;
-		else
-		{
-			auto coneAngles = GetConeAngles();
-			if(uvec::length_sqr(m_soundSourceData.position) == 0.f && uvec::length_sqr(m_soundSourceData.velocity) == 0.f && m_soundSourceData.coneAngles.first >= 360.f && m_soundSourceData.coneAngles.second >= 360.f) // Note: UpdateMode() has to be called whenever one of these was changed
-				mode |= FMOD_2D;
-			else
-				mode |= FMOD_3D | FMOD_3D_HEADRELATIVE;
-		}
-	}
-	if(mode == oldMode)
+		return mode | FMOD_2D;
+	if(IsRelative() == false)
+		return mode | FMOD_3D | FMOD_3D_WORLDRELATIVE;
+	// Note: UpdateMode() has to be called whenever one of these was changed
+	if(uvec::length_sqr(m_soundSourceData.position) == 0.f && uvec::length_sqr(m_soundSourceData.velocity) == 0.f && m_soundSourceData.coneAngles.first >= 360.f && m_soundSourceData.coneAngles.second >= 360.f)
+		return mode | FMOD_2D;
+	return mode | FMOD_3D | FMOD_3D_HEADRELATIVE;
+}
+bool al::FMSoundChannel::SetFMODMode(uint32_t mode)
+{
+	if(m_source == nullptr)
+		return false;
+	if(mode == m_fmMode)
+		return true;
+	if(CheckResultAndUpdateValidity(m_source->setMode(mode)) == false)
+		return false;
+	m_fmMode = mode;
+	return true;
+}
+void al::FMSoundChannel::UpdateMode()
+{
+	if(m_source == nullptr)
 		return;
-	if((mode &FMOD_3D) == 0 || (oldMode &FMOD_3D) != 0) // No update required if new mode isn't 3D, or if old mode was already 3D
-	{
-		CheckResultAndUpdateValidity(m_source->setMode(mode));
+	auto was3D = Is3D();
+	if(SetFMODMode(CalcFMODMode()) == false)
 		return;
-	}
 	// If this was previously a 2D sound, we have to re-set the 3D attributes
 	// after the new mode has been applied
-	auto distRange = GetDistanceRange();
-	auto pos = GetPosition();
-	auto vel = GetVelocity();
-	auto coneAngles = GetConeAngles();
-	auto dopplerFactor = GetDopplerFactor();
-	if(CheckResultAndUpdateValidity(m_source->setMode(mode)) == false)
+	if(was3D == false && Is3D())
+	{
+		Apply3DState();
+		GetTransformStore().MarkDirty(m_transformHandle);
+	}
+}
+std::pair<float,float> al::FMSoundChannel::GetAudioDistanceRange() const
+{
+	auto refDistAudio = al::to_audio_distance(m_soundSourceData.distanceRange.first);
+	auto maxDistAudio = al::to_audio_distance(m_soundSourceData.distanceRange.second);
+	if(maxDistAudio == std::numeric_limits<float>::infinity())
+		maxDistAudio = std::numeric_limits<float>::max();
+	return {refDistAudio,maxDistAudio};
+}
+void al::FMSoundChannel::ApplyDistanceRange()
+{
+	auto distanceRange = GetAudioDistanceRange();
+	CheckResultAndUpdateValidity(m_source->set3DMinMaxDistance(distanceRange.first,distanceRange.second));
+}
+void al::FMSoundChannel::Apply3DState()
+{
+	ApplyDistanceRange();
+	if(m_source != nullptr)
+		CheckResultAndUpdateValidity(m_source->set3DConeSettings(m_soundSourceData.coneAngles.first,m_soundSourceData.coneAngles.second,m_soundSourceData.outerConeGains.first));
+	if(m_source != nullptr)
+		CheckResultAndUpdateValidity(m_source->set3DDopplerLevel(m_soundSourceData.dopplerFactor));
+}
+void al::FMSoundChannel::ApplyState(const FMChannelDefaults &defaults)
+{
+	// Pushes the shadow state to a freshly created FMOD channel. The channel starts out with the defaults
+	// of its sound, so only values that differ from those have to be set.
+	auto &data = m_soundSourceData;
+	if(data.offset > 0ull)
+		CheckResultAndUpdateValidity(m_source->setPosition(data.offset,FMOD_TIMEUNIT_PCM));
+	if(m_source != nullptr && data.priority != defaults.priority)
+		CheckResultAndUpdateValidity(m_source->setPriority(data.priority));
+	if(m_source != nullptr && data.pitch != 1.f)
+		CheckResultAndUpdateValidity(m_source->setPitch(data.pitch));
+	if(m_source != nullptr && data.gain != 1.f)
+		CheckResultAndUpdateValidity(m_source->setVolume(data.gain));
+	ApplyAuxiliarySends();
+	// Looping and 2D/3D are applied with a single mode change
+	if(SetFMODMode(CalcFMODMode()) == false || Is3D() == false)
 		return;
-	SetDistanceRange(distRange.first,distRange.second);
-	SetPosition(pos);
-	SetVelocity(vel);
-	SetConeAngles(coneAngles.first,coneAngles.second);
-	SetDopplerFactor(dopplerFactor);
+	auto distanceRange = GetAudioDistanceRange();
+	if(distanceRange.first != defaults.minDistance || distanceRange.second != defaults.maxDistance)
+		CheckResultAndUpdateValidity(m_source->set3DMinMaxDistance(distanceRange.first,distanceRange.second));
+	if(m_source != nullptr && (data.coneAngles.first != defaults.coneInsideAngle || data.coneAngles.second != defaults.coneOutsideAngle || data.outerConeGains.first != defaults.coneOutsideVolume))
+		CheckResultAndUpdateValidity(m_source->set3DConeSettings(data.coneAngles.first,data.coneAngles.second,data.outerConeGains.first));
+	if(m_source != nullptr && data.dopplerFactor != 1.f)
+		CheckResultAndUpdateValidity(m_source->set3DDopplerLevel(data.dopplerFactor));
+	// The new FMOD channel needs its 3D attributes right away, it can't wait for the next flush
+	GetTransformStore().Commit(m_transformHandle);
+	GetPropagationGraph().MarkDirty(m_propagationHandle,true);
 }
 void al::FMSoundChannel::InvalidateSource() const {m_source = nullptr;}
 bool al::FMSoundChannel::Is3D() const
 {
-	if(m_source != nullptr)
-	{
-		FMOD_MODE mode;
-		if(CheckResultAndUpdateValidity(m_source->getMode(&mode)))
-			return (mode &FMOD_3D) != 0;
-	}
-	return false;
+	return m_source != nullptr && (m_fmMode &FMOD_3D) != 0;
 }
 bool al::FMSoundChannel::Is2D() const {return !Is3D();}
-bool al::FMSoundChannel::InitializeChannel()
+bool al::FMSoundChannel::InitializeChannel(bool bAcquireVoice)
 {
-	if(m_source != nullptr || m_buffer.expired())
+	if(m_source != nullptr)
 		return false;
-	auto *sound = static_cast<FMSoundBuffer*>(m_buffer.lock().get())->GetFMODSound();
-	if(sound == nullptr || CheckResultAndUpdateValidity(static_cast<FMSoundSystem&>(m_system).GetFMODLowLevelSystem().playSound(sound,nullptr,true,&m_source)) == false)
+	FMTracer::Zone zone {static_cast<FMSoundSystem&>(m_system).GetTracer(),"InitializeChannel"};
+	FMOD::Sound *sound = nullptr;
+	const FMChannelDefaults *defaults = nullptr;
+	if(m_decoder != nullptr)
+	{
+		// Decoder streams pull their data on demand and never starve in the sense of FMOD's file streams
+		sound = m_decoder->GetFMODSound();
+		defaults = &m_decoder->GetChannelDefaults();
+		m_bStreamed = false;
+	}
+	else
+	{
+		if(m_buffer.expired())
+			return false;
+		auto *fmBuffer = static_cast<FMSoundBuffer*>(m_buffer.lock().get());
+		sound = fmBuffer->GetFMODSound();
+		if(sound != nullptr)
+			defaults = &fmBuffer->GetChannelDefaults();
+		m_bStreamed = fmBuffer->IsStreamed();
+		if(sound != nullptr && m_bStreamed && m_bOwnsStream == false)
+		{
+			// Playing a stream on a second channel would steal it from the first one
+			if(m_streamInstance == nullptr && fmBuffer->AcquireStream())
+				m_bOwnsStream = true;
+			else
+			{
+				if(m_streamInstance == nullptr)
+					m_streamInstance = static_cast<FMSoundSystem&>(m_system).OpenStreamInstance(*fmBuffer);
+				sound = m_streamInstance.get();
+			}
+		}
+	}
+	if(sound == nullptr)
+		return false;
+	if(bAcquireVoice && GetVoiceManager().AcquireVoice(m_voiceHandle) == false)
+	{
+		if(CanVirtualize() == false)
+		{
+			std::cout<<"[FMOD] Unable to play channel with a procedural decoder: The voice limit has been reached and the channel can't be virtualized!"<<std::endl;
+			return false;
+		}
+		BeginVirtual();
+		return false;
+	}
+	FMOD::Channel *channel = nullptr;
+	if(CheckResultAndUpdateValidity(static_cast<FMSoundSystem&>(m_system).GetFMODLowLevelSystem().playSound(sound,nullptr,true,&channel)) == false)
 		return false;
-	SetOffset(m_soundSourceData.offset);
-	SetPriority(m_soundSourceData.priority);
-	SetLooping(m_soundSourceData.looping);
-	SetPitch(m_soundSourceData.pitch);
-	SetGain(m_soundSourceData.gain);
-	SetDistanceRange(m_soundSourceData.distanceRange.first,m_soundSourceData.distanceRange.second);
-	SetPosition(m_soundSourceData.position);
-	SetVelocity(m_soundSourceData.velocity);
-	SetConeAngles(m_soundSourceData.coneAngles.first,m_soundSourceData.coneAngles.second);
-	SetDopplerFactor(m_soundSourceData.dopplerFactor);
-	SetRelative(m_soundSourceData.relativeToListener);
+	// The channel inherits the mode of its sound, no need to query it
+	SetSource(channel,defaults->mode);
+	if(m_source == nullptr)
+		return false;
+	m_bVirtual = false;
+	ApplyState(*defaults);
 #if ALSYS_STEAM_AUDIO_SUPPORT_ENABLED == 1
 	SetChannelGroup(GetChannelGroup());
 #endif
+	AttachBinaural();
+	return m_source != nullptr;
+}
+bool al::FMSoundChannel::IsVoiceActive() const {return m_bPlaying && m_bPaused == false;}
+bool al::FMSoundChannel::CanVirtualize() const {return m_decoder == nullptr || m_decoder->IsSeekable();}
+void al::FMSoundChannel::BeginVirtual()
+{
+	m_bVirtual = true;
+	m_virtualOffset = static_cast<double>(m_soundSourceData.offset);
+	if(m_decoder != nullptr)
+	{
+		m_virtualFrequency = m_decoder->GetFrequency();
+		m_virtualLength = m_decoder->GetLength();
+		return;
+	}
+	auto buffer = m_buffer.lock();
+	m_virtualFrequency = (buffer != nullptr) ? buffer->GetFrequency() : 0u;
+	m_virtualLength = (buffer != nullptr) ? buffer->GetLength() : 0ull;
+}
+void al::FMSoundChannel::Virtualize()
+{
+	if(m_source == nullptr)
+		return;
+	uint32_t pos;
+	if(CheckResultAndUpdateValidity(m_source->getPosition(&pos,FMOD_TIMEUNIT_PCM)))
+		m_soundSourceData.offset = pos;
+	DetachBinaural();
+	if(m_source != nullptr)
+		CheckResultAndUpdateValidity(m_source->stop());
+	// The playback state is kept, only the FMOD channel is released
+	m_source = nullptr;
+	m_fmMode = 0u;
+	m_bStarving = false;
+	BeginVirtual();
+}
+bool al::FMSoundChannel::Devirtualize()
+{
+	m_soundSourceData.offset = static_cast<uint64_t>(m_virtualOffset);
+	if(InitializeChannel(false) == false)
+		return false;
+	if(CheckResultAndUpdateValidity(m_source->setPaused(false)) == false)
+		return false;
+	m_bPlaying = true;
 	return true;
 }
+bool al::FMSoundChannel::AdvanceVirtualVoice(float dt)
+{
+	m_virtualOffset += static_cast<double>(dt) *m_virtualFrequency *m_soundSourceData.pitch;
+	if(m_virtualLength > 0ull && m_virtualOffset >= static_cast<double>(m_virtualLength))
+	{
+		if(m_soundSourceData.looping == false)
+		{
+			m_soundSourceData.offset = 0ull;
+			m_bVirtual = false;
+			m_bPlaying = false;
+			return false;
+		}
+		m_virtualOffset = std::fmod(m_virtualOffset,static_cast<double>(m_virtualLength));
+	}
+	m_soundSourceData.offset = static_cast<uint64_t>(m_virtualOffset);
+	return true;
+}
+void al::FMSoundChannel::DoAddEffect(IAuxiliaryEffectSlot &slot,uint32_t slotId,const EffectParams &params)
+{
+	if(slotId >= m_auxiliarySends.size())
+		return;
+	auto &send = m_auxiliarySends[slotId];
+	if(send.dsp == nullptr)
+	{
+		auto r = static_cast<FMSoundSystem&>(m_system).GetFMODLowLevelSystem().createDSPByType(FMOD_DSP_TYPE_SEND,&send.dsp);
+		al::check_result(r);
+		if(r != FMOD_OK)
+		{
+			send.dsp = nullptr;
+			return;
+		}
+	}
+	al::check_result(send.dsp->setParameterInt(FMOD_DSP_SEND_RETURNID,static_cast<FMAuxiliaryEffectSlot&>(slot).GetReturnId()));
+	send.gain = params.gain;
+	al::check_result(send.dsp->setParameterFloat(FMOD_DSP_SEND_LEVEL,send.gain));
+	// Sends are taken after the fader, so they include the distance attenuation. The binaural capture DSP has to stay
+	// at the head, behind the sends.
+	if(m_source != nullptr)
+		CheckResultAndUpdateValidity(m_source->addDSP((m_binauralSlot != std::numeric_limits<uint32_t>::max()) ? 1 : FMOD_CHANNELCONTROL_DSP_HEAD,send.dsp));
+}
+void al::FMSoundChannel::DoRemoveInternalEffect(uint32_t slotId)
+{
+	if(slotId >= m_auxiliarySends.size())
+		return;
+	auto &send = m_auxiliarySends[slotId];
+	if(send.dsp == nullptr)
+		return;
+	if(m_source != nullptr)
+		CheckResultAndUpdateValidity(m_source->removeDSP(send.dsp));
+	send.dsp->release();
+	send = {};
+}
+void al::FMSoundChannel::DoRemoveEffect(uint32_t slotId) {DoRemoveInternalEffect(slotId);}
+void al::FMSoundChannel::SetEffectParameters(uint32_t slotId,const EffectParams &params)
+{
+	if(slotId >= m_auxiliarySends.size())
+		return;
+	auto &send = m_auxiliarySends[slotId];
+	if(send.dsp == nullptr || params.gain == send.gain)
+		return;
+	send.gain = params.gain;
+	al::check_result(send.dsp->setParameterFloat(FMOD_DSP_SEND_LEVEL,send.gain));
+}
+void al::FMSoundChannel::ApplyAuxiliarySends()
+{
+	for(auto &send : m_auxiliarySends)
+	{
+		if(send.dsp == nullptr || m_source == nullptr)
+			continue;
+		CheckResultAndUpdateValidity(m_source->addDSP(FMOD_CHANNELCONTROL_DSP_HEAD,send.dsp));
+	}
+}
+void al::FMSoundChannel::AttachBinaural()
+{
+	auto *renderer = static_cast<FMSoundSystem&>(m_system).GetBinauralRenderer();
+	if(renderer != nullptr && Is3D())
+		renderer->AddSource(*this);
+}
+void al::FMSoundChannel::DetachBinaural()
+{
+	if(m_binauralSlot == std::numeric_limits<uint32_t>::max())
+		return;
+	auto *renderer = static_cast<FMSoundSystem&>(m_system).GetBinauralRenderer();
+	if(renderer != nullptr)
+		renderer->RemoveSource(*this);
+	m_binauralSlot = std::numeric_limits<uint32_t>::max();
+}
 bool al::FMSoundChannel::CheckResultAndUpdateValidity(uint32_t result) const
 {
 	if(result == FMOD_ERR_INVALID_HANDLE || result == FMOD_ERR_CHANNEL_STOLEN)
@@ -519,7 +814,7 @@ void al::FMSoundChannel::SetGainRange(float minGain,float maxGain)
 {
 	m_soundSourceData.minGain = minGain;
 	m_soundSourceData.maxGain = maxGain;
-	SetGain(umath::clamp(GetGain(),minGain,maxGain));
+	SetGain(umath::clamp(m_soundSourceData.gain,minGain,maxGain));
 }
 std::pair<float,float> al::FMSoundChannel::GetGainRange() const
 {
@@ -6,10 +6,14 @@
 #include "fmod_sound_buffer.hpp"
 #include "fmod_sound_source.hpp"
 #include "fmod_listener.hpp"
+#include "fmod_decoder.hpp"
+#include "fmod_effect.hpp"
+#include "fmod_auxiliary_effect_slot.hpp"
 #include <fmod_studio.hpp>
 #include <fmod_errors.h>
 #include <fsys/filesystem.h>
 #include <cstring>
+#include <algorithm>
 
 void al::check_result(uint32_t r)
 {
@@ -20,8 +24,29 @@ void al::check_result(uint32_t r)
 	}
 }
 
-std::shared_ptr<al::FMSoundSystem> al::FMSoundSystem::Create(const std::string &deviceName,float metersPerUnit)
+std::shared_ptr<al::FMSoundSystem> al::FMSoundSystem::Create(const std::string &deviceName,float metersPerUnit,const FMSystemCreateInfo &createInfo)
 {
+	// Thread attributes have to be set before the system is created
+	auto &threading = createInfo.threading;
+	std::pair<FMOD_THREAD_TYPE,const FMSystemCreateInfo::ThreadAttributes*> threadAttributes[] = {
+		{FMOD_THREAD_TYPE_MIXER,&threading.mixer},
+		{FMOD_THREAD_TYPE_FEEDER,&threading.feeder},
+		{FMOD_THREAD_TYPE_STREAM,&threading.stream},
+		{FMOD_THREAD_TYPE_FILE,&threading.file},
+		{FMOD_THREAD_TYPE_NONBLOCKING,&threading.nonBlocking},
+		{FMOD_THREAD_TYPE_GEOMETRY,&threading.geometry},
+		{FMOD_THREAD_TYPE_STUDIO_UPDATE,&threading.studioUpdate},
+		{FMOD_THREAD_TYPE_STUDIO_LOAD_BANK,&threading.studioLoadBank},
+		{FMOD_THREAD_TYPE_STUDIO_LOAD_SAMPLE,&threading.studioLoadSample}
+	};
+	for(auto &pair : threadAttributes)
+	{
+		auto &attr = *pair.second;
+		if(attr.affinity == FMOD_THREAD_AFFINITY_GROUP_DEFAULT && attr.priority == FMOD_THREAD_PRIORITY_DEFAULT && attr.stackSize == FMOD_THREAD_STACK_SIZE_DEFAULT)
+			continue;
+		al::check_result(FMOD_Thread_SetAttributes(pair.first,attr.affinity,attr.priority,attr.stackSize));
+	}
+
 	FMOD::Studio::System *system = nullptr;
 	al::check_result(FMOD::Studio::System::create(&system));
 	auto ptrSystem = std::shared_ptr<FMOD::Studio::System>(system,[](FMOD::Studio::System *system) {
@@ -30,137 +55,504 @@ std::shared_ptr<al::FMSoundSystem> al::FMSoundSystem::Create(const std::string &
 
 	FMOD::System *lowLevelSystem = nullptr;
 	al::check_result(system->getCoreSystem(&lowLevelSystem));
-	al::check_result(lowLevelSystem->setSoftwareFormat(0,FMOD_SPEAKERMODE_5POINT1,0));
+	auto &offline = createInfo.offline;
+	if(offline.enabled)
+	{
+		al::check_result(lowLevelSystem->setOutput(offline.wavFile.empty() ? FMOD_OUTPUTTYPE_NOSOUND_NRT : FMOD_OUTPUTTYPE_WAVWRITER_NRT));
+		al::check_result(lowLevelSystem->setSoftwareFormat(offline.frequency,FMOD_SPEAKERMODE_STEREO,0));
+	}
+	else
+		al::check_result(lowLevelSystem->setSoftwareFormat(0,FMOD_SPEAKERMODE_5POINT1,0));
+	if(createInfo.dspBufferLength > 0u || createInfo.dspBufferCount > 0u)
+	{
+		uint32_t bufferLength;
+		int32_t numBuffers;
+		al::check_result(lowLevelSystem->getDSPBufferSize(&bufferLength,&numBuffers));
+		if(createInfo.dspBufferLength > 0u)
+			bufferLength = createInfo.dspBufferLength;
+		if(createInfo.dspBufferCount > 0u)
+			numBuffers = static_cast<int32_t>(createInfo.dspBufferCount);
+		al::check_result(lowLevelSystem->setDSPBufferSize(bufferLength,numBuffers));
+	}
+
+	FMOD_ADVANCEDSETTINGS advancedSettings {};
+	advancedSettings.cbSize = sizeof(advancedSettings);
+	al::check_result(lowLevelSystem->getAdvancedSettings(&advancedSettings));
+	auto &codecs = createInfo.codecs;
+	if(codecs.maxMPEGCodecs > 0)
+		advancedSettings.maxMPEGCodecs = codecs.maxMPEGCodecs;
+	if(codecs.maxADPCMCodecs > 0)
+		advancedSettings.maxADPCMCodecs = codecs.maxADPCMCodecs;
+	if(codecs.maxVorbisCodecs > 0)
+		advancedSettings.maxVorbisCodecs = codecs.maxVorbisCodecs;
+	if(codecs.maxFADPCMCodecs > 0)
+		advancedSettings.maxFADPCMCodecs = codecs.maxFADPCMCodecs;
+	al::check_result(lowLevelSystem->setAdvancedSettings(&advancedSettings));
 
 	void *extraDriverData = nullptr;
-	al::check_result(system->initialize(1'024,FMOD_STUDIO_INIT_NORMAL,FMOD_INIT_NORMAL | FMOD_INIT_3D_RIGHTHANDED | FMOD_INIT_VOL0_BECOMES_VIRTUAL,extraDriverData));
-	al::check_result(lowLevelSystem->setFileSystem(
-		[](const char *name,uint32_t *fileSize,void **handle,void *userData) -> FMOD_RESULT {
-			auto f = FileManager::OpenFile(name,"rb");
-			if(f == nullptr)
-				return FMOD_RESULT::FMOD_ERR_FILE_NOTFOUND;
-			*fileSize = f->GetSize();
-			*handle = new VFilePtr(f);
-			return FMOD_RESULT::FMOD_OK;
-		},[](void *handle,void *userData) -> FMOD_RESULT {
-			delete static_cast<VFilePtr*>(handle);
-			return FMOD_RESULT::FMOD_OK;
-		},[](void *handle,void *buffer,uint32_t sizeBytes,uint32_t *bytesRead,void *userData) -> FMOD_RESULT {
-			*bytesRead = (*static_cast<VFilePtr*>(handle))->Read(buffer,sizeBytes);
-			if((*static_cast<VFilePtr*>(handle))->Eof())
-				return FMOD_RESULT::FMOD_ERR_FILE_EOF;
-			return FMOD_RESULT::FMOD_OK;
-		},[](void *handle,uint32_t pos,void *userData) -> FMOD_RESULT {
-			(*static_cast<VFilePtr*>(handle))->Seek(pos);
-			return FMOD_RESULT::FMOD_OK;
-		},nullptr,nullptr,-1
-	));
+	auto bSynchronousUpdate = threading.synchronousUpdate;
+	FMOD_INITFLAGS flags = FMOD_INIT_NORMAL | FMOD_INIT_3D_RIGHTHANDED | FMOD_INIT_VOL0_BECOMES_VIRTUAL | FMOD_INIT_CHANNEL_LOWPASS;
+	if(offline.enabled)
+	{
+		// Streams are decoded in update() as well, otherwise the stream thread could fall behind the mixer
+		flags |= FMOD_INIT_STREAM_FROM_UPDATE;
+		bSynchronousUpdate = true;
+		if(offline.wavFile.empty() == false)
+			extraDriverData = const_cast<char*>(offline.wavFile.c_str());
+	}
+	auto studioFlags = bSynchronousUpdate ? FMOD_STUDIO_INIT_SYNCHRONOUS_UPDATE : FMOD_STUDIO_INIT_NORMAL;
+	al::check_result(system->initialize(createInfo.maxChannels,studioFlags,flags,extraDriverData));
 	auto soundSys = std::shared_ptr<FMSoundSystem>(new FMSoundSystem(ptrSystem,*lowLevelSystem,metersPerUnit),[](FMSoundSystem *sys) {
 		sys->OnRelease();
 		delete sys;
 	});
+	soundSys->m_fileSystem.Initialize(*lowLevelSystem,createInfo.fileSystem);
+	soundSys->m_voiceManager.SetSettings(createInfo.voices);
+	soundSys->m_channelPool->Reserve(createInfo.reservedChannels);
+	soundSys->m_oneShots.SetMaxOneShots(createInfo.maxOneShots);
+	soundSys->m_maxBinauralSources = createInfo.maxBinauralSources;
+	soundSys->m_bSynchronousUpdate = bSynchronousUpdate;
 	soundSys->Initialize();
+	if(offline.enabled)
+	{
+		soundSys->m_offlineRenderer = FMOfflineRenderer::Create(*soundSys,offline.capture);
+		if(soundSys->m_offlineRenderer == nullptr)
+			std::cout<<"[FMOD] Unable to initialize offline renderer!"<<std::endl;
+	}
 	return soundSys;
 }
 
 void al::FMSoundSystem::Update()
 {
-	ISoundSystem::Update();
-	al::check_result(m_fmSystem->update());
+	auto tStart = std::chrono::steady_clock::now();
+	FMTracer::Zone updateZone {m_tracer,"Update"};
+	auto dt = (m_lastUpdate == std::chrono::steady_clock::time_point{}) ? 0.f : std::chrono::duration<float>(tStart -m_lastUpdate).count();
+	m_lastUpdate = tStart;
+	// Offline renders advance by exactly one block per update, regardless of how long it took to mix
+	if(m_offlineRenderer != nullptr)
+		dt = static_cast<float>(m_offlineRenderer->GetBlockDuration());
+	{
+		// Changes from other threads are applied first, so everything below sees them this frame
+		FMTracer::Zone zone {m_tracer,"DrainCommands"};
+		m_commands.Drain();
+	}
+	{
+		// Finished loads are attached before the channels are updated, so waiting channels can start right away
+		FMTracer::Zone zone {m_tracer,"AttachLoads"};
+		m_loader.Update();
+	}
+	{
+		FMTracer::Zone zone {m_tracer,"UpdateChannels"};
+		ISoundSystem::Update();
+	}
+	{
+		FMTracer::Zone zone {m_tracer,"UpdateVoices"};
+		m_voiceManager.Update(dt);
+	}
+	for(auto *effect : m_effects)
+		effect->Update(dt);
+	// Commit all 3D attribute changes of this frame in one batch before FMOD processes them
+	m_transformStore.Flush();
+	for(auto *listener : m_listeners)
+		listener->Commit(*m_fmSystem);
+	if(m_listeners.empty() == false)
+	{
+		// Offline renders must not depend on how fast the workers are, so their results are waited for before mixing
+		auto bWait = (m_offlineRenderer != nullptr);
+		m_propagation.Update(m_listeners.front()->GetGamePosition(),bWait);
+		m_geometry.Update(m_listeners.front()->GetGamePosition(),bWait);
+	}
+	if(m_binauralRenderer != nullptr && m_listeners.empty() == false)
+		m_binauralRenderer->Update(*m_listeners.front());
+	m_bufferCache.EnforceBudget([this](const std::string &path,bool mono) {EvictSoundBuffer(path,mono);});
+	{
+		FMTracer::Zone zone {m_tracer,"FMODUpdate"};
+		al::check_result(m_fmSystem->update());
+	}
+	if(m_offlineRenderer != nullptr)
+		m_offlineRenderer->OnBlockMixed();
+
+	m_updateTime = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now() -tStart).count();
+	m_updateTimeSum += m_updateTime;
+	m_peakUpdateTime = umath::max(m_peakUpdateTime,m_updateTime);
+	++m_updateCount;
 }
 
 std::shared_ptr<al::FMSoundSystem> al::FMSoundSystem::Create(float metersPerUnit) {return Create("",metersPerUnit);}
+std::shared_ptr<al::FMSoundSystem> al::FMSoundSystem::CreateOffline(float metersPerUnit,const FMSystemCreateInfo::Offline &offline,FMSystemCreateInfo createInfo)
+{
+	createInfo.offline = offline;
+	createInfo.offline.enabled = true;
+	return Create("",metersPerUnit,createInfo);
+}
 const FMOD::Studio::System &al::FMSoundSystem::GetFMODSystem() const {return const_cast<FMSoundSystem*>(this)->GetFMODSystem();}
 FMOD::Studio::System &al::FMSoundSystem::GetFMODSystem() {return *m_fmSystem;}
 const FMOD::System &al::FMSoundSystem::GetFMODLowLevelSystem() const {return const_cast<FMSoundSystem*>(this)->GetFMODLowLevelSystem();}
 FMOD::System &al::FMSoundSystem::GetFMODLowLevelSystem() {return m_fmLowLevelSystem;}
+const al::FMTransformStore &al::FMSoundSystem::GetTransformStore() const {return const_cast<FMSoundSystem*>(this)->GetTransformStore();}
+al::FMTransformStore &al::FMSoundSystem::GetTransformStore() {return m_transformStore;}
+const al::FMFileSystem &al::FMSoundSystem::GetFileSystem() const {return const_cast<FMSoundSystem*>(this)->GetFileSystem();}
+al::FMFileSystem &al::FMSoundSystem::GetFileSystem() {return m_fileSystem;}
+const al::FMVoiceManager &al::FMSoundSystem::GetVoiceManager() const {return const_cast<FMSoundSystem*>(this)->GetVoiceManager();}
+al::FMVoiceManager &al::FMSoundSystem::GetVoiceManager() {return m_voiceManager;}
+const al::FMSpatialGrid &al::FMSoundSystem::GetSpatialGrid() const {return const_cast<FMSoundSystem*>(this)->GetSpatialGrid();}
+al::FMSpatialGrid &al::FMSoundSystem::GetSpatialGrid() {return m_spatialGrid;}
+const al::FMPropagationGraph &al::FMSoundSystem::GetPropagationGraph() const {return const_cast<FMSoundSystem*>(this)->GetPropagationGraph();}
+al::FMPropagationGraph &al::FMSoundSystem::GetPropagationGraph() {return m_propagation;}
+const al::FMGeometryManager &al::FMSoundSystem::GetGeometryManager() const {return const_cast<FMSoundSystem*>(this)->GetGeometryManager();}
+al::FMGeometryManager &al::FMSoundSystem::GetGeometryManager() {return m_geometry;}
+const al::FMCommandQueue &al::FMSoundSystem::GetCommandQueue() const {return const_cast<FMSoundSystem*>(this)->GetCommandQueue();}
+al::FMCommandQueue &al::FMSoundSystem::GetCommandQueue() {return m_commands;}
+al::FMChannelPool::Stats al::FMSoundSystem::GetChannelPoolStats() const {return m_channelPool->GetStats();}
+al::FMOneShotHandle al::FMSoundSystem::PlayOneShot(ISoundBuffer &buffer,const Vector3 &pos,float gain,float pitch,uint32_t priority)
+{
+	auto &fmBuffer = static_cast<FMSoundBuffer&>(buffer);
+	m_bufferCache.Touch(fmBuffer);
+	return m_oneShots.Play(fmBuffer,pos,gain,pitch,priority);
+}
+void al::FMSoundSystem::StopOneShot(FMOneShotHandle handle) {m_oneShots.Stop(handle);}
+bool al::FMSoundSystem::IsOneShotPlaying(FMOneShotHandle handle) const {return m_oneShots.IsPlaying(handle);}
+const al::FMOneShotPlayer::Stats &al::FMSoundSystem::GetOneShotStats() const {return m_oneShots.GetStats();}
+const al::FMImpulseResponseCache &al::FMSoundSystem::GetImpulseResponseCache() const {return const_cast<FMSoundSystem*>(this)->GetImpulseResponseCache();}
+al::FMImpulseResponseCache &al::FMSoundSystem::GetImpulseResponseCache() {return m_impulseResponses;}
+uint32_t al::FMSoundSystem::GetMixerFrequency() const
+{
+	auto frequency = 0;
+	al::check_result(m_fmLowLevelSystem.getSoftwareFormat(&frequency,nullptr,nullptr));
+	return static_cast<uint32_t>(frequency);
+}
+std::pair<uint32_t,uint32_t> al::FMSoundSystem::GetDSPBufferSize() const
+{
+	uint32_t bufferLength = 0u;
+	auto numBuffers = 0;
+	al::check_result(m_fmLowLevelSystem.getDSPBufferSize(&bufferLength,&numBuffers));
+	return {bufferLength,static_cast<uint32_t>(numBuffers)};
+}
+bool al::FMSoundSystem::IsSynchronousUpdate() const {return m_bSynchronousUpdate;}
+al::FMSoundSystem::PerformanceStats al::FMSoundSystem::GetPerformanceStats() const
+{
+	PerformanceStats stats {};
+	FMOD_STUDIO_CPU_USAGE studioUsage {};
+	FMOD_CPU_USAGE usage {};
+	if(m_fmSystem != nullptr && m_fmSystem->getCPUUsage(&studioUsage,&usage) == FMOD_OK)
+	{
+		stats.dspCpu = usage.dsp;
+		stats.streamCpu = usage.stream;
+		stats.geometryCpu = usage.geometry;
+		stats.updateCpu = usage.update;
+		stats.convolutionCpu = usage.convolution1 +usage.convolution2;
+		stats.studioUpdateCpu = studioUsage.update;
+	}
+	auto playing = 0;
+	auto real = 0;
+	if(m_fmSystem != nullptr && m_fmLowLevelSystem.getChannelsPlaying(&playing,&real) == FMOD_OK)
+	{
+		stats.playingChannels = static_cast<uint32_t>(playing);
+		stats.realChannels = static_cast<uint32_t>(real);
+		stats.virtualChannels = stats.playingChannels -umath::min(stats.realChannels,stats.playingChannels);
+	}
+	auto current = 0;
+	auto peak = 0;
+	// Non-blocking, the values may be off by allocations that are in progress on other threads
+	if(FMOD::Memory_GetStats(&current,&peak,false) == FMOD_OK)
+	{
+		stats.fmodMemory = static_cast<uint64_t>(current);
+		stats.fmodPeakMemory = static_cast<uint64_t>(peak);
+	}
+	auto &cacheStats = m_bufferCache.GetStats();
+	stats.soundBufferMemory = cacheStats.residentBytes;
+	stats.soundBuffers = cacheStats.bufferCount;
+	stats.queuedLoads = m_loader.GetQueuedCount();
+	stats.inFlightLoads = m_loader.GetInFlightCount();
+	stats.updateTime = m_updateTime;
+	stats.meanUpdateTime = (m_updateCount > 0ull) ? (m_updateTimeSum /m_updateCount) : 0.0;
+	stats.peakUpdateTime = m_peakUpdateTime;
+	return stats;
+}
+void al::FMSoundSystem::ResetPerformanceStats()
+{
+	m_updateTimeSum = 0.0;
+	m_peakUpdateTime = 0.0;
+	m_updateCount = 0ull;
+}
+const al::FMTracer &al::FMSoundSystem::GetTracer() const {return const_cast<FMSoundSystem*>(this)->GetTracer();}
+al::FMTracer &al::FMSoundSystem::GetTracer() {return m_tracer;}
+const al::FMOfflineRenderer *al::FMSoundSystem::GetOfflineRenderer() const {return const_cast<FMSoundSystem*>(this)->GetOfflineRenderer();}
+al::FMOfflineRenderer *al::FMSoundSystem::GetOfflineRenderer() {return m_offlineRenderer.get();}
+const al::FMSoundBufferCache &al::FMSoundSystem::GetSoundBufferCache() const {return const_cast<FMSoundSystem*>(this)->GetSoundBufferCache();}
+al::FMSoundBufferCache &al::FMSoundSystem::GetSoundBufferCache() {return m_bufferCache;}
+void al::FMSoundSystem::SetSoundBufferMemoryBudget(uint64_t bytes) {m_bufferCache.SetMemoryBudget(bytes);}
+uint64_t al::FMSoundSystem::GetSoundBufferMemoryBudget() const {return m_bufferCache.GetMemoryBudget();}
+const al::FMSoundBufferCache::Stats &al::FMSoundSystem::GetSoundBufferCacheStats() const {return m_bufferCache.GetStats();}
+void al::FMSoundSystem::SetLoadPolicy(const FMLoadPolicy &policy)
+{
+	m_loadPolicy = policy;
+	al::check_result(m_fmLowLevelSystem.setStreamBufferSize(policy.streamFileBufferSize,FMOD_TIMEUNIT_RAWBYTES));
+}
+const al::FMLoadPolicy &al::FMSoundSystem::GetLoadPolicy() const {return m_loadPolicy;}
+void al::FMSoundSystem::EvictSoundBuffer(const std::string &path,bool mono)
+{
+	auto it = m_buffers.find(path);
+	if(it == m_buffers.end())
+		return;
+	if(mono)
+		it->second.mono = nullptr;
+	else
+		it->second.stereo = nullptr;
+	if(it->second.mono == nullptr && it->second.stereo == nullptr)
+		m_buffers.erase(it);
+}
 al::FMSoundSystem::FMSoundSystem(const std::shared_ptr<FMOD::Studio::System> &fmSystem,FMOD::System &lowLevelSystem,float metersPerUnit)
-	: ISoundSystem{metersPerUnit},m_fmSystem(fmSystem),m_fmLowLevelSystem(lowLevelSystem)
+	: ISoundSystem{metersPerUnit},m_fmSystem(fmSystem),m_fmLowLevelSystem(lowLevelSystem),m_geometry{*this},m_commands{*this},m_loader{*this},m_voiceManager{*this},
+	// Leaves room for the shared_ptr control block that std::allocate_shared places in the same block
+	m_channelPool{std::make_shared<FMChannelPool>(sizeof(FMSoundChannel) +128)},m_oneShots{*this}
 {
 	lowLevelSystem.set3DSettings(1.f,1.f,1.f);
+	SetLoadPolicy(m_loadPolicy);
 	// FMOD TODO
 	//SetSpeedOfSound(340.29f /metersPerUnit);
 }
 
 void al::FMSoundSystem::OnRelease()
 {
+	m_loader.Clear();
+	// One-shots reference their buffers without owning them
+	m_oneShots.StopAll();
+	// The channels detach themselves from the renderer when they're released
 	ISoundSystem::OnRelease();
+	m_binauralRenderer = nullptr;
+	m_offlineRenderer = nullptr;
+	m_impulseResponses.Clear();
+	// Geometry has to be released before the FMOD system
+	m_geometry.Clear();
+	m_listeners.clear();
+	m_additionalListeners.clear();
 	m_fmSystem = nullptr;
+	m_fileSystem.Shutdown();
 }
 
-std::unique_ptr<al::IListener> al::FMSoundSystem::CreateListener() {return std::unique_ptr<FMListener>{new FMListener{*this}};}
+std::unique_ptr<al::IListener> al::FMSoundSystem::CreateListener()
+{
+	auto listener = std::unique_ptr<FMListener>{new FMListener{*this,0u}};
+	m_listeners.clear();
+	m_additionalListeners.clear();
+	m_listeners.push_back(listener.get());
+	return listener;
+}
+
+void al::FMSoundSystem::SetListenerCount(uint32_t count)
+{
+	count = umath::clamp(count,1u,static_cast<uint32_t>(FMOD_MAX_LISTENERS));
+	if(m_listeners.empty() || count == m_listeners.size())
+		return;
+	m_listeners.resize(1u);
+	m_additionalListeners.resize(count -1u);
+	for(auto i=decltype(m_additionalListeners.size()){0u};i<m_additionalListeners.size();++i)
+	{
+		auto &listener = m_additionalListeners[i];
+		if(listener == nullptr)
+			listener = std::unique_ptr<FMListener>{new FMListener{*this,static_cast<uint32_t>(i +1)}};
+		m_listeners.push_back(listener.get());
+	}
+	al::check_result(m_fmSystem->setNumListeners(count));
+}
+uint32_t al::FMSoundSystem::GetListenerCount() const {return static_cast<uint32_t>(m_listeners.size());}
+al::IListener *al::FMSoundSystem::GetListenerByIndex(uint32_t index) {return (index < m_listeners.size()) ? m_listeners[index] : nullptr;}
+const al::IListener *al::FMSoundSystem::GetListenerByIndex(uint32_t index) const {return const_cast<FMSoundSystem*>(this)->GetListenerByIndex(index);}
+
+al::PSoundBuffer al::FMSoundSystem::AddSoundBuffer(const std::string &normPath,const std::shared_ptr<FMOD::Sound> &sound,const FMLoadParameters &loadParams,bool bConvertToMono)
+{
+	auto *fmBuf = new FMSoundBuffer(m_fmLowLevelSystem,sound,normPath);
+	fmBuf->SetFileData(loadParams.memory);
+	if(sound != nullptr && loadParams.stream)
+		fmBuf->SetStreamInfo(m_loadPolicy.streamFileBufferSize,loadParams.decodeBufferSize);
+	if(sound != nullptr && loadParams.compressed)
+		fmBuf->SetCompressed(true);
+	auto buf = PSoundBuffer(fmBuf);
+	// The channel count of pending buffers is unknown, they're stored in the slot that was requested and moved to the
+	// right one by OnSoundLoaded
+	auto mono = (bConvertToMono == true || (sound != nullptr && buf->GetChannelConfig() == al::ChannelConfig::Mono));
+	if(mono)
+		m_buffers[normPath].mono = buf;
+	else
+		m_buffers[normPath].stereo = buf;
+	if(bConvertToMono == true)
+		buf->SetTargetChannelConfig(al::ChannelConfig::Mono);
+	m_bufferCache.RecordMiss();
+	m_bufferCache.Add(*fmBuf,normPath,mono);
+	return buf;
+}
+
+void al::FMSoundSystem::OnSoundLoaded(FMSoundBuffer &buffer,const std::shared_ptr<FMOD::Sound> &sound,const FMLoadParameters &loadParams)
+{
+	buffer.SetFileData(loadParams.memory);
+	buffer.SetFMODSound(sound);
+	if(loadParams.stream)
+		buffer.SetStreamInfo(m_loadPolicy.streamFileBufferSize,loadParams.decodeBufferSize);
+	buffer.SetCompressed(loadParams.compressed);
+	buffer.SetLoadState(FMSoundBuffer::LoadState::Loaded);
+	m_bufferCache.UpdateSize(buffer);
+
+	// Pending buffers were stored in the slot that was requested, since their channel count wasn't known yet. A mono file
+	// that was requested without bConvertToMono belongs into the mono slot, otherwise mono lookups would load it again.
+	if(buffer.GetChannelConfig() != al::ChannelConfig::Mono)
+		return;
+	auto it = m_buffers.find(buffer.GetName());
+	if(it == m_buffers.end() || it->second.stereo.get() != &buffer || it->second.mono != nullptr)
+		return;
+	it->second.mono = it->second.stereo;
+	it->second.stereo = nullptr;
+	m_bufferCache.SetMono(buffer,true);
+}
 
 al::ISoundBuffer *al::FMSoundSystem::DoLoadSound(const std::string &normPath,bool bConvertToMono,bool bAsync)
 {
+	FMTracer::Zone zone {m_tracer,"DoLoadSound"};
+	if(bAsync)
+	{
+		auto buf = AddSoundBuffer(normPath,nullptr,{},bConvertToMono);
+		m_loader.Enqueue(buf,normPath,bConvertToMono);
+		return buf.get();
+	}
+	// The file is only looked up once; the load policy only needs its size
+	auto fileInfo = FMFileSystem::QueryFile(normPath);
+	auto loadParams = al::get_load_parameters(m_loadPolicy,normPath,fileInfo.size);
 	FMOD::Sound *sound = nullptr;
 	FMOD_CREATESOUNDEXINFO exInfo {};
 	memset(&exInfo,0,sizeof(exInfo));
 	exInfo.cbsize = sizeof(exInfo);
-	al::check_result(m_fmLowLevelSystem.createSound(normPath.c_str(),FMOD_DEFAULT,&exInfo,&sound));
+	exInfo.decodebuffersize = loadParams.decodeBufferSize;
+	auto *nameOrData = m_fileSystem.PrepareSound(normPath,fileInfo,loadParams.mode,exInfo,loadParams.memory);
+	auto r = m_fmLowLevelSystem.createSound(nameOrData,loadParams.mode,&exInfo,&sound);
+	if(r != FMOD_OK && loadParams.compressed)
+	{
+		// The codec of this file doesn't support compressed samples
+		auto memory = loadParams.memory;
+		loadParams = al::get_load_parameters(m_loadPolicy,normPath,fileInfo.size,false);
+		loadParams.memory = memory;
+		if(memory != nullptr)
+			loadParams.mode |= FMOD_OPENMEMORY_POINT;
+		r = m_fmLowLevelSystem.createSound(nameOrData,loadParams.mode,&exInfo,&sound);
+	}
+	al::check_result(r);
 	if(!sound)
 		return nullptr;
 	auto ptrSound = std::shared_ptr<FMOD::Sound>(sound,[](FMOD::Sound *sound) {
 		al::check_result(sound->release());
 	});
-	auto buf = PSoundBuffer(new FMSoundBuffer(m_fmLowLevelSystem,ptrSound));
-	if(buf->GetChannelConfig() == al::ChannelConfig::Mono || bConvertToMono == true)
-		m_buffers[normPath].mono = buf;
-	else
-		m_buffers[normPath].stereo = buf;
-	if(bConvertToMono == true)
-		buf->SetTargetChannelConfig(al::ChannelConfig::Mono);
-	return buf.get();
+	return AddSoundBuffer(normPath,ptrSound,loadParams,bConvertToMono).get();
 }
 
+std::shared_ptr<FMOD::Sound> al::FMSoundSystem::OpenStreamInstance(const FMSoundBuffer &buffer)
+{
+	FMTracer::Zone zone {m_tracer,"OpenStreamInstance"};
+	auto path = buffer.GetName();
+	uint32_t mode = FMOD_DEFAULT | FMOD_CREATESTREAM;
+	FMOD_CREATESOUNDEXINFO exInfo {};
+	memset(&exInfo,0,sizeof(exInfo));
+	exInfo.cbsize = sizeof(exInfo);
+	exInfo.decodebuffersize = m_loadPolicy.streamPrefetchFrames;
+	FMFileSystem::MemoryData memory = nullptr;
+	auto *nameOrData = m_fileSystem.PrepareSound(path,mode,exInfo,memory);
+	FMOD::Sound *sound = nullptr;
+	auto r = m_fmLowLevelSystem.createSound(nameOrData,mode,&exInfo,&sound);
+	al::check_result(r);
+	if(r != FMOD_OK || sound == nullptr)
+		return nullptr;
+	// Data that is read in place has to outlive the sound
+	return std::shared_ptr<FMOD::Sound>(sound,[memory](FMOD::Sound *sound) {
+		al::check_result(sound->release());
+	});
+}
+
+al::FMSoundLoader::RequestId al::FMSoundSystem::LoadSoundAsync(const std::string &path,const FMSoundLoader::Callback &callback,int32_t priority,bool bConvertToMono)
+{
+	auto *buf = static_cast<FMSoundBuffer*>(LoadSound(path,bConvertToMono,true));
+	if(buf == nullptr || buf->GetLoadState() != FMSoundBuffer::LoadState::Loading)
+	{
+		if(callback != nullptr)
+			callback((buf != nullptr && buf->GetLoadState() == FMSoundBuffer::LoadState::Loaded) ? buf : nullptr);
+		return FMSoundLoader::INVALID_REQUEST;
+	}
+	return m_loader.AddCallback(*buf,priority,callback);
+}
+bool al::FMSoundSystem::CancelSoundLoad(FMSoundLoader::RequestId requestId) {return m_loader.Cancel(requestId);}
+const al::FMSoundLoader &al::FMSoundSystem::GetSoundLoader() const {return const_cast<FMSoundSystem*>(this)->GetSoundLoader();}
+al::FMSoundLoader &al::FMSoundSystem::GetSoundLoader() {return m_loader;}
+
 al::PSoundChannel al::FMSoundSystem::CreateChannel(ISoundBuffer &buffer)
 {
-	FMOD::Channel *channel;
-	al::check_result(m_fmLowLevelSystem.playSound(static_cast<FMSoundBuffer&>(buffer).GetFMODSound(),nullptr,true,&channel));
-	auto snd = std::make_shared<FMSoundChannel>(*this,buffer);
+	FMTracer::Zone zone {m_tracer,"CreateChannel"};
+	auto snd = std::allocate_shared<FMSoundChannel>(FMChannelPoolAllocator<FMSoundChannel>{m_channelPool},*this,buffer);
 	if(snd == nullptr)
 		return nullptr;
-	snd->SetSource(channel);
-	FMOD_MODE mode;
-	al::check_result(channel->getMode(&mode));
-	mode &= ~(FMOD_3D_HEADRELATIVE | FMOD_3D_WORLDRELATIVE | FMOD_3D | FMOD_2D);
-	mode |= FMOD_3D_WORLDRELATIVE | FMOD_3D;
-
-	channel->setMode(mode);
+	// The FMOD channel is only created once the channel is played and the voice manager has granted it a voice
+	m_bufferCache.Touch(static_cast<FMSoundBuffer&>(buffer));
 	return snd;
 }
-al::PSoundChannel al::FMSoundSystem::CreateChannel(Decoder &decoder) {return nullptr;}
+al::PSoundChannel al::FMSoundSystem::CreateChannel(Decoder &decoder)
+{
+	FMTracer::Zone zone {m_tracer,"CreateChannel"};
+	return std::allocate_shared<FMSoundChannel>(FMChannelPoolAllocator<FMSoundChannel>{m_channelPool},*this,decoder);
+}
 
 al::PDecoder al::FMSoundSystem::CreateDecoder(const std::string &path,bool bConvertToMono)
 {
-	return nullptr;
+	return FMDecoder::Create(*this,path,bConvertToMono);
 }
 
 std::vector<std::string> al::FMSoundSystem::GetHRTFNames() const
 {
-	return {}; // FMOD TODO
+	std::vector<std::string> files {};
+	FileManager::FindFiles("sounds/hrtf/*.mhr",&files,nullptr);
+	for(auto &f : files)
+		f = f.substr(0,f.length() -4);
+	std::sort(files.begin(),files.end());
+	return files;
 }
 
-std::string al::FMSoundSystem::GetCurrentHRTF() const
-{
-	return ""; // FMOD TODO
-}
-bool al::FMSoundSystem::IsHRTFEnabled() const
-{
-	return false; // FMOD TODO
-}
+std::string al::FMSoundSystem::GetCurrentHRTF() const {return m_currentHrtf;}
+bool al::FMSoundSystem::IsHRTFEnabled() const {return m_binauralRenderer != nullptr;}
 
 void al::FMSoundSystem::SetHRTF(uint32_t id)
 {
-	// FMOD TODO
+	auto names = GetHRTFNames();
+	if(id >= names.size())
+	{
+		std::cout<<"[FMOD] Invalid HRTF id "<<id<<"!"<<std::endl;
+		return;
+	}
+	auto &name = names[id];
+	if(m_binauralRenderer != nullptr && name == m_currentHrtf)
+		return;
+	auto hrtf = FMHrtfDataSet::Load("sounds/hrtf/" +name +".mhr",GetMixerFrequency());
+	if(hrtf == nullptr)
+		return;
+	// Channels that are currently playing are rendered binaurally once they're (re-)initialized
+	DisableHRTF();
+	m_binauralRenderer = FMBinauralRenderer::Create(*this,hrtf,m_maxBinauralSources);
+	if(m_binauralRenderer != nullptr)
+		m_currentHrtf = name;
 }
 void al::FMSoundSystem::DisableHRTF()
 {
-	// FMOD TODO
+	// The renderer restores regular panning for all channels that are still attached
+	m_binauralRenderer = nullptr;
+	m_currentHrtf.clear();
+}
+const al::FMBinauralRenderer *al::FMSoundSystem::GetBinauralRenderer() const {return const_cast<FMSoundSystem*>(this)->GetBinauralRenderer();}
+al::FMBinauralRenderer *al::FMSoundSystem::GetBinauralRenderer() {return m_binauralRenderer.get();}
+bool al::FMSoundSystem::SetMaxBinauralSources(uint32_t maxSources)
+{
+	if(m_binauralRenderer != nullptr && m_binauralRenderer->SetMaxSources(maxSources) == false)
+		return false;
+	m_maxBinauralSources = maxSources;
+	return true;
 }
 
 uint32_t al::FMSoundSystem::GetMaxAuxiliaryEffectsPerSource() const
 {
-	return 0u; // FMOD TODO
+	return FMSoundChannel::MAX_AUXILIARY_SENDS;
 }
 
 bool al::FMSoundSystem::IsSupported(ChannelConfig channels,SampleType type) const
@@ -198,7 +590,7 @@ void al::FMSoundSystem::ResumeDeviceDSP()
 
 al::IAuxiliaryEffectSlot *al::FMSoundSystem::CreateAuxiliaryEffectSlot()
 {
-	return nullptr; // FMOD TODO
+	return new FMAuxiliaryEffectSlot(*this);
 }
 
 al::DistanceModel al::FMSoundSystem::GetDistanceModel() const {return m_distanceModel;}
@@ -210,5 +602,13 @@ void al::FMSoundSystem::SetDistanceModel(DistanceModel mdl)
 
 al::PEffect al::FMSoundSystem::CreateEffect()
 {
-	return nullptr; // FMOD TODO
+	auto effect = std::shared_ptr<FMEffect>(new FMEffect(*this));
+	m_effects.push_back(effect.get());
+	return effect;
+}
+void al::FMSoundSystem::RemoveEffect(FMEffect &effect)
+{
+	auto it = std::find(m_effects.begin(),m_effects.end(),&effect);
+	if(it != m_effects.end())
+		m_effects.erase(it);
 }
@@ -3,10 +3,29 @@
 * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
 #include <alsoundsystem.hpp>
+#include "fmod_transform_store.hpp"
+#include "fmod_sound_buffer_cache.hpp"
+#include "fmod_load_policy.hpp"
+#include "fmod_sound_loader.hpp"
+#include "fmod_file_system.hpp"
+#include "fmod_voice_manager.hpp"
+#include "fmod_spatial_grid.hpp"
+#include "fmod_channel_pool.hpp"
+#include "fmod_one_shot.hpp"
+#include "fmod_convolution.hpp"
+#include "fmod_hrtf.hpp"
+#include "fmod_propagation.hpp"
+#include "fmod_geometry.hpp"
+#include "fmod_command_queue.hpp"
+#include "fmod_offline_renderer.hpp"
+#include "fmod_trace.hpp"
+#include <fmod_common.h>
+#include <chrono>
 
 namespace FMOD
 {
 	class System;
+	class Sound;
 	namespace Studio
 	{
 		class System;
@@ -14,13 +33,106 @@ namespace FMOD
 };
 namespace al
 {
+	class FMListener;
+	class FMSoundBuffer;
+	class FMEffect;
+	class FMBenchmark;
 	void check_result(uint32_t r);
+	struct FMSystemCreateInfo
+	{
+		// Number of codec instances that are preallocated for compressed samples (FMOD_ADVANCEDSETTINGS).
+		// This limits how many compressed samples of each format can play at the same time; 0 keeps the FMOD default.
+		struct CodecPool
+		{
+			int32_t maxMPEGCodecs = 0;
+			int32_t maxADPCMCodecs = 0;
+			int32_t maxVorbisCodecs = 0;
+			int32_t maxFADPCMCodecs = 0;
+		} codecs;
+		FMFileSystem::Settings fileSystem;
+		// Number of FMOD channels (real and FMOD-virtual); the number of channels that are actually mixed
+		// is limited by the voice manager
+		uint32_t maxChannels = 1'024u;
+		FMVoiceManager::Settings voices;
+		// Number of channel objects that are preallocated, channels beyond that grow the pool in slabs
+		uint32_t reservedChannels = 256u;
+		// Maximum number of concurrent one-shots, see FMSoundSystem::PlayOneShot
+		uint32_t maxOneShots = 256u;
+		// Maximum number of channels that are rendered binaurally while HRTF is enabled, further channels use regular panning
+		uint32_t maxBinauralSources = 64u;
+		// Placement of FMOD's threads (FMOD_Thread_SetAttributes). The affinity is either a mask of cores
+		// (FMOD_THREAD_AFFINITY_CORE_*) or one of the FMOD affinity groups; the defaults leave the choice to FMOD.
+		struct ThreadAttributes
+		{
+			FMOD_THREAD_AFFINITY affinity = FMOD_THREAD_AFFINITY_GROUP_DEFAULT;
+			FMOD_THREAD_PRIORITY priority = FMOD_THREAD_PRIORITY_DEFAULT;
+			FMOD_THREAD_STACK_SIZE stackSize = FMOD_THREAD_STACK_SIZE_DEFAULT;
+		};
+		struct Threading
+		{
+			// Executes Studio commands in FMSoundSystem::Update() on the calling thread (FMOD_STUDIO_INIT_SYNCHRONOUS_UPDATE)
+			// instead of on Studio's own update thread. Saves a thread and a frame of latency, but Update() gets more expensive.
+			bool synchronousUpdate = false;
+			ThreadAttributes mixer;
+			ThreadAttributes feeder;
+			ThreadAttributes stream;
+			ThreadAttributes file;
+			ThreadAttributes nonBlocking; // Asynchronous sound loads
+			ThreadAttributes geometry;
+			ThreadAttributes studioUpdate; // Unused with synchronousUpdate
+			ThreadAttributes studioLoadBank;
+			ThreadAttributes studioLoadSample;
+		} threading;
+		// Mixer block size in samples and number of blocks (System::setDSPBufferSize). Smaller/fewer blocks lower the
+		// latency at the cost of more CPU overhead and a higher risk of dropouts; 0 keeps the FMOD default.
+		uint32_t dspBufferLength = 0u;
+		uint32_t dspBufferCount = 0u;
+		// Renders without an audio device, see FMOfflineRenderer. The mixer only runs in Update(), which mixes one block of
+		// dspBufferLength frames (1024 by default) in stereo; Studio updates are always synchronous.
+		struct Offline
+		{
+			bool enabled = false;
+			// Additionally writes the output to this file (FMOD_OUTPUTTYPE_WAVWRITER_NRT) instead of discarding it
+			std::string wavFile = {};
+			// Keeps the output in memory, e.g. for comparing it against a golden file
+			bool capture = true;
+			uint32_t frequency = 48'000u;
+		} offline;
+	};
 	class FMSoundSystem
 		: public ISoundSystem
 	{
 	public:
-		static std::shared_ptr<FMSoundSystem> Create(const std::string &deviceName,float metersPerUnit=1.f);
+		struct PerformanceStats
+		{
+			// FMOD's CPU usage in percent of one core (FMOD_CPU_USAGE); the mixer and streams run on their own threads
+			float dspCpu = 0.f;
+			float streamCpu = 0.f;
+			float geometryCpu = 0.f;
+			float updateCpu = 0.f;
+			float convolutionCpu = 0.f;
+			float studioUpdateCpu = 0.f;
+			// FMOD channels; virtual channels are playing but not mixed
+			uint32_t playingChannels = 0u;
+			uint32_t realChannels = 0u;
+			uint32_t virtualChannels = 0u;
+			// Memory allocated by FMOD (FMOD_Memory_GetStats)
+			uint64_t fmodMemory = 0ull;
+			uint64_t fmodPeakMemory = 0ull;
+			// Resident memory of all sound buffers, see GetSoundBufferCache().GetBuffers() for the individual buffers
+			uint64_t soundBufferMemory = 0ull;
+			uint32_t soundBuffers = 0u;
+			uint32_t queuedLoads = 0u;
+			uint32_t inFlightLoads = 0u;
+			// Time spent in Update() in milliseconds, the mean and peak since the last ResetPerformanceStats()
+			double updateTime = 0.0;
+			double meanUpdateTime = 0.0;
+			double peakUpdateTime = 0.0;
+		};
+		static std::shared_ptr<FMSoundSystem> Create(const std::string &deviceName,float metersPerUnit=1.f,const FMSystemCreateInfo &createInfo={});
 		static std::shared_ptr<FMSoundSystem> Create(float metersPerUnit=1.f);
+		// Same as Create, with createInfo.offline enabled
+		static std::shared_ptr<FMSoundSystem> CreateOffline(float metersPerUnit=1.f,const FMSystemCreateInfo::Offline &offline={},FMSystemCreateInfo createInfo={});
 		virtual void OnRelease() override;
 
 		virtual void Update() override;
@@ -55,18 +167,134 @@ namespace al
 		virtual bool IsHRTFEnabled() const override;
 		virtual void SetHRTF(uint32_t id) override;
 		virtual void DisableHRTF() override;
+		// HRTF data sets are loaded from "sounds/hrtf/*.mhr". Returns nullptr if HRTF is disabled.
+		const FMBinauralRenderer *GetBinauralRenderer() const;
+		FMBinauralRenderer *GetBinauralRenderer();
+		// Takes effect immediately if HRTF is enabled. The renderer's slots are allocated when HRTF is enabled, so while it
+		// is, the limit can't be raised above the slot count (see FMBinauralRenderer::GetSlotCount) and false is returned.
+		bool SetMaxBinauralSources(uint32_t maxSources);
 
 		const FMOD::Studio::System &GetFMODSystem() const;
 		FMOD::Studio::System &GetFMODSystem();
 		const FMOD::System &GetFMODLowLevelSystem() const;
 		FMOD::System &GetFMODLowLevelSystem();
+
+		// Multiple listeners (e.g. for split-screen). Listener 0 is the default listener of the sound system,
+		// pointers to additional listeners are invalidated if the listener count is reduced.
+		void SetListenerCount(uint32_t count);
+		uint32_t GetListenerCount() const;
+		IListener *GetListenerByIndex(uint32_t index);
+		const IListener *GetListenerByIndex(uint32_t index) const;
+
+		// Memory budget for loaded sound buffers, idle buffers are evicted in least-recently-used order.
+		// A budget of 0 means unlimited.
+		void SetSoundBufferMemoryBudget(uint64_t bytes);
+		uint64_t GetSoundBufferMemoryBudget() const;
+		const FMSoundBufferCache::Stats &GetSoundBufferCacheStats() const;
+		const FMSoundBufferCache &GetSoundBufferCache() const;
+		FMSoundBufferCache &GetSoundBufferCache();
+
+		// Loads the sound without blocking; the callback is invoked from Update() once the buffer is ready (or with nullptr on failure).
+		// Higher priorities are loaded first. Returns FMSoundLoader::INVALID_REQUEST if the callback was invoked immediately.
+		FMSoundLoader::RequestId LoadSoundAsync(const std::string &path,const FMSoundLoader::Callback &callback,int32_t priority=0,bool bConvertToMono=false);
+		bool CancelSoundLoad(FMSoundLoader::RequestId requestId);
+		const FMSoundLoader &GetSoundLoader() const;
+		FMSoundLoader &GetSoundLoader();
+
+		// Only affects sounds that are loaded after the policy has been changed
+		void SetLoadPolicy(const FMLoadPolicy &policy);
+		const FMLoadPolicy &GetLoadPolicy() const;
+		// Opens another stream of a streamed buffer for a channel that can't use the buffer's own stream, since it's
+		// already being played (see FMSoundBuffer::AcquireStream)
+		std::shared_ptr<FMOD::Sound> OpenStreamInstance(const FMSoundBuffer &buffer);
+
+		const FMTransformStore &GetTransformStore() const;
+		FMTransformStore &GetTransformStore();
+		const FMFileSystem &GetFileSystem() const;
+		FMFileSystem &GetFileSystem();
+		const FMVoiceManager &GetVoiceManager() const;
+		FMVoiceManager &GetVoiceManager();
+		// World-space index of all channels, e.g. to find the channels around a listener without iterating all of them
+		const FMSpatialGrid &GetSpatialGrid() const;
+		FMSpatialGrid &GetSpatialGrid();
+		// Room/portal graph for occlusion; also applies the direct filter, air absorption and outer cone gainHF of all channels
+		const FMPropagationGraph &GetPropagationGraph() const;
+		FMPropagationGraph &GetPropagationGraph();
+		// Occlusion through FMOD's geometry engine, built from level meshes
+		const FMGeometryManager &GetGeometryManager() const;
+		FMGeometryManager &GetGeometryManager();
+		// Channel and listener changes from other threads, applied at the beginning of Update()
+		const FMCommandQueue &GetCommandQueue() const;
+		FMCommandQueue &GetCommandQueue();
+		// Channel objects are allocated from a pool; in steady state heapAllocations should not increase
+		FMChannelPool::Stats GetChannelPoolStats() const;
+
+		// Plays the buffer once at the given position (in game space) without creating a sound channel. The sound can't be
+		// modified afterwards, the handle can only be used to stop it early. Returns an invalid handle if the buffer isn't
+		// ready, is streamed or too many one-shots are playing.
+		FMOneShotHandle PlayOneShot(ISoundBuffer &buffer,const Vector3 &pos,float gain=1.f,float pitch=1.f,uint32_t priority=128u);
+		void StopOneShot(FMOneShotHandle handle);
+		bool IsOneShotPlaying(FMOneShotHandle handle) const;
+		const FMOneShotPlayer::Stats &GetOneShotStats() const;
+
+		// Impulse responses for convolution reverbs, see FMEffect::SetImpulseResponse
+		const FMImpulseResponseCache &GetImpulseResponseCache() const;
+		FMImpulseResponseCache &GetImpulseResponseCache();
+		uint32_t GetMixerFrequency() const;
+		// Block size and count the mixer actually uses, see FMSystemCreateInfo::dspBufferLength
+		std::pair<uint32_t,uint32_t> GetDSPBufferSize() const;
+		bool IsSynchronousUpdate() const;
+		PerformanceStats GetPerformanceStats() const;
+		void ResetPerformanceStats();
+		// Zones around Update(), sound loads and channel creation; disabled by default
+		const FMTracer &GetTracer() const;
+		FMTracer &GetTracer();
+
+		// Returns nullptr unless the system was created for offline rendering
+		const FMOfflineRenderer *GetOfflineRenderer() const;
+		FMOfflineRenderer *GetOfflineRenderer();
 	private:
 		FMSoundSystem(const std::shared_ptr<FMOD::Studio::System> &fmSystem,FMOD::System &lowLevelSystem,float metersPerUnit);
 		virtual PSoundChannel CreateChannel(ISoundBuffer &buffer) override;
 		virtual PSoundChannel CreateChannel(Decoder &decoder) override;
 		virtual ISoundBuffer *DoLoadSound(const std::string &path,bool bConvertToMono=false,bool bAsync=true) override;
 		virtual std::unique_ptr<IListener> CreateListener() override;
+		friend FMSoundLoader;
+		friend FMEffect;
+		friend FMBenchmark;
+		void RemoveEffect(FMEffect &effect);
+		void EvictSoundBuffer(const std::string &path,bool mono);
+		PSoundBuffer AddSoundBuffer(const std::string &path,const std::shared_ptr<FMOD::Sound> &sound,const FMLoadParameters &loadParams,bool bConvertToMono);
+		void OnSoundLoaded(FMSoundBuffer &buffer,const std::shared_ptr<FMOD::Sound> &sound,const FMLoadParameters &loadParams);
 		std::shared_ptr<FMOD::Studio::System> m_fmSystem = nullptr;
 		FMOD::System &m_fmLowLevelSystem;
+		FMLoadPolicy m_loadPolicy = {};
+		FMFileSystem m_fileSystem = {};
+		FMTransformStore m_transformStore = {};
+		FMSpatialGrid m_spatialGrid = {};
+		FMPropagationGraph m_propagation;
+		FMGeometryManager m_geometry;
+		FMCommandQueue m_commands;
+		FMSoundBufferCache m_bufferCache = {};
+		FMSoundLoader m_loader;
+		FMVoiceManager m_voiceManager;
+		std::shared_ptr<FMChannelPool> m_channelPool = nullptr;
+		FMOneShotPlayer m_oneShots;
+		// Effects are updated every frame for their parameter smoothing
+		std::vector<FMEffect*> m_effects = {};
+		FMImpulseResponseCache m_impulseResponses = {};
+		std::chrono::steady_clock::time_point m_lastUpdate = {};
+		std::vector<FMListener*> m_listeners = {};
+		std::vector<std::unique_ptr<FMListener>> m_additionalListeners = {};
+		std::unique_ptr<FMBinauralRenderer> m_binauralRenderer = nullptr;
+		std::unique_ptr<FMOfflineRenderer> m_offlineRenderer = nullptr;
+		std::string m_currentHrtf = {};
+		uint32_t m_maxBinauralSources = 64u;
+		bool m_bSynchronousUpdate = false;
+		FMTracer m_tracer;
+		double m_updateTime = 0.0;
+		double m_updateTimeSum = 0.0;
+		double m_peakUpdateTime = 0.0;
+		uint64_t m_updateCount = 0ull;
 	};
 };
@@ -0,0 +1,262 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_spatial_grid.hpp"
+#include <cmath>
+
+al::FMSpatialGrid::FMSpatialGrid(float cellSize)
+{
+	SetCellSize(cellSize);
+}
+
+void al::FMSpatialGrid::SetCellSize(float cellSize)
+{
+	m_cellSize = umath::max(cellSize,1.f);
+	m_invCellSize = 1.f /m_cellSize;
+	m_cells.clear();
+	m_count = 0u;
+	m_boundsMin = {std::numeric_limits<int32_t>::max(),std::numeric_limits<int32_t>::max(),std::numeric_limits<int32_t>::max()};
+	m_boundsMax = {std::numeric_limits<int32_t>::min(),std::numeric_limits<int32_t>::min(),std::numeric_limits<int32_t>::min()};
+	for(auto &entry : m_entries)
+	{
+		if(entry.cell == INVALID_CELL)
+			continue;
+		entry.cell = INVALID_CELL;
+		Insert(static_cast<Handle>(&entry -m_entries.data()));
+	}
+}
+float al::FMSpatialGrid::GetCellSize() const {return m_cellSize;}
+uint32_t al::FMSpatialGrid::GetCount() const {return m_count;}
+uint32_t al::FMSpatialGrid::GetCellCount() const {return static_cast<uint32_t>(m_cells.size());}
+
+al::FMSpatialGrid::CellCoord al::FMSpatialGrid::GetCellCoord(const Vector3 &pos) const
+{
+	return {
+		static_cast<int32_t>(std::floor(pos.x *m_invCellSize)),
+		static_cast<int32_t>(std::floor(pos.y *m_invCellSize)),
+		static_cast<int32_t>(std::floor(pos.z *m_invCellSize))
+	};
+}
+uint64_t al::FMSpatialGrid::GetCellKey(const CellCoord &coord)
+{
+	// 21 bits per axis
+	constexpr uint64_t mask = (1ull<<21) -1ull;
+	return (static_cast<uint64_t>(coord.x) &mask) | ((static_cast<uint64_t>(coord.y) &mask)<<21) | ((static_cast<uint64_t>(coord.z) &mask)<<42);
+}
+
+al::FMSpatialGrid::Handle al::FMSpatialGrid::Register(FMSoundChannel &channel)
+{
+	Handle handle;
+	if(m_freeHandles.empty() == false)
+	{
+		handle = m_freeHandles.back();
+		m_freeHandles.pop_back();
+	}
+	else
+	{
+		handle = static_cast<Handle>(m_entries.size());
+		m_entries.push_back({});
+	}
+	m_entries[handle] = {};
+	m_entries[handle].channel = &channel;
+	return handle;
+}
+void al::FMSpatialGrid::Unregister(Handle handle)
+{
+	if(handle >= m_entries.size() || m_entries[handle].channel == nullptr)
+		return;
+	Remove(handle);
+	m_entries[handle] = {};
+	m_freeHandles.push_back(handle);
+}
+
+void al::FMSpatialGrid::Insert(Handle handle)
+{
+	auto &entry = m_entries[handle];
+	auto coord = GetCellCoord(entry.position);
+	entry.cell = GetCellKey(coord);
+	auto it = m_cells.find(entry.cell);
+	if(it == m_cells.end())
+	{
+		it = m_cells.insert(std::make_pair(entry.cell,Cell{coord,{}})).first;
+		m_boundsMin = {umath::min(m_boundsMin.x,coord.x),umath::min(m_boundsMin.y,coord.y),umath::min(m_boundsMin.z,coord.z)};
+		m_boundsMax = {umath::max(m_boundsMax.x,coord.x),umath::max(m_boundsMax.y,coord.y),umath::max(m_boundsMax.z,coord.z)};
+	}
+	entry.indexInCell = static_cast<uint32_t>(it->second.handles.size());
+	it->second.handles.push_back(handle);
+	++m_count;
+}
+void al::FMSpatialGrid::Remove(Handle handle)
+{
+	if(handle >= m_entries.size())
+		return;
+	auto &entry = m_entries[handle];
+	if(entry.cell == INVALID_CELL)
+		return;
+	auto it = m_cells.find(entry.cell);
+	auto &handles = it->second.handles;
+	// Swap-remove, the moved entry needs to know its new index
+	auto lastHandle = handles.back();
+	handles[entry.indexInCell] = lastHandle;
+	m_entries[lastHandle].indexInCell = entry.indexInCell;
+	handles.pop_back();
+	if(handles.empty())
+		m_cells.erase(it);
+	entry.cell = INVALID_CELL;
+	--m_count;
+}
+void al::FMSpatialGrid::SetPosition(Handle handle,const Vector3 &pos)
+{
+	if(handle >= m_entries.size())
+		return;
+	auto &entry = m_entries[handle];
+	entry.position = pos;
+	if(entry.cell != INVALID_CELL)
+	{
+		// Most position changes don't leave the cell
+		if(GetCellKey(GetCellCoord(pos)) == entry.cell)
+			return;
+		Remove(handle);
+	}
+	Insert(handle);
+}
+
+template<class TTestCell>
+	void al::FMSpatialGrid::ForEachCell(CellCoord min,CellCoord max,const TTestCell &testCell) const
+{
+	min = {umath::max(min.x,m_boundsMin.x),umath::max(min.y,m_boundsMin.y),umath::max(min.z,m_boundsMin.z)};
+	max = {umath::min(max.x,m_boundsMax.x),umath::min(max.y,m_boundsMax.y),umath::min(max.z,m_boundsMax.z)};
+	if(min.x > max.x || min.y > max.y || min.z > max.z)
+		return;
+	auto numCells = static_cast<uint64_t>(max.x -min.x +1) *static_cast<uint64_t>(max.y -min.y +1) *static_cast<uint64_t>(max.z -min.z +1);
+	if(numCells <= m_cells.size())
+	{
+		for(auto x=min.x;x<=max.x;++x)
+		{
+			for(auto y=min.y;y<=max.y;++y)
+			{
+				for(auto z=min.z;z<=max.z;++z)
+				{
+					auto it = m_cells.find(GetCellKey({x,y,z}));
+					if(it != m_cells.end())
+						testCell(it->second);
+				}
+			}
+		}
+		return;
+	}
+	// The query volume covers more cells than are occupied
+	for(auto &pair : m_cells)
+	{
+		auto &coord = pair.second.coord;
+		if(coord.x < min.x || coord.x > max.x || coord.y < min.y || coord.y > max.y || coord.z < min.z || coord.z > max.z)
+			continue;
+		testCell(pair.second);
+	}
+}
+
+void al::FMSpatialGrid::QueryRadius(const Vector3 &center,float radius,std::vector<FMSoundChannel*> &outChannels) const
+{
+	auto radiusSqr = radius *radius;
+	ForEachCell(GetCellCoord(center -Vector3{radius,radius,radius}),GetCellCoord(center +Vector3{radius,radius,radius}),[this,&center,radiusSqr,&outChannels](const Cell &cell) {
+		for(auto handle : cell.handles)
+		{
+			auto &entry = m_entries[handle];
+			if(uvec::length_sqr(entry.position -center) <= radiusSqr)
+				outChannels.push_back(entry.channel);
+		}
+	});
+}
+
+bool al::FMSpatialGrid::GetFrustumBounds(const Frustum &frustum,Vector3 &outMin,Vector3 &outMax)
+{
+	// The corners are the intersections of three planes that lie inside of all other planes
+	constexpr auto epsilon = 0.01f;
+	outMin = {std::numeric_limits<float>::max(),std::numeric_limits<float>::max(),std::numeric_limits<float>::max()};
+	outMax = {std::numeric_limits<float>::lowest(),std::numeric_limits<float>::lowest(),std::numeric_limits<float>::lowest()};
+	auto numCorners = 0u;
+	for(auto i=decltype(frustum.size()){0u};i<frustum.size();++i)
+	{
+		for(auto j=i +1;j<frustum.size();++j)
+		{
+			for(auto k=j +1;k<frustum.size();++k)
+			{
+				auto &a = frustum[i];
+				auto &b = frustum[j];
+				auto &c = frustum[k];
+				auto bc = uvec::cross(b.normal,c.normal);
+				auto det = uvec::dot(a.normal,bc);
+				if(std::abs(det) < 0.0001f)
+					continue;
+				auto corner = (bc *-a.distance +uvec::cross(c.normal,a.normal) *-b.distance +uvec::cross(a.normal,b.normal) *-c.distance) /det;
+				auto inside = true;
+				for(auto &plane : frustum)
+				{
+					if(uvec::dot(plane.normal,corner) +plane.distance < -epsilon *umath::max(uvec::length(corner),1.f))
+					{
+						inside = false;
+						break;
+					}
+				}
+				if(inside == false)
+					continue;
+				outMin = {umath::min(outMin.x,corner.x),umath::min(outMin.y,corner.y),umath::min(outMin.z,corner.z)};
+				outMax = {umath::max(outMax.x,corner.x),umath::max(outMax.y,corner.y),umath::max(outMax.z,corner.z)};
+				++numCorners;
+			}
+		}
+	}
+	// A closed frustum has (at least) eight corners, anything else is open towards some direction
+	return numCorners >= 8u;
+}
+
+void al::FMSpatialGrid::QueryFrustum(const Frustum &frustum,std::vector<FMSoundChannel*> &outChannels) const
+{
+	auto testCell = [this,&frustum,&outChannels](const Cell &cell) {
+		Vector3 cellMin {cell.coord.x *m_cellSize,cell.coord.y *m_cellSize,cell.coord.z *m_cellSize};
+		Vector3 cellMax = cellMin +Vector3{m_cellSize,m_cellSize,m_cellSize};
+		// Cells that are completely outside of a plane are skipped, cells that are completely inside of all planes
+		// don't need per-channel tests
+		auto fullyInside = true;
+		for(auto &plane : frustum)
+		{
+			Vector3 pVertex {(plane.normal.x >= 0.f) ? cellMax.x : cellMin.x,(plane.normal.y >= 0.f) ? cellMax.y : cellMin.y,(plane.normal.z >= 0.f) ? cellMax.z : cellMin.z};
+			if(uvec::dot(plane.normal,pVertex) +plane.distance < 0.f)
+				return;
+			Vector3 nVertex {(plane.normal.x >= 0.f) ? cellMin.x : cellMax.x,(plane.normal.y >= 0.f) ? cellMin.y : cellMax.y,(plane.normal.z >= 0.f) ? cellMin.z : cellMax.z};
+			if(uvec::dot(plane.normal,nVertex) +plane.distance < 0.f)
+				fullyInside = false;
+		}
+		for(auto handle : cell.handles)
+		{
+			auto &entry = m_entries[handle];
+			if(fullyInside == false)
+			{
+				auto inside = true;
+				for(auto &plane : frustum)
+				{
+					if(uvec::dot(plane.normal,entry.position) +plane.distance < 0.f)
+					{
+						inside = false;
+						break;
+					}
+				}
+				if(inside == false)
+					continue;
+			}
+			outChannels.push_back(entry.channel);
+		}
+	};
+	// Only the cells overlapping the frustum's bounding box are visited; open frustums fall back to the occupied bounds
+	Vector3 min,max;
+	if(GetFrustumBounds(frustum,min,max) == false)
+	{
+		ForEachCell(m_boundsMin,m_boundsMax,testCell);
+		return;
+	}
+	// Keep the cell coordinates within the range of the cell keys
+	constexpr auto maxCoord = static_cast<float>((1<<20) -1);
+	auto clampCoord = [this,maxCoord](float v) {return static_cast<int32_t>(std::floor(umath::clamp(v *m_invCellSize,-maxCoord,maxCoord)));};
+	ForEachCell({clampCoord(min.x),clampCoord(min.y),clampCoord(min.z)},{clampCoord(max.x),clampCoord(max.y),clampCoord(max.z)},testCell);
+}
@@ -0,0 +1,95 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_SPATIAL_GRID_HPP__
+#define __FMOD_SPATIAL_GRID_HPP__
+
+#include <alsound_coordinate_system.hpp>
+#include <cinttypes>
+#include <vector>
+#include <array>
+#include <limits>
+#include <unordered_map>
+
+namespace al
+{
+	class FMSoundChannel;
+	// Uniform hash grid over the world positions of all channels (in game space). Only occupied cells are stored,
+	// so queries only touch the cells that overlap the query volume (or all occupied cells, whichever is fewer).
+	// Channels that are relative to the listener aren't part of the grid.
+	class FMSpatialGrid
+	{
+	public:
+		using Handle = uint32_t;
+		static constexpr Handle INVALID_HANDLE = std::numeric_limits<Handle>::max();
+		// Points p with dot(normal,p) +distance >= 0 are inside of the plane
+		struct Plane
+		{
+			Vector3 normal;
+			float distance;
+		};
+		using Frustum = std::array<Plane,6>;
+
+		FMSpatialGrid(float cellSize=512.f);
+		// Rebuilds the grid
+		void SetCellSize(float cellSize);
+		float GetCellSize() const;
+
+		Handle Register(FMSoundChannel &channel);
+		void Unregister(Handle handle);
+		// Inserts the channel into the grid, or moves it to a different cell if necessary
+		void SetPosition(Handle handle,const Vector3 &pos);
+		// Removes the channel from the grid without invalidating its handle
+		void Remove(Handle handle);
+
+		// Results are appended to outChannels
+		void QueryRadius(const Vector3 &center,float radius,std::vector<FMSoundChannel*> &outChannels) const;
+		void QueryFrustum(const Frustum &frustum,std::vector<FMSoundChannel*> &outChannels) const;
+
+		uint32_t GetCount() const;
+		uint32_t GetCellCount() const;
+	private:
+		static constexpr uint64_t INVALID_CELL = std::numeric_limits<uint64_t>::max();
+		struct CellCoord
+		{
+			int32_t x;
+			int32_t y;
+			int32_t z;
+		};
+		struct Cell
+		{
+			CellCoord coord;
+			std::vector<Handle> handles;
+		};
+		struct Entry
+		{
+			FMSoundChannel *channel = nullptr;
+			Vector3 position = {};
+			uint64_t cell = INVALID_CELL;
+			uint32_t indexInCell = 0u;
+		};
+		CellCoord GetCellCoord(const Vector3 &pos) const;
+		static uint64_t GetCellKey(const CellCoord &coord);
+		// Corners of the frustum's bounding box; returns false if the planes don't enclose a finite volume
+		static bool GetFrustumBounds(const Frustum &frustum,Vector3 &outMin,Vector3 &outMax);
+		void Insert(Handle handle);
+		// Calls testCell for every occupied cell in [min,max]. The range is clamped to the occupied bounds first,
+		// and if it still covers more cells than are occupied, the occupied cells are iterated instead.
+		template<class TTestCell>
+			void ForEachCell(CellCoord min,CellCoord max,const TTestCell &testCell) const;
+
+		float m_cellSize = 512.f;
+		float m_invCellSize = 1.f /512.f;
+		std::vector<Entry> m_entries = {};
+		std::vector<Handle> m_freeHandles = {};
+		std::unordered_map<uint64_t,Cell> m_cells = {};
+		// Bounds of all cells that have been occupied since the last rebuild. They only grow, which keeps them
+		// conservative without having to track removals.
+		CellCoord m_boundsMin = {std::numeric_limits<int32_t>::max(),std::numeric_limits<int32_t>::max(),std::numeric_limits<int32_t>::max()};
+		CellCoord m_boundsMax = {std::numeric_limits<int32_t>::min(),std::numeric_limits<int32_t>::min(),std::numeric_limits<int32_t>::min()};
+		uint32_t m_count = 0u;
+	};
+};
+
+#endif
@@ -0,0 +1,92 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_trace.hpp"
+#include <fsys/filesystem.h>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+
+al::FMTracer::Zone::Zone(FMTracer &tracer,const char *name)
+	: m_name{name}
+{
+	if(tracer.m_bEnabled.load(std::memory_order_relaxed) == false)
+		return;
+	m_tracer = &tracer;
+	m_start = Clock::now();
+}
+al::FMTracer::Zone::~Zone()
+{
+	if(m_tracer != nullptr)
+		m_tracer->Record(m_name,m_start,Clock::now());
+}
+
+al::FMTracer::FMTracer()
+	: m_epoch{Clock::now()}
+{}
+void al::FMTracer::SetEnabled(bool enabled) {m_bEnabled = enabled;}
+bool al::FMTracer::IsEnabled() const {return m_bEnabled;}
+void al::FMTracer::Clear()
+{
+	std::unique_lock<std::mutex> lock {m_mutex};
+	m_events.clear();
+	m_droppedEvents = 0u;
+}
+uint32_t al::FMTracer::GetEventCount() const
+{
+	std::unique_lock<std::mutex> lock {m_mutex};
+	return static_cast<uint32_t>(m_events.size());
+}
+uint32_t al::FMTracer::GetDroppedEventCount() const
+{
+	std::unique_lock<std::mutex> lock {m_mutex};
+	return m_droppedEvents;
+}
+
+void al::FMTracer::Record(const char *name,Clock::time_point start,Clock::time_point end)
+{
+	std::unique_lock<std::mutex> lock {m_mutex};
+	if(m_events.size() >= MAX_EVENTS)
+	{
+		++m_droppedEvents;
+		return;
+	}
+	// Small sequential ids are easier to read in the trace viewer than hashed thread ids
+	auto it = m_threadIds.find(std::this_thread::get_id());
+	if(it == m_threadIds.end())
+		it = m_threadIds.insert(std::make_pair(std::this_thread::get_id(),static_cast<uint32_t>(m_threadIds.size() +1u))).first;
+	m_events.push_back({name,start,end,it->second});
+}
+
+std::string al::FMTracer::ToJson() const
+{
+	std::unique_lock<std::mutex> lock {m_mutex};
+	std::stringstream ss;
+	ss<<std::fixed<<std::setprecision(3);
+	ss<<"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	auto first = true;
+	for(auto &ev : m_events)
+	{
+		if(first == false)
+			ss<<',';
+		first = false;
+		// Complete events, timestamps in microseconds
+		auto ts = std::chrono::duration<double,std::micro>(ev.start -m_epoch).count();
+		auto dur = std::chrono::duration<double,std::micro>(ev.end -ev.start).count();
+		ss<<"{\"name\":\""<<ev.name<<"\",\"cat\":\"fmod\",\"ph\":\"X\",\"ts\":"<<ts<<",\"dur\":"<<dur<<",\"pid\":1,\"tid\":"<<ev.threadId<<"}";
+	}
+	ss<<"]}";
+	return ss.str();
+}
+bool al::FMTracer::Save(const std::string &path) const
+{
+	auto json = ToJson();
+	auto f = FileManager::OpenFile<VFilePtrReal>(path.c_str(),"w");
+	if(f == nullptr)
+	{
+		std::cout<<"[FMOD] Unable to write '"<<path<<"'!"<<std::endl;
+		return false;
+	}
+	return f->Write(json.data(),json.size()) == json.size();
+}
@@ -0,0 +1,68 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_TRACE_HPP__
+#define __FMOD_TRACE_HPP__
+
+#include <cinttypes>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+
+namespace al
+{
+	// Records timed zones of the sound system, which can be exported in the Chrome trace event format (chrome://tracing,
+	// Perfetto). Disabled by default; a disabled zone only costs a relaxed atomic load.
+	class FMTracer
+	{
+	public:
+		// Further zones are dropped once the limit has been reached, until the tracer is cleared
+		static constexpr uint32_t MAX_EVENTS = 1'000'000u;
+		using Clock = std::chrono::steady_clock;
+		class Zone
+		{
+		public:
+			// The name has to be a string literal (or otherwise outlive the tracer's events)
+			Zone(FMTracer &tracer,const char *name);
+			~Zone();
+			Zone(const Zone&)=delete;
+			Zone &operator=(const Zone&)=delete;
+		private:
+			FMTracer *m_tracer = nullptr;
+			const char *m_name = nullptr;
+			Clock::time_point m_start = {};
+		};
+
+		FMTracer();
+		void SetEnabled(bool enabled);
+		bool IsEnabled() const;
+		void Clear();
+		uint32_t GetEventCount() const;
+		uint32_t GetDroppedEventCount() const;
+
+		std::string ToJson() const;
+		bool Save(const std::string &path) const;
+	private:
+		struct Event
+		{
+			const char *name;
+			Clock::time_point start;
+			Clock::time_point end;
+			uint32_t threadId;
+		};
+		void Record(const char *name,Clock::time_point start,Clock::time_point end);
+		std::atomic<bool> m_bEnabled = false;
+		Clock::time_point m_epoch = {};
+		mutable std::mutex m_mutex;
+		std::vector<Event> m_events = {};
+		std::unordered_map<std::thread::id,uint32_t> m_threadIds = {};
+		uint32_t m_droppedEvents = 0u;
+	};
+};
+
+#endif
@@ -0,0 +1,234 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_transform_store.hpp"
+#include "fmod_sound_source.hpp"
+#include <cmath>
+
+void al::FMTransformStore::Stream::Resize(size_t size)
+{
+	x.resize(size);
+	y.resize(size);
+	z.resize(size);
+}
+void al::FMTransformStore::Stream::Set(Handle handle,const Vector3 &v)
+{
+	x[handle] = v.x;
+	y[handle] = v.y;
+	z[handle] = v.z;
+}
+Vector3 al::FMTransformStore::Stream::Get(Handle handle) const {return {x[handle],y[handle],z[handle]};}
+
+al::FMTransformStore::Handle al::FMTransformStore::Register(FMSoundChannel &channel)
+{
+	Handle handle;
+	if(m_freeHandles.empty() == false)
+	{
+		handle = m_freeHandles.back();
+		m_freeHandles.pop_back();
+	}
+	else
+	{
+		handle = static_cast<Handle>(m_owners.size());
+		auto size = m_owners.size() +1;
+		m_positions.Resize(size);
+		m_velocities.Resize(size);
+		m_orientations.Resize(size);
+		m_dirtyBits.resize(size);
+		m_queued.resize(size);
+		m_hasOrientation.resize(size);
+		m_owners.resize(size);
+	}
+	m_positions.Set(handle,{});
+	m_velocities.Set(handle,{});
+	m_orientations.Set(handle,{});
+	m_dirtyBits[handle] = DirtyBits::None;
+	m_hasOrientation[handle] = false;
+	m_owners[handle] = &channel;
+	return handle;
+}
+void al::FMTransformStore::Unregister(Handle handle)
+{
+	if(handle >= m_owners.size() || m_owners[handle] == nullptr)
+		return;
+	// Stale entries in the dirty list are skipped during the flush
+	m_owners[handle] = nullptr;
+	m_dirtyBits[handle] = DirtyBits::None;
+	m_freeHandles.push_back(handle);
+}
+
+void al::FMTransformStore::MarkDirty(Handle handle,uint8_t bits)
+{
+	if(m_queued[handle] == false)
+	{
+		m_dirtyHandles.push_back(handle);
+		m_queued[handle] = true;
+	}
+	m_dirtyBits[handle] |= bits;
+}
+void al::FMTransformStore::MarkDirty(Handle handle)
+{
+	if(handle >= m_owners.size() || m_owners[handle] == nullptr)
+		return;
+	MarkDirty(handle,DirtyBits::All);
+}
+void al::FMTransformStore::SetPosition(Handle handle,const Vector3 &pos)
+{
+	m_positions.Set(handle,pos);
+	MarkDirty(handle,DirtyBits::Position);
+}
+void al::FMTransformStore::SetVelocity(Handle handle,const Vector3 &vel)
+{
+	m_velocities.Set(handle,vel);
+	MarkDirty(handle,DirtyBits::Velocity);
+}
+void al::FMTransformStore::SetOrientation(Handle handle,const Vector3 &forward)
+{
+	m_orientations.Set(handle,forward);
+	m_hasOrientation[handle] = true;
+	MarkDirty(handle,DirtyBits::Orientation);
+}
+
+uint32_t al::FMTransformStore::GetCount() const {return static_cast<uint32_t>(m_owners.size() -m_freeHandles.size());}
+uint32_t al::FMTransformStore::GetDirtyCount() const {return static_cast<uint32_t>(m_dirtyHandles.size());}
+
+al::FMTransformStore::AffineMap al::FMTransformStore::GetPositionMap()
+{
+	// The coordinate conversion is affine, so it can be reconstructed from the images of the origin and the basis vectors.
+	// This allows converting all dirty entries in one tight loop instead of calling al::to_audio_position per entry.
+	AffineMap map {};
+	auto origin = al::to_audio_position(Vector3{0.f,0.f,0.f});
+	Vector3 basis[3] = {
+		al::to_audio_position(Vector3{1.f,0.f,0.f}) -origin,
+		al::to_audio_position(Vector3{0.f,1.f,0.f}) -origin,
+		al::to_audio_position(Vector3{0.f,0.f,1.f}) -origin
+	};
+	for(auto col=0u;col<3u;++col)
+	{
+		map.m[0][col] = basis[col].x;
+		map.m[1][col] = basis[col].y;
+		map.m[2][col] = basis[col].z;
+	}
+	map.t[0] = origin.x;
+	map.t[1] = origin.y;
+	map.t[2] = origin.z;
+	return map;
+}
+al::FMTransformStore::AffineMap al::FMTransformStore::GetDirectionMap()
+{
+	AffineMap map {};
+	Vector3 basis[3] = {
+		al::to_audio_direction(Vector3{1.f,0.f,0.f}),
+		al::to_audio_direction(Vector3{0.f,1.f,0.f}),
+		al::to_audio_direction(Vector3{0.f,0.f,1.f})
+	};
+	for(auto col=0u;col<3u;++col)
+	{
+		map.m[0][col] = basis[col].x;
+		map.m[1][col] = basis[col].y;
+		map.m[2][col] = basis[col].z;
+	}
+	return map;
+}
+
+void al::FMTransformStore::Transform(const AffineMap &map,const Stream &in,Stream &out,size_t count,bool normalize)
+{
+	const auto *__restrict ix = in.x.data();
+	const auto *__restrict iy = in.y.data();
+	const auto *__restrict iz = in.z.data();
+	auto *__restrict ox = out.x.data();
+	auto *__restrict oy = out.y.data();
+	auto *__restrict oz = out.z.data();
+	for(auto i=decltype(count){0u};i<count;++i)
+	{
+		ox[i] = map.m[0][0] *ix[i] +map.m[0][1] *iy[i] +map.m[0][2] *iz[i] +map.t[0];
+		oy[i] = map.m[1][0] *ix[i] +map.m[1][1] *iy[i] +map.m[1][2] *iz[i] +map.t[1];
+		oz[i] = map.m[2][0] *ix[i] +map.m[2][1] *iy[i] +map.m[2][2] *iz[i] +map.t[2];
+	}
+	if(normalize == false)
+		return;
+	for(auto i=decltype(count){0u};i<count;++i)
+	{
+		auto l = std::sqrt(ox[i] *ox[i] +oy[i] *oy[i] +oz[i] *oz[i]);
+		auto f = (l > 0.f) ? (1.f /l) : 0.f;
+		ox[i] *= f;
+		oy[i] *= f;
+		oz[i] *= f;
+	}
+}
+
+void al::FMTransformStore::Commit(Handle handle)
+{
+	if(handle >= m_owners.size() || m_owners[handle] == nullptr)
+		return;
+	auto pos = al::to_audio_position(m_positions.Get(handle));
+	auto vel = al::to_audio_position(m_velocities.Get(handle));
+	if(m_hasOrientation[handle])
+	{
+		auto dir = al::to_audio_direction(m_orientations.Get(handle));
+		m_owners[handle]->Apply3DAttributes(pos,vel,&dir);
+	}
+	else
+		m_owners[handle]->Apply3DAttributes(pos,vel,nullptr);
+	m_dirtyBits[handle] = DirtyBits::None;
+}
+
+void al::FMTransformStore::Flush()
+{
+	if(m_dirtyHandles.empty())
+		return;
+	// Pack all dirty entries so the conversion runs over contiguous memory
+	m_flushHandles.clear();
+	for(auto handle : m_dirtyHandles)
+	{
+		m_queued[handle] = false;
+		if(m_dirtyBits[handle] == DirtyBits::None)
+			continue;
+		m_flushHandles.push_back(handle);
+	}
+	m_dirtyHandles.clear();
+	auto count = m_flushHandles.size();
+	if(count == 0)
+		return;
+	if(m_scratchIn.x.size() < count)
+	{
+		m_scratchIn.Resize(count);
+		m_scratchPos.Resize(count);
+		m_scratchVel.Resize(count);
+		m_scratchDir.Resize(count);
+	}
+
+	auto gather = [this,count](const Stream &src) {
+		for(auto i=decltype(count){0u};i<count;++i)
+		{
+			auto handle = m_flushHandles[i];
+			m_scratchIn.x[i] = src.x[handle];
+			m_scratchIn.y[i] = src.y[handle];
+			m_scratchIn.z[i] = src.z[handle];
+		}
+	};
+	auto posMap = GetPositionMap();
+	gather(m_positions);
+	Transform(posMap,m_scratchIn,m_scratchPos,count,false);
+	gather(m_velocities);
+	Transform(posMap,m_scratchIn,m_scratchVel,count,false);
+	gather(m_orientations);
+	Transform(GetDirectionMap(),m_scratchIn,m_scratchDir,count,true);
+
+	for(auto i=decltype(count){0u};i<count;++i)
+	{
+		auto handle = m_flushHandles[i];
+		auto *owner = m_owners[handle];
+		Vector3 pos {m_scratchPos.x[i],m_scratchPos.y[i],m_scratchPos.z[i]};
+		Vector3 vel {m_scratchVel.x[i],m_scratchVel.y[i],m_scratchVel.z[i]};
+		if(m_hasOrientation[handle] && (m_dirtyBits[handle] &DirtyBits::Orientation) != 0)
+		{
+			Vector3 dir {m_scratchDir.x[i],m_scratchDir.y[i],m_scratchDir.z[i]};
+			owner->Apply3DAttributes(pos,vel,&dir);
+		}
+		else
+			owner->Apply3DAttributes(pos,vel,nullptr);
+		m_dirtyBits[handle] = DirtyBits::None;
+	}
+}
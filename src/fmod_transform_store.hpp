@@ -0,0 +1,90 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_TRANSFORM_STORE_HPP__
+#define __FMOD_TRANSFORM_STORE_HPP__
+
+#include <alsound_coordinate_system.hpp>
+#include <cinttypes>
+#include <vector>
+#include <limits>
+
+namespace al
+{
+	class FMSoundChannel;
+	// Structure-of-arrays storage for the 3D transforms of all channels. Writes are only recorded here;
+	// the conversion to audio space and the FMOD calls happen in a single batch in Flush().
+	class FMTransformStore
+	{
+	public:
+		using Handle = uint32_t;
+		static constexpr Handle INVALID_HANDLE = std::numeric_limits<Handle>::max();
+		enum DirtyBits : uint8_t
+		{
+			None = 0u,
+			Position = 1u,
+			Velocity = Position<<1u,
+			Orientation = Velocity<<1u,
+			All = Position | Velocity | Orientation
+		};
+
+		Handle Register(FMSoundChannel &channel);
+		void Unregister(Handle handle);
+
+		void SetPosition(Handle handle,const Vector3 &pos);
+		void SetVelocity(Handle handle,const Vector3 &vel);
+		void SetOrientation(Handle handle,const Vector3 &forward);
+		// Marks all attributes of the channel as dirty, e.g. after a new FMOD channel has been created for it
+		void MarkDirty(Handle handle);
+
+		// Immediately commits a single entry, bypassing the batch
+		void Commit(Handle handle);
+		// Converts all dirty entries to audio space and commits each of them with a single FMOD call
+		void Flush();
+
+		uint32_t GetCount() const;
+		uint32_t GetDirtyCount() const;
+	private:
+		struct Stream
+		{
+			std::vector<float> x;
+			std::vector<float> y;
+			std::vector<float> z;
+			void Resize(size_t size);
+			void Set(Handle handle,const Vector3 &v);
+			Vector3 Get(Handle handle) const;
+		};
+		// Game space to audio space conversion, derived from al::to_audio_position/al::to_audio_direction
+		struct AffineMap
+		{
+			float m[3][3];
+			float t[3];
+		};
+		void MarkDirty(Handle handle,uint8_t bits);
+		static void Transform(const AffineMap &map,const Stream &in,Stream &out,size_t count,bool normalize);
+		static AffineMap GetPositionMap();
+		static AffineMap GetDirectionMap();
+
+		Stream m_positions = {};
+		Stream m_velocities = {};
+		Stream m_orientations = {};
+		std::vector<uint8_t> m_dirtyBits = {};
+		// Whether the handle is in m_dirtyHandles; only cleared by Flush, since Commit and Unregister reset the
+		// dirty bits but leave the handle in the list
+		std::vector<uint8_t> m_queued = {};
+		std::vector<uint8_t> m_hasOrientation = {};
+		std::vector<FMSoundChannel*> m_owners = {};
+		std::vector<Handle> m_freeHandles = {};
+		std::vector<Handle> m_dirtyHandles = {};
+
+		// Scratch streams for the batched conversion (packed dirty entries)
+		std::vector<Handle> m_flushHandles = {};
+		Stream m_scratchIn = {};
+		Stream m_scratchPos = {};
+		Stream m_scratchVel = {};
+		Stream m_scratchDir = {};
+	};
+};
+
+#endif
@@ -0,0 +1,233 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "fmod_voice_manager.hpp"
+#include "fmod_sound_system.hpp"
+#include "fmod_sound_source.hpp"
+#include "fmod_listener.hpp"
+#include <alsound_coordinate_system.hpp>
+#include <algorithm>
+#include <cmath>
+
+al::FMVoiceManager::FMVoiceManager(FMSoundSystem &system)
+	: m_system{system}
+{}
+
+void al::FMVoiceManager::SetSettings(const Settings &settings) {m_settings = settings;}
+const al::FMVoiceManager::Settings &al::FMVoiceManager::GetSettings() const {return m_settings;}
+const al::FMVoiceManager::Stats &al::FMVoiceManager::GetStats() const {return m_stats;}
+
+al::FMVoiceManager::Handle al::FMVoiceManager::Register(FMSoundChannel &channel)
+{
+	Handle handle;
+	if(m_freeHandles.empty() == false)
+	{
+		handle = m_freeHandles.back();
+		m_freeHandles.pop_back();
+	}
+	else
+	{
+		handle = static_cast<Handle>(m_entries.size());
+		m_entries.push_back({});
+	}
+	m_entries[handle] = {&channel,0ull,0.f};
+	return handle;
+}
+void al::FMVoiceManager::Unregister(Handle handle)
+{
+	if(handle >= m_entries.size() || m_entries[handle].channel == nullptr)
+		return;
+	m_entries[handle] = {};
+	m_freeHandles.push_back(handle);
+}
+void al::FMVoiceManager::OnPlay(Handle handle)
+{
+	if(handle < m_entries.size())
+		m_entries[handle].sequence = m_nextSequence++;
+}
+
+bool al::FMVoiceManager::IsReal(const Entry &entry) const {return entry.channel != nullptr && entry.channel->m_source != nullptr && entry.channel->IsVoiceActive();}
+bool al::FMVoiceManager::IsVirtual(const Entry &entry) const {return entry.channel != nullptr && entry.channel->m_bVirtual && entry.channel->IsVoiceActive();}
+
+float al::FMVoiceManager::CalcAudibility(const FMSoundChannel &channel) const
+{
+	auto &data = channel.m_soundSourceData;
+	auto gain = umath::clamp(data.gain,data.minGain,data.maxGain);
+	// Maps the FMOD priority range (0 = most important, 256 = least important) to a weight of 4 to 0.25
+	auto priorityWeight = std::exp2((128.f -static_cast<float>(umath::min(data.priority,256u))) /64.f);
+	if(channel.m_b3DAttributesEffective == false)
+		return gain *priorityWeight;
+
+	auto distance = std::numeric_limits<float>::max();
+	if(data.relativeToListener || m_system.GetListenerCount() == 0u)
+		distance = al::to_audio_distance(uvec::length(data.position));
+	else
+	{
+		auto posAudio = al::to_audio_position(data.position);
+		for(auto i=0u;i<m_system.GetListenerCount();++i)
+		{
+			auto *listener = static_cast<const FMListener*>(m_system.GetListenerByIndex(i));
+			distance = umath::min(distance,uvec::length(posAudio -listener->GetAudioPosition()));
+		}
+	}
+	// Inverse distance rolloff (FMOD default), sounds beyond their maximum distance are considered inaudible
+	auto refDist = umath::max(al::to_audio_distance(data.distanceRange.first),0.001f);
+	auto maxDist = al::to_audio_distance(data.distanceRange.second);
+	auto attenuation = 1.f;
+	if(distance >= maxDist)
+		attenuation = 0.f;
+	else if(distance > refDist)
+		attenuation = refDist /distance;
+	return gain *attenuation *priorityWeight;
+}
+
+al::FMVoiceManager::Entry *al::FMVoiceManager::FindVictim(const Entry &candidate)
+{
+	Entry *victim = nullptr;
+	switch(m_settings.stealPolicy)
+	{
+		case StealPolicy::LeastAudible:
+			for(auto &entry : m_entries)
+			{
+				if(&entry == &candidate || IsReal(entry) == false || entry.channel->CanVirtualize() == false)
+					continue;
+				if(victim == nullptr || entry.audibility < victim->audibility)
+					victim = &entry;
+			}
+			if(victim != nullptr && candidate.audibility <= victim->audibility *(1.f +m_settings.hysteresis))
+				return nullptr;
+			break;
+		case StealPolicy::Oldest:
+			for(auto &entry : m_entries)
+			{
+				if(&entry == &candidate || IsReal(entry) == false || entry.channel->CanVirtualize() == false || entry.sequence > candidate.sequence)
+					continue;
+				if(victim == nullptr || entry.sequence < victim->sequence)
+					victim = &entry;
+			}
+			break;
+	}
+	return victim;
+}
+
+void al::FMVoiceManager::Virtualize(Entry &entry)
+{
+	entry.channel->Virtualize();
+	if(m_realVoiceCount > 0u)
+		--m_realVoiceCount;
+	++m_stats.virtualized;
+}
+
+bool al::FMVoiceManager::AcquireVoice(Handle handle)
+{
+	if(m_settings.maxRealVoices == 0u || handle >= m_entries.size())
+		return true;
+	auto &entry = m_entries[handle];
+	entry.audibility = CalcAudibility(*entry.channel);
+	if(entry.audibility < m_settings.minAudibility)
+		return false;
+	if(m_realVoiceCount < m_settings.maxRealVoices)
+	{
+		++m_realVoiceCount;
+		return true;
+	}
+	if(m_settings.stealPolicy == StealPolicy::None)
+		return false;
+	auto *victim = FindVictim(entry);
+	if(victim == nullptr)
+		return false;
+	Virtualize(*victim);
+	++m_realVoiceCount;
+	return true;
+}
+
+void al::FMVoiceManager::Update(float dt)
+{
+	m_realVoices.clear();
+	m_virtualVoices.clear();
+	for(auto &entry : m_entries)
+	{
+		if(IsVirtual(entry))
+		{
+			// Voices that have reached their end while virtual are stopped
+			if(entry.channel->AdvanceVirtualVoice(dt) == false)
+				continue;
+			entry.audibility = CalcAudibility(*entry.channel);
+			m_virtualVoices.push_back(&entry);
+		}
+		else if(IsReal(entry))
+		{
+			entry.audibility = CalcAudibility(*entry.channel);
+			m_realVoices.push_back(&entry);
+		}
+	}
+	m_realVoiceCount = static_cast<uint32_t>(m_realVoices.size());
+
+	auto budget = m_settings.maxRealVoices;
+	auto minAudibility = m_settings.minAudibility;
+	if(budget == 0u)
+	{
+		// Voice management is disabled, everything is played for real
+		budget = std::numeric_limits<uint32_t>::max();
+		minAudibility = 0.f;
+	}
+	else
+	{
+		// Inaudible voices don't need a real channel. Voices that can't be virtualized keep theirs and
+		// are no candidates for stealing either, but still count towards the budget.
+		auto it = std::remove_if(m_realVoices.begin(),m_realVoices.end(),[this,minAudibility](Entry *entry) {
+			if(entry->channel->CanVirtualize() == false)
+				return true;
+			if(entry->audibility >= minAudibility)
+				return false;
+			Virtualize(*entry);
+			return true;
+		});
+		m_realVoices.erase(it,m_realVoices.end());
+	}
+
+	if(m_virtualVoices.empty() == false)
+	{
+		std::sort(m_virtualVoices.begin(),m_virtualVoices.end(),[](const Entry *a,const Entry *b) {return a->audibility > b->audibility;});
+		if(m_settings.stealPolicy == StealPolicy::Oldest)
+			std::sort(m_realVoices.begin(),m_realVoices.end(),[](const Entry *a,const Entry *b) {return a->sequence < b->sequence;});
+		else
+			std::sort(m_realVoices.begin(),m_realVoices.end(),[](const Entry *a,const Entry *b) {return a->audibility < b->audibility;});
+		auto victimIdx = decltype(m_realVoices.size()){0u};
+		for(auto *entry : m_virtualVoices)
+		{
+			if(entry->audibility < minAudibility)
+				break;
+			if(m_realVoiceCount >= budget)
+			{
+				if(m_settings.stealPolicy == StealPolicy::None || victimIdx >= m_realVoices.size())
+					break;
+				auto *victim = m_realVoices[victimIdx];
+				if(m_settings.stealPolicy == StealPolicy::LeastAudible)
+				{
+					// The remaining candidates are even less audible
+					if(entry->audibility <= victim->audibility *(1.f +m_settings.hysteresis))
+						break;
+				}
+				else if(entry->sequence < victim->sequence)
+					continue;
+				++victimIdx;
+				Virtualize(*victim);
+			}
+			if(entry->channel->Devirtualize())
+			{
+				++m_realVoiceCount;
+				++m_stats.restored;
+			}
+		}
+	}
+
+	m_stats.realVoices = m_realVoiceCount;
+	m_stats.virtualVoices = 0u;
+	for(auto &entry : m_entries)
+	{
+		if(IsVirtual(entry))
+			++m_stats.virtualVoices;
+	}
+}
@@ -0,0 +1,98 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+* License, v. 2.0. If a copy of the MPL was not distributed with this
+* file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __FMOD_VOICE_MANAGER_HPP__
+#define __FMOD_VOICE_MANAGER_HPP__
+
+#include <cinttypes>
+#include <vector>
+#include <limits>
+
+namespace al
+{
+	class FMSoundSystem;
+	class FMSoundChannel;
+	// Limits the number of channels that are played by FMOD at the same time. Playing channels are ranked by their
+	// estimated audibility (distance attenuation * gain * priority), only the most audible ones get a real FMOD channel.
+	// All others are virtual: they keep advancing their offset in the shadow state and are restored from it once
+	// they're audible enough again.
+	class FMVoiceManager
+	{
+	public:
+		using Handle = uint32_t;
+		static constexpr Handle INVALID_HANDLE = std::numeric_limits<Handle>::max();
+		enum class StealPolicy : uint8_t
+		{
+			// A more audible voice takes over the slot of the least audible real voice
+			LeastAudible = 0u,
+			// A newer voice takes over the slot of the real voice that has been playing the longest
+			Oldest,
+			// Real voices are never stolen, new voices stay virtual until a slot becomes free
+			None
+		};
+		struct Settings
+		{
+			// Maximum number of real voices, 0 disables the voice management
+			uint32_t maxRealVoices = 64u;
+			StealPolicy stealPolicy = StealPolicy::LeastAudible;
+			// Voices below this audibility are always virtual
+			float minAudibility = 0.001f;
+			// A voice only takes over a slot if it's this much more audible than the current voice, avoids flip-flopping
+			float hysteresis = 0.25f;
+		};
+		struct Stats
+		{
+			uint32_t realVoices = 0u;
+			uint32_t virtualVoices = 0u;
+			uint64_t virtualized = 0ull;
+			uint64_t restored = 0ull;
+		};
+
+		FMVoiceManager(FMSoundSystem &system);
+		void SetSettings(const Settings &settings);
+		const Settings &GetSettings() const;
+		const Stats &GetStats() const;
+
+		Handle Register(FMSoundChannel &channel);
+		void Unregister(Handle handle);
+		// Called whenever the channel is (re-)started
+		void OnPlay(Handle handle);
+		// Called before the channel creates a real FMOD channel. Returns false if the channel has to stay virtual,
+		// may virtualize another channel to make room for it.
+		bool AcquireVoice(Handle handle);
+
+		// Re-ranks all playing voices and moves voices between the real and virtual set. dt is the time since the last
+		// update in seconds, which virtual voices advance by (see FMSoundSystem::Update).
+		void Update(float dt);
+
+		float CalcAudibility(const FMSoundChannel &channel) const;
+	private:
+		struct Entry
+		{
+			FMSoundChannel *channel = nullptr;
+			uint64_t sequence = 0ull;
+			float audibility = 0.f;
+		};
+		bool IsReal(const Entry &entry) const;
+		bool IsVirtual(const Entry &entry) const;
+		// Returns the real voice that would be replaced by the specified voice according to the steal policy
+		Entry *FindVictim(const Entry &candidate);
+		void Virtualize(Entry &entry);
+
+		FMSoundSystem &m_system;
+		Settings m_settings = {};
+		Stats m_stats = {};
+		std::vector<Entry> m_entries = {};
+		std::vector<Handle> m_freeHandles = {};
+		uint64_t m_nextSequence = 0ull;
+		// Number of real voices; refreshed in Update() and adjusted whenever voices are granted or stolen in between
+		uint32_t m_realVoiceCount = 0u;
+
+		// Scratch lists for Update()
+		std::vector<Entry*> m_realVoices = {};
+		std::vector<Entry*> m_virtualVoices = {};
+	};
+};
+
+#endif
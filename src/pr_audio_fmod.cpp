@@ -4,6 +4,7 @@
 
 #include "pr_audio_fmod.hpp"
 #include "fmod_sound_system.hpp"
+#include "fmod_benchmark.hpp"
 
 
 
@@ -20,4 +21,10 @@ extern "C"
 		outSoundSystem = al::FMSoundSystem::Create(metersPerUnit);
 		return outSoundSystem != nullptr;
 	}
+	// Used by the pr_audio_fmod_benchmark executable
+	DLLEXPORT bool run_audio_benchmarks(const al::FMBenchmark::Settings &settings,std::string &outJson)
+	{
+		outJson = al::FMBenchmark::Run(settings);
+		return outJson.empty() == false;
+	}
 };